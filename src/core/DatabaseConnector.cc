@@ -18,6 +18,7 @@
 
 #include "redisdb/redisdatabase.hpp"
 #include "Config.hpp"
+#include "lib/metrics.hpp"
 
 namespace runos {
 
@@ -38,31 +39,47 @@ void DatabaseConnector::init(Loader* loader, const Config& root_config)
 Json DatabaseConnector::getJson(const std::string& prefix,
                                 const std::string& key) const
 {
+    static auto& timing = metrics::timing("database", "get");
+    metrics::ScopedTiming scoped(timing);
     return rdb_->getDoc(std::string{prefix + ":" + key}.c_str());
 }
 
 void DatabaseConnector::delJson(const std::string& prefix,
                                 const std::string& key) const
 {
+    static auto& timing = metrics::timing("database", "del");
+    metrics::ScopedTiming scoped(timing);
     rdb_->delValue(std::string{prefix + ":" + key}.c_str());
 }
 
-void DatabaseConnector::putSValue(const std::string &prefix,
+bool DatabaseConnector::putSValue(const std::string &prefix,
                                   const std::string &key,
                                   const std::string &str) const
 {
-    rdb_->putValue(std::string{prefix + ":" + key}, str);
+    static auto& timing = metrics::timing("database", "put");
+    metrics::ScopedTiming scoped(timing);
+    return rdb_->putValue(std::string{prefix + ":" + key}, str) >= 0;
+}
+
+size_t DatabaseConnector::maxValueSize(const std::string& prefix,
+                                       const std::string& key) const
+{
+    return rdb_->maxValueSize(std::string{prefix + ":" + key});
 }
 
 std::string DatabaseConnector::getSValue(const std::string& prefix,
                                          const std::string& key) const
 {
+    static auto& timing = metrics::timing("database", "get");
+    metrics::ScopedTiming scoped(timing);
     return rdb_->getValue(std::string{prefix + ":" + key});
 }
 
 std::vector<std::string>
 DatabaseConnector::getKeys(const std::string& prefix) const
 {
+    static auto& timing = metrics::timing("database", "keys");
+    metrics::ScopedTiming scoped(timing);
     auto dotted_prefix = prefix + ":";
     std::vector<std::string> ret = rdb_->getKeys(dotted_prefix);
     for(auto& key : ret) {
@@ -71,8 +88,37 @@ DatabaseConnector::getKeys(const std::string& prefix) const
     return ret;
 }
 
+bool DatabaseConnector::putFields(const std::string& prefix,
+                                  const std::string& key,
+                                  const Fields& fields) const
+{
+    static auto& timing = metrics::timing("database", "put_fields");
+    metrics::ScopedTiming scoped(timing);
+    return rdb_->putFields(std::string{prefix + ":" + key}, fields) >= 0;
+}
+
+bool DatabaseConnector::delFields(const std::string& prefix,
+                                  const std::string& key,
+                                  const std::vector<std::string>& fields) const
+{
+    static auto& timing = metrics::timing("database", "del_fields");
+    metrics::ScopedTiming scoped(timing);
+    return rdb_->delFields(std::string{prefix + ":" + key}, fields) >= 0;
+}
+
+bool DatabaseConnector::getFields(const std::string& prefix,
+                                  const std::string& key,
+                                  Fields& fields) const
+{
+    static auto& timing = metrics::timing("database", "get_fields");
+    metrics::ScopedTiming scoped(timing);
+    return rdb_->getFields(std::string{prefix + ":" + key}, fields) >= 0;
+}
+
 void DatabaseConnector::deleteAllKeys() const
 {
+    static auto& timing = metrics::timing("database", "clear");
+    metrics::ScopedTiming scoped(timing);
     rdb_->clearDB();
 }
 
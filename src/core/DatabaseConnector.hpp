@@ -20,6 +20,7 @@
 #include "Loader.hpp"
 #include "redisdb/redisdatabase.hpp"
 #include "json.hpp"
+#include "lib/metrics.hpp"
 
 namespace runos {
 using json = nlohmann::json;
@@ -38,17 +39,34 @@ public:
                  const std::string& key,
                  const T& json) const
     {
+        static auto& timing = metrics::timing("database", "put");
+        metrics::ScopedTiming scoped(timing);
         rdb_->putValue(std::string{prefix + ":" + key}, json.dump());
     }
 
     Json getJson(const std::string& prefix, const std::string& key) const;
     void delJson(const std::string& prefix, const std::string& key) const;
-    void putSValue(const std::string& prefix,
+    bool putSValue(const std::string& prefix,
                    const std::string& key,
                    const std::string& str) const;
+    // Longest string value which can be put on the key
+    size_t maxValueSize(const std::string& prefix,
+                        const std::string& key) const;
     std::string getSValue(const std::string& prefix,
                           const std::string& key) const;
     std::vector<std::string> getKeys(const std::string& prefix) const;
+
+    // Fields of the hash stored on the key, each call is a single request.
+    // False if the request failed.
+    using Fields = RedisDatabase::Fields;
+    bool putFields(const std::string& prefix,
+                   const std::string& key,
+                   const Fields& fields) const;
+    bool delFields(const std::string& prefix,
+                   const std::string& key,
+                   const std::vector<std::string>& fields) const;
+    bool getFields(const std::string& prefix, const std::string& key,
+                   Fields& fields) const;
     void deleteAllKeys() const;
     void delPrefix(const std::string& prefix) const;
 
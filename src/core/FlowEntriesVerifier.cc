@@ -16,18 +16,35 @@
 
 #include "FlowEntriesVerifier.hpp"
 
+#include "OFMsgSender.hpp"
 #include "SwitchManager.hpp"
+#include "StatsPollScheduler.hpp"
 #include "Recovery.hpp"
 #include "DatabaseConnector.hpp"
 #include "Controller.hpp"
 #include "Logger.hpp"
 #include "api/Switch.hpp"
 #include "api/OFAgent.hpp"
+#include "lib/base64.hpp"
+#include "openflow/common.hh"
 
-#include <of13/of13match.hh>
+#include <runos/core/future.hpp>
 
-#include <boost/functional/hash.hpp>
+#include <of13/of13match.hh>
 
+#include <boost/thread/executors/inline_executor.hpp>
+#include <boost/crc.hpp>
+#include <boost/endian/conversion.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <limits>
+#include <optional>
+#include <string_view>
 #include <unordered_set>
 #include <functional>
 #include <vector>
@@ -37,332 +54,586 @@ namespace runos {
 
 REGISTER_APPLICATION(FlowEntriesVerifier, {"controller", "switch-ordering",
                                            "switch-manager", "recovery-manager",
-                                           "database-connector", ""})
+                                           "database-connector",
+                                           "stats-poll-scheduler", ""})
 
 using lock_t = std::lock_guard<std::mutex>;
 using shared_lock_t = boost::shared_lock<boost::shared_mutex>;
 using upgrade_lock_t = boost::upgrade_lock<boost::shared_mutex>;
 using unique_lock_t = boost::upgrade_to_unique_lock<boost::shared_mutex>;
 
-using FlowModPtrSequence = std::vector<FlowModPtr>;
-using FlowStatsSequence = std::vector<of13::FlowStats>;
+using BucketId = VerifierDatabase::BucketId;
+using PackedFlows = VerifierDatabase::PackedFlows;
+using Buckets = VerifierDatabase::Buckets;
+using DirtySet = std::set<BucketId>;
 
 static constexpr size_t OXM_FIELD_VALUE_SIZE = 2 * sizeof(uint32_t);
 static constexpr size_t OXM_FIELD_SIZE =
     of13::OFP_OXM_HEADER_LEN + OXM_FIELD_VALUE_SIZE;
+static constexpr size_t MATCH_HEADER_LEN = 4;
 
-namespace hash {
-    static size_t hashValue(of13::Match&& m)
-    {
-        size_t hash = 0;
-        size_t match_size = m.length() + m.oxm_fields_len() * OXM_FIELD_SIZE;
-
-        std::vector<uint8_t> buf(match_size);
-        m.pack(buf.data());
-        for (size_t i = 0; i < match_size; ++i) {
-            boost::hash_combine(hash, buf[i]);
-        }
-        return hash;
-    }
+// Stable across builds, so stored buckets keep their flows
+static uint32_t checksum(std::string_view data)
+{
+    boost::crc_32_type crc;
+    crc.process_bytes(data.data(), data.size());
+    return crc.checksum();
+}
 
-    template<class T>
-    static size_t flowHashValue(T& msg)
-    {
-        size_t hash = hashValue(msg.match());
+// Tracked flows are kept in OpenFlow 1.3 wire format
+namespace wire {
+    using namespace boost::endian;
+
+    struct flow_mod {
+        of::header header;
+        big_uint64_t cookie;
+        big_uint64_t cookie_mask;
+        big_uint8_t table_id;
+        big_uint8_t command;
+        big_uint16_t idle_timeout;
+        big_uint16_t hard_timeout;
+        big_uint16_t priority;
+        big_uint32_t buffer_id;
+        big_uint32_t out_port;
+        big_uint32_t out_group;
+        big_uint16_t flags;
+        uint8_t pad[2];
+        big_uint16_t match_type;
+        big_uint16_t match_length; // excluding padding
+    };
+    static_assert(sizeof(flow_mod) == 52, "");
 
-        boost::hash_combine(hash, msg.table_id());
-        boost::hash_combine(hash, msg.priority());
+    static constexpr size_t MATCH_OFFSET = offsetof(flow_mod, match_type);
+    static constexpr size_t MIN_FLOW_MOD_LEN = sizeof(flow_mod);
 
-        return hash;
+    static const flow_mod& view(const std::string& packed)
+    {
+        return *reinterpret_cast<const flow_mod*>(packed.data());
     }
-}
 
-class PatternData {
-public:
-    explicit PatternData(of13::FlowMod& fm)
-        : table_id_(fm.table_id())
-        , priority_(fm.priority())
-        , out_group_(fm.out_group())
-        , out_port_(fm.out_port())
-        , cookie_(fm.cookie())
-        , cookie_mask_(fm.cookie_mask())
-        , match_(fm.match())
-    { }
-
-    bool toBeModifiedBase(FlowModPtr &fmp) const
+    static std::string pack(of13::FlowMod& fm)
     {
-        return fmp->table_id() == table_id_ && cookie_filter(fmp);
+        auto deleter = &fluid_msg::OFMsg::free_buffer;
+        std::unique_ptr<uint8_t[], decltype(deleter)> buf
+            { fm.pack(), deleter };
+        return std::string(reinterpret_cast<const char*>(buf.get()),
+                           fm.length());
     }
 
-    bool toBeDeletedBase(FlowModPtr &fmp) const
+    static size_t instructionsOffset(const std::string& packed)
     {
-        bool table_id = is_table_id_all() ||
-                        (!is_table_id_all() || fmp->table_id() == table_id_);
-        bool out_port = !is_out_port_any() || fmp->out_port() == out_port_;
-        bool out_group = !is_out_group_any() || fmp->out_group() == out_group_;
+        size_t match_length = view(packed).match_length;
+        return MATCH_OFFSET + (match_length + 7) / 8 * 8;
+    }
 
-        return toBeModifiedBase(fmp) && table_id && out_port && out_group;
+    static std::string_view instructions(const std::string& packed)
+    {
+        return std::string_view(packed).substr(instructionsOffset(packed));
     }
 
-    bool nonStrictMatch(FlowModPtr &fmp) const
+    // Returns packed flow-mod with instructions of other one
+    static std::string replaceInstructions(const std::string& packed,
+                                           std::string_view instructions)
     {
-        auto&& fmp_match = fmp->match();
+        auto ret = packed.substr(0, instructionsOffset(packed));
+        ret.append(instructions.data(), instructions.size());
 
-        for (uint8_t field = 0; field < OXM_NUM; ++field) {
-            of13::OXMTLV* field_ptr = fmp_match.oxm_field(field);
-            of13::OXMTLV* match_ptr = match_.oxm_field(field);
+        auto& header = reinterpret_cast<flow_mod*>(&ret[0])->header;
+        header.length = static_cast<uint16_t>(ret.size());
+        return ret;
+    }
+}
 
-            if (match_ptr != nullptr &&
-                (field_ptr == nullptr || !field_ptr->equals(*match_ptr))) {
-                return false;
+namespace key {
+    // Table id and priority precede the match in the strict key
+    static constexpr size_t STRICT_PREFIX_LEN = 3;
+
+    // Returns OXM TLVs of the packed match ordered by their headers,
+    // so equal matches have equal keys regardless of fields order
+    static std::string canonicalMatch(const uint8_t* match, size_t max_len)
+    {
+        uint16_t length;
+        std::memcpy(&length, match + 2, sizeof(length));
+        size_t match_len =
+            std::min<size_t>(boost::endian::big_to_native(length), max_len);
+
+        std::vector<std::string_view> fields;
+        for (size_t offset = MATCH_HEADER_LEN;
+             offset + of13::OFP_OXM_HEADER_LEN <= match_len; ) {
+            size_t field_len = of13::OFP_OXM_HEADER_LEN + match[offset + 3];
+            if (offset + field_len > match_len) {
+                break;
             }
+            fields.emplace_back(reinterpret_cast<const char*>(match + offset),
+                                field_len);
+            offset += field_len;
         }
-        return true;
+        std::sort(fields.begin(), fields.end());
+
+        std::string ret;
+        for (const auto& field: fields) {
+            ret.append(field.data(), field.size());
+        }
+        return ret;
     }
 
-    bool strictMatch(FlowModPtr &fmp) const
+    static std::string canonicalMatch(const std::string& packed_flow_mod)
     {
-        return fmp->priority() == priority_ &&
-               fmp->match() == match_;
+        return canonicalMatch(
+            reinterpret_cast<const uint8_t*>(packed_flow_mod.data())
+                + wire::MATCH_OFFSET,
+            packed_flow_mod.size() - wire::MATCH_OFFSET);
     }
 
-private:
-    uint8_t table_id_;
-    uint16_t priority_;
-    uint32_t out_group_;
-    uint32_t out_port_;
-    uint64_t cookie_;
-    uint64_t cookie_mask_;
-    mutable of13::Match match_;
+    static std::string canonicalMatch(of13::Match&& m)
+    {
+        size_t match_size = m.length() + m.oxm_fields_len() * OXM_FIELD_SIZE;
 
-    bool is_table_id_all() const { return table_id_ == of13::OFPTT_ALL; }
-    bool is_out_port_any() const { return out_port_ == of13::OFPP_ANY; }
-    bool is_out_group_any() const { return out_group_ == of13::OFPG_ANY; }
+        std::vector<uint8_t> buf(match_size);
+        m.pack(buf.data());
+        return canonicalMatch(buf.data(), buf.size());
+    }
 
-    bool cookie_filter(FlowModPtr& fmp) const
+    // Identity of flow entry: (table, priority, canonical match)
+    static std::string strictKey(uint8_t table_id, uint16_t priority,
+                                 const std::string& match)
     {
-        return (fmp->cookie() & cookie_mask_) == (cookie_ & cookie_mask_);
+        std::string ret;
+        ret.reserve(STRICT_PREFIX_LEN + match.size());
+        ret.push_back(static_cast<char>(table_id));
+        ret.push_back(static_cast<char>(priority >> 8));
+        ret.push_back(static_cast<char>(priority & 0xff));
+        return ret + match;
     }
-};
 
-class Pattern {
-public:
-    explicit Pattern(of13::FlowMod& fm)
-        : pattern_data_(fm)
-        , command_(fm.command())
-    { }
+    template<class T>
+    static std::string strictKey(T& msg)
+    {
+        return strictKey(msg.table_id(), msg.priority(),
+                         canonicalMatch(msg.match()));
+    }
 
-    bool matches(FlowModPtr& fmp) const
+    // Calls f for every OXM TLV of canonical match
+    template<class F>
+    static void forEachField(std::string_view match, F&& f)
     {
-        switch (command_) {
-            case of13::OFPFC_MODIFY:
-                return to_be_modified(fmp);
-            case of13::OFPFC_DELETE:
-                return to_be_deleted(fmp);
-            case of13::OFPFC_MODIFY_STRICT:
-                return to_be_modified_strictly(fmp);
-            case of13::OFPFC_DELETE_STRICT:
-                return to_be_deleted_strictly(fmp);
-            default:
-                return false;
+        for (size_t offset = 0;
+             offset + of13::OFP_OXM_HEADER_LEN <= match.size(); ) {
+            size_t field_len = of13::OFP_OXM_HEADER_LEN +
+                               static_cast<uint8_t>(match[offset + 3]);
+            f(match.substr(offset, field_len));
+            offset += field_len;
         }
     }
+}
 
-private:
-    PatternData pattern_data_;
-    uint8_t command_;
+// Flow entry tracked on switch, immutable once created.
+// Flow-mod is stored packed, its fields are read from the buffer directly
+// and the buffer is written to the switch as is when flow is re-sent.
+class Flow {
+public:
+    explicit Flow(of13::FlowMod& fm)
+        : Flow(wire::pack(fm))
+    { }
+
+    explicit Flow(std::string packed)
+        : packed_(std::move(packed))
+        , key_(key::strictKey(tableId(), priority(),
+                              key::canonicalMatch(packed_)))
+        , hash_(checksum(key_))
+    { }
 
-    bool to_be_modified(FlowModPtr& fmp) const
+    // Same flow with other instructions
+    explicit Flow(const Flow& flow, std::string_view instructions)
+        : Flow(wire::replaceInstructions(flow.packed_, instructions))
+    { }
+
+    Flow(const Flow& rhs) = delete;
+    ~Flow() noexcept = default;
+
+    const std::string& key() const { return key_; }
+    const std::string& packed() const { return packed_; }
+
+    uint8_t tableId() const { return view().table_id; }
+    uint16_t priority() const { return view().priority; }
+    uint64_t cookie() const { return view().cookie; }
+    uint32_t outPort() const { return view().out_port; }
+    uint32_t outGroup() const { return view().out_group; }
+
+    std::string_view match() const
     {
-        return pattern_data_.toBeModifiedBase(fmp) &&
-                pattern_data_.nonStrictMatch(fmp);
+        return std::string_view(key_).substr(key::STRICT_PREFIX_LEN);
     }
 
-    bool to_be_deleted(FlowModPtr& fmp) const
+    std::string_view instructions() const
     {
-        return pattern_data_.toBeDeletedBase(fmp) &&
-                pattern_data_.nonStrictMatch(fmp);
+        return wire::instructions(packed_);
     }
 
-    bool to_be_modified_strictly(FlowModPtr& fmp) const
+    bool hasField(std::string_view field) const
     {
-        return pattern_data_.toBeModifiedBase(fmp) &&
-                pattern_data_.strictMatch(fmp);
+        bool found = false;
+        key::forEachField(match(), [&](std::string_view f) {
+            found = found || f == field;
+        });
+        return found;
     }
 
-    bool to_be_deleted_strictly(FlowModPtr& fmp) const
+    // Flows are spread over 256 buckets per table by their hash
+    BucketId bucket() const
     {
-        return pattern_data_.toBeDeletedBase(fmp) &&
-                pattern_data_.strictMatch(fmp);
+        return static_cast<BucketId>(tableId() << 8 | (hash_ & 0xff));
     }
+
+private:
+    std::string packed_;
+    std::string key_;
+    uint32_t hash_;
+
+    const wire::flow_mod& view() const { return wire::view(packed_); }
 };
 
-class FlowMessage {
-public:
-    template<class T>
-    explicit FlowMessage(T& msg)
-        : fmp_(std::make_unique<of13::FlowMod>())
-    { }
+using FlowPtrSet = std::unordered_set<FlowPtr>;
 
-    explicit FlowMessage(of13::FlowMod& fm)
-        : fmp_(copy(fm))
-    { }
+class Pattern {
+public:
+    explicit Pattern(const std::string& packed)
+        : command_(wire::view(packed).command)
+        , table_id_(wire::view(packed).table_id)
+        , priority_(wire::view(packed).priority)
+        , out_group_(wire::view(packed).out_group)
+        , out_port_(wire::view(packed).out_port)
+        , cookie_(wire::view(packed).cookie)
+        , cookie_mask_(wire::view(packed).cookie_mask)
+        , match_(key::canonicalMatch(packed))
+    {
+        key::forEachField(match_, [this](std::string_view field) {
+            fields_.emplace_back(field);
+        });
+    }
 
-    explicit FlowMessage(const json& flow_json)
-        : fmp_(parse(flow_json))
-    { }
+    bool isStrict() const
+    {
+        return command_ == of13::OFPFC_MODIFY_STRICT ||
+               command_ == of13::OFPFC_DELETE_STRICT;
+    }
 
-    FlowMessage(const FlowMessage& rhs)
-        : fmp_(copy(*rhs.fmp_))
-    { }
+    // Only deletion may refer to all tables
+    bool isAllTables() const
+    {
+        return is_delete() && table_id_ == of13::OFPTT_ALL;
+    }
 
-    ~FlowMessage() noexcept = default;
+    uint8_t tableId() const { return table_id_; }
+    const std::vector<std::string>& fields() const { return fields_; }
 
-    FlowModPtr ptr() const { return copy(*fmp_); }
-    of13::InstructionSet instructions() const { return fmp_->instructions(); }
-    json toJson() const { return dump(); }
+    std::string strictKey() const
+    {
+        return key::strictKey(table_id_, priority_, match_);
+    }
 
-    void changeInstructions(const of13::InstructionSet& is)
+    // Cookie to look up if pattern filters on exact cookie value
+    std::optional<uint64_t> cookie() const
     {
-        fmp_->instructions(is);
+        if (cookie_mask_ != std::numeric_limits<uint64_t>::max()) {
+            return std::nullopt;
+        }
+        return cookie_;
     }
 
-    bool matches(const Pattern& pv) const { return pv.matches(fmp_); }
+    bool matches(const Flow& flow) const
+    {
+        if (!isAllTables() && flow.tableId() != table_id_) {
+            return false;
+        }
+        if ((flow.cookie() & cookie_mask_) != (cookie_ & cookie_mask_)) {
+            return false;
+        }
+        if (is_delete() && !out_filter(flow)) {
+            return false;
+        }
+
+        if (isStrict()) {
+            return flow.priority() == priority_ && flow.match() == match_;
+        }
+        return std::all_of(fields_.begin(), fields_.end(),
+                           [&](const std::string& field) {
+                               return flow.hasField(field);
+                           });
+    }
 
 private:
-    mutable FlowModPtr fmp_;
+    uint8_t command_;
+    uint8_t table_id_;
+    uint16_t priority_;
+    uint32_t out_group_;
+    uint32_t out_port_;
+    uint64_t cookie_;
+    uint64_t cookie_mask_;
+    std::string match_;
+    std::vector<std::string> fields_;
 
-    using raw_t = std::unique_ptr<uint8_t>;
-    using raw_vector_t = std::vector<uint8_t>;
+    bool is_delete() const
+    {
+        return command_ == of13::OFPFC_DELETE ||
+               command_ == of13::OFPFC_DELETE_STRICT;
+    }
 
-    json dump() const
+    bool out_filter(const Flow& flow) const
     {
-        auto dump = json::array();
-        raw_t packed{ fmp_->pack() };
-        auto dump_size = fmp_->length();
+        bool out_port = out_port_ == of13::OFPP_ANY ||
+                        flow.outPort() == out_port_;
+        bool out_group = out_group_ == of13::OFPG_ANY ||
+                         flow.outGroup() == out_group_;
+        return out_port && out_group;
+    }
+};
 
-        for (auto i = 0; i < dump_size; ++i) {
-            uchar value = *(packed.get() + i);
-            dump.push_back(value);
+// Flow entries of switch indexed by strict key, cookie and match fields
+class FlowTable {
+public:
+    // Replaces flow with the same strict key
+    void insert(const FlowPtr& flow)
+    {
+        // keys refer to the flows, so replaced flow is re-keyed
+        auto it = strict_.find(flow->key());
+        if (it != strict_.end()) {
+            unindex(it->second);
+            strict_.erase(it);
         }
+        strict_.emplace(flow->key(), flow);
+        index(flow);
+    }
 
-        VLOG(17) << "[FlowEntriesVerifier] Dumped Flow-Mod message is of type="
-                    << static_cast<unsigned>(fmp_->type())
-                 << ", of size=" << fmp_->length()
-                 << " and refers to the table="
-                    << static_cast<unsigned>(fmp_->table_id())
-                 << " with priority=" << fmp_->priority();
+    void erase(const FlowPtr& flow)
+    {
+        auto it = strict_.find(flow->key());
+        if (it == strict_.end() || it->second != flow) {
+            return;
+        }
+        unindex(flow);
+        strict_.erase(it);
+    }
 
-        return dump;
+    FlowPtr find(std::string_view key) const
+    {
+        auto it = strict_.find(key);
+        return it != strict_.end() ? it->second : nullptr;
     }
 
-    static FlowModPtr parse(const json& fm_dump)
+    // Candidates are taken from the most selective index
+    // and then checked against the pattern
+    FlowPtrSequence select(const Pattern& pattern) const
     {
-        FlowModPtr fmp = std::make_unique<of13::FlowMod>();
-        raw_vector_t parsed;
+        FlowPtrSequence ret;
+        auto check = [&](const FlowPtr& flow) {
+            if (pattern.matches(*flow)) {
+                ret.push_back(flow);
+            }
+        };
 
-        for (auto value: fm_dump) {
-            parsed.push_back(std::move(value));
+        if (pattern.isStrict() && !pattern.isAllTables()) {
+            if (auto flow = find(pattern.strictKey())) {
+                check(flow);
+            }
+            return ret;
         }
-        fmp->unpack(parsed.data());
 
-        VLOG(17) << "[FlowEntriesVerifier] Parsed Flow-Mod message is of type="
-                    << static_cast<unsigned>(fmp->type())
-                 << ", of size=" << fmp->length()
-                 << " and refers to the table="
-                     << static_cast<unsigned>(fmp->table_id())
-                 << " with priority=" << fmp->priority();
+        std::vector<const FlowPtrSet*> candidates;
+        size_t candidates_size = 0;
+        if (pattern.isAllTables()) {
+            for (const auto& table: tables_) {
+                add_candidates(table.second, pattern,
+                               candidates, candidates_size);
+            }
+        } else {
+            auto it = tables_.find(pattern.tableId());
+            if (it == tables_.end()) {
+                return ret;
+            }
+            add_candidates(it->second, pattern, candidates, candidates_size);
+        }
 
-        return fmp;
+        if (auto cookie = pattern.cookie()) {
+            auto it = by_cookie_.find(*cookie);
+            if (it == by_cookie_.end()) {
+                return ret;
+            }
+            if (it->second.size() < candidates_size) {
+                candidates = { &it->second };
+            }
+        }
+
+        for (auto set: candidates) {
+            for (const auto& flow: *set) {
+                check(flow);
+            }
+        }
+        return ret;
     }
 
-    static FlowModPtr copy(of13::FlowMod& fm)
+    template<class F>
+    void forEach(F&& f) const
     {
-        auto copy = std::make_unique<of13::FlowMod>();
-        raw_t packed{ fm.pack() };
-        copy->unpack(packed.get());
-        return copy;
+        for (const auto& pair: strict_) {
+            f(pair.second);
+        }
     }
-};
-
-class Flow {
-public:
-    template<class T>
-    explicit Flow(T& msg)
-        : msg_(msg)
-        , table_id_(msg.table_id())
-        , priority_(msg.priority())
-        , match_(msg.match())
-        , hash_(hash::flowHashValue(msg))
-    { }
 
-    explicit Flow(const json& flow_message_json)
-        : msg_(flow_message_json)
+    template<class F>
+    void forEach(const FlowSlice& slice, F&& f) const
     {
-        auto fmp = msg_.ptr();
-        table_id_ = fmp->table_id();
-        priority_ = fmp->priority();
-        match_ = fmp->match();
-        hash_ = hash::flowHashValue(*fmp);
+        auto it = tables_.find(slice.table_id);
+        if (it == tables_.end()) {
+            return;
+        }
+
+        for (const auto& flow: it->second.flows) {
+            if ((flow->cookie() & slice.cookie_mask) ==
+                    (slice.cookie & slice.cookie_mask)) {
+                f(flow);
+            }
+        }
     }
 
-    explicit Flow(const Flow& flow, const of13::InstructionSet& is)
-        : Flow(flow)
+    // Tables are sliced by cookie values if they are large
+    // and their flows have a few distinct cookies
+    std::vector<FlowSlice> slices(size_t slice_size) const
     {
-        msg_.changeInstructions(is);
+        static constexpr size_t MAX_COOKIE_SLICES = 64;
+        static constexpr uint64_t EXACT_COOKIE =
+            std::numeric_limits<uint64_t>::max();
+
+        std::vector<FlowSlice> ret;
+        for (const auto& pair: tables_) {
+            auto table_id = pair.first;
+            const auto& flows = pair.second.flows;
+
+            std::set<uint64_t> cookies;
+            if (flows.size() > slice_size) {
+                for (const auto& flow: flows) {
+                    cookies.insert(flow->cookie());
+                    if (cookies.size() > MAX_COOKIE_SLICES) {
+                        break;
+                    }
+                }
+            }
+
+            if (cookies.size() > 1 && cookies.size() <= MAX_COOKIE_SLICES) {
+                for (auto cookie: cookies) {
+                    ret.push_back(FlowSlice{table_id, cookie, EXACT_COOKIE});
+                }
+            } else {
+                ret.push_back(FlowSlice{table_id, 0, 0});
+            }
+        }
+        return ret;
     }
 
-    Flow(const Flow& rhs) = default;
-    ~Flow() noexcept = default;
+    size_t size() const { return strict_.size(); }
 
-    bool operator==(const Flow& rhs) const
+private:
+    struct TableIndex {
+        FlowPtrSet flows;
+        std::unordered_map<std::string, FlowPtrSet> by_field;
+    };
+
+    std::unordered_map<std::string_view, FlowPtr> strict_;
+    std::unordered_map<uint64_t, FlowPtrSet> by_cookie_;
+    std::unordered_map<uint8_t, TableIndex> tables_;
+
+    static void add_candidates(const TableIndex& table, const Pattern& pattern,
+                               std::vector<const FlowPtrSet*>& candidates,
+                               size_t& candidates_size)
     {
-        return table_id_ == rhs.table_id_ &&
-               priority_ == rhs.priority_ &&
-               match_ == rhs.match_;
+        const FlowPtrSet* best = &table.flows;
+        for (const auto& field: pattern.fields()) {
+            auto it = table.by_field.find(field);
+            if (it == table.by_field.end()) {
+                return; // no flows with this field in the table
+            }
+            if (it->second.size() < best->size()) {
+                best = &it->second;
+            }
+        }
+        candidates.push_back(best);
+        candidates_size += best->size();
     }
 
-    FlowMessage message() const { return msg_; }
-    of13::InstructionSet instructions() const { return msg_.instructions(); }
-    json toJson() const { return msg_.toJson(); }
+    void index(const FlowPtr& flow)
+    {
+        by_cookie_[flow->cookie()].insert(flow);
 
-    bool matches(const Pattern& pv) const { return msg_.matches(pv); }
+        auto& table = tables_[flow->tableId()];
+        table.flows.insert(flow);
+        key::forEachField(flow->match(), [&](std::string_view field) {
+            table.by_field[std::string(field)].insert(flow);
+        });
+    }
 
-    struct Hasher {
-        size_t operator()(const Flow& flow) const { return flow.hash_; }
-    };
+    void unindex(const FlowPtr& flow)
+    {
+        auto cookie_it = by_cookie_.find(flow->cookie());
+        cookie_it->second.erase(flow);
+        if (cookie_it->second.empty()) {
+            by_cookie_.erase(cookie_it);
+        }
 
-private:
-    FlowMessage msg_;
-    uint8_t table_id_;
-    uint16_t priority_;
-    of13::Match match_;
-    size_t hash_;
+        auto table_it = tables_.find(flow->tableId());
+        auto& table = table_it->second;
+        key::forEachField(flow->match(), [&](std::string_view field) {
+            auto it = table.by_field.find(std::string(field));
+            it->second.erase(flow);
+            if (it->second.empty()) {
+                table.by_field.erase(it);
+            }
+        });
+        table.flows.erase(flow);
+        if (table.flows.empty()) {
+            tables_.erase(table_it);
+        }
+    }
 };
 
-using FlowSet = std::unordered_set<Flow, Flow::Hasher>;
-
 class FlowModHandler {
 public:
     explicit FlowModHandler(of13::FlowMod& fm)
-        : flow_(fm)
-        , pattern_(fm)
-        , command_(fm.command())
-    { }
+        : command_(fm.command())
+    {
+        auto&& packed = wire::pack(fm);
 
-    void applyToFlowSet(FlowSet& flow_entries) const
+        switch (command_) {
+            case of13::OFPFC_ADD:
+                flow_ = std::make_shared<const Flow>(std::move(packed));
+                break;
+            case of13::OFPFC_MODIFY:
+            case of13::OFPFC_MODIFY_STRICT:
+                instructions_ = wire::instructions(packed);
+                pattern_.emplace(packed);
+                break;
+            case of13::OFPFC_DELETE:
+            case of13::OFPFC_DELETE_STRICT:
+                pattern_.emplace(packed);
+                break;
+            default:
+                break;
+        }
+    }
+
+    // Buckets of all affected flows are added to `dirty`
+    void applyToFlowTable(FlowTable& flow_table, DirtySet& dirty) const
     {
         switch (command_) {
             case of13::OFPFC_ADD:
-                add_to_flow_set(flow_entries);
+                add_to_flow_table(flow_table, dirty);
                 break;
             case of13::OFPFC_MODIFY:
             case of13::OFPFC_MODIFY_STRICT:
-                modify_flow_set(flow_entries);
+                modify_flow_table(flow_table, dirty);
                 break;
             case of13::OFPFC_DELETE:
             case of13::OFPFC_DELETE_STRICT:
-                delete_from_flow_set(flow_entries);
+                delete_from_flow_table(flow_table, dirty);
                 break;
             default:
                 break;
@@ -370,37 +641,30 @@ public:
     }
 
 private:
-    Flow flow_;
-    Pattern pattern_;
     uint8_t command_;
+    FlowPtr flow_;
+    std::string instructions_;
+    std::optional<Pattern> pattern_;
 
-    void add_to_flow_set(FlowSet& flows) const { flows.insert(flow_); }
-
-    void modify_flow_set(FlowSet& flows) const
+    void add_to_flow_table(FlowTable& flows, DirtySet& dirty) const
     {
-        FlowSet modified_entries;
-
-        for (auto it = flows.begin(); it != flows.end(); ++it) {
-            if (!it->matches(pattern_)) {
-                continue;
-            }
+        flows.insert(flow_);
+        dirty.insert(flow_->bucket());
+    }
 
-            auto instr = flow_.instructions();
-            modified_entries.emplace(*it, instr);
-            it = flows.erase(it);
+    void modify_flow_table(FlowTable& flows, DirtySet& dirty) const
+    {
+        for (auto& flow: flows.select(*pattern_)) {
+            flows.insert(std::make_shared<const Flow>(*flow, instructions_));
+            dirty.insert(flow->bucket());
         }
-
-        flows.insert(modified_entries.begin(), modified_entries.end());
     }
 
-    void delete_from_flow_set(FlowSet& flows) const
+    void delete_from_flow_table(FlowTable& flows, DirtySet& dirty) const
     {
-        for (auto it = flows.begin(); it != flows.end(); ) {
-            if (it->matches(pattern_)) {
-                it = flows.erase(it);
-            } else {
-                ++it;
-            }
+        for (auto& flow: flows.select(*pattern_)) {
+            flows.erase(flow);
+            dirty.insert(flow->bucket());
         }
     }
 };
@@ -408,82 +672,119 @@ private:
 class SwitchState {
 public:
     SwitchState() noexcept = default;
-    explicit SwitchState(const json& state_json) { fromJson(state_json); }
+    explicit SwitchState(const PackedFlows& flows) { load(flows); }
 
     void process(of13::FlowMod& fm)
     {
         FlowModHandler handler(fm);
 
         lock_t lock(entries_mut_);
-        handler.applyToFlowSet(flow_entries_);
+        handler.applyToFlowTable(flow_table_, dirty_);
     }
 
-    FlowModPtr process(of13::FlowRemoved& fr)
+    FlowPtr process(of13::FlowRemoved& fr)
     {
-        Flow removed_flow(fr);
+        auto&& removed_key = key::strictKey(fr);
 
         lock_t lock(entries_mut_);
-        auto it = flow_entries_.find(removed_flow);
-        if (it != flow_entries_.end()) {
+        auto flow = flow_table_.find(removed_key);
+        if (flow) {
             if (is_expected(fr)) {
-                flow_entries_.erase(it);
+                dirty_.insert(flow->bucket());
+                flow_table_.erase(flow);
             } else {
-                auto&& msg = it->message();
-                return msg.ptr();
+                return flow;
             }
         }
         return nullptr;
     }
 
-    FlowModPtrSequence process(FlowStatsSequence& fs_seq) const
+    FlowPtrSequence diff(const FlowSlice& slice,
+                         FlowStatsSequence& fs_seq) const
     {
-        auto&& flow_set = to_flow_set(fs_seq);
-        FlowModPtrSequence fmp_sequence;
+        auto&& installed = to_key_set(fs_seq);
+        FlowPtrSequence missing;
 
         lock_t lock(entries_mut_);
-        for (auto& flow: flow_entries_) {
-            auto it = flow_set.find(flow);
-            if (it == flow_set.end()) {
-                auto&& msg = flow.message();
-                fmp_sequence.push_back(msg.ptr());
+        flow_table_.forEach(slice, [&](const FlowPtr& flow) {
+            if (installed.count(flow->key()) == 0) {
+                missing.push_back(flow);
             }
-        }
+        });
 
-        return fmp_sequence;
+        return missing;
     }
 
-    json toJson() const
+    std::vector<FlowSlice> slices(size_t slice_size) const
     {
         lock_t lock(entries_mut_);
+        return flow_table_.slices(slice_size);
+    }
+
+    // Returns full content of buckets changed since the previous call,
+    // emptied buckets are returned too
+    Buckets takeDirty()
+    {
+        Buckets buckets;
 
-        auto&& state_json = json::array();
-        for (const auto& flow: flow_entries_) {
-            state_json.push_back(flow.toJson());
+        lock_t lock(entries_mut_);
+        if (dirty_.empty()) {
+            return buckets;
         }
-        return state_json;
+
+        for (auto bucket: dirty_) {
+            buckets[bucket];
+        }
+        flow_table_.forEach([&](const FlowPtr& flow) {
+            auto it = buckets.find(flow->bucket());
+            if (it != buckets.end()) {
+                it->second.push_back(flow->packed());
+            }
+        });
+        dirty_.clear();
+
+        return buckets;
+    }
+
+    // Buckets are saved again with the next checkpoint
+    void markDirty(const std::vector<BucketId>& buckets)
+    {
+        lock_t lock(entries_mut_);
+        dirty_.insert(buckets.begin(), buckets.end());
     }
 
-    void fromJson(const json& state_json)
+    void markAllDirty()
     {
         lock_t lock(entries_mut_);
+        flow_table_.forEach([&](const FlowPtr& flow) {
+            dirty_.insert(flow->bucket());
+        });
+    }
 
-        flow_entries_.clear();
-        for (const auto& flow_json: state_json) {
-            flow_entries_.emplace(flow_json);
+    void load(const PackedFlows& flows)
+    {
+        lock_t lock(entries_mut_);
+
+        flow_table_ = FlowTable();
+        dirty_.clear();
+        for (const auto& packed: flows) {
+            flow_table_.insert(std::make_shared<const Flow>(packed));
         }
     }
 
 private:
-    FlowSet flow_entries_;
+    FlowTable flow_table_;
+    DirtySet dirty_;
     mutable std::mutex entries_mut_;
 
-    static FlowSet to_flow_set(FlowStatsSequence& fs_sequence)
+    static std::unordered_set<std::string>
+    to_key_set(FlowStatsSequence& fs_sequence)
     {
-        FlowSet flow_set;
+        std::unordered_set<std::string> key_set;
         for (auto& fs: fs_sequence) {
-            flow_set.emplace(fs);
+            key_set.insert(key::strictKey(fs));
         }
-        return flow_set;
+        return key_set;
     }
 
     static bool is_expected(of13::FlowRemoved& fr)
@@ -502,77 +803,129 @@ public:
         : sw_mgr_(sw_mgr)
     { }
 
-    void send(uint64_t dpid, fluid_msg::OFMsg& msg) const
+    // Returns false if the switch is absent
+    bool send(uint64_t dpid, fluid_msg::OFMsg& msg) const
     {
-        auto conn = sw_mgr_->switch_(dpid)->connection();
+        auto conn = connection(dpid);
+        if (not conn) {
+            return false;
+        }
         conn->send(msg);
+        return true;
     }
 
-    void send(uint64_t dpid, FlowModPtr& fmp) const { send(dpid, *fmp); }
-
-    void send(uint64_t dpid, FlowModPtrSequence& fmp_sequence) const
+    // Tracked flow is restored as it was packed, in the bulk lane
+    // of OFMsgSender not to delay urgent messages
+    bool send(uint64_t dpid, const Flow& flow) const
     {
-        auto conn = sw_mgr_->switch_(dpid)->connection();
-        for (auto& fmp: fmp_sequence) {
-            conn->send(*fmp);
+        const auto& packed = flow.packed();
+        if (ofmsg_sender_) {
+            return ofmsg_sender_->send(dpid, packed.data(), packed.size(),
+                                       SendLane::Bulk);
         }
+
+        auto conn = connection(dpid);
+        if (not conn) {
+            return false;
+        }
+        conn->send(const_cast<char*>(packed.data()), packed.size());
+        return true;
     }
 
-    FlowStatsSequence flowStatsRequest(uint64_t dpid) const
+    // OFMsgSender depends on the verifier, so it is set on start-up
+    void setOFMsgSender(OFMsgSender* ofmsg_sender)
     {
-        UnsafeSwitchPtr sw = sw_mgr_->switch_(dpid);
-        auto agent = sw->connection()->agent();
-        ofp::flow_stats_request req;
+        ofmsg_sender_ = ofmsg_sender;
+    }
 
-        try {
-            auto f = agent->request_flow_stats(req);
-            auto status = f.wait_for(boost::chrono::seconds(5));
-            if (status == boost::future_status::timeout) {
-                return FlowStatsSequence();
-            }
-            return f.get();
-        }
-        catch (OFAgent::request_error const& e) {
-            return FlowStatsSequence();
+    future<OFAgent::sequence<of13::FlowStats>>
+    flowStatsRequest(uint64_t dpid, const FlowSlice& slice) const
+    {
+        auto conn = connection(dpid);
+        if (not conn) {
+            promise<OFAgent::sequence<of13::FlowStats>> failed;
+            failed.set_exception(OFAgent::not_responded(dpid, 0));
+            return failed.get_future();
         }
+
+        ofp::flow_stats_request req;
+        req.table_id = slice.table_id;
+        req.cookie = slice.cookie;
+        req.cookie_mask = slice.cookie_mask;
+        return conn->agent()->request_flow_stats(req);
     }
 
 private:
+    OFConnectionPtr connection(uint64_t dpid) const
+    {
+        auto sw = sw_mgr_->switch_(dpid);
+        return sw ? sw->connection() : nullptr;
+    }
+
     SwitchManager* sw_mgr_;
+    OFMsgSender* ofmsg_sender_ {nullptr};
 };
 
 class Recovery {
 public:
-    using dump_json = VerifierDatabase::dump_json;
+    using Checkpoint = VerifierDatabase::Checkpoint;
+    using db_dump = std::map<uint64_t, PackedFlows>;
 
-    explicit Recovery(DatabaseConnector* db_mgr, RecoveryManager* rc_mgr)
+    explicit Recovery(DatabaseConnector* db_mgr, RecoveryManager* rc_mgr,
+                      size_t batch_size)
         : db_mgr_(db_mgr)
         , rc_mgr_(rc_mgr)
+        , batch_size_(batch_size)
     { }
 
-    void save(const dump_json& db_dump) const
+    // Returns buckets which weren't saved
+    std::map<uint64_t, std::vector<BucketId>> save(const Checkpoint& checkpoint)
     {
-        json states_list;
-        for (const auto& state_pair: db_dump) {
-            states_list.push_back(state_pair.first);
+        std::map<uint64_t, std::vector<BucketId>> unsaved;
+
+        if (checkpoint.list_changed) {
+            json states_list = json::array();
+            for (auto dpid: checkpoint.dpids) {
+                states_list.push_back(std::to_string(dpid));
+            }
+            save_states_list(states_list);
         }
-        save_states_list(states_list);
 
-        for (const auto& state_pair: db_dump) {
-            save_state(state_pair.first, state_pair.second);
+        for (auto dpid: checkpoint.reset) {
+            db_mgr_->delPrefix(flows_prefix(dpid));
+            batches_.erase(dpid);
         }
+
+        for (const auto& state_pair: checkpoint.dirty) {
+            for (const auto& bucket_pair: state_pair.second) {
+                if (!save_bucket(state_pair.first, bucket_pair.first,
+                                 bucket_pair.second)) {
+                    unsaved[state_pair.first].push_back(bucket_pair.first);
+                }
+            }
+        }
+
+        return unsaved;
     }
 
-    dump_json load() const
+    // Switches whose stored flows are laid out otherwise are added
+    // to `stale`, their flows are loaded anyway
+    db_dump load(std::vector<uint64_t>& stale)
     {
-        dump_json db_dump;
+        db_dump dump;
+        batches_.clear();
 
         auto&& states_list = get_states_list();
         for (const std::string& dpid_str: states_list) {
-            db_dump[dpid_str] = get_state(dpid_str);
+            auto dpid = std::stoull(dpid_str);
+            bool stale_layout = false;
+            dump[dpid] = get_state(dpid, stale_layout);
+            if (stale_layout) {
+                stale.push_back(dpid);
+            }
         }
 
-        return db_dump;
+        return dump;
     }
 
     bool isPrimary() const { return rc_mgr_->isPrimary(); }
@@ -580,14 +933,75 @@ public:
 private:
     DatabaseConnector* db_mgr_;
     RecoveryManager* rc_mgr_;
+    size_t batch_size_;
 
-    static constexpr auto states_prefix = "flow-entries-verifier:state";
+    // Number of stored batches of each bucket
+    std::map<uint64_t, std::map<BucketId, size_t>> batches_;
+
+    static constexpr auto flows_prefix_base = "flow-entries-verifier:flows";
     static constexpr auto settings_prefix = "flow-entries-verifier";
     static constexpr auto states_list_key = "states_list";
+    static constexpr size_t OF_HEADER_LEN = 8;
+
+    static std::string flows_prefix(uint64_t dpid)
+    {
+        return std::string(flows_prefix_base) + ":" + std::to_string(dpid);
+    }
+
+    static std::string batch_key(BucketId bucket, size_t batch)
+    {
+        return std::to_string(bucket) + ":" + std::to_string(batch);
+    }
+
+    static constexpr size_t CRC_FIELD_LEN = 9;
+
+    // Batch is stored as "<crc32 of raw data>:<base64 of raw data>",
+    // where raw data is a concatenation of packed flow-mods
+    static std::string encode_batch(const std::string& raw)
+    {
+        char crc[CRC_FIELD_LEN];
+        std::snprintf(crc, sizeof(crc), "%08x", checksum(raw));
+        return std::string(crc) + ":" + base64::encode(raw);
+    }
 
-    static std::string state_prefix(const std::string& dpid_str)
+    static bool decode_batch(const std::string& value, PackedFlows& flows)
     {
-        return std::string(states_prefix) + ":" + dpid_str;
+        auto delim = value.find(':');
+        if (delim == std::string::npos) {
+            return false;
+        }
+
+        auto raw = base64::decode(value.substr(delim + 1));
+        if (!raw ||
+            std::strtoul(value.substr(0, delim).c_str(), nullptr, 16)
+                != checksum(*raw)) {
+            return false;
+        }
+
+        PackedFlows batch;
+        for (size_t offset = 0; offset < raw->size(); ) {
+            if (raw->size() - offset < OF_HEADER_LEN) {
+                return false;
+            }
+
+            uint16_t length;
+            std::memcpy(&length, raw->data() + offset + 2, sizeof(length));
+            length = boost::endian::big_to_native(length);
+            if (length < wire::MIN_FLOW_MOD_LEN ||
+                length > raw->size() - offset) {
+                return false;
+            }
+
+            auto&& packed = raw->substr(offset, length);
+            if (wire::instructionsOffset(packed) > packed.size()) {
+                return false;
+            }
+            batch.push_back(std::move(packed));
+            offset += length;
+        }
+
+        flows.insert(flows.end(), batch.begin(), batch.end());
+        return true;
     }
 
     void save_states_list(const json& list) const
@@ -597,17 +1011,63 @@ private:
                  << list.dump();
     }
 
-    void save_state(const std::string& dpid_str, const json& state) const
+    // Longest raw data whose encoded batch fits the value size
+    static size_t max_raw_size(size_t value_size)
     {
-        VLOG(17) << "[FlowEntriesVerifier] Saving state #"
-                 << dpid_str << ": " << state;
+        return value_size > CRC_FIELD_LEN
+             ? (value_size - CRC_FIELD_LEN) / 4 * 3 : 0;
+    }
 
-        for (size_t i = 1; i < state.size() + 1; ++i) {
-            const auto& flow = state[i - 1];
-            db_mgr_->putSValue(state_prefix(dpid_str),
-                               std::to_string(i),
-                               flow.dump());
+    // Returns false if the bucket wasn't saved completely
+    bool save_bucket(uint64_t dpid, BucketId bucket, const PackedFlows& flows)
+    {
+        auto&& prefix = flows_prefix(dpid);
+        // the longest batch key of the bucket bounds all of them
+        auto max_raw = std::min(batch_size_, max_raw_size(db_mgr_->maxValueSize(
+            prefix, batch_key(bucket, std::numeric_limits<size_t>::max()))));
+
+        size_t batch = 0;
+        bool saved = true;
+        std::string raw;
+        auto put_batch = [&]() {
+            saved = db_mgr_->putSValue(prefix, batch_key(bucket, batch++),
+                                       encode_batch(raw)) && saved;
+            raw.clear();
+        };
+
+        for (const auto& packed: flows) {
+            if (packed.size() > max_raw) {
+                LOG(ERROR) << "[FlowEntriesVerifier] Flow-Mod of " << packed.size()
+                           << " bytes of state #" << dpid << " is too long to save";
+                continue;
+            }
+            if (!raw.empty() && raw.size() + packed.size() > max_raw) {
+                put_batch();
+            }
+            raw += packed;
         }
+        if (!raw.empty()) {
+            put_batch();
+        }
+
+        auto& stored = batches_[dpid][bucket];
+        if (!saved) {
+            // batches above are deleted once the bucket is saved
+            stored = std::max(stored, batch);
+            LOG(ERROR) << "[FlowEntriesVerifier] Can't save bucket " << bucket
+                       << " of state #" << dpid << ", it will be saved again";
+            return false;
+        }
+
+        for (size_t i = batch; i < stored; ++i) {
+            db_mgr_->delJson(prefix, batch_key(bucket, i));
+        }
+        stored = batch;
+
+        VLOG(17) << "[FlowEntriesVerifier] Saved bucket " << bucket
+                 << " of state #" << dpid << ": " << flows.size()
+                 << " flows in " << batch << " batches";
+        return true;
     }
 
     json get_states_list() const
@@ -624,27 +1084,406 @@ private:
         return json::parse(list_dump);
     }
 
-    json get_state(const std::string dpid_str) const
+    // Batches of a bucket are numbered from 0, ones after a gap are left
+    // from the bucket being shrunk. Flows of batches laid out by other
+    // bucket hashes are loaded before the others to be replaced by them.
+    PackedFlows get_state(uint64_t dpid, bool& stale)
     {
-        auto&& state_keys = db_mgr_->getKeys(state_prefix(dpid_str));
+        std::map<BucketId, std::set<size_t>> keys;
+        for (const auto& key: db_mgr_->getKeys(flows_prefix(dpid))) {
+            unsigned bucket;
+            size_t batch;
+            if (std::sscanf(key.c_str(), "%u:%zu", &bucket, &batch) != 2 ||
+                bucket > std::numeric_limits<BucketId>::max()) {
+                stale = true;
+                continue;
+            }
+            keys[bucket].insert(batch);
+        }
 
-        if (state_keys.empty()) {
-            return json::array();
+        PackedFlows state;
+        PackedFlows misplaced;
+        auto& stored = batches_[dpid];
+        for (const auto& bucket_pair: keys) {
+            auto bucket = bucket_pair.first;
+            size_t batch = 0;
+            for (; bucket_pair.second.count(batch); ++batch) {
+                auto&& key = batch_key(bucket, batch);
+                auto&& value = db_mgr_->getSValue(flows_prefix(dpid), key);
+
+                PackedFlows flows;
+                if (!decode_batch(value, flows)) {
+                    LOG(ERROR) << "[FlowEntriesVerifier] Corrupted batch " << key
+                               << " of state #" << dpid << " was skipped";
+                    continue;
+                }
+
+                bool placed = std::all_of(flows.begin(), flows.end(),
+                    [bucket](const std::string& packed) {
+                        return Flow(packed).bucket() == bucket;
+                    });
+                auto& dest = placed ? state : misplaced;
+                dest.insert(dest.end(), flows.begin(), flows.end());
+                stale = stale || !placed;
+            }
+            stale = stale || batch < bucket_pair.second.size();
+            stored[bucket] = *bucket_pair.second.rbegin() + 1;
         }
+        state.insert(state.begin(), misplaced.begin(), misplaced.end());
 
-        json state;
-        for (const auto& key: state_keys) {
-            auto&& flow = db_mgr_->getSValue(state_prefix(dpid_str), key);
-            if (flow.empty()) {
+        VLOG(17) << "[FlowEntriesVerifier] Got state #" << dpid
+                 << " from db: " << state.size() << " flows";
+
+        return state;
+    }
+};
+
+// Verifies switches in parallel slice by slice
+// and re-sends missing flows within flow-mod budgets
+class Reconciler : public Polling {
+public:
+    struct Settings {
+        size_t max_concurrency;     // switches reconciled at once
+        double global_budget;       // flow-mods per second for all switches
+        double switch_budget;       // flow-mods per second for each switch
+        size_t slice_size;          // flows per flow-stats request
+        std::chrono::milliseconds request_timeout;
+        uint16_t tick_interval;
+    };
+
+    explicit Reconciler(VerifierDatabase* data, const MessageSender* sender,
+                        StatsPollScheduler* scheduler,
+                        const Settings& settings)
+        : data_(data)
+        , sender_(sender)
+        , scheduler_(scheduler)
+        , settings_(settings)
+        , global_tokens_(settings.global_budget)
+        , last_tick_(Clock::now())
+        , poller_(this, settings.tick_interval)
+    { }
+
+    void run() { poller_.run(); }
+
+    // Queues all switches which are not being reconciled now
+    void startRound()
+    {
+        auto&& dpids = data_->dpids();
+
+        lock_t lock(mut_);
+        for (auto dpid: dpids) {
+            auto it = jobs_.find(dpid);
+            if (it == jobs_.end()) {
+                jobs_.emplace(dpid, Job(dpid));
+            } else if (it->second.progress.state == +ReconcileState::Queued ||
+                       it->second.progress.state == +ReconcileState::Running) {
                 continue;
+            } else {
+                it->second.reset();
+            }
+            queue_.push_back(dpid);
+        }
+    }
+
+    void forget(uint64_t dpid)
+    {
+        lock_t lock(mut_);
+        auto it = jobs_.find(dpid);
+        if (it != jobs_.end()) {
+            if (it->second.progress.state == +ReconcileState::Running) {
+                --running_;
             }
+            jobs_.erase(it);
+        }
+    }
+
+    void clear()
+    {
+        lock_t lock(mut_);
+        jobs_.clear();
+        queue_.clear();
+        running_ = 0;
+    }
 
-            state.push_back(json::parse(flow));
+    std::vector<ReconcileProgress> progress() const
+    {
+        std::vector<ReconcileProgress> ret;
+        auto now = Clock::now();
+
+        lock_t lock(mut_);
+        for (const auto& pair: jobs_) {
+            ret.push_back(pair.second.snapshot(now));
         }
-        VLOG(17) << "[FlowEntriesVerifier] Got state #"
-                 << dpid_str << " from db: " << state;
+        return ret;
+    }
 
-        return state;
+    std::optional<ReconcileProgress> progress(uint64_t dpid) const
+    {
+        lock_t lock(mut_);
+        auto it = jobs_.find(dpid);
+        if (it == jobs_.end()) {
+            return std::nullopt;
+        }
+        return it->second.snapshot(Clock::now());
+    }
+
+    void polling() override
+    {
+        auto now = Clock::now();
+
+        lock_t lock(mut_);
+        double elapsed = std::chrono::duration<double>(now - last_tick_).count();
+        last_tick_ = now;
+        global_tokens_ = std::min(settings_.global_budget,
+                                  global_tokens_ + settings_.global_budget * elapsed);
+
+        while (running_ < settings_.max_concurrency && !queue_.empty()) {
+            auto dpid = queue_.front();
+            queue_.pop_front();
+
+            auto it = jobs_.find(dpid);
+            if (it != jobs_.end() &&
+                it->second.progress.state == +ReconcileState::Queued) {
+                start(it->second, now);
+            }
+        }
+
+        if (running_ == 0) {
+            return;
+        }
+
+        // global budget is shared equally by running switches
+        double share = global_tokens_ / running_;
+        for (auto& pair: jobs_) {
+            auto& job = pair.second;
+            if (job.progress.state != +ReconcileState::Running) {
+                continue;
+            }
+
+            job.tokens = std::min(settings_.switch_budget,
+                                  job.tokens + settings_.switch_budget * elapsed);
+            collect(job, now);
+            correct(job, share);
+            request(job, now);
+            finish(job, now);
+        }
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+    using StatsFuture = future<OFAgent::sequence<of13::FlowStats>>;
+
+    struct SliceRequest {
+        Clock::time_point sent_at;
+        FlowStatsSequence flow_stats;
+        bool failed = false;
+        std::atomic_bool ready{false};
+    };
+
+    struct Job {
+        ReconcileProgress progress;
+        std::vector<FlowSlice> slices;
+        std::shared_ptr<SliceRequest> request;
+        std::deque<FlowPtr> corrections;
+        double tokens = 0;
+        Clock::time_point started;
+
+        explicit Job(uint64_t dpid)
+            : progress{dpid, ReconcileState::Queued, 0, 0, 0, 0, 0, 0, 0,
+                       std::chrono::milliseconds::zero(),
+                       std::chrono::milliseconds::zero()}
+        { }
+
+        // Keeps results of previous rounds
+        void reset()
+        {
+            progress.state = ReconcileState::Queued;
+            progress.slices = 0;
+            progress.slices_done = 0;
+            progress.slices_failed = 0;
+            progress.divergent = 0;
+            progress.corrected = 0;
+            progress.elapsed = std::chrono::milliseconds::zero();
+            slices.clear();
+            request.reset();
+            corrections.clear();
+        }
+
+        ReconcileProgress snapshot(Clock::time_point now) const
+        {
+            auto ret = progress;
+            ret.pending = corrections.size();
+            if (progress.state == +ReconcileState::Running) {
+                ret.elapsed = std::chrono::duration_cast<
+                    std::chrono::milliseconds>(now - started);
+            }
+            return ret;
+        }
+    };
+
+    VerifierDatabase* data_;
+    const MessageSender* sender_;
+    StatsPollScheduler* scheduler_;
+    Settings settings_;
+    boost::inline_executor executor_;
+
+    std::map<uint64_t, Job> jobs_;
+    std::deque<uint64_t> queue_;
+    size_t running_ = 0;
+    double global_tokens_;
+    Clock::time_point last_tick_;
+    mutable std::mutex mut_;
+
+    Poller poller_;
+
+    void start(Job& job, Clock::time_point now)
+    {
+        job.slices = data_->slices(job.progress.dpid, settings_.slice_size);
+        job.progress.state = ReconcileState::Running;
+        job.progress.slices = job.slices.size();
+        job.tokens = settings_.switch_budget;
+        job.started = now;
+        ++running_;
+
+        VLOG(8) << "[FlowEntriesVerifier] Reconciliation of switch dpid="
+                << job.progress.dpid << " started, slices: "
+                << job.slices.size();
+    }
+
+    void collect(Job& job, Clock::time_point now)
+    {
+        auto& request = job.request;
+        if (!request) {
+            return;
+        }
+
+        auto dpid = job.progress.dpid;
+        const auto& slice = job.slices[job.progress.slices_done];
+
+        if (request->ready) {
+            if (request->failed) {
+                ++job.progress.slices_failed;
+            } else {
+                auto&& missing = data_->diff(dpid, slice, request->flow_stats);
+                if (!missing.empty()) {
+                    LOG(WARNING) << "[FlowEntriesVerifier] No "
+                                 << missing.size() << " required flow entries "
+                                 << "in table " << static_cast<int>(slice.table_id)
+                                 << " on switch dpid=" << dpid;
+                }
+                job.progress.divergent += missing.size();
+                job.corrections.insert(job.corrections.end(),
+                                       missing.begin(), missing.end());
+            }
+        } else if (now - request->sent_at > settings_.request_timeout) {
+            LOG(WARNING) << "[FlowEntriesVerifier] Flow-stats request "
+                         << "to switch dpid=" << dpid << " timed out";
+            ++job.progress.slices_failed;
+        } else {
+            return;
+        }
+
+        ++job.progress.slices_done;
+        request.reset();
+    }
+
+    void correct(Job& job, double share)
+    {
+        auto dpid = job.progress.dpid;
+
+        while (!job.corrections.empty() &&
+               job.tokens >= 1 && share >= 1 && global_tokens_ >= 1) {
+            bool sent = false;
+            try {
+                sent = sender_->send(dpid, *job.corrections.front());
+            } catch (const std::exception& e) {
+                LOG(ERROR) << "[FlowEntriesVerifier] Can't re-send Flow-Mod "
+                           << "to switch dpid=" << dpid << ": " << e.what();
+            }
+            if (not sent) {
+                job.corrections.clear();
+                job.progress.state = ReconcileState::Failed;
+                return;
+            }
+            job.corrections.pop_front();
+            ++job.progress.corrected;
+            job.tokens -= 1;
+            share -= 1;
+            global_tokens_ -= 1;
+        }
+    }
+
+    // Next slice is requested when corrections of previous ones
+    // fit into the switch budget, so the backlog stays bounded
+    void request(Job& job, Clock::time_point now)
+    {
+        if (job.request ||
+            job.progress.state != +ReconcileState::Running ||
+            job.progress.slices_done == job.slices.size() ||
+            job.corrections.size() > settings_.switch_budget) {
+            return;
+        }
+
+        auto dpid = job.progress.dpid;
+        auto request = std::make_shared<SliceRequest>();
+        request->sent_at = now;
+
+        // sent by the poll scheduler within its in-flight budgets,
+        // waiting for them counts to the request timeout
+        scheduler_->submit(PollType::Verifier, dpid,
+            [this, dpid, request,
+             slice = job.slices[job.progress.slices_done]]() -> future<void> {
+                try {
+                    return sender_->flowStatsRequest(dpid, slice)
+                        .then(executor_, [request](StatsFuture f) {
+                            try {
+                                request->flow_stats = f.get();
+                            } catch (const std::exception& e) {
+                                request->failed = true;
+                            }
+                            request->ready = true;
+                        });
+                } catch (const std::exception& e) {
+                    LOG(ERROR) << "[FlowEntriesVerifier] Can't request flow "
+                               << "stats from switch dpid=" << dpid << ": "
+                               << e.what();
+                    request->failed = true;
+                    request->ready = true;
+                    return make_ready_future();
+                }
+            });
+        job.request = std::move(request);
+    }
+
+    void finish(Job& job, Clock::time_point now)
+    {
+        auto& progress = job.progress;
+        bool done = progress.state == +ReconcileState::Failed ||
+                    (progress.slices_done == job.slices.size() &&
+                     job.corrections.empty());
+        if (!done) {
+            return;
+        }
+
+        if (progress.slices_failed > 0) {
+            progress.state = ReconcileState::Failed;
+        }
+        if (progress.state == +ReconcileState::Running) {
+            progress.state = ReconcileState::Converged;
+        }
+        progress.elapsed = std::chrono::duration_cast<
+            std::chrono::milliseconds>(now - job.started);
+        if (progress.state == +ReconcileState::Converged) {
+            progress.time_to_converge = progress.elapsed;
+        }
+        ++progress.rounds;
+        --running_;
+
+        VLOG(6) << "[FlowEntriesVerifier] Reconciliation of switch dpid="
+                << progress.dpid << " finished as "
+                << progress.state._to_string() << " in "
+                << progress.elapsed.count() << " ms, "
+                << progress.corrected << " Flow-Mods re-sent";
     }
 };
 
@@ -658,6 +1497,8 @@ void VerifierDatabase::removeState(uint64_t dpid)
     auto it = states_.find(dpid);
     CHECK(it != states_.end());
     states_.erase(it);
+    reset_.insert(dpid);
+    list_changed_ = true;
 }
 
 void VerifierDatabase::process(uint64_t dpid, of13::FlowMod& fm)
@@ -678,7 +1519,7 @@ void VerifierDatabase::process(uint64_t dpid, of13::FlowMod& fm)
     state_ptr->process(fm);
 }
 
-FlowModPtr VerifierDatabase::process(uint64_t dpid, of13::FlowRemoved& fr)
+FlowPtr VerifierDatabase::process(uint64_t dpid, of13::FlowRemoved& fr)
 {
     VLOG(8) << "[FlowEntriesVerifier] Flow-Removed arrived from switch "
             << "dpid=" << dpid;
@@ -693,54 +1534,107 @@ FlowModPtr VerifierDatabase::process(uint64_t dpid, of13::FlowRemoved& fr)
     return state_ptr->process(fr);
 }
 
-void VerifierDatabase::fromJson(VerifierDatabase::dump_json& db_dump)
+void VerifierDatabase::load(const std::map<uint64_t, PackedFlows>& db_dump)
 {
-    clear();
+    SwitchStatePtrMap states;
     for (const auto& state_pair: db_dump) {
-        auto dpid = std::stoull(state_pair.first);
-        auto& state = state_pair.second;
+        states.emplace(state_pair.first,
+                       std::make_shared<SwitchState>(state_pair.second));
+    }
 
-        addState(dpid, state);
+    upgrade_lock_t lock(states_mut_);
+    unique_lock_t unique_lock(lock);
+    states_ = std::move(states);
+    reset_.clear();
+    list_changed_ = false;
+}
+
+void VerifierDatabase::markDirty(uint64_t dpid,
+                                 const std::vector<BucketId>& buckets)
+{
+    if (auto state = find_state(dpid)) {
+        state->markDirty(buckets);
     }
 }
 
-VerifierDatabase::dump_json VerifierDatabase::toJson() const
+void VerifierDatabase::rewrite(uint64_t dpid)
 {
-    dump_json db_dump;
+    auto state = find_state(dpid);
+    if (not state) {
+        return;
+    }
 
-    shared_lock_t lock(states_mut_);
-    for (const auto& state: states_) {
-        std::string dpid_str = std::to_string(state.first);
-        db_dump[dpid_str] = state.second->toJson();
+    {
+        upgrade_lock_t lock(states_mut_);
+        unique_lock_t unique_lock(lock);
+        reset_.insert(dpid);
     }
-    return db_dump;
+    state->markAllDirty();
 }
 
-void VerifierDatabase::restoreStates(const MessageSender* sender) const
+VerifierDatabase::Checkpoint VerifierDatabase::checkpoint()
 {
-    shared_lock_t lock(states_mut_);
+    Checkpoint checkpoint;
+    SwitchStatePtrMap states;
+
+    { // lock
+        upgrade_lock_t lock(states_mut_);
+        unique_lock_t unique_lock(lock);
+
+        states = states_;
+        checkpoint.list_changed = list_changed_;
+        checkpoint.reset.assign(reset_.begin(), reset_.end());
+        reset_.clear();
+        list_changed_ = false;
+    } // unlock
+
+    if (checkpoint.list_changed) {
+        for (const auto& state: states) {
+            checkpoint.dpids.push_back(state.first);
+        }
+    }
 
-    for (const auto& pair: states_) {
-        auto dpid = pair.first;
-        auto& state_ptr = pair.second;
+    // packing is done outside of the lock, flow-mods are processed meanwhile
+    for (const auto& state: states) {
+        auto&& buckets = state.second->takeDirty();
+        if (!buckets.empty()) {
+            checkpoint.dirty.emplace(state.first, std::move(buckets));
+        }
+    }
 
-        auto&& flow_stats = sender->flowStatsRequest(dpid);
-        if (!flow_stats.empty()) {
-            auto&& fmp_sequence = state_ptr->process(flow_stats);
-            if (!fmp_sequence.empty()) {
-                LOG(WARNING) << "[FlowEntriesVerifier] No "
-                             << fmp_sequence.size() << "required flow entries "
-                             << "on switch dpid=" << dpid;
-            }
+    return checkpoint;
+}
 
-            sender->send(dpid, fmp_sequence);
+std::vector<uint64_t> VerifierDatabase::dpids() const
+{
+    std::vector<uint64_t> ret;
 
-            if (!fmp_sequence.empty()) {
-                VLOG(7) << "[FlowEntriesVerifier] " << fmp_sequence.size()
-                        << "Flow-Mod re-sent to switch dpid=" << dpid;
-            }
-        }
+    shared_lock_t lock(states_mut_);
+    for (const auto& pair: states_) {
+        ret.push_back(pair.first);
+    }
+    return ret;
+}
+
+std::vector<FlowSlice> VerifierDatabase::slices(uint64_t dpid,
+                                                size_t slice_size) const
+{
+    auto state_ptr = find_state(dpid);
+    if (!state_ptr) {
+        return {};
+    }
+    return state_ptr->slices(slice_size);
+}
+
+FlowPtrSequence VerifierDatabase::diff(uint64_t dpid,
+                                       const FlowSlice& slice,
+                                       FlowStatsSequence& flow_stats) const
+{
+    auto state_ptr = find_state(dpid);
+    if (!state_ptr) {
+        return {};
     }
+    return state_ptr->diff(slice, flow_stats);
 }
 
 void VerifierDatabase::add_state_impl(uint64_t dpid, SwitchStatePtr& state_ptr)
@@ -753,6 +1647,9 @@ void VerifierDatabase::add_state_impl(uint64_t dpid, SwitchStatePtr& state_ptr)
     if (!pair.second) {
         state_it->second = state_ptr;
     }
+    // stored flows of the previous state are obsolete
+    reset_.insert(dpid);
+    list_changed_ = true;
 }
 
 void VerifierDatabase::clear()
@@ -760,6 +1657,8 @@ void VerifierDatabase::clear()
     upgrade_lock_t lock(states_mut_);
     unique_lock_t unique_lock(lock);
     states_.clear();
+    reset_.clear();
+    list_changed_ = false;
 
     VLOG(8) << "[FlowEntriesVerifier] VerifierDatabase cleared";
 }
@@ -783,12 +1682,17 @@ struct FlowEntriesVerifier::implementation final
     VerifierDatabase* data_ptr;
     MessageSender sender;
     Recovery recovery;
+    Reconciler reconciler;
 
     explicit implementation(VerifierDatabase* data, SwitchManager* sw_mgr,
-                            DatabaseConnector* db_mgr, RecoveryManager* rc_mgr)
+                            DatabaseConnector* db_mgr, RecoveryManager* rc_mgr,
+                            StatsPollScheduler* scheduler,
+                            size_t batch_size,
+                            const Reconciler::Settings& reconcile_settings)
         : data_ptr(data)
         , sender(sw_mgr)
-        , recovery(db_mgr, rc_mgr)
+        , recovery(db_mgr, rc_mgr, batch_size)
+        , reconciler(data, &sender, scheduler, reconcile_settings)
     { }
 
     void send(uint64_t dpid, fluid_msg::OFMsg& msg) { sender.send(dpid, msg); }
@@ -800,7 +1704,7 @@ struct FlowEntriesVerifier::implementation final
         process(*fmp, dpid);
     }
 
-    void polling() const
+    void polling()
     {
         if (!isPrimary()) {
             return;
@@ -817,6 +1721,7 @@ struct FlowEntriesVerifier::implementation final
         }
 
         data_ptr->removeState(dpid);
+        reconciler.forget(dpid);
     }
 
     void switchUp(uint64_t dpid)
@@ -835,16 +1740,16 @@ struct FlowEntriesVerifier::implementation final
         }
 
         auto dpid = conn->dpid();
-        auto&& fmp = data_ptr->process(dpid, fr);
-        if (fmp) {
+        auto&& flow = data_ptr->process(dpid, fr);
+        if (flow) {
             VLOG(7) << "[FlowEntriesVerifier] Unexpected flow removal "
                     << "on switch dpid=" << dpid << ", table id="
                     << static_cast<int>(fr.table_id());
 
-            sender.send(dpid, fmp);
-
-            VLOG(7) << "[FlowEntriesVerifier] Flow-Mod re-sent "
-                    << "to switch dpid=" << dpid;
+            if (sender.send(dpid, *flow)) {
+                VLOG(7) << "[FlowEntriesVerifier] Flow-Mod re-sent "
+                        << "to switch dpid=" << dpid;
+            }
         }
         return false;
     }
@@ -857,23 +1762,33 @@ struct FlowEntriesVerifier::implementation final
 
     void loadFromDatabase()
     {
-        auto&& db_dump = recovery.load();
-        data_ptr->fromJson(db_dump);
+        std::vector<uint64_t> stale;
+        auto&& db_dump = recovery.load(stale);
+        data_ptr->load(db_dump);
+
+        for (auto dpid: stale) {
+            LOG(WARNING) << "[FlowEntriesVerifier] Stale batches of state #"
+                         << dpid << ", it will be saved anew";
+            data_ptr->rewrite(dpid);
+        }
     }
 
-    void saveToDatabase() const
+    void saveToDatabase()
     {
-        auto&& db_dump = data_ptr->toJson();
-        recovery.save(db_dump);
+        auto&& checkpoint = data_ptr->checkpoint();
+        for (const auto& unsaved: recovery.save(checkpoint)) {
+            data_ptr->markDirty(unsaved.first, unsaved.second);
+        }
 
-        VLOG(6) << "[FlowEntriesVerifier] States were saved to database";
+        VLOG(6) << "[FlowEntriesVerifier] Changes of " << checkpoint.dirty.size()
+                << " states were saved to database";
     }
 
-    void restoreStates() const
+    void restoreStates()
     {
-        data_ptr->restoreStates(&sender);
+        reconciler.startRound();
 
-        VLOG(6) << "[FlowEntriesVerifier] States were verified";
+        VLOG(6) << "[FlowEntriesVerifier] States were queued for verification";
     }
 
     bool isPrimary() const { return recovery.isPrimary(); }
@@ -889,7 +1804,26 @@ void FlowEntriesVerifier::init(Loader* loader, const Config& rootConfig)
     SwitchManager* sw_mgr = SwitchManager::get(loader);
     RecoveryManager* rc_mgr = RecoveryManager::get(loader);
     DatabaseConnector* db_mgr = DatabaseConnector::get(loader);
-    impl_.reset(new implementation(&data_, sw_mgr, db_mgr, rc_mgr));
+    size_t batch_size = config_get(config, "batch-size", 4096);
+
+    auto reconcile_config = config_cd(config, "reconciliation");
+    Reconciler::Settings reconcile_settings;
+    reconcile_settings.max_concurrency =
+        config_get(reconcile_config, "max-concurrency", 4);
+    reconcile_settings.global_budget =
+        config_get(reconcile_config, "global-budget", 1000.0);
+    reconcile_settings.switch_budget =
+        config_get(reconcile_config, "switch-budget", 200.0);
+    reconcile_settings.slice_size =
+        config_get(reconcile_config, "slice-size", 1000);
+    reconcile_settings.request_timeout = std::chrono::milliseconds(
+        config_get(reconcile_config, "request-timeout", 5000));
+    reconcile_settings.tick_interval =
+        config_get(reconcile_config, "tick-interval", 100);
+
+    impl_.reset(new implementation(&data_, sw_mgr, db_mgr, rc_mgr,
+                                   StatsPollScheduler::get(loader),
+                                   batch_size, reconcile_settings));
 
     if (is_active_) {
         uint16_t poll_interval = config_get(config, "poll-interval", 30000);
@@ -904,7 +1838,10 @@ void FlowEntriesVerifier::init(Loader* loader, const Config& rootConfig)
         });
 
         connect(rc_mgr, &RecoveryManager::signalSetupBackupMode,
-                this, [this]() { data_.clear(); });
+                this, [this]() {
+                    data_.clear();
+                    impl_->reconciler.clear();
+                });
         connect(rc_mgr, &RecoveryManager::signalSetupPrimaryMode,
                 this, [this]() { impl_->loadFromDatabase(); });
     }
@@ -912,11 +1849,26 @@ void FlowEntriesVerifier::init(Loader* loader, const Config& rootConfig)
 
 void FlowEntriesVerifier::startUp(Loader *loader)
 {
+    // nullptr if ofmsg-sender is not loaded
+    impl_->sender.setOFMsgSender(OFMsgSender::get(loader));
+
     if (is_active_) {
         poller_->run();
+        impl_->reconciler.run();
     }
 }
 
+std::vector<ReconcileProgress> FlowEntriesVerifier::reconciliation() const
+{
+    return impl_->reconciler.progress();
+}
+
+std::optional<ReconcileProgress>
+FlowEntriesVerifier::reconciliation(uint64_t dpid) const
+{
+    return impl_->reconciler.progress(dpid);
+}
+
 void FlowEntriesVerifier::send(uint64_t dpid, fluid_msg::OFMsg& msg)
 {
     if (is_active_ && msg.type() == of13::OFPT_FLOW_MOD) {
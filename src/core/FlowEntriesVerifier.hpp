@@ -18,6 +18,7 @@
 
 #include "Application.hpp"
 #include "SwitchOrdering.hpp"
+#include "lib/better_enum.hpp"
 #include "lib/poller.hpp"
 
 #include <fluid/ofcommon/msg.hh>
@@ -26,23 +27,68 @@
 
 #include <boost/thread/shared_mutex.hpp>
 
+#include <chrono>
 #include <memory>
 #include <map>
+#include <optional>
+#include <set>
+#include <string>
 #include <unordered_map>
+#include <vector>
 
 namespace runos {
 
 namespace of13 = fluid_msg::of13;
 
 using json = nlohmann::json;
-using FlowModPtr = std::unique_ptr<of13::FlowMod>;
+using FlowPtr = std::shared_ptr<const class Flow>;
+using FlowPtrSequence = std::vector<FlowPtr>;
+using FlowStatsSequence = std::vector<of13::FlowStats>;
+
+// Part of switch flow table requested at once during reconciliation
+struct FlowSlice {
+    uint8_t table_id;
+    uint64_t cookie;
+    uint64_t cookie_mask;
+};
+
+BETTER_ENUM(ReconcileState, uint8_t, Queued,
+                                     Running,
+                                     Converged,
+                                     Failed);
+
+struct ReconcileProgress {
+    uint64_t dpid;
+    ReconcileState state;
+    size_t slices;          // flow-stats requests in the round
+    size_t slices_done;
+    size_t slices_failed;   // timed out or rejected requests
+    uint64_t divergent;     // missing flow entries found in the round
+    uint64_t corrected;     // flow-mods re-sent in the round
+    size_t pending;         // corrections waiting for budget
+    uint64_t rounds;        // completed rounds
+    std::chrono::milliseconds elapsed;          // of the current round
+    std::chrono::milliseconds time_to_converge; // of the last completed round
+};
 
 class VerifierDatabase {
 public:
     using SwitchStatePtr = std::shared_ptr<class SwitchState>;
     using SwitchStatePtrMap = std::unordered_map<uint64_t, SwitchStatePtr>;
 
-    using dump_json = std::map<std::string, json>;
+    // Flows are persisted in buckets grouped by switch and table,
+    // bucket id is (table_id << 8 | bucket within table)
+    using BucketId = uint16_t;
+    using PackedFlows = std::vector<std::string>;
+    using Buckets = std::map<BucketId, PackedFlows>;
+
+    // Changes since the previous checkpoint
+    struct Checkpoint {
+        bool list_changed = false;
+        std::vector<uint64_t> dpids;    // all switches, if list was changed
+        std::vector<uint64_t> reset;    // switches with obsolete stored flows
+        std::map<uint64_t, Buckets> dirty;  // full content of changed buckets
+    };
 
     template<class... Args>
     void addState(uint64_t dpid, Args&&... args)
@@ -57,15 +103,25 @@ public:
     void clear();
 
     void process(uint64_t dpid, of13::FlowMod& fm);
-    FlowModPtr process(uint64_t dpid, of13::FlowRemoved& fr);
+    FlowPtr process(uint64_t dpid, of13::FlowRemoved& fr);
 
-    void fromJson(dump_json& db_dump);
-    dump_json toJson() const;
+    void load(const std::map<uint64_t, PackedFlows>& db_dump);
+    Checkpoint checkpoint();
+    // Buckets are saved again with the next checkpoint
+    void markDirty(uint64_t dpid, const std::vector<BucketId>& buckets);
+    // Stored flows of the switch are replaced with its whole state
+    void rewrite(uint64_t dpid);
 
-    void restoreStates(const class MessageSender* sender) const;
+    std::vector<uint64_t> dpids() const;
+    std::vector<FlowSlice> slices(uint64_t dpid, size_t slice_size) const;
+    // Returns flows of the slice missing in flow-stats reply
+    FlowPtrSequence diff(uint64_t dpid, const FlowSlice& slice,
+                         FlowStatsSequence& flow_stats) const;
 
 private:
     SwitchStatePtrMap states_;
+    std::set<uint64_t> reset_;
+    bool list_changed_ = false;
     mutable boost::shared_mutex states_mut_;
 
     void add_state_impl(uint64_t dpid, SwitchStatePtr& new_state_ptr);
@@ -83,6 +139,9 @@ public:
 
     void send(uint64_t dpid, fluid_msg::OFMsg& msg);
 
+    std::vector<ReconcileProgress> reconciliation() const;
+    std::optional<ReconcileProgress> reconciliation(uint64_t dpid) const;
+
 protected slots:
     void polling();
 
@@ -0,0 +1,113 @@
+/*
+ * Copyright 2019 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Application.hpp"
+#include "Loader.hpp"
+#include "FlowEntriesVerifier.hpp"
+#include "RestListener.hpp"
+
+#include <boost/lexical_cast.hpp>
+
+namespace runos {
+
+static rest::ptree toPtree(const ReconcileProgress& progress)
+{
+    rest::ptree ret;
+    ret.put("dpid", progress.dpid);
+    ret.put("state", progress.state._to_string());
+    ret.put("slices", progress.slices);
+    ret.put("slices_done", progress.slices_done);
+    ret.put("slices_failed", progress.slices_failed);
+    ret.put("divergent", progress.divergent);
+    ret.put("corrected", progress.corrected);
+    ret.put("pending", progress.pending);
+    ret.put("rounds", progress.rounds);
+    ret.put("elapsed_ms", progress.elapsed.count());
+    ret.put("time_to_converge_ms", progress.time_to_converge.count());
+    return ret;
+}
+
+struct ReconciliationCollection : rest::resource {
+    FlowEntriesVerifier* app;
+
+    explicit ReconciliationCollection(FlowEntriesVerifier* app)
+        : app(app)
+    { }
+
+    rest::ptree Get() const override {
+        rest::ptree root;
+        rest::ptree switches;
+
+        for (const auto& progress : app->reconciliation()) {
+            switches.push_back(std::make_pair("", toPtree(progress)));
+        }
+
+        root.add_child("array", switches);
+        root.put("_size", switches.size());
+        return root;
+    }
+};
+
+struct ReconciliationResource : rest::resource {
+    FlowEntriesVerifier* app;
+    uint64_t dpid;
+
+    explicit ReconciliationResource(FlowEntriesVerifier* app, uint64_t dpid)
+        : app(app), dpid(dpid)
+    { }
+
+    rest::ptree Get() const override {
+        auto progress = app->reconciliation(dpid);
+        if (not progress) {
+            THROW(rest::http_error(404), "Switch was not reconciled yet");
+        }
+        return toPtree(*progress);
+    }
+};
+
+class FlowEntriesVerifierRest : public Application
+{
+    SIMPLE_APPLICATION(FlowEntriesVerifierRest, "flow-entries-verifier-rest")
+public:
+    void init(Loader* loader, const Config&) override
+    {
+        using rest::path_spec;
+        using rest::path_match;
+
+        auto app = FlowEntriesVerifier::get(loader);
+        auto rest_ = RestListener::get(loader);
+
+        rest_->mount(path_spec("/flow-entries-verifier/"),
+                     [=](const path_match&) {
+            return ReconciliationCollection {app};
+        });
+
+        rest_->mount(path_spec("/flow-entries-verifier/(\\d+)/"),
+                     [=](const path_match& m) {
+            try {
+                auto dpid = boost::lexical_cast<uint64_t>(m[1].str());
+                return ReconciliationResource {app, dpid};
+            } catch (const boost::bad_lexical_cast& e) {
+                THROW( rest::http_error(400), "Bad request: {}", e.what() );
+            }
+        });
+    }
+};
+
+REGISTER_APPLICATION(FlowEntriesVerifierRest, {"rest-listener",
+                                               "flow-entries-verifier", ""})
+
+} // namespace runos
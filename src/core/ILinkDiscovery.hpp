@@ -72,6 +72,13 @@ signals:
      */
     virtual void linkBroken(switch_and_port from, switch_and_port to) = 0;
 
+    /**
+     * This signal emitted right before linkBroken when fast failure
+     * detection finds the link silent. It is emitted from the detector
+     * thread, receivers not safe to run there connect it queued.
+     */
+    virtual void linkFailed(switch_and_port from, switch_and_port to) = 0;
+
     // return by value because we don't want to use mutex (faster for REST calls?)
     virtual const std::set<DiscoveredLink> links() const = 0;
     virtual switch_and_port other(switch_and_port) const = 0;
@@ -28,6 +28,8 @@
 
 #include <fluid/of13/of13match.hh>
 
+#include <boost/functional/hash.hpp>
+
 #include <algorithm>
 #include <chrono>
 
@@ -48,12 +50,54 @@ void LinkDiscovery::init(Loader *loader, const Config &rootConfig)
     auto config = config_cd(rootConfig, "link-discovery");
     c_poll_interval = config_get(config, "poll-interval", 5);
     queue_id = config_get(config, "queue", -1);
+    // probes are spread over the poll interval with this resolution, ms
+    auto lldp_tick = config_get(config, "lldp-tick", 100);
 
     /* Get dependencies */
     recovery = RecoveryManager::get(loader);
     m_switch_manager = SwitchManager::get(loader);
     db_connector_ = DatabaseConnector::get(loader);
-    poller = new Poller(this, c_poll_interval * 1000);
+    poller = new Poller(this, lldp_tick);
+    // probes of stable links and edge ports back off up to these, seconds
+    auto link_max = std::chrono::seconds(config_get(config, "lldp-link-max-interval", 20));
+    auto edge_max = std::chrono::seconds(config_get(config, "lldp-edge-max-interval", 60));
+    scheduler = new LLDPScheduler(*this, std::chrono::milliseconds(lldp_tick),
+                                  config_get(config, "lldp-copies", 1),
+                                  config_get(config, "lldp-jitter", 10) / 100.0,
+                                  link_max, edge_max);
+
+    // selected links are probed every interval ms and fail after
+    // multiplier intervals of silence
+    auto fast_config = config_cd(config, "fast-detection");
+    fast_monitor = new FastLinkMonitor(*this,
+        std::chrono::milliseconds(config_get(fast_config, "interval", 30)),
+        config_get(fast_config, "multiplier", 3),
+        std::chrono::milliseconds(config_get(fast_config, "false-positive-window", 1000)),
+        [this](switch_and_port from, switch_and_port to) {
+            fastFailure(from, to);
+        });
+    auto fast_ports = fast_config.find("ports");
+    if (fast_ports != fast_config.end()) {
+        // "dpid:port" ends of links, "*" for all links
+        for (const auto& end : fast_ports->second.array_items()) {
+            auto str = end.string_value();
+            auto colon = str.find(':');
+            if (str == "*") {
+                fast_monitor->selectAll();
+            } else if (colon != std::string::npos) {
+                fast_monitor->select(switch_and_port(
+                    strtoull(str.substr(0, colon).c_str(), nullptr, 10),
+                    strtoul(str.substr(colon + 1).c_str(), nullptr, 10)));
+            } else {
+                LOG(ERROR) << "[LinkDiscovery] Incorrect fast detection port: " << str;
+            }
+        }
+    }
+
+    // one turn of the wheel covers the link lifetime
+    auto tick = std::chrono::milliseconds(lldp_tick);
+    m_expiry = TimerWheel<LinkTimer>(tick,
+        std::chrono::seconds(c_poll_interval * 2) / tick + 1);
 
     /* Do logging and save to DB */
     connect(this, &LinkDiscovery::linkDiscovered,
@@ -64,6 +108,7 @@ void LinkDiscovery::init(Loader *loader, const Config &rootConfig)
          });
     connect(this, &LinkDiscovery::linkBroken,
          [this](switch_and_port from, switch_and_port to) {
+             fast_monitor->unwatch(from, to);
              save_to_database();
              LOG(INFO) << "[LinkDiscovery] Link broken - "
                        << from << " <-> " << to;
@@ -145,6 +190,17 @@ void LinkDiscovery::startUp(Loader *)
     poller->run();
 }
 
+const std::set<DiscoveredLink> LinkDiscovery::links() const
+{
+    std::lock_guard<std::mutex> lock(links_mutex);
+
+    std::set<DiscoveredLink> ret;
+    for (const auto& it : m_links) {
+        ret.insert(it.second.link);
+    }
+    return ret;
+}
+
 switch_and_port LinkDiscovery::other(switch_and_port sp) const
 {
     std::lock_guard<std::mutex> lock(links_mutex);
@@ -154,19 +210,10 @@ switch_and_port LinkDiscovery::other(switch_and_port sp) const
         return switch_and_port {0, 0};
     }
 
-    auto edge_it = out_it->second;
-    switch_and_port target;
-
-    if (edge_it->source == sp)
-        target = edge_it->target;
-    else
-        target = edge_it->source;
+    const auto& key = out_it->second;
+    CHECK(m_links.count(key) == 1);
 
-    DiscoveredLink link(*edge_it);
-    auto link_it = find_link(m_links, link);
-    CHECK(link_it != m_links.end());
-
-    return target;
+    return key.first == sp ? key.second : key.first;
 }
 
 void LinkDiscovery::handleBeacon(switch_and_port from, switch_and_port to)
@@ -178,25 +225,24 @@ void LinkDiscovery::handleBeacon(switch_and_port from, switch_and_port to)
         return;
     }
 
+    fast_monitor->received(from, to);
+
+    // link lives for two probe intervals of the sending port
     DiscoveredLink link{ from, to,
                          std::chrono::steady_clock::now() +
-                         std::chrono::seconds(c_poll_interval * 2) };
-    DiscoveredLink reversed{ to, from, link.valid_through };
+                         scheduler->answered(from) * 2 };
     bool emit_on_add { false };
     std::vector<std::optional<link_pair>> emit_on_remove;
 
     { // lock
     std::lock_guard<std::mutex> lock(links_mutex);
 
-    auto link_it     = find_link(m_waiting_links, link);
-    auto reversed_it = find_link(m_waiting_links, reversed);
-
-    if (reversed_it != m_waiting_links.end()) {
+    if (m_waiting_links.count({to, from})) {
         // Reversed link exists, add (or update) bidirectional link
         remove_waiting_link(to, from);
         emit_on_add = add_link(link);
     }
-    else if (link_it != m_waiting_links.end()) {
+    else if (m_waiting_links.count({from, to})) {
         // Link of the same direction
     }
     else {
@@ -209,6 +255,17 @@ void LinkDiscovery::handleBeacon(switch_and_port from, switch_and_port to)
     } // unlock
 
     if (emit_on_add) {
+        if (fast_monitor->selected(link.source, link.target)) {
+            auto source = m_switch_manager->switch_(link.source.dpid);
+            auto target = m_switch_manager->switch_(link.target.dpid);
+            if (source && target) {
+                auto source_port = source->port(link.source.port);
+                auto target_port = target->port(link.target.port);
+                if (source_port && target_port) {
+                    fast_monitor->watch(source_port, target_port);
+                }
+            }
+        }
         emit linkDiscovered(link.source, link.target);
     }
 
@@ -219,6 +276,31 @@ void LinkDiscovery::handleBeacon(switch_and_port from, switch_and_port to)
     }
 }
 
+void LinkDiscovery::fastFailure(switch_and_port from, switch_and_port to)
+{
+    if (not recovery->isPrimary()) {
+        return;
+    }
+    if (from > to)
+        std::swap(from, to);
+
+    { // lock
+    std::lock_guard<std::mutex> lock(links_mutex);
+    if (not m_links.count({from, to})) {
+        return;
+    }
+    remove_link(from, to);
+    // otherwise a probe of the direction still alive brings it back
+    remove_waiting_link(from, to);
+    remove_waiting_link(to, from);
+    } // unlock
+
+    LOG(WARNING) << "[LinkDiscovery] Fast detection - link failed "
+                 << from << " <-> " << to;
+    emit linkFailed(from, to);
+    emit linkBroken(from, to);
+}
+
 void LinkDiscovery::clearLinkAt(PortPtr port)
 {
     switch_and_port source{port->switch_()->dpid(), port->number()};
@@ -237,37 +319,31 @@ void LinkDiscovery::clearLinkAt(PortPtr port)
 
 void LinkDiscovery::polling()
 {
+    auto now = std::chrono::steady_clock::now();
+    bool round = not (now < m_next_round);
+    if (round) {
+        m_next_round = now + std::chrono::seconds(c_poll_interval);
+    }
+
     // Backup controller
     if (not recovery->isPrimary()) {
-        load_from_database();
+        if (round) {
+            load_from_database();
+        }
         return;
     }
 
     // Master controller
-    auto now = std::chrono::steady_clock::now();
 
     std::vector<link_pair> links_to_delete;
 
     {//lock
         std::lock_guard<std::mutex> lock(links_mutex);
 
-        // Remove all expired links
-        while (!m_links.empty() && m_links.begin()->valid_through < now) {
-            auto top = m_links.begin();
-            links_to_delete.push_back(std::make_pair(top->source, top->target));
-            CHECK(m_out_edges.erase(top->source) == 1);
-            CHECK(m_out_edges.erase(top->target) == 1);
-            CHECK(top != m_links.end());
-            m_links.erase(top);
-        }
-
-        // Remove expired links from waiting list
-        while (!m_waiting_links.empty() &&
-                m_waiting_links.begin()->valid_through < now) {
-            auto top = m_waiting_links.begin();
-            CHECK(top != m_waiting_links.end());
-            m_waiting_links.erase(top);
-        }
+        // Remove all expired links, including waiting ones
+        m_expiry.expire(now, [&](LinkTimer timer) {
+            expire_link(std::move(timer), now, links_to_delete);
+        });
     }//unlock
 
     // emit all signals
@@ -275,39 +351,87 @@ void LinkDiscovery::polling()
         emit linkBroken(link.first, link.second);
     }
 
-    // Send LLDP packets to all known ports
-    for (SwitchPtr sw : m_switch_manager->switches()) {
-        sendLLDP s(*this, sw);
-        s.sendLLDPtoPorts();
+    // Send LLDP packets to ports which phases are within this tick
+    if (round) {
+        scheduler->sync(m_switch_manager->switches());
     }
+    scheduler->run(now);
 }
 
-LinkDiscovery::links_set_iterator
-LinkDiscovery::find_link(const links_set& set, const DiscoveredLink& link) const
+LLDPStats LinkDiscovery::lldpStats() const
 {
-    return std::find_if(set.begin(), set.end(), [&](DiscoveredLink l){
-        return std::tie(link.source, link.target) == std::tie(l.source, l.target);
-    });
+    return scheduler->stats();
 }
 
-bool LinkDiscovery::add_link(DiscoveredLink& link)
+FastDetectionStats LinkDiscovery::fastDetectionStats() const
 {
-    bool isNew = true;
+    return fast_monitor->stats();
+}
 
-    if (link.source > link.target)
-        std::swap(link.source, link.target);
+size_t LinkDiscovery::link_pair_hash::operator()(const link_pair& p) const
+{
+    size_t seed = 0;
+    boost::hash_combine(seed, p.first.dpid);
+    boost::hash_combine(seed, p.first.port);
+    boost::hash_combine(seed, p.second.dpid);
+    boost::hash_combine(seed, p.second.port);
+    return seed;
+}
 
-    auto link_it = find_link(m_links, link);
-    if (link_it != m_links.end()) {
-        m_links.erase(link_it);
-        isNew = false;
+bool LinkDiscovery::refresh(links_map& map, bool waiting, const DiscoveredLink& link)
+{
+    link_pair key { link.source, link.target };
+    auto inserted = map.emplace(key, LinkState{ link, 0 });
+    auto& state = inserted.first->second;
+
+    if (not inserted.second) {
+        // the timer will find the new deadline when it fires,
+        // ends probed at different rates never shorten it
+        state.link.valid_through = std::max(state.link.valid_through,
+                                            link.valid_through);
+        return false;
     }
 
-    auto it = m_links.insert(m_links.end(), link);
-    m_out_edges[link.source] = it;
-    m_out_edges[link.target] = it;
+    state.timer = ++m_timer_stamp;
+    m_expiry.schedule(LinkTimer{ key, waiting, state.timer }, link.valid_through);
+    return true;
+}
 
-    return isNew;
+void LinkDiscovery::expire_link(LinkTimer timer,
+                                DiscoveredLink::valid_through_t now,
+                                std::vector<link_pair>& expired)
+{
+    auto& map = timer.waiting ? m_waiting_links : m_links;
+    auto link_it = map.find(timer.key);
+    if (link_it == map.end() || link_it->second.timer != timer.stamp) {
+        return; // link was removed since
+    }
+
+    auto valid_through = link_it->second.link.valid_through;
+    if (not (valid_through < now)) {
+        // link was refreshed since
+        m_expiry.schedule(std::move(timer), valid_through);
+        return;
+    }
+
+    map.erase(link_it);
+    if (not timer.waiting) {
+        CHECK(m_out_edges.erase(timer.key.first) == 1);
+        CHECK(m_out_edges.erase(timer.key.second) == 1);
+        expired.push_back(timer.key);
+    }
+}
+
+bool LinkDiscovery::add_link(DiscoveredLink& link)
+{
+    if (link.source > link.target)
+        std::swap(link.source, link.target);
+
+    link_pair key { link.source, link.target };
+    m_out_edges[link.source] = key;
+    m_out_edges[link.target] = key;
+
+    return refresh(m_links, false, link);
 }
 
 LinkDiscovery::link_pair
@@ -316,12 +440,7 @@ LinkDiscovery::remove_link(switch_and_port from, switch_and_port to)
     if (from > to)
         std::swap(from, to);
 
-    DiscoveredLink link{ from, to, DiscoveredLink::valid_through_t() };
-
-    auto link_it = find_link(m_links, link);
-
-    CHECK(link_it != m_links.end());
-    m_links.erase(link_it);
+    CHECK(m_links.erase({from, to}) == 1);
     CHECK(m_out_edges.erase(from) == 1);
     CHECK(m_out_edges.erase(to) == 1);
 
@@ -337,33 +456,19 @@ LinkDiscovery::remove_broken_link(switch_and_port from)
         return {};
     }
 
-    auto old_from = out_edge->second->source;
-    auto old_to   = out_edge->second->target;
-    auto other_it = m_out_edges.find(old_to);
-
-    CHECK(other_it != m_out_edges.end());
-    return remove_link(old_from, old_to);
+    auto key = out_edge->second;
+    CHECK(m_out_edges.count(key.second) == 1);
+    return remove_link(key.first, key.second);
 }
 
 void LinkDiscovery::add_waiting_link(DiscoveredLink link)
 {
-    auto link_it = find_link(m_waiting_links, link);
-    if (link_it != m_waiting_links.end())
-        m_waiting_links.erase(link_it);
-
-    m_waiting_links.insert(m_waiting_links.end(), link);
+    refresh(m_waiting_links, true, link);
 }
 
 void LinkDiscovery::remove_waiting_link(switch_and_port from, switch_and_port to)
 {
-    DiscoveredLink link{ from, to, DiscoveredLink::valid_through_t() };
-
-    auto link_it = find_link(m_waiting_links, link);
-    if (link_it == m_waiting_links.end()) {
-        return;
-    }
-
-    m_waiting_links.erase(link_it);
+    m_waiting_links.erase({from, to});
 }
 
 void LinkDiscovery::switchUp(SwitchPtr sw)
@@ -378,12 +483,14 @@ void LinkDiscovery::switchUp(SwitchPtr sw)
 void LinkDiscovery::linkUp(PortPtr port)
 {
     if (recovery->isPrimary()) {
-        (port->switch_())->handle(sendLLDP(*this,port));
+        scheduler->add(port, true);
     }
 }
 
 void LinkDiscovery::linkDown(PortPtr port)
 {
+    scheduler->remove(port);
+    fast_monitor->portDown({ port->switch_()->dpid(), port->number() });
     if (recovery->isPrimary()) {
         clearLinkAt(port);
     }
@@ -405,6 +512,8 @@ void LinkDiscovery::load_from_database()
     m_links.clear();
     m_waiting_links.clear();
     m_out_edges.clear();
+    m_expiry.clear();
+    fast_monitor->clear();
 
     auto time = std::chrono::steady_clock::now() + 
                 std::chrono::seconds(c_poll_interval * 2); 
@@ -432,7 +541,9 @@ void LinkDiscovery::load_from_database()
 
 LinkDiscovery::~LinkDiscovery()
 {
+    delete fast_monitor; // stops the thread reporting failures here
     delete poller;
+    delete scheduler;
 }
 
 } // namespace runos
@@ -21,15 +21,44 @@
 #include "Loader.hpp"
 #include "ILinkDiscovery.hpp"
 #include "Controller.hpp" // OFMessageHandlerPtr
+#include "lib/timer_wheel.hpp"
 
+#include <chrono>
 #include <mutex>
 #include <optional>
 #include <set>
 #include <unordered_map>
 #include <utility> // std::pair
+#include <vector>
 
 namespace runos {
 
+struct LLDPStats {
+    uint64_t probes;        // ports probed
+    uint64_t sent;          // packet-outs, including copies
+    uint64_t ticks;
+    size_t ports;           // ports scheduled
+    size_t fast_ports;      // probed at the poll interval
+    size_t link_ports;      // backed off, probes are answered
+    size_t edge_ports;      // backed off, probes are not answered
+    uint64_t missed;        // links stopped answering
+    size_t last_burst;      // ports probed at the last tick
+    size_t max_burst;
+};
+
+struct FastDetectionStats {
+    size_t links;               // watched links, including failed ones
+    uint64_t sent;              // probes
+    uint64_t failures;          // links reported failed
+    uint64_t false_positives;   // failed links answered within the window
+    uint64_t late_ticks;        // detector woke up too late to judge links
+    // time from the last probe received to the failure report
+    std::chrono::microseconds avg_latency;
+    std::chrono::microseconds max_latency;
+    // upper bounds of buckets with counts, the last one is unbounded
+    std::vector<std::pair<std::chrono::milliseconds, uint64_t>> latency;
+};
+
 inline bool operator<(const DiscoveredLink& a, const DiscoveredLink& b) {
     return std::tie(a.valid_through, a.source, a.target) < std::tie(b.valid_through, b.source, b.target);
 }
@@ -46,19 +75,19 @@ public:
     void init(Loader* provider, const Config& config) override;
     void startUp(Loader* provider) override;
 
-    const std::set<DiscoveredLink> links() const override
-    {
-        return m_links;
-    }
+    const std::set<DiscoveredLink> links() const override;
 
     switch_and_port other(switch_and_port sp) const override;
 
     unsigned int pollInterval(void) const { return c_poll_interval; }
     int outputQueueId(void) const { return queue_id; }
+    LLDPStats lldpStats() const;
+    FastDetectionStats fastDetectionStats() const;
 
 signals:
     void linkDiscovered(switch_and_port from, switch_and_port to) override;
     void linkBroken(switch_and_port from, switch_and_port to) override;
+    void linkFailed(switch_and_port from, switch_and_port to) override;
 
 private slots:
     void clearLinkAt(PortPtr port);
@@ -72,22 +101,48 @@ private:
     class DatabaseConnector* db_connector_;
     OFMessageHandlerPtr handler;
 
-    using links_set = std::set<DiscoveredLink>;
-    using links_set_iterator = links_set::iterator;
     using link_pair = std::pair<switch_and_port, switch_and_port>;
 
-    links_set m_links;
-    links_set m_waiting_links;
-    std::unordered_map<switch_and_port, links_set_iterator >
-            m_out_edges;
+    struct link_pair_hash {
+        size_t operator()(const link_pair& p) const;
+    };
+
+    struct LinkState {
+        DiscoveredLink link;
+        uint64_t timer; // stamp of the wheel timer watching the link
+    };
+    using links_map = std::unordered_map<link_pair, LinkState, link_pair_hash>;
+
+    struct LinkTimer {
+        link_pair key;
+        bool waiting; // in m_waiting_links
+        uint64_t stamp;
+    };
+
+    // links are found by their ends, bidirectional ones with (from <= to)
+    links_map m_links;
+    links_map m_waiting_links;
+    std::unordered_map<switch_and_port, link_pair> m_out_edges;
+    // refreshing a link only moves its deadline,
+    // timers are rescheduled when they fire before it
+    TimerWheel<LinkTimer> m_expiry;
+    uint64_t m_timer_stamp {0};
     mutable std::mutex links_mutex; //protect link containers
 
     class Poller* poller; //run sending lldp timer from separate threads
+    class LLDPScheduler* scheduler;
+    class FastLinkMonitor* fast_monitor; // probes selected links at high rate
+    // links are expired and probes are sent every tick,
+    // other work is done once per poll interval
+    std::chrono::steady_clock::time_point m_next_round;
 
     void handleBeacon(switch_and_port from, switch_and_port to);
+    void fastFailure(switch_and_port from, switch_and_port to);
 
     // thread-unsafe functions, lock links_mutex before calling
-    links_set_iterator find_link(const links_set& set, const DiscoveredLink& link) const;
+    bool refresh(links_map& map, bool waiting, const DiscoveredLink& link);
+    void expire_link(LinkTimer timer, DiscoveredLink::valid_through_t now,
+                     std::vector<link_pair>& expired);
     bool add_link(DiscoveredLink& link);
     link_pair remove_link(switch_and_port from, switch_and_port to);
     std::optional<link_pair> remove_broken_link(switch_and_port from);
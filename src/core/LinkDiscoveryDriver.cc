@@ -17,6 +17,12 @@
 #include "LinkDiscoveryDriver.hpp"
 
 #include <runos/core/logging.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <limits>
+#include <memory>
  
 namespace runos {
 
@@ -38,32 +44,31 @@ void onSwitchUp::handle(drivers::DefaultDriver& driver) const {
     sw->connection()->send(fm);
 }
 
-lldp_packet sendLLDP::cookPacket() const {
-    lldp_packet lldp;
+// TTL is this many probe intervals, so a neighbour doesn't expire
+// the probe while one or two of the next ones are lost
+static constexpr unsigned LLDP_TTL_INTERVALS = 4;
+
+static uint16_t lldpTtl(std::chrono::steady_clock::duration interval)
+{
+    using namespace std::chrono;
+    auto ttl = ceil<seconds>(interval * LLDP_TTL_INTERVALS).count();
+    return std::clamp<decltype(ttl)>(ttl, 1, std::numeric_limits<uint16_t>::max());
+}
 
+std::vector<uint8_t> lldpPacketOut(const LinkDiscovery& app,
+                                   const SwitchPtr& sw, const PortPtr& port,
+                                   std::chrono::steady_clock::duration interval)
+{
+    lldp_packet lldp;
     lldp.src_mac = port->hw_addr().to_number();
     // lower 48 bits of datapath id represents switch MAC address
     lldp.chassis_id_sub_mac = sw->dpid();
     lldp.port_id_sub_component = port->number();
-    lldp.ttl_seconds = app.pollInterval();
+    lldp.ttl_seconds = lldpTtl(interval);
     lldp.dpid_data   = sw->dpid();
 
-    return lldp;
-}
-
-void sendLLDP::handle(drivers::DefaultDriver& driver) const { 
-
-    if (sw->property("local_port", of13::OFPP_LOCAL) == port->number() ||
-        port->link_down() || port->number() > of13::OFPP_MAX) {
-        return;
-    }
-
-    of13::OutputAction ofoutput(port->number(), of13::OFPCML_NO_BUFFER);
     of13::PacketOut po;
-
-    lldp_packet lldp = cookPacket();
     po.data(&lldp, sizeof lldp);
-
     po.xid(xid);
     po.in_port(of13::OFPP_CONTROLLER);
 
@@ -71,26 +76,423 @@ void sendLLDP::handle(drivers::DefaultDriver& driver) const {
         of13::SetQueueAction queue(app.outputQueueId());
         po.add_action(queue);
     }
+    of13::OutputAction ofoutput(port->number(), of13::OFPCML_NO_BUFFER);
     po.add_action(ofoutput);
 
-    VLOG(5) << "Sending LLDP packet to " << port->name();
-    // Send packet 3 times to prevent drops
-    sw->connection()->send(po);
-    sw->connection()->send(po);
-    sw->connection()->send(po);
+    auto deleter = &fluid_msg::OFMsg::free_buffer;
+    std::unique_ptr<uint8_t[], decltype(deleter)> buf { po.pack(), deleter };
+    return std::vector<uint8_t>(buf.get(), buf.get() + po.length());
+}
+
+void lldpSetInterval(std::vector<uint8_t>& packet_out,
+                     std::chrono::steady_clock::duration interval)
+{
+    // LLDP frame is the packet-out data, which ends the message
+    auto offset = packet_out.size() - sizeof(lldp_packet) +
+                  offsetof(lldp_packet, ttl_seconds);
+    auto ttl = boost::endian::native_to_big(lldpTtl(interval));
+    std::memcpy(packet_out.data() + offset, &ttl, sizeof ttl);
+}
+
+LLDPScheduler::LLDPScheduler(const LinkDiscovery& app, clock::duration tick,
+                             unsigned copies, double jitter,
+                             clock::duration link_max, clock::duration edge_max)
+    : app(app)
+    , interval(std::chrono::seconds(app.pollInterval()))
+    , link_max(std::max(link_max, interval))
+    , edge_max(std::max(edge_max, interval))
+    , copies(std::max(copies, 1u))
+    , jitter(std::clamp(jitter, 0.0, 0.5))
+    , wheel(tick, std::max(this->link_max, this->edge_max) / tick + 1)
+{ }
+
+bool LLDPScheduler::eligible(const SwitchPtr& sw, const PortPtr& port) const
+{
+    return sw->property("local_port", of13::OFPP_LOCAL) != port->number() &&
+           not port->link_down() && port->number() <= of13::OFPP_MAX;
+}
+
+void LLDPScheduler::schedule(const switch_and_port& key, Probe& probe)
+{
+    std::uniform_real_distribution<double> noise(-jitter, jitter);
+    auto deadline = probe.base + std::chrono::duration_cast<clock::duration>(
+                                     probe.interval * noise(rng));
+    wheel.schedule(Timer{ key, probe.stamp }, deadline);
+}
+
+void LLDPScheduler::add(PortPtr port, bool immediate)
+{
+    auto sw = port->switch_();
+    switch_and_port key { sw->dpid(), port->number() };
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (not eligible(sw, port)) {
+        probes.erase(key);
+        return;
+    }
+
+    Probe probe { sw, port, lldpPacketOut(app, sw, port, interval), clock::now(),
+                  ++stamp, interval };
+    if (immediate) {
+        wheel.schedule(Timer{ key, probe.stamp }, probe.base);
+    } else {
+        std::uniform_real_distribution<double> phase(0.0, 1.0);
+        probe.base += std::chrono::duration_cast<clock::duration>(
+                          interval * phase(rng));
+        schedule(key, probe);
+    }
+    probes.insert_or_assign(key, std::move(probe));
+}
+
+void LLDPScheduler::remove(PortPtr port)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    probes.erase({ port->switch_()->dpid(), port->number() });
+}
+
+void LLDPScheduler::sync(const std::vector<SwitchPtr>& switches)
+{
+    for (const auto& sw : switches) {
+        for (const auto& port : sw->ports()) {
+            bool known;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                known = probes.count({ sw->dpid(), port->number() });
+            }
+            if (not known && not port->link_down()) {
+                add(port, false);
+            }
+        }
+    }
+}
+
+void LLDPScheduler::run(clock::time_point now)
+{
+    std::vector<std::pair<OFConnectionPtr, std::vector<uint8_t>>> due;
+
+    { // lock
+    std::lock_guard<std::mutex> lock(mutex);
+
+    wheel.expire(now, [&](Timer timer) {
+        auto it = probes.find(timer.key);
+        if (it == probes.end() || it->second.stamp != timer.stamp) {
+            return; // port was removed or added again since
+        }
+
+        auto& probe = it->second;
+        auto conn = probe.sw->connection();
+        if (not conn || not conn->alive() || not eligible(probe.sw, probe.port)) {
+            probes.erase(it); // added again by sync or link up
+            return;
+        }
+
+        for (unsigned i = 0; i < copies; ++i) {
+            // pre-serialized message differs by xid only
+            uint32_t seq = boost::endian::native_to_big(xid_seq++);
+            std::memcpy(probe.packet_out.data() + 4, &seq, sizeof seq);
+            due.emplace_back(conn, probe.packet_out);
+        }
+
+        // next round keeps the phase, jitter does not accumulate
+        adapt(probe);
+        do {
+            probe.base += probe.interval;
+        } while (probe.base < now);
+        schedule(timer.key, probe);
+    });
+
+    auto burst = due.size() / copies;
+    stats_.probes += burst;
+    stats_.sent += due.size();
+    stats_.ticks++;
+    stats_.last_burst = burst;
+    stats_.max_burst = std::max(stats_.max_burst, burst);
+    } // unlock
+
+    for (auto& msg : due) {
+        msg.first->send(msg.second.data(), msg.second.size());
+    }
+}
+
+void LLDPScheduler::adapt(Probe& probe)
+{
+    auto prev = probe.interval;
+    if (probe.answered) {
+        probe.linked = true;
+        probe.interval = std::min(probe.interval * 2, link_max);
+    } else if (probe.linked) {
+        // link stopped answering, it is probed fast until expired
+        probe.linked = false;
+        probe.interval = interval;
+        stats_.missed++;
+    } else {
+        probe.interval = std::min(probe.interval * 2, edge_max);
+    }
+    probe.answered = false;
+
+    if (probe.interval != prev) {
+        lldpSetInterval(probe.packet_out, probe.interval);
+    }
+}
+
+LLDPScheduler::clock::duration LLDPScheduler::answered(switch_and_port sp)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = probes.find(sp);
+    if (it == probes.end()) {
+        return interval;
+    }
+    it->second.answered = true;
+    return it->second.interval;
+}
+
+LLDPStats LLDPScheduler::stats() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto ret = stats_;
+    ret.ports = probes.size();
+    ret.link_ports = ret.edge_ports = ret.fast_ports = 0;
+    for (const auto& it : probes) {
+        const auto& probe = it.second;
+        if (probe.interval == interval) {
+            ret.fast_ports++;
+        } else if (probe.linked) {
+            ret.link_ports++;
+        } else {
+            ret.edge_ports++;
+        }
+    }
+    return ret;
+}
+
+FastLinkMonitor::FastLinkMonitor(const LinkDiscovery& app, clock::duration interval,
+                                 unsigned multiplier, clock::duration window,
+                                 FailureHandler on_failure)
+    : app(app)
+    , interval(std::max(interval, clock::duration(std::chrono::milliseconds(1))))
+    , timeout(this->interval * std::max(multiplier, 2u))
+    , window(window)
+    , on_failure(std::move(on_failure))
+{
+    using namespace std::chrono;
+    for (auto bound : { 10, 20, 50, 100, 200, 500, 1000 }) {
+        stats_.latency.emplace_back(milliseconds(bound), 0);
+    }
+    stats_.latency.emplace_back(milliseconds::max(), 0);
+}
+
+FastLinkMonitor::~FastLinkMonitor()
+{
+    stop();
+}
+
+void FastLinkMonitor::select(switch_and_port sp)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    selection.insert(sp);
+}
+
+void FastLinkMonitor::selectAll()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    select_all = true;
+}
+
+bool FastLinkMonitor::selected(switch_and_port from, switch_and_port to) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return select_all || selection.count(from) || selection.count(to);
+}
+
+void FastLinkMonitor::watch(PortPtr from, PortPtr to)
+{
+    auto now = clock::now();
+    auto from_sw = from->switch_();
+    auto to_sw = to->switch_();
+    switch_and_port a { from_sw->dpid(), from->number() };
+    switch_and_port b { to_sw->dpid(), to->number() };
+
+    std::lock_guard<std::mutex> lock(mutex);
+    probes.insert_or_assign(a, Probe{ from_sw, from,
+                                      lldpPacketOut(app, from_sw, from, interval),
+                                      b, now });
+    probes.insert_or_assign(b, Probe{ to_sw, to,
+                                      lldpPacketOut(app, to_sw, to, interval),
+                                      a, now });
+
+    if (not running && not thread.joinable()) {
+        running = true;
+        thread = std::thread(&FastLinkMonitor::loop, this);
+    }
+}
+
+// thread-unsafe
+void FastLinkMonitor::erase(switch_and_port from, switch_and_port to)
+{
+    auto it = probes.find(from);
+    if (it != probes.end() && it->second.peer == to) {
+        probes.erase(it);
+    }
 }
 
-void sendLLDP::sendLLDPtoPorts() {
-    for (auto &pr: sw->ports()) {
-        if (pr->link_down()) {
-            continue;
+void FastLinkMonitor::unwatch(switch_and_port from, switch_and_port to)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto sp : { from, to }) {
+        auto it = probes.find(sp);
+        if (it != probes.end() && not it->second.verify_until) {
+            probes.erase(it);
         }
-        port = pr;
-        sw->handle(*this);
-        
     }
 }
 
+void FastLinkMonitor::portDown(switch_and_port sp)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = probes.find(sp);
+    if (it != probes.end()) {
+        erase(it->second.peer, sp);
+        probes.erase(it);
+    }
+}
 
+void FastLinkMonitor::received(switch_and_port from, switch_and_port to)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = probes.find(from);
+    if (it == probes.end() || it->second.peer != to) {
+        return;
+    }
+
+    auto& probe = it->second;
+    if (not probe.verify_until) {
+        probe.last_rx = clock::now();
+        return;
+    }
+
+    // link reported failed is alive in both directions
+    probe.answered = true;
+    auto peer = probes.find(to);
+    if (peer != probes.end() && peer->second.answered) {
+        stats_.false_positives++;
+        probes.erase(peer);
+        probes.erase(from);
+    }
+}
+
+void FastLinkMonitor::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    probes.clear();
+}
+
+void FastLinkMonitor::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        running = false;
+    }
+    wakeup.notify_all();
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+// thread-unsafe
+void FastLinkMonitor::fail(switch_and_port sp, Probe& probe, Probe* peer,
+                           clock::time_point now, std::vector<link_pair>& failed)
+{
+    using namespace std::chrono;
+    auto latency = duration_cast<microseconds>(now - probe.last_rx);
+    stats_.failures++;
+    latency_sum += latency.count();
+    stats_.avg_latency = microseconds(latency_sum / stats_.failures);
+    stats_.max_latency = std::max(stats_.max_latency, latency);
+    for (auto& bucket : stats_.latency) {
+        if (latency <= bucket.first) {
+            bucket.second++;
+            break;
+        }
+    }
+
+    for (auto p : { &probe, peer }) {
+        if (p) {
+            p->verify_until = now + window;
+            p->answered = false;
+        }
+    }
+    failed.emplace_back(sp, probe.peer);
+}
+
+void FastLinkMonitor::loop()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    auto next = clock::now();
+    auto last_tick = next;
+
+    while (running) {
+        auto now = clock::now();
+        std::vector<link_pair> failed;
+        std::vector<std::pair<OFConnectionPtr, std::vector<uint8_t>>> due;
+
+        // probes could not be sent or received while the thread slept,
+        // silence of that time says nothing about links
+        if (now - last_tick > timeout) {
+            stats_.late_ticks++;
+            for (auto& it : probes) {
+                it.second.last_rx = std::max(it.second.last_rx, now - interval);
+            }
+        }
+        last_tick = now;
+
+        for (auto it = probes.begin(); it != probes.end(); ) {
+            auto& probe = it->second;
+            if (probe.verify_until) {
+                if (*probe.verify_until < now) {
+                    it = probes.erase(it); // failure confirmed
+                    continue;
+                }
+            } else if (now - probe.last_rx > timeout) {
+                auto peer = probes.find(probe.peer);
+                fail(it->first, probe, peer != probes.end() && peer->second.peer == it->first
+                                ? &peer->second : nullptr,
+                     now, failed);
+            }
+
+            auto conn = probe.sw->connection();
+            if (conn && conn->alive()) {
+                uint32_t seq = boost::endian::native_to_big(xid_seq++);
+                std::memcpy(probe.packet_out.data() + 4, &seq, sizeof seq);
+                due.emplace_back(conn, probe.packet_out);
+            }
+            ++it;
+        }
+        stats_.sent += due.size();
+
+        lock.unlock();
+        for (auto& msg : due) {
+            msg.first->send(msg.second.data(), msg.second.size());
+        }
+        for (auto& link : failed) {
+            on_failure(link.first, link.second);
+        }
+        lock.lock();
+
+        // fixed cadence, ticks missed while busy are skipped
+        next += interval;
+        if (next < clock::now()) {
+            next = clock::now() + interval;
+        }
+        wakeup.wait_until(lock, next, [this] { return not running; });
+    }
+}
+
+FastDetectionStats FastLinkMonitor::stats() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto ret = stats_;
+    ret.links = probes.size() / 2;
+    return ret;
+}
 
 } //runos
@@ -20,11 +20,23 @@
 #include "api/OFDriver.hpp"
 #include "api/Switch.hpp"
 #include "LinkDiscovery.hpp"
+#include "lib/timer_wheel.hpp"
 
 #include <fluid/of13/of13match.hh>
 #include <boost/endian/arithmetic.hpp>
 #include <boost/endian/conversion.hpp>
 
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <set>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
 namespace runos {
 
 using namespace boost::endian;
@@ -104,24 +116,158 @@ public:
     void handle(drivers::DefaultDriver& driver) const;
 };
 
-class sendLLDP : public drivers::Handler {
+// Serialized packet-out sending LLDP probe of the port,
+// its TTL covers several rounds of the probe interval
+std::vector<uint8_t> lldpPacketOut(const LinkDiscovery& app,
+                                   const SwitchPtr& sw, const PortPtr& port,
+                                   std::chrono::steady_clock::duration interval);
+// Patches TTL of the serialized probe for the new probe interval
+void lldpSetInterval(std::vector<uint8_t>& packet_out,
+                     std::chrono::steady_clock::duration interval);
+
+// Sends LLDP probes of every port with adaptive per-port intervals.
+// Probes are spread over the interval by random per-port phases
+// with jitter in each round, instead of one burst for all ports.
+// Packet-out of each port is serialized once, sending only patches its xid.
+//
+// Ports start at the poll interval. Each round the interval doubles,
+// up to link_max for ports whose probes were answered and up to
+// edge_max for ports that never answered. A port returns to the poll
+// interval on link up or when its link stops answering. So a silent
+// link failure is detected within 2 * link_max, and a new link on
+// an edge port within edge_max.
+class LLDPScheduler {
 public:
+    using clock = std::chrono::steady_clock;
+
+    LLDPScheduler(const LinkDiscovery& app, clock::duration tick,
+                  unsigned copies, double jitter,
+                  clock::duration link_max, clock::duration edge_max);
+
+    // (Re)builds packet-out of the port, first probe is sent
+    // on the next tick if immediate or at random phase otherwise
+    void add(PortPtr port, bool immediate);
+    void remove(PortPtr port);
+    // Adds ports of the switches not probed yet
+    void sync(const std::vector<SwitchPtr>& switches);
+    // Sends probes with deadline passed by now
+    void run(clock::time_point now);
+    // Probe of the port was received by the neighbour,
+    // returns current probe interval of the port
+    clock::duration answered(switch_and_port sp);
+
+    LLDPStats stats() const;
+
+private:
+    struct Probe {
+        SwitchPtr sw;
+        PortPtr port;
+        std::vector<uint8_t> packet_out;
+        clock::time_point base; // phase of the current round
+        uint64_t stamp;
+        clock::duration interval;
+        bool answered {false};  // since the last probe
+        bool linked {false};    // previous probes were answered
+    };
+    struct Timer {
+        switch_and_port key;
+        uint64_t stamp;
+    };
+
     const LinkDiscovery& app;
-    SwitchPtr sw;
-    PortPtr port;
+    clock::duration interval; // initial
+    clock::duration link_max;
+    clock::duration edge_max;
+    unsigned copies;
+    double jitter; // fraction of the interval
 
-    sendLLDP(const LinkDiscovery& _app, SwitchPtr _sw): app(_app), sw(_sw)
-    { }
+    std::unordered_map<switch_and_port, Probe> probes;
+    TimerWheel<Timer> wheel;
+    uint64_t stamp {0};
+    uint32_t xid_seq {xid};
+    std::mt19937 rng {std::random_device{}()};
+    LLDPStats stats_ {};
+    mutable std::mutex mutex;
 
-    sendLLDP(const LinkDiscovery& _app, PortPtr _port): app(_app), port(_port)
-    {  sw = port->switch_(); }
+    // thread-unsafe functions, lock mutex before calling
+    bool eligible(const SwitchPtr& sw, const PortPtr& port) const;
+    void schedule(const switch_and_port& key, Probe& probe);
+    void adapt(Probe& probe);
+};
 
+// Detects silent failures of selected links within milliseconds.
+// Both directions of a watched link are probed every interval from
+// a dedicated thread, which sleeps until the exact deadline instead
+// of polling. A link fails when probes of either direction are not
+// received for interval * multiplier. Failed links are still probed
+// during the verification window, and the failure is counted as
+// false positive if both directions answer within it.
+class FastLinkMonitor {
+public:
+    using clock = std::chrono::steady_clock;
+    using FailureHandler = std::function<void(switch_and_port, switch_and_port)>;
 
-    lldp_packet cookPacket() const;
+    FastLinkMonitor(const LinkDiscovery& app, clock::duration interval,
+                    unsigned multiplier, clock::duration window,
+                    FailureHandler on_failure);
+    ~FastLinkMonitor();
 
-    void handle(drivers::DefaultDriver& driver) const;
+    void select(switch_and_port sp);
+    void selectAll();
+    // Link has a selected end
+    bool selected(switch_and_port from, switch_and_port to) const;
+
+    // Starts probing of the discovered link, and the thread if not running
+    void watch(PortPtr from, PortPtr to);
+    // Link is broken by other means, verification of failed links goes on
+    void unwatch(switch_and_port from, switch_and_port to);
+    // Failure of links of the port is confirmed
+    void portDown(switch_and_port sp);
+    // Probe sent from the port was received
+    void received(switch_and_port from, switch_and_port to);
+    void clear();
+    void stop();
+
+    FastDetectionStats stats() const;
+
+private:
+    using link_pair = std::pair<switch_and_port, switch_and_port>;
+
+    struct Probe {
+        SwitchPtr sw;
+        PortPtr port;
+        std::vector<uint8_t> packet_out;
+        switch_and_port peer;
+        clock::time_point last_rx;
+        // set while the failed link is verified
+        std::optional<clock::time_point> verify_until;
+        bool answered {false}; // since the failure
+    };
+
+    const LinkDiscovery& app;
+    clock::duration interval;
+    clock::duration timeout;
+    clock::duration window;
+    FailureHandler on_failure;
+
+    std::set<switch_and_port> selection;
+    bool select_all {false};
+
+    std::unordered_map<switch_and_port, Probe> probes; // by sending end
+    uint32_t xid_seq {xid + 0x10000};
+    FastDetectionStats stats_ {};
+    uint64_t latency_sum {0}; // microseconds
+    mutable std::mutex mutex;
+
+    std::thread thread;
+    std::condition_variable wakeup;
+    bool running {false};
 
-    void sendLLDPtoPorts();
+    void loop();
+    // thread-unsafe functions, lock mutex before calling
+    void fail(switch_and_port sp, Probe& probe, Probe* peer,
+              clock::time_point now, std::vector<link_pair>& failed);
+    void erase(switch_and_port from, switch_and_port to);
 };
 
 }//runos
@@ -15,6 +15,7 @@
  */
 
 #include "ILinkDiscovery.hpp"
+#include "LinkDiscovery.hpp"
 
 #include "RestListener.hpp"
 #include <fluid/of13msg.hh>
@@ -49,6 +50,73 @@ struct LinkCollection : rest::resource {
     }
 };
 
+struct LLDPDump : rest::resource {
+    LinkDiscovery* app;
+
+    explicit LLDPDump(QObject* _app)
+    { app = dynamic_cast<LinkDiscovery*>(_app); }
+
+    rest::ptree Get() const override {
+        rest::ptree ret;
+        if (not app) {
+            return ret;
+        }
+
+        auto stats = app->lldpStats();
+        ret.put("ports", stats.ports);
+        ret.put("fast-ports", stats.fast_ports);
+        ret.put("link-ports", stats.link_ports);
+        ret.put("edge-ports", stats.edge_ports);
+        ret.put("missed", stats.missed);
+        ret.put("probes", stats.probes);
+        ret.put("sent", stats.sent);
+        ret.put("ticks", stats.ticks);
+        ret.put("avg-burst", stats.ticks ? double(stats.probes) / stats.ticks : 0.0);
+        ret.put("last-burst", stats.last_burst);
+        ret.put("max-burst", stats.max_burst);
+
+        return ret;
+    }
+};
+
+struct FastDetectionDump : rest::resource {
+    LinkDiscovery* app;
+
+    explicit FastDetectionDump(QObject* _app)
+    { app = dynamic_cast<LinkDiscovery*>(_app); }
+
+    rest::ptree Get() const override {
+        rest::ptree ret;
+        if (not app) {
+            return ret;
+        }
+
+        auto stats = app->fastDetectionStats();
+        ret.put("links", stats.links);
+        ret.put("sent", stats.sent);
+        ret.put("failures", stats.failures);
+        ret.put("false-positives", stats.false_positives);
+        ret.put("late-ticks", stats.late_ticks);
+        ret.put("avg-latency-us", stats.avg_latency.count());
+        ret.put("max-latency-us", stats.max_latency.count());
+
+        rest::ptree latency;
+        for (const auto& bucket : stats.latency) {
+            rest::ptree bpt;
+            if (bucket.first == std::chrono::milliseconds::max()) {
+                bpt.put("le-ms", "inf");
+            } else {
+                bpt.put("le-ms", bucket.first.count());
+            }
+            bpt.put("count", bucket.second);
+            latency.push_back(std::make_pair("", std::move(bpt)));
+        }
+        ret.add_child("latency", latency);
+
+        return ret;
+    }
+};
+
 class LinkDiscoveryRest : public Application
 {
     SIMPLE_APPLICATION(LinkDiscoveryRest, "link-discovery-rest")
@@ -64,6 +132,12 @@ public:
         rest_->mount(path_spec("/links/"), [=](const path_match&) {
             return LinkCollection {app};
         });
+        rest_->mount(path_spec("/dump/lldp/"), [=](const path_match&) {
+            return LLDPDump {app};
+        });
+        rest_->mount(path_spec("/dump/fast-detection/"), [=](const path_match&) {
+            return FastDetectionDump {app};
+        });
     }
 };
 
@@ -18,6 +18,7 @@
 
 #include "Application.hpp"
 #include "Config.hpp"
+#include "lib/metrics.hpp"
 #include <runos/core/logging.hpp>
 
 #include <vector>
@@ -170,6 +171,8 @@ void Loader::startAll()
             AppThread* app_thread = qobject_cast<AppThread*>(info.app->thread());
             std::mutex start_mutex;
             start_mutex.lock();
+            metrics::ScopedTiming timing(
+                metrics::timing("start-up", servicePair.first));
             emit app_thread->initializer.startApp(m->this_, info.app, &start_mutex);
             start_mutex.lock();
             info.state = APP_STARTED;
@@ -235,8 +238,11 @@ AppInfo* LoaderImpl::initialize(std::string serviceId)
 
     std::mutex init_mutex;
     init_mutex.lock();
-    emit app_thread->initializer.initializeApp(this_, app, &init_mutex);
-    init_mutex.lock();
+    {
+        metrics::ScopedTiming timing(metrics::timing("init", serviceId));
+        emit app_thread->initializer.initializeApp(this_, app, &init_mutex);
+        init_mutex.lock();
+    }
 
     appInfo.state = APP_INITIALIZED;
     return &appInfo;
@@ -0,0 +1,371 @@
+/*
+ * Copyright 2019 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Application.hpp"
+#include "Loader.hpp"
+#include "OFMsgSender.hpp"
+#include "OFServer.hpp"
+#include "RestListener.hpp"
+#include "StatsColumns.hpp"
+#include "StatsPollScheduler.hpp"
+#include "SwitchManager.hpp"
+#include "lib/metrics.hpp"
+#include "lib/openmetrics.hpp"
+
+#include <mutex>
+#include <string>
+
+namespace runos {
+
+namespace {
+
+constexpr const char* rx_tx[] = {"rx", "tx"};
+
+// Counters of PortMeasurement are rx/tx pairs
+constexpr struct {
+    const char* name;
+    const char* help;
+} port_counters[] = {
+    {"runos_port_packets", "Packets received and transmitted by the port"},
+    {"runos_port_bytes", "Bytes received and transmitted by the port"},
+    {"runos_port_dropped", "Packets dropped by the port"},
+    {"runos_port_errors", "Errors of the port"},
+};
+
+// Counters of QueueMeasurement
+constexpr struct {
+    const char* name;
+    const char* help;
+} queue_counters[] = {
+    {"runos_queue_tx_bytes", "Bytes transmitted by the queue"},
+    {"runos_queue_tx_packets", "Packets transmitted by the queue"},
+    {"runos_queue_tx_errors", "Packets dropped by the queue"},
+};
+
+using StatsColumnsList = std::vector<std::pair<uint64_t, SwitchStatsColumnsPtr>>;
+
+void writePorts(OpenMetricsWriter& w, const StatsColumnsList& switches)
+{
+    // family by family, as OpenMetrics requires samples
+    // of a family to be together
+    for (size_t pair = 0; pair < 4; ++pair) {
+        std::string name = port_counters[pair].name;
+        w.family(name, "counter", port_counters[pair].help);
+        auto total = name + "_total";
+        for (const auto& sw : switches) {
+            std::lock_guard<std::mutex> lock(sw.second->mutex);
+            const auto& ports = sw.second->ports;
+            for (size_t row = 0; row < ports.size(); ++row) {
+                auto stats = ports.get(row);
+                for (size_t dir = 0; dir < 2; ++dir) {
+                    w.sample(total).label("dpid", sw.first)
+                     .label("port", ports.key(row))
+                     .label("direction", rx_tx[dir])
+                     .value(stats.integral[2 * pair + dir]);
+                }
+            }
+        }
+
+        // speeds of packets and bytes only
+        if (pair > 1)
+            continue;
+        auto rate = name + "_rate";
+        w.family(rate, "gauge", std::string("Per second rate of ") + name);
+        for (const auto& sw : switches) {
+            std::lock_guard<std::mutex> lock(sw.second->mutex);
+            const auto& ports = sw.second->ports;
+            for (size_t row = 0; row < ports.size(); ++row) {
+                auto stats = ports.get(row);
+                for (size_t dir = 0; dir < 2; ++dir) {
+                    w.sample(rate).label("dpid", sw.first)
+                     .label("port", ports.key(row))
+                     .label("direction", rx_tx[dir])
+                     .value(stats.current_speed[2 * pair + dir]);
+                }
+            }
+        }
+    }
+}
+
+void writeQueues(OpenMetricsWriter& w, const StatsColumnsList& switches)
+{
+    for (size_t counter = 0; counter < 3; ++counter) {
+        std::string name = queue_counters[counter].name;
+        w.family(name, "counter", queue_counters[counter].help);
+        auto total = name + "_total";
+        for (const auto& sw : switches) {
+            std::lock_guard<std::mutex> lock(sw.second->mutex);
+            const auto& queues = sw.second->queues;
+            for (size_t row = 0; row < queues.size(); ++row) {
+                auto key = queues.key(row);
+                w.sample(total).label("dpid", sw.first)
+                 .label("port", stats_key_port(key))
+                 .label("queue", uint32_t(key))
+                 .value(queues.get(row).integral[counter]);
+            }
+        }
+    }
+
+    w.family("runos_queue_tx_bytes_rate", "gauge",
+             "Bytes per second transmitted by the queue");
+    for (const auto& sw : switches) {
+        std::lock_guard<std::mutex> lock(sw.second->mutex);
+        const auto& queues = sw.second->queues;
+        for (size_t row = 0; row < queues.size(); ++row) {
+            auto key = queues.key(row);
+            w.sample("runos_queue_tx_bytes_rate").label("dpid", sw.first)
+             .label("port", stats_key_port(key))
+             .label("queue", uint32_t(key))
+             .value(queues.get(row).current_speed[0]);
+        }
+    }
+}
+
+void writeConnections(OpenMetricsWriter& w, OFServer* of_server)
+{
+    auto connections = of_server->connections();
+
+    w.family("runos_openflow_messages", "counter",
+             "OpenFlow messages received from and sent to the switch");
+    for (const auto& conn : connections) {
+        w.sample("runos_openflow_messages_total").label("dpid", conn->dpid())
+         .label("direction", "rx").value(conn->get_rx_packets());
+        w.sample("runos_openflow_messages_total").label("dpid", conn->dpid())
+         .label("direction", "tx").value(conn->get_tx_packets());
+    }
+
+    w.family("runos_openflow_packet_in", "counter",
+             "Packet-in messages received from the switch");
+    for (const auto& conn : connections) {
+        w.sample("runos_openflow_packet_in_total").label("dpid", conn->dpid())
+         .value(conn->get_pkt_in_packets());
+    }
+}
+
+void writeSender(OpenMetricsWriter& w, OFMsgSender* sender)
+{
+    auto stats = sender->stats();
+
+    w.family("runos_ofmsg_sender_queued", "gauge",
+             "Messages waiting to be sent to the switch");
+    for (const auto& s : stats) {
+        for (const auto& lane : s.lanes) {
+            w.sample("runos_ofmsg_sender_queued").label("dpid", s.dpid)
+             .label("lane", lane.lane._to_string()).value(lane.queued);
+        }
+    }
+
+    w.family("runos_ofmsg_sender_in_flight", "gauge",
+             "Windows of messages waiting for barrier reply");
+    for (const auto& s : stats) {
+        w.sample("runos_ofmsg_sender_in_flight").label("dpid", s.dpid)
+         .value(s.in_flight);
+    }
+
+    constexpr struct {
+        const char* name;
+        const char* help;
+        uint64_t SenderStats::* value;
+    } counters[] = {
+        {"runos_ofmsg_sender_sent", "Messages sent", &SenderStats::sent},
+        {"runos_ofmsg_sender_acked", "Messages acknowledged by barriers",
+         &SenderStats::acked},
+        {"runos_ofmsg_sender_errors", "Messages replied with errors",
+         &SenderStats::errors},
+        {"runos_ofmsg_sender_timeouts", "Windows not acknowledged in time",
+         &SenderStats::timeouts},
+    };
+    for (const auto& counter : counters) {
+        std::string total = std::string(counter.name) + "_total";
+        w.family(counter.name, "counter", counter.help);
+        for (const auto& s : stats) {
+            w.sample(total).label("dpid", s.dpid).value(s.*counter.value);
+        }
+    }
+}
+
+void writeScheduler(OpenMetricsWriter& w, StatsPollScheduler* scheduler)
+{
+    auto stats = scheduler->stats();
+
+    w.family("runos_stats_poll_in_flight", "gauge",
+             "Statistics requests waiting for replies");
+    w.sample("runos_stats_poll_in_flight").value(stats.in_flight);
+    w.family("runos_stats_poll_queued", "gauge",
+             "Statistics polls waiting for in-flight budget");
+    w.sample("runos_stats_poll_queued").value(stats.queued);
+
+    w.family("runos_stats_polls", "counter", "Statistics polls sent");
+    for (const auto& type : stats.types) {
+        w.sample("runos_stats_polls_total")
+         .label("type", type.type._to_string()).value(type.polls);
+    }
+    w.family("runos_stats_poll_failures", "counter",
+             "Statistics polls failed or timed out");
+    for (const auto& type : stats.types) {
+        w.sample("runos_stats_poll_failures_total")
+         .label("type", type.type._to_string()).value(type.failed);
+    }
+    w.family("runos_stats_poll_latency_seconds", "gauge",
+             "Moving average of statistics reply latency", "seconds");
+    for (const auto& type : stats.types) {
+        w.sample("runos_stats_poll_latency_seconds")
+         .label("type", type.type._to_string())
+         .value(double(type.avg_latency.count()) * 1e-6);
+    }
+    w.family("runos_stats_poll_interval_seconds", "gauge",
+             "Average effective polling interval", "seconds");
+    for (const auto& type : stats.types) {
+        w.sample("runos_stats_poll_interval_seconds")
+         .label("type", type.type._to_string())
+         .value(double(type.effective_interval.count()) * 1e-3);
+    }
+}
+
+// Timings of the group as a summary and a gauge of the maximum,
+// family is named without the unit
+void writeTimings(OpenMetricsWriter& w, const std::string& group,
+                  const std::string& family, const char* label,
+                  const char* help)
+{
+    auto seconds = family + "_seconds";
+    auto count = seconds + "_count";
+    auto sum = seconds + "_sum";
+    w.family(seconds, "summary", help, "seconds");
+    metrics::for_each_timing(group,
+        [&](const std::string& name, const metrics::Timing& timing) {
+            w.sample(count).label(label, name).value(timing.count());
+            w.sample(sum).label(label, name).value(timing.sum_seconds());
+        });
+
+    auto max = family + "_max_seconds";
+    w.family(max, "gauge", std::string("Maximum of ") + seconds, "seconds");
+    metrics::for_each_timing(group,
+        [&](const std::string& name, const metrics::Timing& timing) {
+            w.sample(max).label(label, name).value(timing.max_seconds());
+        });
+}
+
+} // namespace
+
+// Renders all metrics as OpenMetrics text into a buffer reused by scrapes
+class MetricsExposition {
+public:
+    MetricsExposition(SwitchManager* switch_manager, OFServer* of_server,
+                      OFMsgSender* sender, StatsPollScheduler* scheduler)
+        : switch_manager(switch_manager)
+        , of_server(of_server)
+        , sender(sender)
+        , scheduler(scheduler)
+    { }
+
+    // Copies rendered text to body
+    void render(std::string& body)
+    {
+        static auto& scrape = metrics::timing("metrics", "scrape");
+
+        std::lock_guard<std::mutex> lock(mutex);
+        {
+            metrics::ScopedTiming scoped(scrape);
+            OpenMetricsWriter w(buffer);
+
+            auto switches = switch_manager->stats_columns();
+            writePorts(w, switches);
+            writeQueues(w, switches);
+            writeConnections(w, of_server);
+            writeSender(w, sender);
+            writeScheduler(w, scheduler);
+            writeTimings(w, "database", "runos_db_request",
+                         "request", "Latency of database requests");
+            writeTimings(w, "polling", "runos_app_polling",
+                         "app", "Time spent in periodic polling of the application");
+            writeTimings(w, "metrics", "runos_metrics_render",
+                         "operation", "Time spent rendering metrics");
+
+            w.family("runos_app_startup_seconds", "gauge",
+                     "Time spent initializing and starting the application",
+                     "seconds");
+            for (auto phase : {"init", "start-up"}) {
+                metrics::for_each_timing(phase,
+                    [&](const std::string& name, const metrics::Timing& timing) {
+                        w.sample("runos_app_startup_seconds")
+                         .label("app", name).label("phase", phase)
+                         .value(timing.sum_seconds());
+                    });
+            }
+
+            w.finish();
+        }
+        body.assign(buffer);
+    }
+
+private:
+    SwitchManager* switch_manager;
+    OFServer* of_server;
+    OFMsgSender* sender;
+    StatsPollScheduler* scheduler;
+
+    std::mutex mutex;
+    std::string buffer;
+};
+
+struct MetricsResource : rest::resource {
+    MetricsExposition* exposition;
+
+    explicit MetricsResource(MetricsExposition* exposition)
+        : exposition(exposition)
+    { }
+
+    bool Render(std::string& body, std::string& content_type) const override
+    {
+        exposition->render(body);
+        content_type = openmetrics_content_type;
+        return true;
+    }
+};
+
+class MetricsRest : public Application
+{
+    SIMPLE_APPLICATION(MetricsRest, "metrics-rest")
+public:
+    void init(Loader* loader, const Config&) override
+    {
+        using rest::path_spec;
+        using rest::path_match;
+
+        exposition.reset(new MetricsExposition(
+            SwitchManager::get(loader),
+            OFServer::get(loader),
+            OFMsgSender::get(loader),
+            StatsPollScheduler::get(loader)
+        ));
+
+        auto rest_ = RestListener::get(loader);
+        auto exposition_ = exposition.get();
+        rest_->mount(path_spec("/metrics/?"), [=](const path_match&) {
+            return MetricsResource {exposition_};
+        });
+    }
+
+private:
+    std::unique_ptr<MetricsExposition> exposition;
+};
+
+REGISTER_APPLICATION(MetricsRest, {"rest-listener", "switch-manager",
+                                   "of-server", "ofmsg-sender",
+                                   "stats-poll-scheduler", ""})
+
+} // namespace runos
@@ -20,85 +20,492 @@
 #include "FlowEntriesVerifier.hpp"
 #include "api/OFAgent.hpp"
 #include "lib/poller.hpp"
+#include "lib/flow_mod_compaction.hpp"
 
 #include <runos/core/logging.hpp>
 #include <runos/core/future.hpp>
 
 #include <boost/chrono.hpp>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cctype>
+#include <cstring>
+#include <deque>
+#include <functional>
 #include <mutex>
-#include <queue>
+#include <string>
+#include <unordered_map>
 #include <utility>
 
 namespace runos {
 
-REGISTER_APPLICATION(OFMsgSender, {"switch-ordering", "flow-entries-verifier", ""})
+REGISTER_APPLICATION(OFMsgSender, {"controller", "switch-ordering",
+                                   "switch-manager", "flow-entries-verifier",
+                                   ""})
 
-static constexpr int min_rate = 20; 
+static constexpr int min_rate = 20;
+
+using Clock = std::chrono::steady_clock;
 
 namespace barrier_status {
     template<typename R>
-    bool received(boost::future<R> const& f)
+    bool received(boost::shared_future<R> const& f)
     {
         return f.wait_for(boost::chrono::seconds(0)) == boost::future_status::ready;
     }
 }
 
+struct QueuedMsg {
+    uint8_t* data;
+    size_t len;
+    Clock::time_point enqueued;
+    uint64_t epoch; // messages of the next epoch wait for cross-lane barrier
+    std::string key; // compaction key, empty if message isn't compactable
+};
+
+// Queue of one priority class
+struct Lane {
+    std::deque<QueuedMsg> msgs;
+    uint32_t weight {1};    // quantum of deficit round-robin, messages
+    uint32_t deficit {0};
+    bool visited {false};   // quantum was added on current visit
+
+    // Latest pending flow-mods by compaction key.
+    // Dropped messages are left in queue with null data.
+    std::unordered_map<std::string, QueuedMsg*> index;
+    size_t dropped {0};
+
+    uint64_t sent {0};
+    uint64_t compacted {0};
+    uint64_t merged {0};
+    Clock::duration avg_latency {Clock::duration::zero()};
+    Clock::duration max_latency {Clock::duration::zero()};
+
+    bool ready(uint64_t epoch) const
+    {
+        return !msgs.empty() && msgs.front().epoch == epoch;
+    }
+
+    void purge()
+    {
+        while (!msgs.empty() && msgs.front().data == nullptr) {
+            msgs.pop_front();
+            dropped--;
+        }
+    }
+};
+
+// Pack of messages delimited by barrier
+struct Window {
+    boost::shared_future<void> barrier;
+    Clock::time_point sent_at;
+    uint32_t size;
+    std::vector<promise<void>> fences; // cross-lane barriers closed by window
+};
+
 struct MsgStatus {
-    MsgStatus(OFConnectionPtr conn, uint32_t limit, uint32_t add = 5, uint32_t mult = 2)
+    MsgStatus(OFConnectionPtr conn, uint32_t limit, uint16_t max_windows,
+              uint32_t add = 5, uint32_t mult = 2)
         : conn(conn)
         , limit(limit)
-        , sent(0)
+        , max_windows(max_windows)
         , additive_ratio(add)
         , multiplicative_ratio(mult)
     {}
 
+    ~MsgStatus()
+    {
+        for (auto& lane : lanes) {
+            for (auto& msg : lane.msgs) {
+                if (msg.data) {
+                    fluid_msg::OFMsg::free_buffer(msg.data);
+                }
+            }
+        }
+    }
+
     OFConnectionPtr conn;
-    uint32_t limit; // limit for sending msgs per pack
-    uint32_t sent;  // amount sent msgs without barrier
-    std::queue<std::pair<uint8_t*, size_t>> msgs;
-    boost::future<void> barrier;
-    boost::chrono::time_point<boost::chrono::steady_clock> updated;
+    uint32_t limit;         // limit for sending msgs per window
+    uint16_t max_windows;   // limit for windows waiting for barrier-reply
+    std::array<Lane, SendLane::_size()> lanes;
+    size_t current_lane {0};
+    std::deque<Window> windows;
+    std::function<void()> wake;
+    std::atomic_bool scheduled {false};
+    bool compaction {false};
     std::mutex mut;
 
-    void send_barrier();
-    void send_pack();
-
-    // AIMD logic for OFMsg congestion control
+    // Cross-lane barriers
+    uint64_t epoch {0};         // epoch of enqueued messages
+    uint64_t sending_epoch {0}; // epoch of messages allowed to be sent
+    std::deque<std::pair<uint64_t, promise<void>>> fences;
+
+    void enqueue(SendLane lane, uint8_t* data, size_t len);
+    future<void> fence();
+    void send_windows(boost::inline_executor& executor);
+    void collect(Clock::time_point now, Clock::duration timeout,
+                 double rtt_tolerance);
+    void on_error();
+    void abort();
+    void update_throughput(Clock::time_point now);
+    SenderStats stats();
+
+    // Delay-based AIMD logic for OFMsg congestion control
     uint32_t additive_ratio;
     uint32_t multiplicative_ratio;
     void add_increase();
     void mult_decrease();
+
+    // Barrier round-trip time estimation
+    Clock::duration srtt {Clock::duration::zero()};
+    Clock::duration min_rtt {Clock::duration::max()};
+    Clock::time_point last_decrease;
+    uint32_t pending_errors {0};
+
+    // Counters
+    uint64_t sent {0};
+    uint64_t acked {0};
+    uint64_t errors {0};
+    uint64_t timeouts {0};
+    uint64_t acked_at_tick {0};
+    Clock::time_point tick {Clock::now()};
+    double throughput {0.0};
+
+private:
+    void compact(Lane& lane, QueuedMsg& msg);
+    uint32_t schedule(uint32_t budget);
+    void send_one(Lane& lane, Clock::time_point now);
+    bool send_barrier(uint32_t size, std::vector<promise<void>> fences,
+                      boost::inline_executor& executor);
+    void on_ack(Clock::duration rtt, double rtt_tolerance);
+    void drop_windows();
 };
 
-void MsgStatus::send_barrier()
+void MsgStatus::enqueue(SendLane lane_id, uint8_t* data, size_t len)
+{
+    std::lock_guard lock(mut);
+
+    auto& lane = lanes[lane_id._to_integral()];
+    lane.msgs.push_back(QueuedMsg{ data, len, Clock::now(), epoch, {} });
+    if (compaction) {
+        compact(lane, lane.msgs.back());
+    }
+}
+
+void MsgStatus::compact(Lane& lane, QueuedMsg& msg)
+{
+    using namespace flow_mod_compaction;
+
+    msg.key = key(msg.data, msg.len);
+    if (msg.key.empty()) {
+        // Message may depend on any pending flow-mod
+        lane.index.clear();
+        return;
+    }
+
+    auto it = lane.index.find(msg.key);
+    if (it == lane.index.end()) {
+        lane.index.emplace(msg.key, &msg);
+        return;
+    }
+
+    auto& earlier = *it->second;
+    switch (resolve(earlier.data, msg.data)) {
+    case Resolution::KeepBoth:
+        break;
+    case Resolution::MergeIntoLater:
+        lane.merged++;
+        [[fallthrough]];
+    case Resolution::DropEarlier:
+        fluid_msg::OFMsg::free_buffer(earlier.data);
+        earlier.data = nullptr;
+        earlier.key.clear();
+        lane.dropped++;
+        lane.compacted++;
+        lane.purge();
+        break;
+    }
+    it->second = &msg;
+}
+
+future<void> MsgStatus::fence()
+{
+    std::lock_guard lock(mut);
+
+    // Don't compact messages across the barrier
+    for (auto& lane : lanes) {
+        lane.index.clear();
+    }
+
+    promise<void> p;
+    auto ret = p.get_future();
+    fences.emplace_back(epoch++, std::move(p));
+    return ret;
+}
+
+void MsgStatus::send_one(Lane& lane, Clock::time_point now)
+{
+    auto& msg = lane.msgs.front();
+
+    conn->send(msg.data, msg.len);
+    fluid_msg::OFMsg::free_buffer(msg.data);
+
+    if (not msg.key.empty()) {
+        auto it = lane.index.find(msg.key);
+        if (it != lane.index.end() && it->second == &msg) {
+            lane.index.erase(it);
+        }
+    }
+
+    auto latency = now - msg.enqueued;
+    lane.msgs.pop_front();
+    lane.purge();
+
+    lane.avg_latency = lane.sent == 0 ? latency
+                     : (7 * lane.avg_latency + latency) / 8;
+    lane.max_latency = std::max(lane.max_latency, latency);
+    lane.sent++;
+}
+
+// Deficit round-robin over lanes, returns number of sent messages
+uint32_t MsgStatus::schedule(uint32_t budget)
+{
+    auto now = Clock::now();
+    uint32_t sent_in_pack = 0;
+    size_t idle = 0;
+
+    while (sent_in_pack < budget && idle < lanes.size()) {
+        auto& lane = lanes[current_lane];
+
+        if (not lane.ready(sending_epoch)) {
+            lane.deficit = 0;
+            lane.visited = false;
+            current_lane = (current_lane + 1) % lanes.size();
+            idle++;
+            continue;
+        }
+
+        if (not lane.visited) {
+            lane.deficit += lane.weight;
+            lane.visited = true;
+        }
+
+        while (sent_in_pack < budget && lane.deficit > 0 &&
+               lane.ready(sending_epoch)) {
+            send_one(lane, now);
+            lane.deficit--;
+            sent_in_pack++;
+        }
+
+        if (sent_in_pack == budget && lane.deficit > 0 &&
+            lane.ready(sending_epoch)) {
+            break; // continue this visit in the next window
+        }
+
+        if (not lane.ready(sending_epoch)) {
+            lane.deficit = 0;
+        }
+        lane.visited = false;
+        current_lane = (current_lane + 1) % lanes.size();
+        idle = 0;
+    }
+
+    return sent_in_pack;
+}
+
+bool MsgStatus::send_barrier(uint32_t size, std::vector<promise<void>> closed,
+                             boost::inline_executor& executor)
 {
     try {
-        barrier = std::move(conn->agent()->barrier());
+        auto barrier = conn->agent()->barrier().share();
+        barrier.then(executor, [wake = wake](boost::shared_future<void>) {
+            wake();
+        });
+        windows.push_back(Window{ std::move(barrier), Clock::now(),
+                                  size, std::move(closed) });
+        return true;
     } catch (const OFAgent::request_error& e) {
         LOG(ERROR) << "[MsgStatus] - " << e.what();
+        for (auto& fence : closed) {
+            fence.set_exception(boost::current_exception());
+        }
+        return false;
     }
-    updated = boost::chrono::steady_clock::now();
 }
 
-void MsgStatus::send_pack()
+void MsgStatus::send_windows(boost::inline_executor& executor)
 {
-    uint32_t sent_in_pack = 0;
-
     std::lock_guard lock(mut);
-    while (!msgs.empty() && sent_in_pack < limit && sent < limit) {
-        auto elem = msgs.front();
-        conn->send(elem.first, elem.second);
-        fluid_msg::OFMsg::free_buffer(elem.first);
-        msgs.pop();
-        sent_in_pack++;
-        sent++;
-
-        if (sent_in_pack == limit || sent == limit) { // reached limit
-            send_barrier();
-            sent = 0;
+    while (windows.size() < max_windows) {
+        uint32_t sent_in_pack = schedule(limit);
+        sent += sent_in_pack;
+
+        // All messages enqueued before cross-lane barrier are sent,
+        // close the window and go on with the next epoch
+        std::vector<promise<void>> closed;
+        bool epoch_sent = std::none_of(lanes.begin(), lanes.end(),
+            [this](const Lane& lane) { return lane.ready(sending_epoch); });
+        while (epoch_sent && !fences.empty() &&
+               fences.front().first == sending_epoch) {
+            closed.push_back(std::move(fences.front().second));
+            fences.pop_front();
+            sending_epoch++;
+            epoch_sent = std::none_of(lanes.begin(), lanes.end(),
+                [this](const Lane& lane) { return lane.ready(sending_epoch); });
+        }
+
+        if (sent_in_pack == 0 && closed.empty()) {
             break;
         }
+
+        if (not send_barrier(sent_in_pack, std::move(closed), executor)) {
+            break;
+        }
+    }
+}
+
+void MsgStatus::collect(Clock::time_point now, Clock::duration timeout,
+                        double rtt_tolerance)
+{
+    std::lock_guard lock(mut);
+
+    // Switch replies on barriers in order,
+    // so windows are acknowledged from the oldest one
+    while (!windows.empty() &&
+           barrier_status::received(windows.front().barrier)) {
+        auto& window = windows.front();
+        try {
+            window.barrier.get();
+            acked += window.size;
+            on_ack(now - window.sent_at, rtt_tolerance);
+            for (auto& fence : window.fences) {
+                fence.set_value();
+            }
+        } catch (const OFAgent::error& e) {
+            LOG(WARNING) << "[MsgStatus] - " << e.what();
+            pending_errors++;
+            for (auto& fence : window.fences) {
+                fence.set_exception(boost::current_exception());
+            }
+        }
+        windows.pop_front();
+    }
+
+    // Don't decrease limit more than once per round-trip time
+    if (pending_errors > 0) {
+        errors += pending_errors;
+        pending_errors = 0;
+        if (now - last_decrease > srtt) {
+            mult_decrease();
+            last_decrease = now;
+        }
     }
+
+    if (!windows.empty() && now - windows.front().sent_at > timeout) {
+        LOG(WARNING) << "Switch " << conn->dpid() << " don't reply on barrier";
+        timeouts++;
+        mult_decrease();
+        last_decrease = now;
+        drop_windows();
+    }
+}
+
+// Cross-lane barriers closed by dropped windows are failed, not broken
+void MsgStatus::drop_windows()
+{
+    for (auto& window : windows) {
+        for (auto& fence : window.fences) {
+            // xid of the barrier isn't kept
+            fence.set_exception(OFAgent::not_responded(conn->dpid(), 0));
+        }
+    }
+    windows.clear();
+}
+
+// Switch is down, no barrier will be acknowledged
+void MsgStatus::abort()
+{
+    std::lock_guard lock(mut);
+    drop_windows();
+    for (auto& fence : fences) {
+        fence.second.set_exception(OFAgent::not_responded(conn->dpid(), 0));
+    }
+    fences.clear();
+}
+
+void MsgStatus::on_ack(Clock::duration rtt, double rtt_tolerance)
+{
+    srtt = srtt == Clock::duration::zero() ? rtt : (7 * srtt + rtt) / 8;
+    min_rtt = std::min(min_rtt, rtt);
+
+    // Grow window while barrier-replies aren't queued up on the switch
+    if (srtt <= min_rtt * rtt_tolerance) {
+        add_increase();
+    }
+}
+
+void MsgStatus::on_error()
+{
+    std::lock_guard lock(mut);
+    if (!windows.empty()) {
+        pending_errors++;
+    }
+}
+
+void MsgStatus::update_throughput(Clock::time_point now)
+{
+    std::lock_guard lock(mut);
+
+    auto elapsed = std::chrono::duration<double>(now - tick).count();
+    if (elapsed >= 1.0) {
+        throughput = (acked - acked_at_tick) / elapsed;
+        acked_at_tick = acked;
+        tick = now;
+    }
+}
+
+SenderStats MsgStatus::stats()
+{
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+
+    std::lock_guard lock(mut);
+
+    SenderStats ret;
+    ret.dpid = conn->dpid();
+    ret.window = limit;
+    ret.in_flight = windows.size();
+    ret.queued = 0;
+    ret.compacted = 0;
+    ret.sent = sent;
+    ret.acked = acked;
+    ret.errors = errors;
+    ret.timeouts = timeouts;
+    ret.throughput = throughput;
+    ret.srtt = duration_cast<microseconds>(srtt);
+    ret.min_rtt = min_rtt == Clock::duration::max()
+                ? microseconds::zero()
+                : duration_cast<microseconds>(min_rtt);
+
+    for (size_t i = 0; i < lanes.size(); ++i) {
+        auto& lane = lanes[i];
+
+        LaneStats lane_stats;
+        lane_stats.lane = SendLane::_from_integral(i);
+        lane_stats.weight = lane.weight;
+        lane_stats.queued = lane.msgs.size() - lane.dropped;
+        lane_stats.sent = lane.sent;
+        lane_stats.compacted = lane.compacted;
+        lane_stats.merged = lane.merged;
+        lane_stats.avg_latency = duration_cast<microseconds>(lane.avg_latency);
+        lane_stats.max_latency = duration_cast<microseconds>(lane.max_latency);
+
+        ret.queued += lane_stats.queued;
+        ret.compacted += lane_stats.compacted;
+        ret.lanes.push_back(lane_stats);
+    }
+    return ret;
 }
 
 void MsgStatus::add_increase()
@@ -112,11 +519,9 @@ void MsgStatus::add_increase()
 
 void MsgStatus::mult_decrease()
 {
-    LOG(WARNING) << "Switch " << conn->dpid() << " don't reply on barrier";
-
     if (limit >= multiplicative_ratio * min_rate) {
         limit /= multiplicative_ratio;
-        LOG(WARNING) << "Changed ofmsg limit for switch " << conn->dpid() 
+        LOG(WARNING) << "Changed ofmsg limit for switch " << conn->dpid()
                      << " to " << limit << " messages";
     } else {
         limit = min_rate;
@@ -130,13 +535,37 @@ void MsgStatus::mult_decrease()
 void OFMsgSender::init(Loader* loader, const Config& rootConfig)
 {
     verifier = FlowEntriesVerifier::get(loader);
+    sw_mgr = SwitchManager::get(loader);
 
     auto config = config_cd(rootConfig, "ofmsg-sender");
-    poll_interval = config_get(config, "poll-interval", 50);    // ms
+    poll_interval = config_get(config, "poll-interval", 500);   // ms
     wait_interval = config_get(config, "wait-interval", 5000);  // ms
+    max_windows = config_get(config, "max-windows", 4);
+    rtt_tolerance = config_get(config, "rtt-tolerance", 2.0);
+    compaction = config_get(config, "compaction", false);
+
+    static constexpr int default_weights[] = {16, 4, 1};
+    auto weights_config = config_cd(config, "lane-weights");
+    for (auto lane : SendLane::_values()) {
+        std::string name = lane._to_string();
+        std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+        int weight = config_get(weights_config, name,
+                                default_weights[lane._to_integral()]);
+        lane_weights[lane._to_integral()] = std::max(weight, 1);
+    }
 
+    // Sending is driven by enqueued messages and barrier-replies,
+    // poller only checks for timeouts and updates statistics
     poller = new Poller(this, poll_interval);
     SwitchOrderingManager::get(loader)->registerHandler(this, 16);
+
+    error_handler = Controller::get(loader)->register_handler(
+        [this](of13::Error& error, OFConnectionPtr conn) {
+            if (auto status = find_status(conn->dpid())) {
+                status->on_error();
+            }
+            return false;
+        }, -93);
 }
 
 void OFMsgSender::startUp(Loader* loader)
@@ -144,43 +573,120 @@ void OFMsgSender::startUp(Loader* loader)
     poller->run();
 }
 
-void OFMsgSender::send(uint64_t dpid, message& msg)
+void OFMsgSender::send(uint64_t dpid, message& msg, SendLane lane)
 {
-    send_impl(dpid, msg);
+    send_impl(dpid, msg, lane);
 }
 
-void OFMsgSender::send(uint64_t dpid, message&& msg)
+void OFMsgSender::send(uint64_t dpid, message&& msg, SendLane lane)
 {
-    send_impl(dpid, msg);
+    send_impl(dpid, msg, lane);
 }
 
-void OFMsgSender::polling()
+bool OFMsgSender::send(uint64_t dpid, const char* data, size_t len,
+                       SendLane lane)
 {
-    auto now = boost::chrono::steady_clock::now();
-    for (auto& it : status_map) {
-        auto status_ptr = it.second;
-        {
-            std::lock_guard lock(status_ptr->mut);
-            if (status_ptr->msgs.empty()) {
-                continue;       // no messages for switch
-            }
+    auto status_ptr = find_status(dpid);
+    if (not status_ptr) { // no limits
+        auto conn = connection(dpid);
+        if (not conn) {
+            LOG(WARNING) << "[OFMsgSender] - Switch " << dpid
+                         << " is absent, message is dropped";
+            return false;
         }
+        conn->send(const_cast<char*>(data), len);
+        return true;
+    }
 
-        if (status_ptr->barrier.valid()) {                        // we sent barrier (state is valid)
-            if (barrier_status::received(status_ptr->barrier)) {    // and received barrier-reply
-                status_ptr->barrier.get();                            // make state invalid
-                status_ptr->add_increase();                           // and increase limit
-            } else {                                                // or...
-                if (now - status_ptr->updated > boost::chrono::milliseconds(wait_interval)) {
-                    status_ptr->mult_decrease();                      // send new barrier if time was over
-                    status_ptr->send_barrier();
-                }
-                continue;                                           // wait barrier-reply
-            }
+    // queued buffers are freed as packed by OFMsg
+    auto buffer = new uint8_t[len];
+    std::memcpy(buffer, data, len);
+    status_ptr->enqueue(lane, buffer, len);
+    wakeup(status_ptr);
+    return true;
+}
+
+future<void> OFMsgSender::barrier(uint64_t dpid)
+{
+    auto status_ptr = find_status(dpid);
+    if (not status_ptr) { // no limits, messages are already sent
+        auto conn = connection(dpid);
+        if (not conn) {
+            promise<void> failed;
+            failed.set_exception(OFAgent::not_responded(dpid, 0));
+            return failed.get_future();
         }
+        return conn->agent()->barrier();
+    }
+
+    auto ret = status_ptr->fence();
+    wakeup(status_ptr);
+    return ret;
+}
+
+std::vector<SenderStats> OFMsgSender::stats() const
+{
+    std::vector<SenderStats> ret;
+
+    boost::shared_lock<boost::shared_mutex> lock(status_mut);
+    for (auto& it : status_map) {
+        ret.push_back(it.second->stats());
+    }
+    return ret;
+}
 
-        poller->apply([=](){ status_ptr->send_pack(); });
+std::optional<SenderStats> OFMsgSender::stats(uint64_t dpid) const
+{
+    auto status_ptr = find_status(dpid);
+    if (not status_ptr) {
+        return std::nullopt;
     }
+    return status_ptr->stats();
+}
+
+void OFMsgSender::polling()
+{
+    std::vector<msg_status_ptr> statuses;
+    {
+        boost::shared_lock<boost::shared_mutex> lock(status_mut);
+        for (auto& it : status_map) {
+            statuses.push_back(it.second);
+        }
+    }
+
+    auto now = Clock::now();
+    for (auto& status_ptr : statuses) {
+        drain(status_ptr);
+        status_ptr->update_throughput(now);
+    }
+}
+
+void OFMsgSender::wakeup(const msg_status_ptr& status_ptr)
+{
+    if (status_ptr->scheduled.exchange(true)) {
+        return; // already scheduled
+    }
+
+    poller->apply([this, status_ptr]() {
+        status_ptr->scheduled = false;
+        drain(status_ptr);
+    });
+}
+
+void OFMsgSender::drain(const msg_status_ptr& status_ptr)
+{
+    status_ptr->collect(Clock::now(),
+                        std::chrono::milliseconds(wait_interval),
+                        rtt_tolerance);
+    status_ptr->send_windows(inline_executor);
+}
+
+msg_status_ptr OFMsgSender::find_status(uint64_t dpid) const
+{
+    boost::shared_lock<boost::shared_mutex> lock(status_mut);
+
+    auto it = status_map.find(dpid);
+    return it != status_map.end() ? it->second : nullptr;
 }
 
 void OFMsgSender::switchUp(SwitchPtr sw)
@@ -192,33 +698,67 @@ void OFMsgSender::switchUp(SwitchPtr sw)
     if (limit > 0) {
         auto additive = sw->property("ofmsg_add_ratio", 5);
         auto multiplicative = sw->property("ofmsg_mult_ratio", 2);
-        status_map.emplace(sw->dpid(), 
-                std::make_shared<MsgStatus>(sw->connection(),
-                                            static_cast<uint32_t>(limit),
-                                            additive, multiplicative)
-        );
+        auto windows = sw->property("ofmsg_max_windows", max_windows);
+        auto status_ptr =
+            std::make_shared<MsgStatus>(sw->connection(),
+                                        static_cast<uint32_t>(limit),
+                                        std::max<uint16_t>(windows, 1),
+                                        additive, multiplicative);
+
+        status_ptr->compaction = compaction;
+        for (size_t i = 0; i < status_ptr->lanes.size(); ++i) {
+            status_ptr->lanes[i].weight = lane_weights[i];
+        }
+
+        std::weak_ptr<MsgStatus> weak_status = status_ptr;
+        status_ptr->wake = [this, weak_status]() {
+            if (auto status_ptr = weak_status.lock()) {
+                wakeup(status_ptr);
+            }
+        };
+
+        boost::unique_lock<boost::shared_mutex> lock(status_mut);
+        status_map[sw->dpid()] = std::move(status_ptr);
     }
 }
 
 void OFMsgSender::switchDown(SwitchPtr sw)
 {
-    status_map.erase(sw->dpid());
+    msg_status_ptr status_ptr;
+    {
+        boost::unique_lock<boost::shared_mutex> lock(status_mut);
+        auto it = status_map.find(sw->dpid());
+        if (it == status_map.end()) {
+            return;
+        }
+        status_ptr = std::move(it->second);
+        status_map.erase(it);
+    }
+    status_ptr->abort();
 }
 
-void OFMsgSender::send_impl(uint64_t dpid, message& msg)
+OFConnectionPtr OFMsgSender::connection(uint64_t dpid) const
 {
-    auto status_iter = status_map.find(dpid);
-    if (status_iter == status_map.end()) { // no limits
+    auto sw = sw_mgr->switch_(dpid);
+    return sw ? sw->connection() : nullptr;
+}
+
+void OFMsgSender::send_impl(uint64_t dpid, message& msg, SendLane lane)
+{
+    auto status_ptr = find_status(dpid);
+    if (not status_ptr) { // no limits
         verifier->send(dpid, msg);
         return;
     }
 
     try {
-        std::lock_guard lock(status_iter->second->mut);
-        status_iter->second->msgs.emplace(msg.pack(), msg.length());
+        status_ptr->enqueue(lane, msg.pack(), msg.length());
     } catch (const invalid_argument& e) {
         LOG(WARNING) << e.what();
+        return;
     }
+
+    wakeup(status_ptr);
 }
 
 } // namespace runos
@@ -17,14 +17,25 @@
 #pragma once
 
 #include "Application.hpp"
+#include "Controller.hpp" // OFMessageHandlerPtr
 #include "SwitchOrdering.hpp"
 #include "api/Switch.hpp"
+#include "lib/better_enum.hpp"
+
+#include <runos/core/future-decl.hpp>
 
 #include <fluid/of13msg.hh>
 #include <fluid/ofcommon/msg.hh>
 
+#include <boost/thread/executors/inline_executor.hpp>
+#include <boost/thread/shared_mutex.hpp>
+
+#include <array>
+#include <chrono>
 #include <map>
 #include <memory>
+#include <optional>
+#include <vector>
 
 namespace runos {
 
@@ -33,6 +44,38 @@ namespace of13 = fluid_msg::of13;
 using message = fluid_msg::OFMsg;
 using msg_status_ptr = std::shared_ptr<struct MsgStatus>;
 
+// Priority classes of messages, served by weighted deficit round-robin
+BETTER_ENUM(SendLane, uint8_t, Critical,
+                               Interactive,
+                               Bulk);
+
+struct LaneStats {
+    SendLane lane;
+    uint32_t weight;
+    size_t queued;
+    uint64_t sent;
+    uint64_t compacted;     // messages eliminated by compaction
+    uint64_t merged;        // of them merged into later messages
+    std::chrono::microseconds avg_latency;  // from enqueue to send
+    std::chrono::microseconds max_latency;
+};
+
+struct SenderStats {
+    uint64_t dpid;
+    uint32_t window;        // messages per barrier-delimited window
+    uint32_t in_flight;     // windows waiting for barrier-reply
+    size_t queued;          // messages waiting to be sent
+    uint64_t sent;
+    uint64_t acked;
+    uint64_t errors;
+    uint64_t timeouts;
+    uint64_t compacted;
+    double throughput;      // acknowledged messages per second
+    std::chrono::microseconds srtt;
+    std::chrono::microseconds min_rtt;
+    std::vector<LaneStats> lanes;
+};
+
 class OFMsgSender : public Application
                   , public SwitchEventHandler
 {
@@ -41,9 +84,23 @@ class OFMsgSender : public Application
 public:
     void init(Loader* loader, const Config& config) override;
     void startUp(Loader *loader) override;
-    
-    void send(uint64_t dpid, message& msg);
-    void send(uint64_t dpid, message&& msg);
+
+    // Messages are sent in order within the lane only
+    void send(uint64_t dpid, message& msg,
+              SendLane lane = SendLane::Interactive);
+    void send(uint64_t dpid, message&& msg,
+              SendLane lane = SendLane::Interactive);
+    // Already packed message, not passed to FlowEntriesVerifier.
+    // Returns false if the switch is absent
+    bool send(uint64_t dpid, const char* data, size_t len,
+              SendLane lane = SendLane::Interactive);
+
+    // Messages sent after the barrier in any lane are not sent
+    // until messages sent before it in all lanes are processed by switch
+    future<void> barrier(uint64_t dpid);
+
+    std::vector<SenderStats> stats() const;
+    std::optional<SenderStats> stats(uint64_t dpid) const;
 
 protected slots:
     void polling();
@@ -52,13 +109,27 @@ private:
     void switchUp(SwitchPtr sw) override;
     void switchDown(SwitchPtr sw) override;
 
-    void send_impl(uint64_t dpid, message& msg);
+    OFConnectionPtr connection(uint64_t dpid) const;
+    void send_impl(uint64_t dpid, message& msg, SendLane lane);
+    void wakeup(const msg_status_ptr& status);
+    void drain(const msg_status_ptr& status);
+    msg_status_ptr find_status(uint64_t dpid) const;
 
     class Poller* poller;
     class FlowEntriesVerifier* verifier;
+    class SwitchManager* sw_mgr;
+    OFMessageHandlerPtr error_handler;
+    boost::inline_executor inline_executor;
+
     std::map<uint64_t, msg_status_ptr> status_map;
+    mutable boost::shared_mutex status_mut;
+
     uint16_t poll_interval;
     uint16_t wait_interval;
+    uint16_t max_windows;
+    double rtt_tolerance;
+    bool compaction;
+    std::array<uint32_t, SendLane::_size()> lane_weights;
 };
 
 } // namespace runos
@@ -0,0 +1,126 @@
+/*
+ * Copyright 2019 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Application.hpp"
+#include "Loader.hpp"
+#include "OFMsgSender.hpp"
+#include "RestListener.hpp"
+
+#include <boost/lexical_cast.hpp>
+
+namespace runos {
+
+static rest::ptree toPtree(const SenderStats& stats)
+{
+    rest::ptree ret;
+    ret.put("dpid", stats.dpid);
+    ret.put("window", stats.window);
+    ret.put("in_flight", stats.in_flight);
+    ret.put("queued", stats.queued);
+    ret.put("sent", stats.sent);
+    ret.put("acked", stats.acked);
+    ret.put("errors", stats.errors);
+    ret.put("timeouts", stats.timeouts);
+    ret.put("compacted", stats.compacted);
+    ret.put("throughput", stats.throughput);
+    ret.put("srtt_us", stats.srtt.count());
+    ret.put("min_rtt_us", stats.min_rtt.count());
+
+    rest::ptree lanes;
+    for (const auto& lane : stats.lanes) {
+        rest::ptree lpt;
+        lpt.put("lane", lane.lane._to_string());
+        lpt.put("weight", lane.weight);
+        lpt.put("queued", lane.queued);
+        lpt.put("sent", lane.sent);
+        lpt.put("compacted", lane.compacted);
+        lpt.put("merged", lane.merged);
+        lpt.put("avg_latency_us", lane.avg_latency.count());
+        lpt.put("max_latency_us", lane.max_latency.count());
+        lanes.push_back(std::make_pair("", std::move(lpt)));
+    }
+    ret.add_child("lanes", lanes);
+    return ret;
+}
+
+struct SenderCollection : rest::resource {
+    OFMsgSender* app;
+
+    explicit SenderCollection(OFMsgSender* app)
+        : app(app)
+    { }
+
+    rest::ptree Get() const override {
+        rest::ptree root;
+        rest::ptree switches;
+
+        for (const auto& stats : app->stats()) {
+            switches.push_back(std::make_pair("", toPtree(stats)));
+        }
+
+        root.add_child("array", switches);
+        root.put("_size", switches.size());
+        return root;
+    }
+};
+
+struct SenderResource : rest::resource {
+    OFMsgSender* app;
+    uint64_t dpid;
+
+    explicit SenderResource(OFMsgSender* app, uint64_t dpid)
+        : app(app), dpid(dpid)
+    { }
+
+    rest::ptree Get() const override {
+        auto stats = app->stats(dpid);
+        if (not stats) {
+            THROW(rest::http_error(404), "Switch has no ofmsg limits");
+        }
+        return toPtree(*stats);
+    }
+};
+
+class OFMsgSenderRest : public Application
+{
+    SIMPLE_APPLICATION(OFMsgSenderRest, "ofmsg-sender-rest")
+public:
+    void init(Loader* loader, const Config&) override
+    {
+        using rest::path_spec;
+        using rest::path_match;
+
+        auto app = OFMsgSender::get(loader);
+        auto rest_ = RestListener::get(loader);
+
+        rest_->mount(path_spec("/ofmsg-sender/"), [=](const path_match&) {
+            return SenderCollection {app};
+        });
+
+        rest_->mount(path_spec("/ofmsg-sender/(\\d+)/"), [=](const path_match& m) {
+            try {
+                auto dpid = boost::lexical_cast<uint64_t>(m[1].str());
+                return SenderResource {app, dpid};
+            } catch (const boost::bad_lexical_cast& e) {
+                THROW( rest::http_error(400), "Bad request: {}", e.what() );
+            }
+        });
+    }
+};
+
+REGISTER_APPLICATION(OFMsgSenderRest, {"rest-listener", "ofmsg-sender", ""})
+
+} // namespace runos
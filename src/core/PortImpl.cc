@@ -20,9 +20,8 @@
 #include <runos/core/assert.hpp>
 
 #include <boost/lexical_cast.hpp>
-#include <range/v3/view/map.hpp>
 
-#include <unordered_set>
+#include <stdexcept>
 
 namespace runos {
 
@@ -42,6 +41,7 @@ PortImpl::PortImpl(SwitchImplPtr sw, of13::Port& port, QObject* parent)
     , current_speed_(port.curr_speed())
     , max_speed_(port.max_speed())
     , maintenance_(false)
+    , stats_(sw->stats_columns())
 {
     moveToThread(parent->thread());
     setParent(parent);
@@ -54,13 +54,6 @@ PortImpl::PortImpl(SwitchImplPtr sw, of13::Port& port, QObject* parent)
         max_speed_ = speed;
     }
 
-    traffic_stats_->emplace((+ForwardingType::Unicast)._to_string(),
-                            StatisticsStore<TrafficMeasurement>());
-    traffic_stats_->emplace((+ForwardingType::Multicast)._to_string(),
-                            StatisticsStore<TrafficMeasurement>());
-    traffic_stats_->emplace((+ForwardingType::Broadcast)._to_string(),
-                            StatisticsStore<TrafficMeasurement>());
-
     QObject::connect(this, &PortImpl::linkUp, sw.get(), &Switch::linkUp);
     QObject::connect(this, &PortImpl::linkDown, sw.get(), &Switch::linkDown);
     QObject::connect(this, &PortImpl::maintenanceStart, sw.get(), &Switch::portMaintenanceStart);
@@ -75,10 +68,45 @@ void PortImpl::start()
     }
 }
 
+Statistics<PortMeasurement> PortImpl::stats() const
+{
+    std::lock_guard<std::mutex> lock(stats_->mutex);
+    auto row = stats_->ports.find(number_);
+    return row == stats_->ports.npos ? Statistics<PortMeasurement>{}
+                                     : stats_->ports.get(row);
+}
+
+Statistics<QueueMeasurement> PortImpl::queue_stats(uint32_t qid) const
+{
+    std::lock_guard<std::mutex> lock(stats_->mutex);
+    auto row = stats_->queues.find(queue_stats_key(number_, qid));
+    if (row == stats_->queues.npos)
+        throw std::out_of_range("No such queue");
+    return stats_->queues.get(row);
+}
+
+Statistics<TrafficMeasurement> PortImpl::traffic_stats(ForwardingType type) const
+{
+    if (type == +ForwardingType::None)
+        throw std::out_of_range("No such forwarding type");
+
+    std::lock_guard<std::mutex> lock(stats_->mutex);
+    auto row = stats_->traffic.find(
+        traffic_stats_key(number_, type._to_integral()));
+    return row == stats_->traffic.npos ? Statistics<TrafficMeasurement>{}
+                                       : stats_->traffic.get(row);
+}
+
 std::vector<uint32_t> PortImpl::queues() const
 {
-    auto queues = queue_stats_.synchronize();
-    return *queues | ranges::view::keys;
+    std::vector<uint32_t> ret;
+    std::lock_guard<std::mutex> lock(stats_->mutex);
+    for (size_t row = 0; row < stats_->queues.size(); ++row) {
+        auto key = stats_->queues.key(row);
+        if (stats_key_port(key) == number_)
+            ret.push_back(uint32_t(key));
+    }
+    return ret;
 }
 
 void PortImpl::set_config(uint32_t config)
@@ -134,109 +162,47 @@ void PortImpl::process_event(of13::Port& port)
     }
 }
 
-void PortImpl::process_event(of13::PortStats stats)
+HistoryRange PortImpl::stats_history(size_t counter, history_time from,
+                                     history_time to) const
 {
-    PortMeasurement<uint64_t> m;
-
-    m.rx_packets() = stats.rx_packets();
-    m.tx_packets() = stats.tx_packets();
-    m.rx_bytes() = stats.rx_bytes();
-    m.tx_bytes() = stats.tx_bytes();
-    m.rx_dropped() = stats.rx_dropped();
-    m.tx_dropped() = stats.tx_dropped();
-    m.rx_errors() = stats.rx_errors();
-    m.tx_errors() = stats.tx_errors();
-
-    auto duration = std::chrono::seconds(stats.duration_sec())
-                  + std::chrono::nanoseconds(stats.duration_nsec());
-
-    //  if switch doesn't support duration params in port stats replies,
-    //  we use epoch duration for computing 'speed'
-    if (duration.count() == 0) {
-        duration = std::chrono::steady_clock::now().time_since_epoch();
-    }
-
-    stats_->append(duration, std::move(m));
+    std::lock_guard<std::mutex> lock(stats_->mutex);
+    auto row = stats_->ports.find(number_);
+    auto history = row == stats_->ports.npos ? nullptr
+                                             : stats_->ports.history(row);
+    return history ? history->query(counter, from, to) : HistoryRange{};
 }
 
-void PortImpl::process_event(std::vector<of13::QueueStats> stats)
+HistoryRange PortImpl::queue_stats_history(uint32_t qid, size_t counter,
+                                           history_time from,
+                                           history_time to) const
 {
-    auto store = queue_stats_.synchronize();
-
-    std::unordered_set<uint32_t> ids;
-
-    for (auto& s : stats) {
-        auto id = s.queue_id();
-        QueueMeasurement<uint64_t> m;
-
-        m.tx_bytes() = s.tx_bytes();
-        m.tx_packets() = s.tx_packets();
-        m.tx_errors() = s.tx_errors();
-
-        using std::chrono::seconds;
-        using std::chrono::nanoseconds;
-
-        (*store)[id].append( seconds(s.duration_sec())
-                           + nanoseconds(s.duration_nsec())
-                           , std::move(m) );
-
-        ids.insert(id);
-    }
-
-    // Remove unused queues
-    auto next = store->end();
-    for (auto it = store->begin(); it != store->end(); it = next) {
-        next = it; ++next;
-        if (ids.count(it->first) == 0)
-            store->erase(it);
-    }
+    std::lock_guard<std::mutex> lock(stats_->mutex);
+    auto row = stats_->queues.find(queue_stats_key(number_, qid));
+    if (row == stats_->queues.npos)
+        throw std::out_of_range("No such queue");
+    auto history = stats_->queues.history(row);
+    return history ? history->query(counter, from, to) : HistoryRange{};
 }
 
-void PortImpl::process_event(std::vector<of13::FlowStats> traffic_stats)
+std::pair<size_t, size_t> PortImpl::history_memory() const
 {
-    auto store = traffic_stats_.synchronize();
-    CHECK(traffic_stats.size() == 3);
-
-    auto guess_type = [](of13::FlowStats& fs) -> ForwardingType {
-        auto match = fs.match();
-
-        of13::EthDst* eth_dst = match.eth_dst();
-        if (eth_dst == nullptr) {
-            return ForwardingType::Unicast;
-        }
-
-        auto eth_dst_value = eth_dst->value().to_string();
-        if (eth_dst_value == "ff:ff:ff:ff:ff:ff") {
-            return ForwardingType::Broadcast;
+    std::pair<size_t, size_t> ret {0, 0};
+    auto add = [&ret](const auto* history) {
+        if (history) {
+            ret.first += history->memory();
+            ret.second += history->memory_limit();
         }
-
-        auto masked_value = eth_dst_value.substr(0, 2);
-        if (masked_value == "01") {
-            return ForwardingType::Multicast;
-        }
-
-        CHECK(false);
-        return ForwardingType::None;
     };
 
-    for (auto& flow : traffic_stats) {
-        TrafficMeasurement<uint64_t> m;
-
-        m.rx_packets() = flow.packet_count();
-        m.rx_bytes() = flow.byte_count();
-
-        auto duration = std::chrono::seconds(flow.duration_sec()) +
-                        std::chrono::nanoseconds(flow.duration_nsec());
-
-        //  if switch doesn't support duration params in port stats replies,
-        //  we use epoch duration for computing 'speed'
-        if (duration.count() == 0) {
-            duration = std::chrono::steady_clock::now().time_since_epoch();
-        }
-
-        ForwardingType traffic_type = guess_type(flow);
-        (*store)[traffic_type._to_string()].append(duration, std::move(m));
+    std::lock_guard<std::mutex> lock(stats_->mutex);
+    auto row = stats_->ports.find(number_);
+    if (row != stats_->ports.npos)
+        add(stats_->ports.history(row));
+    for (row = 0; row < stats_->queues.size(); ++row) {
+        if (stats_key_port(stats_->queues.key(row)) == number_)
+            add(stats_->queues.history(row));
     }
+    return ret;
 }
 
 bool PortImpl::disabled() const
@@ -22,11 +22,10 @@
 #include <chrono>
 
 #include <boost/thread/shared_mutex.hpp>
-#include <boost/thread/synchronized_value.hpp>
 #include <fluid/of13msg.hh>
 
 #include "api/Port.hpp"
-#include "StatisticsStore.hpp"
+#include "StatsColumns.hpp"
 
 namespace runos {
 
@@ -50,14 +49,16 @@ public:
     SwitchPtr switch_() const override { return sw_.lock(); }
 
     // Stats
-    Statistics<PortMeasurement> stats() const override
-    { return stats_->get(); }
+    Statistics<PortMeasurement> stats() const override;
+    Statistics<QueueMeasurement> queue_stats(uint32_t qid) const override;
+    Statistics<TrafficMeasurement> traffic_stats(ForwardingType type) const override;
 
-    Statistics<QueueMeasurement> queue_stats(uint32_t qid) const override
-    { return queue_stats_->at(qid).get(); }
-
-    Statistics<TrafficMeasurement> traffic_stats(ForwardingType type) const override
-    { return traffic_stats_->at(type._to_string()).get(); }
+    HistoryRange stats_history(size_t counter, history_time from,
+                               history_time to) const override;
+    HistoryRange queue_stats_history(uint32_t qid, size_t counter,
+                                     history_time from,
+                                     history_time to) const override;
+    std::pair<size_t, size_t> history_memory() const override;
 
     std::vector<uint32_t> queues() const override;
     
@@ -109,9 +110,6 @@ public:
     void set_offline();
 
     void process_event(of13::Port& port);
-    void process_event(of13::PortStats port_stats);
-    void process_event(std::vector<of13::QueueStats> queue_stats);
-    void process_event(std::vector<of13::FlowStats> traffic_stats);
 
 protected:
     friend class PortModImpl;
@@ -134,17 +132,8 @@ protected:
 
     bool maintenance_;
 
-    boost::synchronized_value<
-        StatisticsStore<PortMeasurement>
-    > stats_;
-
-    boost::synchronized_value<
-        std::unordered_map<uint32_t, StatisticsStore<QueueMeasurement>>
-    > queue_stats_;
-
-    boost::synchronized_value<
-        std::unordered_map<std::string, StatisticsStore<TrafficMeasurement>>
-    > traffic_stats_;
+    // rows of the port in the switch statistics
+    SwitchStatsColumnsPtr stats_;
 };
 
 class PortModImpl : public PortMod<mod_reuse_trait> {
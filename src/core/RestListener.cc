@@ -306,8 +306,13 @@ struct RestHandler {
         } else if (req.method == "GET") {
             rest::ptree resp;
             raw::RawPathExtractor path_parser(path(req));
+            std::string body, content_type;
+            bool rendered = false;
 
             dispatch(path_parser.path(), [&](rest::resource& r) {
+                rendered = r.Render(body, content_type);
+                if (rendered)
+                    return;
                 resp = r.Get();
                 if (path_parser.isRaw()) {
                     auto raw_path = path_parser.rawPath();
@@ -316,7 +321,11 @@ struct RestHandler {
                 }
             });
 
-            respond(req, connection, resp);
+            if (rendered) {
+                respond_rendered(connection, std::move(body), content_type);
+            } else {
+                respond(req, connection, resp);
+            }
         } else if (req.method == "PUT" || req.method == "POST") {
             bool post = req.method == "POST";
 
@@ -389,6 +398,23 @@ struct RestHandler {
         LOG(ERROR) << "Rest handler failed";
     }
 
+    void respond_rendered(
+        connection_ptr connection
+      , std::string body
+      , const std::string& content_type
+    ) try {
+        connection->set_status(connection::ok);
+        connection->set_headers(std::vector<rest_server::response_header>{
+            {"Content-Length", std::to_string(body.size())},
+            {"Content-Type", content_type}
+        });
+        connection->write( std::move(body) );
+    } catch (boost::system::system_error const& e) {
+        LOG(ERROR) << "Rest handler failed: " << e.what();
+    } catch (...) {
+        LOG(ERROR) << "Rest handler failed";
+    }
+
     void error(boost::system::error_code const& ec)
     {
         LOG(ERROR) << "Rest error: " << ec.message();
@@ -29,6 +29,7 @@
 #include <memory> // unique_ptr
 #include <functional> // function
 #include <regex>
+#include <string>
 
 namespace runos {
 
@@ -71,6 +72,11 @@ namespace rest {
         virtual ptree Delete()
         { THROW(http_error(405), "Unimplemented"); }
 
+        // Resources served as is instead of JSON of Get() write
+        // the body and its content type and return true
+        virtual bool Render(std::string&, std::string&) const
+        { return false; }
+
         // TODO: subscribe
     };
 
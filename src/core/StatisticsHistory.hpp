@@ -0,0 +1,392 @@
+/*
+ * Copyright 2019 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "api/Statistics.hpp"
+#include "lib/counter_series.hpp"
+
+namespace runos {
+
+// Resolution of the history: speeds are rolled up
+// to buckets of `step`, the last `length` buckets are kept
+struct HistoryLevel {
+    std::chrono::seconds step;
+    uint32_t length;
+};
+
+// Levels of histories created afterwards, finest first.
+// Set once from the config before switches connect.
+inline std::vector<HistoryLevel>& statistics_history_levels()
+{
+    using std::chrono::seconds;
+    static std::vector<HistoryLevel> levels {
+        { seconds(2), 300 },    // 10 minutes
+        { seconds(30), 720 },   // 6 hours
+        { seconds(300), 2016 }  // 7 days
+    };
+    return levels;
+}
+
+// Raw counters kept compressed for `retention`, finer than any level.
+// Zero retention disables it. Set once from the config like levels.
+struct RawHistory {
+    std::chrono::seconds retention;
+    uint32_t chunk_samples;
+};
+
+inline RawHistory& statistics_raw_history()
+{
+    static RawHistory raw { std::chrono::seconds(86400), 120 };
+    return raw;
+}
+
+// Fixed-memory history of speeds of every counter of the measurement.
+// Each level is a ring of buckets keeping min, max and time-weighted
+// average of the speeds appended within the bucket. Every sample is
+// rolled up into all levels at once, so coarse levels never lose
+// extremes of the fine ones. Rings grow up to their length as time
+// passes, memory is bounded by memory_limit().
+//
+// Counters themselves are also kept for the raw retention in
+// compressed chunks, so recent ranges are answered with exact extremes
+// and averages at any step.
+template<template<class> class Measurement>
+class StatisticsHistory {
+    // measurements are derived from std::array
+    template<class T, size_t N>
+    static constexpr size_t array_size(const std::array<T, N>*) { return N; }
+
+public:
+    using clock = std::chrono::system_clock;
+    static constexpr size_t counters =
+        array_size(static_cast<Measurement<double>*>(nullptr));
+
+    explicit StatisticsHistory(const std::vector<HistoryLevel>& levels
+                                   = statistics_history_levels(),
+                               const RawHistory& raw = statistics_raw_history())
+        : raw_retention_(raw.retention)
+        , raw_(raw.chunk_samples)
+    {
+        for (const auto& level : levels) {
+            if (level.step.count() > 0 && level.length > 0) {
+                rings_.push_back(Ring{ level, 0, 0, {} });
+            }
+        }
+    }
+
+    // Speeds measured over the interval ended at time
+    // and the counters at time
+    void append(clock::time_point time, std::chrono::duration<double> interval,
+                const Measurement<double>& speed,
+                const Measurement<uint64_t>& integral)
+    {
+        if (raw_retention_.count() > 0) {
+            auto ms = milliseconds(time);
+            typename RawSeries::Values values;
+            std::copy(integral.begin(), integral.end(), values.begin());
+            raw_.append(ms, values);
+            raw_last_ = ms;
+            raw_.trim(ms - std::chrono::duration_cast<std::chrono::milliseconds>(
+                               raw_retention_).count());
+        }
+
+        auto seconds = std::chrono::duration_cast<std::chrono::seconds>(
+                           time.time_since_epoch()).count();
+        auto covered = float(interval.count());
+
+        for (auto& ring : rings_) {
+            auto& bucket = ring.at(seconds / ring.level.step.count());
+            bucket.covered += covered;
+            for (size_t i = 0; i < counters; ++i) {
+                auto value = float(speed[i]);
+                bucket.sum[i] += value * covered;
+                bucket.min[i] = std::min(bucket.min[i], value);
+                bucket.max[i] = std::max(bucket.max[i], value);
+            }
+        }
+    }
+
+    // Speeds of the counter in [from, to] at the finest level
+    // still keeping `from`
+    HistoryRange query(size_t counter, clock::time_point from,
+                       clock::time_point to) const
+    {
+        using std::chrono::seconds;
+        using std::chrono::duration_cast;
+
+        HistoryRange ret {};
+        if (counter >= counters || to < from) {
+            return ret;
+        }
+        if (not raw_.empty() && raw_.first_time() <= milliseconds(from)) {
+            return query_raw(counter, from, to);
+        }
+        if (rings_.empty()) {
+            return ret;
+        }
+
+        auto from_sec = duration_cast<seconds>(from.time_since_epoch()).count();
+        auto to_sec = duration_cast<seconds>(to.time_since_epoch()).count();
+
+        auto ring = std::find_if(rings_.begin(), rings_.end(),
+            [from_sec](const Ring& ring) {
+                return ring.last - int64_t(ring.level.length) <
+                       from_sec / ring.level.step.count();
+            });
+        if (ring == rings_.end()) {
+            --ring;
+        }
+
+        auto step = ring->level.step.count();
+        auto first = std::max(from_sec / step,
+                              ring->last - int64_t(ring->level.length) + 1);
+        auto last = std::min(to_sec / step, ring->last);
+
+        double sum = 0.0, covered = 0.0;
+        ret.step = ring->level.step;
+        ret.min = std::numeric_limits<double>::max();
+        ret.max = 0.0;
+        for (auto index = first; index <= last; ++index) {
+            auto bucket = ring->find(index);
+            if (not bucket || bucket->covered <= 0) {
+                continue;
+            }
+            ret.points.push_back(HistoryPoint{
+                index * step,
+                bucket->sum[counter] / bucket->covered,
+                bucket->min[counter],
+                bucket->max[counter]
+            });
+            ret.min = std::min<double>(ret.min, bucket->min[counter]);
+            ret.max = std::max<double>(ret.max, bucket->max[counter]);
+            sum += bucket->sum[counter];
+            covered += bucket->covered;
+        }
+
+        if (ret.points.empty()) {
+            ret.min = 0.0;
+        } else {
+            ret.avg = sum / covered;
+        }
+        return ret;
+    }
+
+    std::vector<HistoryLevel> levels() const
+    {
+        std::vector<HistoryLevel> ret;
+        for (const auto& ring : rings_) {
+            ret.push_back(ring.level);
+        }
+        return ret;
+    }
+
+    // Allocated bytes
+    size_t memory() const
+    {
+        size_t ret = sizeof(*this) + raw_.memory();
+        for (const auto& ring : rings_) {
+            ret += ring.buckets.capacity() * sizeof(Bucket);
+        }
+        return ret;
+    }
+
+    // Bytes allocated when all rings are full, compressed
+    // counters are extrapolated to the raw retention
+    size_t memory_limit() const
+    {
+        size_t ret = sizeof(*this) + raw_.memory();
+        for (const auto& ring : rings_) {
+            ret += ring.level.length * sizeof(Bucket);
+        }
+
+        auto span = double(raw_last_ - raw_.first_time());
+        auto retention = double(std::chrono::duration_cast<
+            std::chrono::milliseconds>(raw_retention_).count());
+        if (not raw_.empty() && span > 0 && span < retention) {
+            ret += size_t(double(raw_.memory()) * (retention - span) / span);
+        }
+        return ret;
+    }
+
+    void clear()
+    {
+        for (auto& ring : rings_) {
+            ring.buckets.clear();
+        }
+        raw_.clear();
+    }
+
+private:
+    using RawSeries = CounterSeries<counters>;
+
+    static int64_t milliseconds(clock::time_point time)
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+                   time.time_since_epoch()).count();
+    }
+
+    // Speeds between consecutive samples rolled up to buckets
+    // of the finest level step, or coarser to keep as many points
+    HistoryRange query_raw(size_t counter, clock::time_point from,
+                           clock::time_point to) const
+    {
+        using std::chrono::seconds;
+
+        int64_t step = rings_.empty() ? 1 : rings_.front().level.step.count();
+        int64_t max_points = rings_.empty() ? 300 : rings_.front().level.length;
+        int64_t span = milliseconds(to) / 1000 - milliseconds(from) / 1000 + 1;
+        if (span > step * max_points) {
+            step *= (span + step * max_points - 1) / (step * max_points);
+        }
+
+        HistoryRange ret {};
+        ret.step = seconds(step);
+        ret.min = std::numeric_limits<double>::max();
+        ret.max = 0.0;
+
+        HistoryPoint* point = nullptr;
+        double point_sum = 0.0, point_covered = 0.0;
+        double sum = 0.0, covered = 0.0;
+        auto close = [&]() {
+            if (point && point_covered > 0) {
+                point->avg = point_sum / point_covered;
+            }
+        };
+
+        bool first = true;
+        int64_t prev_time = 0;
+        uint64_t prev_value = 0;
+        raw_.scan(milliseconds(from), milliseconds(to),
+            [&](int64_t time, const typename RawSeries::Values& values) {
+                auto value = values[counter];
+                if (first || time <= prev_time) {
+                    first = false;
+                    prev_time = time;
+                    prev_value = value;
+                    return;
+                }
+
+                // counters going back are counted from zero
+                double interval = double(time - prev_time) / 1000;
+                double speed = double(value >= prev_value ? value - prev_value
+                                                          : value) / interval;
+                prev_time = time;
+                prev_value = value;
+
+                auto index = (time / 1000) / step;
+                if (not point || point->time != index * step) {
+                    close();
+                    ret.points.push_back(HistoryPoint{
+                        index * step, 0.0,
+                        std::numeric_limits<double>::max(), 0.0
+                    });
+                    point = &ret.points.back();
+                    point_sum = point_covered = 0.0;
+                }
+                point->min = std::min(point->min, speed);
+                point->max = std::max(point->max, speed);
+                point_sum += speed * interval;
+                point_covered += interval;
+                ret.min = std::min(ret.min, speed);
+                ret.max = std::max(ret.max, speed);
+                sum += speed * interval;
+                covered += interval;
+            });
+        close();
+
+        if (ret.points.empty()) {
+            ret.min = 0.0;
+        } else {
+            ret.avg = sum / covered;
+        }
+        return ret;
+    }
+
+    struct Bucket {
+        int64_t index {-1}; // start time / step
+        float covered {0};  // seconds of the samples
+        std::array<float, counters> sum {};  // speed * seconds
+        std::array<float, counters> min;
+        std::array<float, counters> max {};
+
+        Bucket() { min.fill(std::numeric_limits<float>::max()); }
+    };
+
+    struct Ring {
+        HistoryLevel level;
+        int64_t origin; // index of the first bucket, kept at slot 0
+        int64_t last;   // index of the latest bucket
+        std::vector<Bucket> buckets;
+
+        size_t slot(int64_t index) const
+        {
+            auto length = int64_t(level.length);
+            return size_t(((index - origin) % length + length) % length);
+        }
+
+        Bucket& at(int64_t index)
+        {
+            if (buckets.empty() || index + int64_t(level.length) <= last) {
+                // first sample, or clock went back beyond the ring
+                buckets.clear();
+                origin = last = index;
+            }
+
+            auto s = slot(index);
+            if (s >= buckets.size()) {
+                if (s >= buckets.capacity()) {
+                    // grow geometrically, but never beyond the length
+                    buckets.reserve(std::min<size_t>(level.length,
+                        std::max(buckets.capacity() * 2, s + 1)));
+                }
+                buckets.resize(s + 1);
+            }
+            if (buckets[s].index != index) {
+                buckets[s] = Bucket();
+                buckets[s].index = index;
+            }
+            last = std::max(last, index);
+            return buckets[s];
+        }
+
+        const Bucket* find(int64_t index) const
+        {
+            if (buckets.empty()) {
+                return nullptr;
+            }
+            auto s = slot(index);
+            if (s >= buckets.size() || buckets[s].index != index) {
+                return nullptr;
+            }
+            return &buckets[s];
+        }
+    };
+
+    std::vector<Ring> rings_;
+    std::chrono::seconds raw_retention_;
+    RawSeries raw_;
+    int64_t raw_last_ {0};
+};
+
+} // namespace runos
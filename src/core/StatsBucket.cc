@@ -21,6 +21,7 @@
 #include <runos/core/catch_all.hpp>
 
 #include "StatisticsStore.hpp"
+#include "StatsPollScheduler.hpp"
 #include "OFServer.hpp"
 
 #include "lib/qt_executor.hpp"
@@ -32,7 +33,11 @@
 #include <range/v3/to_container.hpp>
 #include <range/v3/view/transform.hpp>
 
+#include <algorithm>
 #include <unordered_map>
+#include <map>
+#include <mutex>
+#include <tuple>
 #include <iterator> // begin, end, move
 #include <chrono>
 #include <atomic>
@@ -40,7 +45,95 @@
 
 namespace runos {
 
-REGISTER_APPLICATION(StatsBucketManager, {"of-server", ""})
+REGISTER_APPLICATION(StatsBucketManager, {"of-server", "stats-poll-scheduler", ""})
+
+namespace {
+
+// OXM TLV of the match, compared regardless of fields order
+struct OxmField {
+    uint32_t type;          // class and field, without hasmask and length
+    std::string value;
+    std::string mask;       // empty if not masked
+};
+
+using OxmFields = std::vector<OxmField>;
+
+OxmFields parseMatch(of13::Match match)
+{
+    static constexpr size_t MATCH_HEADER_LEN = 4;
+    static constexpr size_t OXM_FIELD_SIZE = of13::OFP_OXM_HEADER_LEN +
+                                             2 * sizeof(uint32_t);
+
+    std::vector<uint8_t> buf(match.length() +
+                             match.oxm_fields_len() * OXM_FIELD_SIZE);
+    match.pack(buf.data());
+
+    size_t match_len = std::min<size_t>((size_t(buf[2]) << 8) | buf[3],
+                                        buf.size());
+    OxmFields ret;
+    for (size_t offset = MATCH_HEADER_LEN;
+         offset + of13::OFP_OXM_HEADER_LEN <= match_len; ) {
+        const uint8_t* header = buf.data() + offset;
+        size_t len = header[3];
+        if (offset + of13::OFP_OXM_HEADER_LEN + len > match_len) {
+            break;
+        }
+
+        OxmField field;
+        field.type = (uint32_t(header[0]) << 16) |
+                     (uint32_t(header[1]) << 8) |
+                     (header[2] >> 1);
+        auto value = reinterpret_cast<const char*>(header) +
+                     of13::OFP_OXM_HEADER_LEN;
+        if (header[2] & 1) {
+            field.value.assign(value, len / 2);
+            field.mask.assign(value + len / 2, len / 2);
+        } else {
+            field.value.assign(value, len);
+        }
+        ret.push_back(std::move(field));
+        offset += of13::OFP_OXM_HEADER_LEN + len;
+    }
+    return ret;
+}
+
+// Non-strict OpenFlow match: does the aggregate request with `selector`
+// count the flow entry with `entry` match
+bool covers(const OxmFields& selector, const OxmFields& entry)
+{
+    for (const auto& s : selector) {
+        auto e = std::find_if(entry.begin(), entry.end(),
+            [&s](const OxmField& f) { return f.type == s.type; });
+        if (e == entry.end() || e->value.size() != s.value.size()) {
+            return false;
+        }
+        for (size_t i = 0; i < s.value.size(); ++i) {
+            uint8_t smask = s.mask.empty() ? 0xff : uint8_t(s.mask[i]);
+            uint8_t emask = e->mask.empty() ? 0xff : uint8_t(e->mask[i]);
+            if ((emask & smask) != smask ||
+                ((e->value[i] ^ s.value[i]) & smask) != 0) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Poll of the object while it is alive
+template<class T>
+StatsPollScheduler::PollFunction weakPoll(const std::shared_ptr<T>& object)
+{
+    return [weak = std::weak_ptr<T>(object)]() -> future<void> {
+        if (auto self = weak.lock()) {
+            return self->update();
+        }
+        return make_ready_future();
+    };
+}
+
+} // namespace
+
+class FlowStatsGroup;
 
 class FlowStatsBucketImpl : public FlowStatsBucket
                           , public std::enable_shared_from_this<FlowStatsBucketImpl>
@@ -104,7 +197,15 @@ public:
         per_request_stats_.resize( dpids_.size() * requests_.size() );
     }
 
-    void start(OFServer* ofserver, std::chrono::milliseconds period);
+    ~FlowStatsBucketImpl()
+    {
+        if (scheduler_) {
+            scheduler_->remove(task_);
+        }
+    }
+
+    void start(OFServer* ofserver, StatsPollScheduler* scheduler,
+               std::chrono::milliseconds period);
 
     // observers
     int id() const override { return id_; }
@@ -115,10 +216,14 @@ public:
         return aggregated_stats_.get();
     }
 
-    void update();
+    // Served by the group instead of own requests
+    void join(std::shared_ptr<FlowStatsGroup> group) { group_ = std::move(group); }
+    const std::vector<ofp::flow_stats_request>& requests() const { return requests_; }
+    const std::vector<uint64_t>& dpids() const { return dpids_; }
 
-protected:
-    void timerEvent(QTimerEvent*) override;
+    future<void> update();
+    void process(const FlowMeasurement<uint64_t>& acc);
+    const FlowMeasurement<uint64_t>& last() const { return last_; }
 
 private:
     using stats_store_type
@@ -135,6 +240,10 @@ private:
     std::chrono::steady_clock clock_;
     stats_store_type aggregated_stats_;
     std::vector< ofp::aggregate_stats > per_request_stats_;
+    FlowMeasurement<uint64_t> last_ {};
+    std::shared_ptr<FlowStatsGroup> group_;
+    StatsPollScheduler* scheduler_ {nullptr};
+    StatsPollScheduler::TaskId task_ {0};
 
     qt_executor executor {this};
     std::vector<OFAgentPtr> agents;
@@ -145,14 +254,83 @@ std::atomic<int> FlowStatsBucketImpl::next_id {0};
 using FlowStatsBucketImplPtr = std::shared_ptr<FlowStatsBucketImpl>;
 using FlowStatsBucketImplWeakPtr = std::weak_ptr<FlowStatsBucketImpl>;
 
-void FlowStatsBucketImpl::start(OFServer* ofserver, std::chrono::milliseconds period)
+// Buckets of one switch selecting flows of the same table and cookie.
+// Flow entries are requested once per period and the aggregates
+// of the buckets are computed from them, so the switch answers
+// one flow stats request instead of an aggregate one per bucket.
+class FlowStatsGroup : public QObject
+                     , public std::enable_shared_from_this<FlowStatsGroup>
+{
+    Q_OBJECT
+
+public:
+    // dpid, table, cookie, cookie mask, period
+    using Key = std::tuple<uint64_t, uint8_t, uint64_t, uint64_t, int64_t>;
+
+    FlowStatsGroup(uint64_t dpid, ofp::flow_stats_request request,
+                   std::chrono::milliseconds period, QObject* parent)
+        : dpid_(dpid)
+        , request_(std::move(request))
+        , period_(period)
+    {
+        moveToThread(parent->thread());
+        request_.match = of13::Match();
+    }
+
+    static Key key(const FlowStatsBucketImpl& bucket,
+                   std::chrono::milliseconds period)
+    {
+        const auto& req = bucket.requests().front();
+        return Key{ bucket.dpids().front(), req.table_id,
+                    req.cookie, req.cookie_mask, period.count() };
+    }
+
+    ~FlowStatsGroup()
+    {
+        if (scheduler_) {
+            scheduler_->remove(task_);
+        }
+    }
+
+    void start(OFServer* ofserver, StatsPollScheduler* scheduler);
+    void join(const FlowStatsBucketImplPtr& bucket);
+    future<void> update();
+
+private:
+    struct Member {
+        FlowStatsBucketImplWeakPtr bucket;
+        OxmFields match;
+    };
+
+    const uint64_t dpid_;
+    ofp::flow_stats_request request_;
+    const std::chrono::milliseconds period_;
+
+    OFAgentPtr agent_;
+    StatsPollScheduler* scheduler_ {nullptr};
+    StatsPollScheduler::TaskId task_ {0};
+    std::mutex mutex_;
+    std::vector<Member> members_;
+
+    qt_executor executor {this};
+
+    void demultiplex(const OFAgent::sequence<of13::FlowStats>& flows);
+    std::vector<std::pair<FlowStatsBucketImplPtr, OxmFields>> alive();
+};
+
+using FlowStatsGroupPtr = std::shared_ptr<FlowStatsGroup>;
+using FlowStatsGroupWeakPtr = std::weak_ptr<FlowStatsGroup>;
+
+void FlowStatsBucketImpl::start(OFServer* ofserver,
+                                StatsPollScheduler* scheduler,
+                                std::chrono::milliseconds period)
 {
     auto futures = dpids_
         | ranges::view::transform([&](auto id) { return ofserver->agent(id); })
         | ranges::to_<std::vector>();
 
     when_all_fix(futures.begin(), futures.end()).then(executor,
-        [self = shared_from_this(), period](auto ret) {
+        [self = shared_from_this(), scheduler, period](auto ret) {
             VLOG(10) << "Activating stats bucket " << self->id()
                 << " (" << self->name() << ')';
 
@@ -160,21 +338,15 @@ void FlowStatsBucketImpl::start(OFServer* ofserver, std::chrono::milliseconds pe
                 self->agents_.push_back(agent.get());
             }
 
-            self->startTimer(period.count());
-            self->update();
+            // buckets of several switches are limited by the global budget
+            auto dpid = self->dpids_.size() == 1 ? self->dpids_.front() : 0;
+            self->scheduler_ = scheduler;
+            self->task_ = scheduler->add(PollType::Buckets, dpid, period,
+                                         weakPoll(self));
         });
 }
 
-void FlowStatsBucketImpl::timerEvent(QTimerEvent*)
-try {
-    update();
-} catch (std::bad_weak_ptr const&) {
-    // shared_ptr control block may be destroyed before
-    // QObject deleted by deleteLater(), so ignore this
-    // exception (caused by shared_from_this())
-}
-
-void FlowStatsBucketImpl::update()
+future<void> FlowStatsBucketImpl::update()
 {
     using future_vector =
         std::vector< future<ofp::aggregate_stats> >;
@@ -198,7 +370,7 @@ void FlowStatsBucketImpl::update()
         }
     }
 
-    when_all_fix(futures.begin(), futures.end()).then(executor,
+    return when_all_fix(futures.begin(), futures.end()).then(executor,
         [self = shared_from_this()](future< future_vector > result) {
             VLOG(10) << "Entering flow stats continuation";
 
@@ -222,13 +394,121 @@ void FlowStatsBucketImpl::update()
                 ++j;
             }
 
-            VLOG(10) << "Bucket " << self->id() << " (" << self->name() << ") updated";
-            self->aggregated_stats_.append(self->clock_.now().time_since_epoch(), acc);
-            emit self->updated();
+            self->process(acc);
         }
     );
 }
 
+void FlowStatsBucketImpl::process(const FlowMeasurement<uint64_t>& acc)
+{
+    VLOG(10) << "Bucket " << id() << " (" << name() << ") updated";
+    last_ = acc;
+    aggregated_stats_.append(clock_.now().time_since_epoch(), acc);
+    emit updated();
+}
+
+///////////////////////////
+//         Group         //
+///////////////////////////
+
+void FlowStatsGroup::start(OFServer* ofserver, StatsPollScheduler* scheduler)
+{
+    ofserver->agent(dpid_).then(executor,
+        [self = shared_from_this(), scheduler](future<OFAgentPtr> agent) {
+            VLOG(10) << "Activating flow stats group of switch " << self->dpid_;
+
+            self->agent_ = agent.get();
+            self->scheduler_ = scheduler;
+            self->task_ = scheduler->add(PollType::Buckets, self->dpid_,
+                                         self->period_, weakPoll(self));
+        });
+}
+
+void FlowStatsGroup::join(const FlowStatsBucketImplPtr& bucket)
+{
+    Member member { bucket, parseMatch(bucket->requests().front().match) };
+    bucket->join(shared_from_this());
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    members_.push_back(std::move(member));
+}
+
+auto FlowStatsGroup::alive()
+    -> std::vector<std::pair<FlowStatsBucketImplPtr, OxmFields>>
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    members_.erase(std::remove_if(members_.begin(), members_.end(),
+        [](const Member& m) { return m.bucket.expired(); }),
+        members_.end());
+
+    std::vector<std::pair<FlowStatsBucketImplPtr, OxmFields>> ret;
+    for (const auto& m : members_) {
+        if (auto bucket = m.bucket.lock()) {
+            ret.emplace_back(std::move(bucket), m.match);
+        }
+    }
+    return ret;
+}
+
+future<void> FlowStatsGroup::update()
+{
+    if (not agent_) {
+        return make_ready_future();
+    }
+
+    try {
+        return agent_->request_flow_stats(request_).then(executor,
+            [self = shared_from_this()]
+            (future<OFAgent::sequence<of13::FlowStats>> flows) {
+                VLOG(10) << "Entering flow stats group continuation";
+                try {
+                    self->demultiplex(flows.get());
+                    return;
+                } catch (OFAgent::openflow_error const& ex) {
+                    VLOG(10) << "Failed to get flow stats of switch "
+                             << self->dpid_ << ":";
+                    diagnostic_information::get().log();
+                }
+                // keep the buckets updated with the last values
+                for (auto& member : self->alive()) {
+                    member.first->process(member.first->last());
+                }
+            });
+    } catch (OFAgent::request_error const& ex) {
+        VLOG(10) << "Failed to request flow stats of switch " << dpid_;
+        for (auto& member : alive()) {
+            member.first->process(member.first->last());
+        }
+        return make_ready_future();
+    }
+}
+
+void FlowStatsGroup::demultiplex(const OFAgent::sequence<of13::FlowStats>& flows)
+{
+    std::vector<OxmFields> matches;
+    matches.reserve(flows.size());
+    for (auto flow : flows) {
+        matches.push_back(parseMatch(flow.match()));
+    }
+
+    for (auto& member : alive()) {
+        FlowMeasurement<uint64_t> acc;
+        ranges::fill(acc, 0);
+
+        for (size_t i = 0; i < matches.size(); ++i) {
+            if (not covers(member.second, matches[i])) {
+                continue;
+            }
+            auto flow = flows[i];
+            acc.packets() += flow.packet_count();
+            acc.bytes() += flow.byte_count();
+            acc.flows() += 1;
+        }
+
+        member.first->process(acc);
+    }
+}
+
 ///////////////////////////
 //        Manager        //
 ///////////////////////////
@@ -236,9 +516,11 @@ void FlowStatsBucketImpl::update()
 struct StatsBucketManager::implementation
 {
     OFServer* ofserver;
+    StatsPollScheduler* scheduler;
     mutable boost::shared_mutex mutex;
     std::unordered_map<int, FlowStatsBucketImplWeakPtr> bucket;
     std::unordered_map<std::string, FlowStatsBucketImplWeakPtr> bucket_by_name;
+    std::map<FlowStatsGroup::Key, FlowStatsGroupWeakPtr> group;
 };
 
 StatsBucketManager::StatsBucketManager()
@@ -250,6 +532,7 @@ StatsBucketManager::~StatsBucketManager() noexcept = default;
 void StatsBucketManager::init(Loader* loader, const Config&)
 {
     impl->ofserver = OFServer::get(loader);
+    impl->scheduler = StatsPollScheduler::get(loader);
 }
 
 auto StatsBucketManager::bucket(int id) const
@@ -274,21 +557,53 @@ auto StatsBucketManager::aggregateFlows(duration poll_interval,
                                         FlowSelector selector)
     -> FlowStatsBucketPtr
 {
+    using namespace flow_selector;
+
+    // Buckets of a single switch selected by cookie
+    // are served by the shared request of their group
+    bool grouped = selector.get(dpid) && selector.get(dpid)->size() == 1 &&
+                   selector.get(cookie) &&
+                   not selector.get(out_port) && not selector.get(out_group);
+
     FlowStatsBucketImplPtr bucket {new FlowStatsBucketImpl(
         std::move(name),
         std::move(selector),
         this
     ), std::mem_fn(&QObject::deleteLater)};
 
+    FlowStatsGroupPtr new_group;
+    FlowStatsGroupPtr group;
     {
         boost::unique_lock< boost::shared_mutex > lock(impl->mutex);
         impl->bucket[bucket->id()] = bucket;
         if (not bucket->name().empty()) {
             impl->bucket_by_name[bucket->name()] = bucket;
         }
+
+        if (grouped) {
+            auto key = FlowStatsGroup::key(*bucket, poll_interval);
+            group = impl->group[key].lock();
+            if (not group) {
+                group.reset(new FlowStatsGroup(
+                    bucket->dpids().front(),
+                    bucket->requests().front(),
+                    poll_interval,
+                    this
+                ), std::mem_fn(&QObject::deleteLater));
+                impl->group[key] = group;
+                new_group = group;
+            }
+        }
     }
 
-    bucket->start(impl->ofserver, poll_interval);
+    if (group) {
+        group->join(bucket);
+        if (new_group) {
+            new_group->start(impl->ofserver, impl->scheduler);
+        }
+    } else {
+        bucket->start(impl->ofserver, impl->scheduler, poll_interval);
+    }
     return bucket;
 }
 
@@ -0,0 +1,315 @@
+/*
+ * Copyright 2019 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "api/Statistics.hpp"
+#include "StatisticsHistory.hpp"
+
+namespace runos {
+
+// Statistics of all rows of one reply type of a switch (ports, queues
+// or traffic types) kept column by column. Replies are appended row
+// by row into buffers reused between polls, then speeds and maxima
+// of all rows are computed by commit() in one pass over contiguous
+// columns. Speeds follow StatisticsStore: counters going back are
+// counted from zero, time going back resets the row.
+template<template<class> class Measurement>
+class StatsColumns {
+public:
+    using statistics_type = Statistics<Measurement>;
+    using history_type = StatisticsHistory<Measurement>;
+    using fpseconds = std::chrono::duration<double>;
+    static constexpr size_t counters = history_type::counters;
+    static constexpr size_t npos = std::numeric_limits<size_t>::max();
+
+    explicit StatsColumns(bool history = false)
+        : history_enabled_(history)
+    { }
+
+    size_t size() const { return keys_.size(); }
+    uint64_t key(size_t row) const { return keys_[row]; }
+
+    size_t find(uint64_t key) const
+    {
+        auto it = index_.find(key);
+        return it == index_.end() ? npos : it->second;
+    }
+
+    // Starts a reply, rows not appended until commit() keep their values
+    void begin()
+    {
+        std::fill(updated_.begin(), updated_.end(), 0);
+        cursor_ = 0;
+    }
+
+    template<class... Values>
+    void append(uint64_t key, fpseconds time, Values... values)
+    {
+        static_assert(sizeof...(Values) == counters,
+                      "every counter of the measurement is required");
+        auto row = lookup(key);
+        if (curr_time_[row] > time.count()) {
+            reset(row);
+        }
+        prev_time_[row] = curr_time_[row];
+        curr_time_[row] = time.count();
+        updated_[row] = 1;
+
+        size_t c = 0;
+        // expands to assignments in counter order
+        (void) std::initializer_list<int>{
+            (shift(c++, row, uint64_t(values)), 0)...
+        };
+    }
+
+    // Computes speeds of the rows appended since begin()
+    void commit()
+    {
+        const size_t n = size();
+        less_.assign(n, 0);
+        decided_.assign(n, 0);
+        inv_delta_.resize(n);
+
+        // measurements are compared lexicographically, as std::array
+        for (size_t c = 0; c < counters; ++c) {
+            const uint64_t* curr = curr_[c].data();
+            const uint64_t* prev = prev_[c].data();
+            for (size_t i = 0; i < n; ++i) {
+                uint8_t diff = curr[i] != prev[i];
+                less_[i] |= (decided_[i] ^ 1) & diff & uint8_t(curr[i] < prev[i]);
+                decided_[i] |= diff;
+            }
+        }
+
+        for (size_t i = 0; i < n; ++i) {
+            double delta = curr_time_[i] - prev_time_[i];
+            inv_delta_[i] = delta > 0 ? 1.0 / delta : 0.0;
+        }
+
+        for (size_t c = 0; c < counters; ++c) {
+            uint64_t* prev = prev_[c].data();
+            const uint64_t* curr = curr_[c].data();
+            double* speed = speed_[c].data();
+            double* max = max_[c].data();
+            for (size_t i = 0; i < n; ++i) {
+                // branchless, only rows appended since begin() change
+                uint64_t mask = -uint64_t(less_[i] & updated_[i]);
+                prev[i] &= ~mask;
+                double s = double(curr[i] - prev[i]) * inv_delta_[i];
+                speed[i] = updated_[i] ? s : speed[i];
+                max[i] = std::max(max[i], speed[i]);
+            }
+        }
+
+        if (not history_enabled_)
+            return;
+
+        auto now = std::chrono::system_clock::now();
+        for (size_t i = 0; i < n; ++i) {
+            // the first sample after reset has no interval
+            if (updated_[i] && prev_time_[i] > 0) {
+                history_[i]->append(now, fpseconds(curr_time_[i] - prev_time_[i]),
+                                    row_speed(i), row_integral(i));
+            }
+        }
+    }
+
+    statistics_type get(size_t row) const
+    {
+        statistics_type ret;
+        for (size_t c = 0; c < counters; ++c) {
+            ret.integral[c] = curr_[c][row];
+            ret.current_speed[c] = speed_[c][row];
+            ret.max_speed[c] = max_[c][row];
+        }
+        return ret;
+    }
+
+    // nullptr if history is not enabled
+    const history_type* history(size_t row) const
+    {
+        return history_enabled_ ? history_[row].get() : nullptr;
+    }
+
+    // Removes rows matching pred(key, updated since begin())
+    template<class Pred>
+    void erase_if(Pred&& pred)
+    {
+        size_t out = 0;
+        for (size_t i = 0; i < size(); ++i) {
+            if (pred(keys_[i], bool(updated_[i])))
+                continue;
+            if (out != i)
+                move_row(i, out);
+            ++out;
+        }
+        if (out == size())
+            return;
+
+        resize(out);
+        index_.clear();
+        for (size_t i = 0; i < out; ++i) {
+            index_.emplace(keys_[i], i);
+        }
+        cursor_ = 0;
+    }
+
+private:
+    bool history_enabled_;
+
+    std::vector<uint64_t> keys_;
+    std::unordered_map<uint64_t, size_t> index_;
+    size_t cursor_ {0};
+
+    std::vector<double> prev_time_;
+    std::vector<double> curr_time_;
+    std::array<std::vector<uint64_t>, counters> prev_;
+    std::array<std::vector<uint64_t>, counters> curr_;
+    std::array<std::vector<double>, counters> speed_;
+    std::array<std::vector<double>, counters> max_;
+    std::vector<uint8_t> updated_;
+    std::vector<std::unique_ptr<history_type>> history_;
+
+    // scratch columns of commit()
+    std::vector<uint8_t> less_;
+    std::vector<uint8_t> decided_;
+    std::vector<double> inv_delta_;
+
+    size_t lookup(uint64_t key)
+    {
+        // replies usually list rows in the order of the previous one
+        if (cursor_ < size() && keys_[cursor_] == key)
+            return cursor_++;
+
+        auto it = index_.find(key);
+        if (it != index_.end()) {
+            cursor_ = it->second + 1;
+            return it->second;
+        }
+
+        auto row = size();
+        resize(row + 1);
+        keys_[row] = key;
+        index_.emplace(key, row);
+        if (history_enabled_)
+            history_[row].reset(new history_type());
+        cursor_ = row + 1;
+        return row;
+    }
+
+    void shift(size_t c, size_t row, uint64_t value)
+    {
+        prev_[c][row] = curr_[c][row];
+        curr_[c][row] = value;
+    }
+
+    void reset(size_t row)
+    {
+        prev_time_[row] = curr_time_[row] = 0;
+        for (size_t c = 0; c < counters; ++c) {
+            prev_[c][row] = curr_[c][row] = 0;
+        }
+    }
+
+    Measurement<double> row_speed(size_t row) const
+    {
+        Measurement<double> ret;
+        for (size_t c = 0; c < counters; ++c) {
+            ret[c] = speed_[c][row];
+        }
+        return ret;
+    }
+
+    Measurement<uint64_t> row_integral(size_t row) const
+    {
+        Measurement<uint64_t> ret;
+        for (size_t c = 0; c < counters; ++c) {
+            ret[c] = curr_[c][row];
+        }
+        return ret;
+    }
+
+    void resize(size_t n)
+    {
+        keys_.resize(n);
+        prev_time_.resize(n, 0);
+        curr_time_.resize(n, 0);
+        for (size_t c = 0; c < counters; ++c) {
+            prev_[c].resize(n, 0);
+            curr_[c].resize(n, 0);
+            speed_[c].resize(n, 0);
+            max_[c].resize(n, 0);
+        }
+        updated_.resize(n, 0);
+        history_.resize(n);
+    }
+
+    void move_row(size_t from, size_t to)
+    {
+        keys_[to] = keys_[from];
+        prev_time_[to] = prev_time_[from];
+        curr_time_[to] = curr_time_[from];
+        for (size_t c = 0; c < counters; ++c) {
+            prev_[c][to] = prev_[c][from];
+            curr_[c][to] = curr_[c][from];
+            speed_[c][to] = speed_[c][from];
+            max_[c][to] = max_[c][from];
+        }
+        updated_[to] = updated_[from];
+        history_[to] = std::move(history_[from]);
+    }
+};
+
+// Rows of queues and traffic types are keyed by the port number
+// in the high half
+inline uint64_t queue_stats_key(uint32_t port_no, uint32_t queue_id)
+{
+    return (uint64_t(port_no) << 32) | queue_id;
+}
+
+inline uint64_t traffic_stats_key(uint32_t port_no, uint32_t type)
+{
+    return (uint64_t(port_no) << 32) | type;
+}
+
+inline uint32_t stats_key_port(uint64_t key)
+{
+    return uint32_t(key >> 32);
+}
+
+// Columns of all statistics of a switch, shared with its ports
+struct SwitchStatsColumns {
+    mutable std::mutex mutex;
+    StatsColumns<PortMeasurement> ports {true};
+    StatsColumns<QueueMeasurement> queues {true};
+    StatsColumns<TrafficMeasurement> traffic;
+};
+
+using SwitchStatsColumnsPtr = std::shared_ptr<SwitchStatsColumns>;
+
+} // namespace runos
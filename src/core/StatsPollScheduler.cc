@@ -0,0 +1,367 @@
+/*
+ * Copyright 2019 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "StatsPollScheduler.hpp"
+
+#include "lib/poller.hpp"
+
+#include <runos/core/logging.hpp>
+#include <runos/core/future.hpp>
+#include <runos/core/catch_all.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <string>
+
+namespace runos {
+
+REGISTER_APPLICATION(StatsPollScheduler, {""})
+
+using std::chrono::milliseconds;
+
+namespace {
+
+// PortStats -> port-stats
+std::string config_name(PollType type)
+{
+    std::string ret;
+    for (const char* c = type._to_string(); *c; ++c) {
+        if (std::isupper(*c) && not ret.empty()) {
+            ret.push_back('-');
+        }
+        ret.push_back(std::tolower(*c));
+    }
+    return ret;
+}
+
+} // namespace
+
+void StatsPollScheduler::init(Loader*, const Config& rootConfig)
+{
+    auto config = config_cd(rootConfig, "stats-poll-scheduler");
+    tick_interval = std::max(config_get(config, "tick-interval", 10), 1);
+    global_budget = std::max(config_get(config, "global-in-flight", 64), 1);
+    switch_budget = std::max(config_get(config, "switch-in-flight", 2), 1);
+    request_timeout = milliseconds(
+        config_get(config, "request-timeout", 10000));
+    lag_ratio = config_get(config, "lag-ratio", 0.5);
+    max_stretch = std::max(config_get(config, "max-stretch", 8.0), 1.0);
+
+    auto intervals_config = config_cd(config, "intervals");
+    for (auto type : PollType::_values()) {
+        int interval = config_get(intervals_config, config_name(type), 2000);
+        intervals[type._to_integral()] =
+            milliseconds(std::max<int>(interval, tick_interval));
+    }
+
+    wheel = TimerWheel<TaskId>(milliseconds(tick_interval), 1024);
+    poller = new Poller(this, tick_interval);
+}
+
+void StatsPollScheduler::startUp(Loader*)
+{
+    poller->run();
+}
+
+auto StatsPollScheduler::add(PollType type, uint64_t dpid,
+                             milliseconds interval, PollFunction poll)
+    -> TaskId
+{
+    return insert(type, dpid, interval, std::move(poll), false);
+}
+
+void StatsPollScheduler::submit(PollType type, uint64_t dpid,
+                                PollFunction poll)
+{
+    insert(type, dpid, milliseconds::zero(), std::move(poll), true);
+}
+
+auto StatsPollScheduler::insert(PollType type, uint64_t dpid,
+                                milliseconds interval,
+                                PollFunction poll, bool once)
+    -> TaskId
+{
+    auto now = Clock::now();
+    interval = std::max(interval, milliseconds(tick_interval));
+
+    std::lock_guard<std::mutex> lock(mut);
+    auto id = next_id++;
+    auto& task = tasks.emplace(id, Task{
+        type, dpid, interval, std::move(poll), once, 1.0,
+        now, now, 0, false, false, false
+    }).first->second;
+
+    if (once) {
+        task.queued = true;
+        ready.push_back(id);
+    } else {
+        // golden ratio sequence spreads first polls evenly
+        // over the interval whatever number of tasks is added
+        double phase = std::fmod(0.6180339887 * double(next_phase++), 1.0);
+        task.due = now + std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double, std::milli>(
+                phase * double(interval.count())));
+        wheel.schedule(id, task.due);
+    }
+    return id;
+}
+
+void StatsPollScheduler::remove(TaskId id)
+{
+    std::lock_guard<std::mutex> lock(mut);
+    auto it = tasks.find(id);
+    if (it == tasks.end()) {
+        return;
+    }
+    if (it->second.in_flight) {
+        release(id, it->second);
+    }
+    // its timer and place in the ready queue are skipped later
+    tasks.erase(it);
+}
+
+milliseconds StatsPollScheduler::interval(PollType type) const
+{
+    return intervals[type._to_integral()];
+}
+
+void StatsPollScheduler::polling()
+{
+    struct Started {
+        TaskId id;
+        uint64_t generation;
+        PollType type;
+        uint64_t dpid;
+        PollFunction poll;
+    };
+
+    auto now = Clock::now();
+    std::vector<Started> started;
+    {
+        std::lock_guard<std::mutex> lock(mut);
+
+        // replies that never came free their budget
+        std::vector<TaskId> expired;
+        for (auto id : in_flight) {
+            if (now - tasks.at(id).sent_at > request_timeout) {
+                expired.push_back(id);
+            }
+        }
+        for (auto id : expired) {
+            finish(id, now, false, true);
+        }
+
+        wheel.expire(now, [this, now](TaskId id) {
+            auto it = tasks.find(id);
+            if (it == tasks.end()) {
+                return;
+            }
+            auto& task = it->second;
+            if (task.queued || task.in_flight || task.due > now) {
+                return;
+            }
+            task.queued = true;
+            ready.push_back(id);
+        });
+
+        for (size_t n = ready.size(); n > 0 && not ready.empty(); --n) {
+            auto id = ready.front();
+            ready.pop_front();
+
+            auto it = tasks.find(id);
+            if (it == tasks.end()) {
+                continue;
+            }
+            auto& task = it->second;
+
+            auto sw = switch_in_flight.find(task.dpid);
+            bool switch_busy = sw != switch_in_flight.end() &&
+                               sw->second >= switch_budget;
+            if (in_flight.size() >= global_budget || switch_busy) {
+                if (not task.deferred) {
+                    task.deferred = true;
+                    ++counters[task.type._to_integral()].deferred;
+                }
+                ready.push_back(id);
+                continue;
+            }
+
+            task.queued = false;
+            task.in_flight = true;
+            task.sent_at = now;
+            ++task.generation;
+            in_flight.insert(id);
+            if (task.dpid != 0) {
+                ++switch_in_flight[task.dpid];
+            }
+            started.push_back(Started{
+                id, task.generation, task.type, task.dpid, task.poll
+            });
+        }
+    }
+
+    // requests are sent outside of the lock,
+    // replies may be processed before then() returns
+    for (auto& s : started) {
+        try {
+            s.poll().then(inline_executor,
+                [this, id = s.id, generation = s.generation]
+                (future<void> f) {
+                    bool ok = true;
+                    try {
+                        f.get();
+                    } catch (...) {
+                        ok = false;
+                    }
+                    complete(id, generation, ok);
+                });
+        } catch (...) {
+            LOG(WARNING) << "[StatsPollScheduler] Can't poll "
+                         << s.type._to_string() << " of switch dpid="
+                         << s.dpid << ":";
+            diagnostic_information::get().log();
+            complete(s.id, s.generation, false);
+        }
+    }
+}
+
+void StatsPollScheduler::complete(TaskId id, uint64_t generation, bool ok)
+{
+    auto now = Clock::now();
+
+    std::lock_guard<std::mutex> lock(mut);
+    auto it = tasks.find(id);
+    if (it == tasks.end() || not it->second.in_flight ||
+        it->second.generation != generation) {
+        return; // removed or timed out
+    }
+    finish(id, now, ok, false);
+}
+
+void StatsPollScheduler::finish(TaskId id, Clock::time_point now,
+                                bool ok, bool timeout)
+{
+    auto it = tasks.find(id);
+    auto& task = it->second;
+    auto& counter = counters[task.type._to_integral()];
+    release(id, task);
+
+    double latency =
+        std::chrono::duration<double, std::micro>(now - task.sent_at).count();
+    counter.avg_latency = counter.polls == 0
+        ? latency
+        : counter.avg_latency + (latency - counter.avg_latency) / 8;
+    counter.max_latency = std::max(counter.max_latency, latency);
+    ++counter.polls;
+    if (not ok) {
+        ++counter.failed;
+    }
+    if (timeout) {
+        ++counter.timeouts;
+    }
+
+    if (task.once) {
+        tasks.erase(it);
+        return;
+    }
+
+    // Lag is the time from the deadline to the reply: waiting
+    // for the budget plus the reply latency. Intervals are stretched
+    // fast while it lags and shrink back slowly after.
+    double effective = double(task.interval.count()) * task.stretch;
+    double lag = std::chrono::duration<double, std::milli>(now - task.due).count();
+    if (timeout || lag > effective * lag_ratio) {
+        task.stretch = std::min(task.stretch * 1.5, max_stretch);
+    } else if (lag < effective * lag_ratio / 4) {
+        task.stretch = std::max(task.stretch * 0.9, 1.0);
+    }
+
+    auto next = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double, std::milli>(
+            double(task.interval.count()) * task.stretch));
+    task.due += next;
+    if (task.due <= now) {
+        // missed polls are skipped, not sent in a burst
+        task.due = now + next;
+    }
+    task.deferred = false;
+    wheel.schedule(id, task.due);
+}
+
+void StatsPollScheduler::release(TaskId id, Task& task)
+{
+    task.in_flight = false;
+    in_flight.erase(id);
+    if (task.dpid != 0) {
+        auto it = switch_in_flight.find(task.dpid);
+        if (it != switch_in_flight.end() && --it->second == 0) {
+            switch_in_flight.erase(it);
+        }
+    }
+}
+
+PollSchedulerStats StatsPollScheduler::stats() const
+{
+    struct Sum {
+        size_t tasks {0};
+        double interval {0};
+        double effective {0};
+    };
+    std::array<Sum, PollType::_size()> sums;
+
+    PollSchedulerStats ret;
+    std::lock_guard<std::mutex> lock(mut);
+    ret.in_flight = in_flight.size();
+    ret.queued = ready.size();
+
+    for (const auto& pair : tasks) {
+        const auto& task = pair.second;
+        if (task.once) {
+            continue;
+        }
+        auto& sum = sums[task.type._to_integral()];
+        ++sum.tasks;
+        sum.interval += double(task.interval.count());
+        sum.effective += double(task.interval.count()) * task.stretch;
+    }
+
+    for (auto type : PollType::_values()) {
+        auto i = type._to_integral();
+        const auto& sum = sums[i];
+        const auto& counter = counters[i];
+        auto average = [&sum](double value) {
+            return milliseconds(sum.tasks == 0
+                ? 0 : int64_t(value / double(sum.tasks)));
+        };
+
+        ret.types.push_back(PollTypeStats{
+            type,
+            sum.tasks,
+            average(sum.interval),
+            average(sum.effective),
+            std::chrono::microseconds(int64_t(counter.avg_latency)),
+            std::chrono::microseconds(int64_t(counter.max_latency)),
+            counter.polls,
+            counter.failed,
+            counter.timeouts,
+            counter.deferred
+        });
+    }
+    return ret;
+}
+
+} // namespace runos
@@ -0,0 +1,151 @@
+/*
+ * Copyright 2019 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "Application.hpp"
+#include "Loader.hpp"
+#include "lib/better_enum.hpp"
+#include "lib/timer_wheel.hpp"
+
+#include <runos/core/future-decl.hpp>
+
+#include <boost/thread/executors/inline_executor.hpp>
+
+#include <array>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace runos {
+
+BETTER_ENUM(PollType, uint8_t, PortStats,
+                               QueueStats,
+                               FlowStats,
+                               Buckets,
+                               Verifier);
+
+struct PollTypeStats {
+    PollType type;
+    size_t tasks;
+    std::chrono::milliseconds interval;             // average requested
+    std::chrono::milliseconds effective_interval;   // average after stretching
+    std::chrono::microseconds avg_latency;          // from request to reply
+    std::chrono::microseconds max_latency;
+    uint64_t polls;
+    uint64_t failed;
+    uint64_t timeouts;
+    uint64_t deferred;      // polls waited for in-flight budget
+};
+
+struct PollSchedulerStats {
+    size_t in_flight;
+    size_t queued;
+    std::vector<PollTypeStats> types;
+};
+
+// Owns periodic multipart polling of switches.
+// Polls are spread over their intervals, sent within global and
+// per-switch in-flight budgets, and intervals of polls which replies
+// lag behind are stretched until the lag goes away.
+class StatsPollScheduler : public Application
+{
+    Q_OBJECT
+    SIMPLE_APPLICATION(StatsPollScheduler, "stats-poll-scheduler")
+public:
+    using TaskId = uint64_t;
+    // Sends the request, the future is ready when the reply is processed
+    using PollFunction = std::function<future<void>()>;
+
+    void init(Loader* loader, const Config& config) override;
+    void startUp(Loader* loader) override;
+
+    // Polls of dpid 0 are limited by the global budget only
+    TaskId add(PollType type, uint64_t dpid,
+               std::chrono::milliseconds interval, PollFunction poll);
+    void remove(TaskId id);
+
+    // Single request sent within the budgets
+    void submit(PollType type, uint64_t dpid, PollFunction poll);
+
+    std::chrono::milliseconds interval(PollType type) const;
+    PollSchedulerStats stats() const;
+
+protected slots:
+    void polling();
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Task {
+        PollType type;
+        uint64_t dpid;
+        std::chrono::milliseconds interval;
+        PollFunction poll;
+        bool once;
+        double stretch;
+        Clock::time_point due;
+        Clock::time_point sent_at;
+        uint64_t generation;    // replies of other generations are stale
+        bool queued;
+        bool in_flight;
+        bool deferred;
+    };
+
+    struct TypeCounters {
+        double avg_latency {0};  // us, moving average
+        double max_latency {0};
+        uint64_t polls {0};
+        uint64_t failed {0};
+        uint64_t timeouts {0};
+        uint64_t deferred {0};
+    };
+
+    TaskId insert(PollType type, uint64_t dpid,
+                  std::chrono::milliseconds interval,
+                  PollFunction poll, bool once);
+    void complete(TaskId id, uint64_t generation, bool ok);
+    // Requires the lock
+    void finish(TaskId id, Clock::time_point now, bool ok, bool timeout);
+    void release(TaskId id, Task& task);
+
+    class Poller* poller;
+    boost::inline_executor inline_executor;
+
+    mutable std::mutex mut;
+    std::unordered_map<TaskId, Task> tasks;
+    TimerWheel<TaskId> wheel;
+    std::deque<TaskId> ready;
+    std::unordered_set<TaskId> in_flight;
+    std::unordered_map<uint64_t, uint32_t> switch_in_flight;
+    std::array<TypeCounters, PollType::_size()> counters;
+    TaskId next_id {1};
+    uint64_t next_phase {0};
+
+    uint16_t tick_interval;
+    uint32_t global_budget;
+    uint32_t switch_budget;
+    std::chrono::milliseconds request_timeout;
+    double lag_ratio;
+    double max_stretch;
+    std::array<std::chrono::milliseconds, PollType::_size()> intervals;
+};
+
+} // namespace runos
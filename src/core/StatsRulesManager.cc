@@ -16,6 +16,9 @@
 
 #include "StatsRulesManager.hpp"
 
+#include <algorithm>
+#include <chrono>
+
 namespace runos {
 
 REGISTER_APPLICATION(StatsRulesManager, {"stats-bucket-manager", ""})
@@ -48,18 +51,23 @@ public:
         }
     }
 
-    BucketsMap makeBuckets(StatsBucketManager* mgr)
+    // Selected by cookie, buckets of the switch share
+    // a single flow stats request per poll interval
+    BucketsMap makeBuckets(StatsBucketManager* mgr,
+                           std::chrono::milliseconds poll_interval)
     {
         BucketsMap new_buckets;
         auto names = bucketsNames();
         for (size_t i = 0; i < names.size(); ++i) {
             auto bucket = mgr->aggregateFlows(
-                std::chrono::seconds(1),
+                poll_interval,
                 names[i],
                 flow_selector::dpid = {dpid_},
                 flow_selector::table = installation_table_,
+                flow_selector::cookie = cookie,
                 flow_selector::match = matches_[i]
             );
+            new_buckets.emplace(names[i], std::move(bucket));
         }
         return new_buckets;
     }
@@ -165,9 +173,13 @@ private:
     static constexpr auto multicast_mac_mask = "ff:00:00:00:00:00";
 };
 
-void StatsRulesManager::init(Loader* loader, const Config&)
+void StatsRulesManager::init(Loader* loader, const Config& rootConfig)
 {
     bucket_mgr_ = StatsBucketManager::get(loader);
+
+    auto config = config_cd(rootConfig, "stats-rules-manager");
+    poll_interval_ = std::chrono::milliseconds(
+        std::max(config_get(config, "poll-interval", 1000), 100));
 }
 
 BucketsMap StatsRulesManager::installEndpointRules(PortPtr port,
@@ -181,7 +193,7 @@ BucketsMap StatsRulesManager::installEndpointRules(PortPtr port,
     for (auto& rule: creator.makeInstallRules()) {
         sw->connection()->send(*rule);
     }
-    return creator.makeBuckets(bucket_mgr_);
+    return creator.makeBuckets(bucket_mgr_, poll_interval_);
 }
 
 BucketsNames StatsRulesManager::deleteEndpointRules(PortPtr port,
@@ -24,6 +24,7 @@
 
 #include <fluid/of13msg.hh>
 
+#include <chrono>
 #include <vector>
 #include <memory>
 
@@ -40,7 +41,7 @@ class StatsRulesManager : public Application
 {
     SIMPLE_APPLICATION(StatsRulesManager, "stats-rules-manager")
 public:
-    void init(Loader* loader, const Config&) override;
+    void init(Loader* loader, const Config& rootConfig) override;
 
     BucketsMap installEndpointRules(PortPtr port, uint16_t stag);
     BucketsNames deleteEndpointRules(PortPtr port, uint16_t stag);
@@ -54,6 +55,7 @@ public:
 
 private:
     StatsBucketManager* bucket_mgr_;
+    std::chrono::milliseconds poll_interval_;
 };
 
 } // namespace runos
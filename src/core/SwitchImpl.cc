@@ -17,6 +17,7 @@
 #include "SwitchImpl.hpp"
 
 #include "PortImpl.hpp"
+#include "StatsPollScheduler.hpp"
 #include "api/OFAgent.hpp"
 
 #include <runos/core/assert.hpp>
@@ -27,14 +28,14 @@
 //#include <range/v3/all.hpp>
 #include <range/v3/algorithm/find_if.hpp>
 #include <range/v3/view/all.hpp>
-#include <range/v3/view/group_by.hpp>
 #include <range/v3/view/transform.hpp>
 #include <range/v3/view/zip.hpp>
 #include <range/v3/view/map.hpp>
-#include <range/v3/action/sort.hpp>
 
 #include <boost/lexical_cast.hpp>
+#include <algorithm>
 #include <iterator> // back_inserter
+#include <unordered_set>
 #include <utility> // move
 #include <chrono>
 #include <functional>
@@ -56,15 +57,45 @@ SwitchImpl::SwitchImpl(of13::FeaturesReply& fr,
     moveToThread(parent->thread());
     setParent(parent);
 
-    async(executor, [this]() {
-        constexpr static auto stats_update_interval
-            = std::chrono::seconds(2);
-        startTimer(std::chrono::milliseconds(stats_update_interval).count());
-    });
-
     set_up();
 }
 
+SwitchImpl::~SwitchImpl()
+{
+    if (poll_scheduler_) {
+        for (auto id : poll_tasks_) {
+            poll_scheduler_->remove(id);
+        }
+    }
+}
+
+void SwitchImpl::startPolling(StatsPollScheduler* scheduler)
+{
+    poll_scheduler_ = scheduler;
+
+    using poll_method = future<void> (SwitchImpl::*)();
+    auto poll = [weak = weak_from_this()](poll_method method) {
+        return [weak, method]() -> future<void> {
+            if (auto self = weak.lock()) {
+                return ((*self).*method)();
+            }
+            return make_ready_future();
+        };
+    };
+
+    poll_tasks_ = {
+        scheduler->add(PollType::PortStats, dpid_,
+                       scheduler->interval(PollType::PortStats),
+                       poll(&SwitchImpl::pollPortStats)),
+        scheduler->add(PollType::QueueStats, dpid_,
+                       scheduler->interval(PollType::QueueStats),
+                       poll(&SwitchImpl::pollQueueStats)),
+        scheduler->add(PollType::FlowStats, dpid_,
+                       scheduler->interval(PollType::FlowStats),
+                       poll(&SwitchImpl::pollFlowStats))
+    };
+}
+
 std::any const& SwitchImpl::property(std::string_view name) const {
     static std::any none;
     auto it = property_.find(name);
@@ -185,6 +216,16 @@ std::map<unsigned, PortImplPtr>::iterator SwitchImpl::delete_port(unsigned no)
     auto port = it->second;
     CHECK(it != ports_.end());
     port->set_offline();
+    {
+        std::lock_guard<std::mutex> lock(stats_columns_->mutex);
+        auto of_port = [no](uint64_t key, bool) {
+            return stats_key_port(key) == no;
+        };
+        stats_columns_->ports.erase_if(
+            [no](uint64_t key, bool) { return key == no; });
+        stats_columns_->queues.erase_if(of_port);
+        stats_columns_->traffic.erase_if(of_port);
+    }
     auto ret = ports_.erase(it);
     emit portDeleted(port);
     return ret;
@@ -424,100 +465,169 @@ auto SwitchImpl::modify() -> SwitchModPtr
     return std::make_unique<SwitchModImpl>(shared_from_this());
 }
 
-void SwitchImpl::timerEvent(QTimerEvent*)
+namespace {
+
+// if switch doesn't support duration params in stats replies,
+// we use epoch duration for computing 'speed'
+std::chrono::duration<double> stats_duration(uint32_t sec, uint32_t nsec)
 {
-    updateStats();
+    if (sec == 0 && nsec == 0) {
+        return std::chrono::steady_clock::now().time_since_epoch();
+    }
+    return std::chrono::seconds(sec) + std::chrono::nanoseconds(nsec);
 }
 
-void SwitchImpl::updateStats()
+ForwardingType traffic_type(of13::Match& match)
 {
-    VLOG(10) << "updateStats()";
+    of13::EthDst* eth_dst = match.eth_dst();
+    if (eth_dst == nullptr) {
+        return ForwardingType::Unicast;
+    }
+
+    auto value = eth_dst->value();
+    const uint8_t* addr = value.get_data();
+    if (std::all_of(addr, addr + 6, [](uint8_t b) { return b == 0xff; })) {
+        return ForwardingType::Broadcast;
+    }
+    if (addr[0] == 0x01) {
+        return ForwardingType::Multicast;
+    }
+    return ForwardingType::None;
+}
+
+} // namespace
+
+future<void> SwitchImpl::pollPortStats()
+{
+    VLOG(10) << "pollPortStats()";
     auto self = shared_from_this();
 
     if (not connection()->alive()) {
         VLOG(3) << "Request to offline switch";
-        return;
+        return make_ready_future();
     }
 
-    try {
-        auto agent = connection()->agent();
-
-        agent->request_port_stats().then(executor,
-            [self](future<OFAgent::sequence<of13::PortStats>> stats) {
-                VLOG(10) << "Entering port stats continuation";
-
-                for (auto& ps : stats.get()) try {
-                    if (self->property("local_port", of13::OFPP_LOCAL) != ps.port_no())
-                        self->port_impl(ps.port_no())->process_event(ps);
-                } catch (bad_pointer_access& ex) {
+    auto agent = connection()->agent();
+    return agent->request_port_stats().then(executor,
+        [self](future<OFAgent::sequence<of13::PortStats>> f) {
+            VLOG(10) << "Entering port stats continuation";
+
+            auto stats = f.get();
+            auto local_port = self->property("local_port", of13::OFPP_LOCAL);
+
+            boost::shared_lock< boost::shared_mutex > rlock(self->pmutex);
+            std::lock_guard<std::mutex> lock(self->stats_columns_->mutex);
+            auto& columns = self->stats_columns_->ports;
+
+            columns.begin();
+            for (auto& ps : stats) {
+                if (ps.port_no() == local_port)
+                    continue;
+                if (self->ports_.count(ps.port_no()) == 0) {
                     LOG(WARNING) << "Can't find port " << ps.port_no();
+                    continue;
                 }
-            });
-
-        agent->request_queue_stats().then(executor,
-            [self](future<OFAgent::sequence<of13::QueueStats>> stats) {
-                VLOG(10) << "Entering queue stats continuation";
-
-                using Stats = of13::QueueStats;
-                using namespace ranges;
+                columns.append(ps.port_no(),
+                               stats_duration(ps.duration_sec(),
+                                              ps.duration_nsec()),
+                               ps.rx_packets(), ps.tx_packets(),
+                               ps.rx_bytes(), ps.tx_bytes(),
+                               ps.rx_dropped(), ps.tx_dropped(),
+                               ps.rx_errors(), ps.tx_errors());
+            }
+            columns.commit();
+        });
+}
 
-                auto port_no_less
-                    = [](Stats a, Stats b) { return a.port_no() < b.port_no(); };
-                auto port_no_equal
-                    = [](Stats a, Stats b) { return a.port_no() == b.port_no(); };
+future<void> SwitchImpl::pollQueueStats()
+{
+    VLOG(10) << "pollQueueStats()";
+    auto self = shared_from_this();
 
-                auto sorted_stats
-                    = stats.get() | action::sort(port_no_less);
-                auto grouped_stats
-                    = sorted_stats | view::group_by(port_no_equal);
+    if (not connection()->alive()) {
+        return make_ready_future();
+    }
 
-                RANGES_FOR(auto stats, grouped_stats) {
-                    auto port_no = (*begin(stats)).port_no();
-                    self->port_impl(port_no)->process_event(stats);
+    auto agent = connection()->agent();
+    return agent->request_queue_stats().then(executor,
+        [self](future<OFAgent::sequence<of13::QueueStats>> f) {
+            VLOG(10) << "Entering queue stats continuation";
+
+            auto stats = f.get();
+
+            boost::shared_lock< boost::shared_mutex > rlock(self->pmutex);
+            std::lock_guard<std::mutex> lock(self->stats_columns_->mutex);
+            auto& columns = self->stats_columns_->queues;
+
+            std::unordered_set<uint32_t> replied;
+            columns.begin();
+            for (auto& qs : stats) {
+                if (self->ports_.count(qs.port_no()) == 0) {
+                    LOG(WARNING) << "Can't find port " << qs.port_no();
+                    continue;
                 }
+                replied.insert(qs.port_no());
+                columns.append(queue_stats_key(qs.port_no(), qs.queue_id()),
+                               std::chrono::seconds(qs.duration_sec()) +
+                               std::chrono::nanoseconds(qs.duration_nsec()),
+                               qs.tx_bytes(), qs.tx_packets(),
+                               qs.tx_errors());
+            }
+            columns.commit();
+
+            // Remove unused queues of the ports replied
+            columns.erase_if([&replied](uint64_t key, bool updated) {
+                return not updated && replied.count(stats_key_port(key)) > 0;
             });
+        });
+}
 
-        if (tables.statistics == Tables::no_table) {
-            return;
-        }
+future<void> SwitchImpl::pollFlowStats()
+{
+    VLOG(10) << "pollFlowStats()";
+    auto self = shared_from_this();
 
-        ofp::flow_stats_request request;
-        request.table_id = tables.statistics;
-        agent->request_flow_stats(request).then(executor,
-            [self](future<OFAgent::sequence<of13::FlowStats>> flow_stats) {
-                VLOG(10) << "Entering traffic stats continuation";
-
-                using Stats = of13::FlowStats;
-                using namespace ranges;
-
-                auto port_no_less = [](Stats a, Stats b)
-                {
-                    uint32_t a_in_port = a.match().in_port()->value();
-                    uint32_t b_in_port = b.match().in_port()->value();
-                    return a_in_port < b_in_port;
-                };
-                auto port_no_equal = [](Stats a, Stats b)
-                {
-                    uint32_t a_in_port = a.match().in_port()->value();
-                    uint32_t b_in_port = b.match().in_port()->value();
-                    return a_in_port == b_in_port;
-                };
-
-                auto sorted_stats
-                    = flow_stats.get() | action::sort(port_no_less);
-                auto grouped_stats
-                    = sorted_stats | view::group_by(port_no_equal);
-
-                RANGES_FOR(auto stats, grouped_stats) {
-                    auto match = (*begin(stats)).match();
-                    auto port_no = match.in_port()->value();
-                    self->port_impl(port_no)->process_event(stats);
-                }
-            });
-    } catch (OFAgent::request_error const& ex) {
-        LOG(WARNING) << "Can't update stats:";
-        diagnostic_information::get().log();
+    if (not connection()->alive() || tables.statistics == Tables::no_table) {
+        return make_ready_future();
     }
+
+    auto agent = connection()->agent();
+    ofp::flow_stats_request request;
+    request.table_id = tables.statistics;
+    return agent->request_flow_stats(request).then(executor,
+        [self](future<OFAgent::sequence<of13::FlowStats>> f) {
+            VLOG(10) << "Entering traffic stats continuation";
+
+            auto stats = f.get();
+
+            boost::shared_lock< boost::shared_mutex > rlock(self->pmutex);
+            std::lock_guard<std::mutex> lock(self->stats_columns_->mutex);
+            auto& columns = self->stats_columns_->traffic;
+
+            columns.begin();
+            for (auto& flow : stats) {
+                auto match = flow.match();
+                of13::InPort* in_port = match.in_port();
+                if (in_port == nullptr) {
+                    continue;
+                }
+
+                auto port_no = in_port->value();
+                auto type = traffic_type(match);
+                if (type == +ForwardingType::None ||
+                    self->ports_.count(port_no) == 0) {
+                    LOG(WARNING) << "Unexpected traffic stats flow of port "
+                                 << port_no;
+                    continue;
+                }
+
+                columns.append(traffic_stats_key(port_no, type._to_integral()),
+                               stats_duration(flow.duration_sec(),
+                                              flow.duration_nsec()),
+                               flow.packet_count(), flow.byte_count());
+            }
+            columns.commit();
+        });
 }
 
 void SwitchImpl::loadDriver()
@@ -20,6 +20,7 @@
 #include "lib/qt_executor.hpp"
 #include "api/Switch.hpp"
 #include "PortImpl.hpp"
+#include "StatsColumns.hpp"
 
 #include <runos/DeviceDb.hpp>
 
@@ -28,12 +29,14 @@
 
 #include <memory>
 #include <map>
+#include <vector>
 
 namespace runos {
 
 namespace of13 = fluid_msg::of13;
 
 class SwitchImpl;
+class StatsPollScheduler;
 using SwitchImplPtr = std::shared_ptr<SwitchImpl>;
 
 class SwitchImpl : public Switch
@@ -45,6 +48,7 @@ public:
                         Rc<DeviceDb> propdb,
                         OFConnectionPtr conn,
                         QObject* parent = 0);
+    ~SwitchImpl();
 
     OFConnectionPtr connection() const override { return conn_; }
 
@@ -103,17 +107,23 @@ public:
     void set_up();
     void set_down();
 
+    // Port, queue and flow stats are polled by the scheduler
+    void startPolling(StatsPollScheduler* scheduler);
+
     void handle(const drivers::Handler& h) const override { m_driver->apply(h); }
 
+    SwitchStatsColumnsPtr stats_columns() const { return stats_columns_; }
+
 protected:
     void process_event(std::vector<of13::Port> vports);
     safe::shared_ptr<PortImpl> port_impl(unsigned port_no) const;
     void update_props();
     void init_tables();
     void init_aux_address();
-    void updateStats();
+    future<void> pollPortStats();
+    future<void> pollQueueStats();
+    future<void> pollFlowStats();
     void loadDriver();
-    void timerEvent(QTimerEvent*) override;
 
 private:
     friend class SwitchModImpl;
@@ -143,6 +153,11 @@ private:
 
     mutable boost::shared_mutex pmutex;
     std::map<unsigned, PortImplPtr> ports_;
+    // locked after pmutex
+    SwitchStatsColumnsPtr stats_columns_ {std::make_shared<SwitchStatsColumns>()};
+
+    StatsPollScheduler* poll_scheduler_ {nullptr};
+    std::vector<uint64_t> poll_tasks_;
 
     mutable qt_executor executor{this};
     drivers::DefaultDriver* m_driver;
@@ -21,6 +21,8 @@
 #include "SwitchImpl.hpp"
 #include "DpidChecker.hpp"
 #include "StatsRulesManager.hpp"
+#include "StatsPollScheduler.hpp"
+#include "StatisticsHistory.hpp"
 
 #include <runos/DeviceDb.hpp>
 #include <runos/core/logging.hpp>
@@ -40,7 +42,8 @@ namespace runos {
 namespace of13 = fluid_msg::of13;
 
 REGISTER_APPLICATION(SwitchManager, {"controller", "of-server",
-                                     "dpid-checker", "stats-rules-manager", ""})
+                                     "dpid-checker", "stats-rules-manager",
+                                     "stats-poll-scheduler", ""})
 
 /////////////////
 //// Handler ////
@@ -53,6 +56,7 @@ struct SwitchManager::implementation final
 {
     SwitchManager& app;
     StatsRulesManager* stats_rules_mgr;
+    StatsPollScheduler* poll_scheduler;
     Controller* controller;
     OFServer* ofserver;
     Rc<DeviceDb> propdb;
@@ -123,6 +127,7 @@ struct SwitchManager::implementation final
                          &app, &SwitchManager::switchMaintenanceEnd);
 
         stats_rules_mgr->clearStatsTable(ret);
+        ret->startPolling(poll_scheduler);
 
         return ret;
     }
@@ -179,16 +184,43 @@ struct SwitchManager::implementation final
 SwitchManager::SwitchManager() = default;
 SwitchManager::~SwitchManager() = default;
 
-void SwitchManager::init(Loader* loader, const Config&)
+void SwitchManager::init(Loader* loader, const Config& rootConfig)
 {
     qRegisterMetaType<runos::SwitchPtr>("SwitchPtr");
     qRegisterMetaType<fluid_msg::of13::Port>("of13::Port");
 
+    // resolutions of port and queue speeds history, finest first
+    auto config = config_cd(rootConfig, "switch-manager");
+    auto history = config.find("stats-history");
+    if (history != config.end()) {
+        auto& levels = statistics_history_levels();
+        levels.clear();
+        for (const auto& level : history->second.array_items()) {
+            auto step = level["step"].int_value();
+            auto length = level["length"].int_value();
+            if (step <= 0 || length <= 0) {
+                LOG(ERROR) << "[SwitchManager] Incorrect stats history level: "
+                           << level.dump();
+                continue;
+            }
+            levels.push_back({ std::chrono::seconds(step), uint32_t(length) });
+        }
+    }
+
+    // compressed raw counters, finer than any level
+    auto raw_config = config_cd(config, "stats-raw-history");
+    auto& raw = statistics_raw_history();
+    raw.retention = std::chrono::seconds(std::max(
+        config_get(raw_config, "retention", int(raw.retention.count())), 0));
+    raw.chunk_samples = uint32_t(std::max(
+        config_get(raw_config, "chunk-samples", int(raw.chunk_samples)), 2));
+
     impl.reset(new implementation{ *this });
 
     impl->controller = Controller::get(loader);
     impl->ofserver = OFServer::get(loader);
     impl->stats_rules_mgr = StatsRulesManager::get(loader);
+    impl->poll_scheduler = StatsPollScheduler::get(loader);
 
     impl->connect_stats_rules_mgr();
     impl->controller->register_handler(impl, -50);
@@ -220,4 +252,16 @@ std::vector<SwitchPtr> SwitchManager::switches() const
     return ret;
 }
 
+std::vector<std::pair<uint64_t, SwitchStatsColumnsPtr>>
+SwitchManager::stats_columns() const
+{
+    std::vector<std::pair<uint64_t, SwitchStatsColumnsPtr>> ret;
+    boost::shared_lock< boost::shared_mutex > lock(impl->smutex);
+    ret.reserve(impl->switches.size());
+    for (const auto& sw : impl->switches) {
+        ret.emplace_back(sw.first, sw.second->stats_columns());
+    }
+    return ret;
+}
+
 } // namespace runos
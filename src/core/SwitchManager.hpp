@@ -20,6 +20,7 @@
 #include "api/Switch.hpp"
 #include "Application.hpp"
 #include "Controller.hpp"
+#include "StatsColumns.hpp"
 
 #include <runos/core/safe_ptr.hpp>
 
@@ -41,6 +42,8 @@ public:
 
     safe::shared_ptr<Switch> switch_(uint64_t dpid) /* noexcept */ const;
     std::vector<SwitchPtr> switches() const;
+    // Statistics of connected switches, for exporting all at once
+    std::vector<std::pair<uint64_t, SwitchStatsColumnsPtr>> stats_columns() const;
 
 signals:
     void portAdded(PortPtr);
@@ -21,12 +21,17 @@
 #include "DpidChecker.hpp"
 #include "Recovery.hpp"
 #include "api/Statistics.hpp"
+#include "StatisticsHistory.hpp"
+#include "StatsPollScheduler.hpp"
 #include "json11.hpp"
 #include "runos/core/logging.hpp"
 
 #include <boost/lexical_cast.hpp>
 #include <fluid/of13msg.hh>
 
+#include <algorithm>
+#include <chrono>
+#include <optional>
 #include <sstream>
 
 namespace runos {
@@ -751,6 +756,146 @@ struct QueueStatsResource : rest::resource {
     }
 };
 
+// Names of counters in the order of the measurement
+static const std::vector<std::string> port_counters {
+    "rx-packets", "tx-packets", "rx-bytes", "tx-bytes",
+    "rx-dropped", "tx-dropped", "rx-errors", "tx-errors"
+};
+static const std::vector<std::string> queue_counters {
+    "tx-bytes", "tx-packets", "tx-errors"
+};
+
+struct StatsHistoryResource : rest::resource {
+    UnsafePortPtr port;
+    std::optional<uint32_t> queue_id;
+    size_t counter;
+    std::string counter_name;
+    Port::history_time from;
+    Port::history_time to;
+
+    // range is the last `from` seconds if `to` is empty,
+    // seconds since epoch otherwise
+    explicit StatsHistoryResource(PortPtr port, std::optional<uint32_t> queue_id,
+                                  const std::string& name,
+                                  const std::string& from_str,
+                                  const std::string& to_str)
+        : port(port.not_null()), queue_id(queue_id), counter_name(name)
+    {
+        const auto& names = queue_id ? queue_counters : port_counters;
+        auto it = std::find(names.begin(), names.end(), name);
+        if (it == names.end()) {
+            THROW( rest::http_error(404), "Unknown counter {}", name );
+        }
+        counter = it - names.begin();
+
+        using std::chrono::seconds;
+        to = std::chrono::system_clock::now();
+        from = to - seconds(600);
+        if (not to_str.empty()) {
+            from = Port::history_time(seconds(boost::lexical_cast<int64_t>(from_str)));
+            to = Port::history_time(seconds(boost::lexical_cast<int64_t>(to_str)));
+        } else if (not from_str.empty()) {
+            from = to - seconds(boost::lexical_cast<int64_t>(from_str));
+        }
+    }
+
+    rest::ptree Get() const override
+    {
+        using std::chrono::seconds;
+        using std::chrono::duration_cast;
+
+        auto range = queue_id ? port->queue_stats_history(*queue_id, counter, from, to)
+                              : port->stats_history(counter, from, to);
+
+        rest::ptree ret;
+        ret.put("counter", counter_name);
+        ret.put("from", duration_cast<seconds>(from.time_since_epoch()).count());
+        ret.put("to", duration_cast<seconds>(to.time_since_epoch()).count());
+        ret.put("step", range.step.count());
+        ret.put("min", range.min);
+        ret.put("max", range.max);
+        ret.put("avg", range.avg);
+
+        rest::ptree points;
+        for (const auto& point : range.points) {
+            rest::ptree ppt;
+            ppt.put("time", point.time);
+            ppt.put("avg", point.avg);
+            ppt.put("min", point.min);
+            ppt.put("max", point.max);
+            points.push_back(std::make_pair("", std::move(ppt)));
+        }
+        ret.add_child("points", points);
+        ret.put("_size", range.points.size());
+        return ret;
+    }
+};
+
+struct StatsHistoryMemoryResource : rest::resource {
+    UnsafePortPtr port;
+
+    explicit StatsHistoryMemoryResource(PortPtr port)
+        : port(port.not_null())
+    { }
+
+    rest::ptree Get() const override
+    {
+        rest::ptree ret;
+        auto memory = port->history_memory();
+        ret.put("memory", memory.first);
+        ret.put("memory-limit", memory.second);
+
+        rest::ptree levels;
+        for (const auto& level : statistics_history_levels()) {
+            rest::ptree lpt;
+            lpt.put("step", level.step.count());
+            lpt.put("length", level.length);
+            levels.push_back(std::make_pair("", std::move(lpt)));
+        }
+        ret.add_child("levels", levels);
+
+        const auto& raw = statistics_raw_history();
+        ret.put("raw-retention", raw.retention.count());
+        ret.put("raw-chunk-samples", raw.chunk_samples);
+        return ret;
+    }
+};
+
+struct StatsPollingResource : rest::resource {
+    StatsPollScheduler* scheduler;
+
+    explicit StatsPollingResource(StatsPollScheduler* scheduler)
+        : scheduler(scheduler)
+    { }
+
+    rest::ptree Get() const override
+    {
+        auto stats = scheduler->stats();
+
+        rest::ptree ret;
+        ret.put("in-flight", stats.in_flight);
+        ret.put("queued", stats.queued);
+
+        rest::ptree types;
+        for (const auto& type : stats.types) {
+            rest::ptree tpt;
+            tpt.put("type", type.type._to_string());
+            tpt.put("tasks", type.tasks);
+            tpt.put("interval-ms", type.interval.count());
+            tpt.put("effective-interval-ms", type.effective_interval.count());
+            tpt.put("avg-latency-us", type.avg_latency.count());
+            tpt.put("max-latency-us", type.max_latency.count());
+            tpt.put("polls", type.polls);
+            tpt.put("failed", type.failed);
+            tpt.put("timeouts", type.timeouts);
+            tpt.put("deferred", type.deferred);
+            types.push_back(std::make_pair("", std::move(tpt)));
+        }
+        ret.add_child("types", types);
+        return ret;
+    }
+};
+
 class SwitchManagerRest : public Application
 {
     SIMPLE_APPLICATION(SwitchManagerRest, "switch-manager-rest")
@@ -763,6 +908,7 @@ public:
         auto app = SwitchManager::get(loader);
         auto rest_ = RestListener::get(loader);
         auto checker = DpidChecker::get(loader);
+        auto scheduler = StatsPollScheduler::get(loader);
         auto recovery_manager = RecoveryManager::get(loader);
 
         rest_->mount(path_spec("/switches/"), [=](const path_match&)
@@ -843,6 +989,12 @@ public:
             }
         });
 
+        // effective intervals and latencies of stats polling
+        rest_->mount(path_spec("/switches/polling/"), [=](const path_match&)
+        {
+            return StatsPollingResource {scheduler};
+        });
+
         // control stats for switches
         rest_->mount(path_spec("/switches/controlstats/"),
                      [=](const path_match& m)
@@ -907,6 +1059,57 @@ public:
             }
         });
 
+        rest_->mount(path_spec("/switches/(\\d+)/ports/(\\d+)/history/"),
+                     [=](const path_match& m)
+        {
+            try {
+                auto dpid = boost::lexical_cast<uint64_t>(m[1].str());
+                auto port_no = boost::lexical_cast<uint32_t>(m[2].str());
+                return StatsHistoryMemoryResource{
+                    app->switch_(dpid)->port(port_no)
+                };
+            } catch (const boost::bad_lexical_cast& e) {
+                THROW( rest::http_error(400), "Bad request: {}", e.what() );
+            } catch (const bad_pointer_access& e) {
+                THROW( rest::http_error(404), "Port or switch not found" );
+            }
+        });
+
+        rest_->mount(path_spec("/switches/(\\d+)/ports/(\\d+)/history/([a-z-]+)/"
+                               "(?:(\\d+)/)?(?:(\\d+)/)?"),
+                     [=](const path_match& m)
+        {
+            try {
+                auto dpid = boost::lexical_cast<uint64_t>(m[1].str());
+                auto port_no = boost::lexical_cast<uint32_t>(m[2].str());
+                return StatsHistoryResource{ app->switch_(dpid)->port(port_no),
+                                             std::nullopt, m[3].str(),
+                                             m[4].str(), m[5].str() };
+            } catch (const boost::bad_lexical_cast& e) {
+                THROW( rest::http_error(400), "Bad request: {}", e.what() );
+            } catch (const bad_pointer_access& e) {
+                THROW( rest::http_error(404), "Port or switch not found" );
+            }
+        });
+
+        rest_->mount(path_spec("/switches/(\\d+)/ports/(\\d+)/queues/(\\d+)/"
+                               "history/([a-z-]+)/(?:(\\d+)/)?(?:(\\d+)/)?"),
+                     [=](const path_match& m)
+        {
+            try {
+                auto dpid = boost::lexical_cast<uint64_t>(m[1].str());
+                auto port_no = boost::lexical_cast<uint32_t>(m[2].str());
+                auto queue_id = boost::lexical_cast<uint32_t>(m[3].str());
+                return StatsHistoryResource{ app->switch_(dpid)->port(port_no),
+                                             queue_id, m[4].str(),
+                                             m[5].str(), m[6].str() };
+            } catch (const boost::bad_lexical_cast& e) {
+                THROW( rest::http_error(400), "Bad request: {}", e.what() );
+            } catch (const bad_pointer_access& e) {
+                THROW( rest::http_error(404), "Not found" );
+            }
+        });
+
         rest_->mount(path_spec(
                          "/switches/(\\d+)/ports/(\\d+)/queues/(\\d+)/stats/"),
         [=](const path_match& m)
@@ -928,6 +1131,6 @@ public:
 
 REGISTER_APPLICATION(SwitchManagerRest, {"rest-listener", "switch-manager",
                                          "dpid-checker", "recovery-manager",
-                                         ""})
+                                         "stats-poll-scheduler", ""})
 
 }
@@ -17,24 +17,44 @@
 #include "Topology.hpp"
 
 #include "DatabaseConnector.hpp"
+#include "OFMsgSender.hpp"
 #include "SwitchManager.hpp"
 #include "Recovery.hpp"
+#include "api/OFAgent.hpp"
 #include "api/Switch.hpp"
 #include "api/Port.hpp"
+#include "lib/base64.hpp"
 #include <json.hpp>
+#include <runos/IdGen.hpp>
 #include <runos/core/logging.hpp>
 
+#include <boost/crc.hpp>
 #include <boost/graph/adjacency_list.hpp>
+#include <boost/graph/compressed_sparse_row_graph.hpp>
 #include <boost/graph/dijkstra_shortest_paths_no_color_map.hpp>
+#include <boost/graph/filtered_graph.hpp>
 #include <boost/property_map/function_property_map.hpp>
+#include <boost/thread/executors/basic_thread_pool.hpp>
+#include <boost/thread/future.hpp>
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <limits>
+#include <list>
 #include <memory>
 #include <mutex>
+#include <optional>
+#include <queue>
+#include <set>
 #include <sstream>
 #include <vector>
 #include <unordered_map>
+#include <unordered_set>
 
 using json = nlohmann::json;
 
@@ -42,7 +62,7 @@ namespace runos {
 
 REGISTER_APPLICATION(Topology, {"link-discovery", "switch-manager", 
                                 "switch-ordering", "recovery-manager",
-                                "database-connector", ""})
+                                "database-connector", "ofmsg-sender", ""})
 
 using namespace boost;
 
@@ -78,6 +98,7 @@ struct Path {
     uint8_t drop_threshold {0}; //percents
     uint8_t util_threshold {0}; //percents
     MetricsFlag metrics { MetricsFlag::Hop };
+    bool disjoint {false}; // computed in the disjoint set of the route
 
     bool contains(uint64_t dpid) const;
     bool contains(switch_and_port sp) const;
@@ -104,6 +125,7 @@ struct Path {
         ret["drop_threshold"] = drop_threshold;
         ret["util_threshold"] = util_threshold;
         ret["metrics"] = metrics._to_string();
+        ret["disjoint"] = disjoint;
 
         std::for_each(m_path.begin(), m_path.end(), [&ret](auto sp) {
             ret["m_path"].push_back({sp.dpid, sp.port});
@@ -126,6 +148,20 @@ struct Route {
     std::vector<PathPtr> paths;
     bool allowed_dynamic { false };
     mutable RouteSelector dynamic;
+    DisjointFlag disjoint_mode { DisjointFlag::None };
+    uint8_t disjoint_count { 0 }; // requested disjoint paths
+
+    // flows are spread over paths approaching `to` at every hop
+    // and not longer than the shortest one by `stretch` percents
+    struct Balancing {
+        BalanceFlag balance { BalanceFlag::None };
+        MetricsFlag metrics { MetricsFlag::Hop };
+        uint8_t stretch { 0 };
+        bool rebalance { false };
+    } balancing;
+
+    bool fast_failover { false };
+    std::map<uint64_t, FailoverGroup> failover; // by dpid, guarded by failover_mutex
     mutable std::mutex mut;
 
     PathPtr attachPath(data_link_route path) {
@@ -175,6 +211,21 @@ struct Route {
         return (eq != paths.end() ? true : false);
     }
 
+    // copies for computing paths outside of the thread changing the route
+    std::vector<data_link_route> pathList() const {
+        std::lock_guard<std::mutex> lock(mut);
+        std::vector<data_link_route> ret;
+        ret.reserve(paths.size());
+        for (const auto& path : paths)
+            ret.push_back(path->m_path);
+        return ret;
+    }
+
+    RouteSelector dynamicSelector() const {
+        std::lock_guard<std::mutex> lock(mut);
+        return dynamic;
+    }
+
     json to_json() const {
         using namespace route_selector;
         json ret = {
@@ -190,6 +241,37 @@ struct Route {
             ret["paths"].push_back(path->to_json());
         });
 
+        if (disjoint_mode != +DisjointFlag::None) {
+            auto achieved = std::count_if(paths.begin(), paths.end(),
+                                          [](const auto& path) { return path->disjoint; });
+            ret["disjoint"] = {
+                {"mode", disjoint_mode._to_string()},
+                {"requested", disjoint_count},
+                {"achieved", achieved},
+                {"guaranteed", achieved >= disjoint_count}
+            };
+        }
+
+        if (balancing.balance != +BalanceFlag::None) {
+            ret["multipath"] = {
+                {"balance", balancing.balance._to_string()},
+                {"metrics", balancing.metrics._to_string()},
+                {"stretch", balancing.stretch},
+                {"rebalance", balancing.rebalance}
+            };
+        }
+
+        if (fast_failover) {
+            ret["fast_failover"] = json::array();
+            for (const auto& it : failover) {
+                ret["fast_failover"].push_back({
+                    {"dpid", it.second.dpid},
+                    {"group_id", it.second.group_id},
+                    {"ports", it.second.ports}
+                });
+            }
+        }
+
         if (allowed_dynamic) {
             ret["dynamic_settings"] = {
                 {"metrics", (*dynamic.get(metrics))._to_string()},
@@ -317,9 +399,704 @@ void Path::clearFlapping(TriggerFlag tf)
 using TopologyGraph = adjacency_list< multisetS, vecS, undirectedS, no_property, link_property>;
 using vertex_descriptor = TopologyGraph::vertex_descriptor;
 using edge_descriptor = TopologyGraph::edge_descriptor;
+using VertexMap = std::unordered_map<uint64_t, vertex_descriptor>;
+
+// Both directed edges of a link refer to it
+struct snapshot_edge {
+    uint32_t link;
+};
+using SnapshotGraph = compressed_sparse_row_graph<directedS, no_property, snapshot_edge>;
+using snapshot_edge_descriptor = SnapshotGraph::edge_descriptor;
+
+// Immutable compressed sparse row copy of the topology graph.
+// Path computation and other readers work on the published snapshot
+// without locking, switches keep their vertex descriptors.
+struct TopologySnapshot {
+    TopologySnapshot(uint64_t generation, uint64_t links_generation,
+                     const TopologyGraph& g, VertexMap vertices)
+        : generation(generation)
+        , links_generation(links_generation)
+        , vertices(std::move(vertices))
+        , graph(build(g, links))
+    { }
+
+    uint64_t generation;        // number of publication
+    uint64_t links_generation;  // TopologyImpl::generation when published
+    VertexMap vertices;
+    std::vector<link_property> links;
+    SnapshotGraph graph;
+
+    vertex_descriptor vertex(uint64_t dpid) const {
+        auto it = vertices.find(dpid);
+        return it != vertices.end() ? it->second
+                   : SnapshotGraph::null_vertex();
+    }
+
+    const link_property& link(snapshot_edge_descriptor e) const {
+        return links[graph[e].link];
+    }
+
+private:
+    static SnapshotGraph build(const TopologyGraph& g,
+                               std::vector<link_property>& links) {
+        std::vector<std::pair<vertex_descriptor, vertex_descriptor>> edges;
+        std::vector<snapshot_edge> props;
+        links.reserve(num_edges(g));
+        edges.reserve(2 * num_edges(g));
+        props.reserve(2 * num_edges(g));
+
+        auto range = boost::edges(g);
+        for (auto it = range.first; it != range.second; ++it) {
+            snapshot_edge prop {uint32_t(links.size())};
+            links.push_back(g[*it]);
+            edges.emplace_back(source(*it, g), target(*it, g));
+            edges.emplace_back(target(*it, g), source(*it, g));
+            props.push_back(prop);
+            props.push_back(prop);
+        }
+
+        return SnapshotGraph(edges_are_unsorted_multi_pass,
+                             edges.begin(), edges.end(), props.begin(),
+                             num_vertices(g));
+    }
+};
+
+using TopologySnapshotPtr = std::shared_ptr<const TopologySnapshot>;
+
+// Link between `a` and `b` was added or removed,
+// or changed the `metrics` only
+struct LinkChange {
+    vertex_descriptor a;
+    vertex_descriptor b;
+    std::optional<MetricsFlag> metrics;
+};
+
+// Read-only view of the topology snapshot for a single path request.
+// Excluded switches and links are hidden by the link filter and links
+// of already existing paths are penalized through the weight map,
+// so the request neither copies nor modifies the graph.
+struct PathView {
+    explicit PathView(const TopologySnapshot& snapshot)
+        : snapshot(snapshot), graph(snapshot.graph) {}
+
+    const TopologySnapshot& snapshot;
+    const SnapshotGraph& graph;
+    std::unordered_set<vertex_descriptor> removed_switches;
+    std::unordered_set<uint32_t> removed_links;
+    std::unordered_map<uint32_t, uint64_t> penalties;
+
+    bool allowed(snapshot_edge_descriptor e) const {
+        if (removed_switches.count(source(e, graph)) ||
+                removed_switches.count(target(e, graph)))
+            return false;
+        return removed_links.count(graph[e].link) == 0;
+    }
+
+    vertex_descriptor vertex(uint64_t dpid) const {
+        return snapshot.vertex(dpid);
+    }
+
+    std::optional<uint32_t> link(switch_and_port sp) const {
+        auto vert = vertex(sp.dpid);
+        if (vert == SnapshotGraph::null_vertex())
+            return std::nullopt;
+
+        auto edges = out_edges(vert, graph);
+        for (auto it = edges.first; it != edges.second; ++it) {
+            const auto& link = snapshot.link(*it);
+            if (link.source == sp or link.target == sp) {
+                return graph[*it].link;
+            }
+        }
+        return std::nullopt;
+    }
+
+    uint64_t weight(snapshot_edge_descriptor e, MetricsFlag mf) const;
+
+    bool plain() const {
+        return removed_switches.empty() && removed_links.empty() && penalties.empty();
+    }
+
+    struct LinkFilter {
+        const PathView* view {nullptr};
+        bool operator()(snapshot_edge_descriptor e) const { return view->allowed(e); }
+    };
+    using Filtered = filtered_graph<SnapshotGraph, LinkFilter>;
+
+    Filtered filtered() const { return Filtered(graph, LinkFilter{this}); }
+};
+
+static uint64_t linkMetrics(const link_property& link, MetricsFlag mf)
+{
+    switch (mf) {
+    case MetricsFlag::Hop:
+        return link.hop_metrics;
+    case MetricsFlag::PortSpeed:
+        return link.ps_metrics;
+    case MetricsFlag::PortLoading:
+        return link.pl_metrics;
+    default:
+        // FIXME: should throw exception?
+        LOG(ERROR) << "[Topology] Incorrect metrics!";
+        return 0;
+    }
+}
+
+uint64_t PathView::weight(snapshot_edge_descriptor e, MetricsFlag mf) const
+{
+    uint64_t metrics = linkMetrics(snapshot.link(e), mf);
+    if (metrics == 0)
+        return 0;
+
+    auto it = penalties.find(graph[e].link);
+    return it != penalties.end() ? metrics + it->second : metrics;
+}
+
+// Shortest-path tree towards the root switch on the whole graph.
+// Unreachable vertices are their own predecessors, as after dijkstra.
+struct ShortestPathTree {
+    static constexpr uint64_t infinity = std::numeric_limits<uint64_t>::max();
+
+    ShortestPathTree(vertex_descriptor root, MetricsFlag metrics)
+        : root(root), metrics(metrics) {}
+
+    vertex_descriptor root;
+    MetricsFlag metrics;
+    std::vector<vertex_descriptor> pred;
+    std::vector<uint64_t> dist;
+
+    size_t memory() const {
+        return sizeof(*this) + pred.capacity() * sizeof(vertex_descriptor)
+                             + dist.capacity() * sizeof(uint64_t);
+    }
+};
+
+using ShortestPathTreePtr = std::shared_ptr<ShortestPathTree>;
+using ShortestPathTreeConstPtr = std::shared_ptr<const ShortestPathTree>;
+
+// Cache of shortest-path trees shared by path requests with the same
+// destination and metrics and without per-route exclusions or penalties.
+// Links changed by a new snapshot are passed to update(), which repairs
+// only the affected part of every cached tree (dynamic SSSP: relaxation
+// from the improved vertices, recomputation of the detached subtree
+// otherwise). Trees belong to the latest snapshot only.
+class SptCache {
+public:
+    using Key = std::pair<vertex_descriptor, int>;
+
+    void setLimit(size_t bytes) {
+        std::lock_guard<std::mutex> lk(mut_);
+        limit_ = bytes;
+        shrink();
+    }
+
+    bool enabled() const {
+        std::lock_guard<std::mutex> lk(mut_);
+        return limit_ > 0;
+    }
+
+    ShortestPathTreeConstPtr find(vertex_descriptor root, MetricsFlag mf,
+                                  uint64_t generation) {
+        std::lock_guard<std::mutex> lk(mut_);
+        auto it = trees_.find(Key{root, mf._to_integral()});
+        if (it == trees_.end() || generation != generation_) {
+            stats_.misses++;
+            return nullptr;
+        }
+        stats_.hits++;
+        lru_.splice(lru_.begin(), lru_, it->second.lru);
+        return it->second.tree;
+    }
+
+    void insert(ShortestPathTreePtr tree, uint64_t generation) {
+        std::lock_guard<std::mutex> lk(mut_);
+        if (generation != generation_ || tree->memory() > limit_)
+            return;
+
+        Key key {tree->root, tree->metrics._to_integral()};
+        if (trees_.count(key))
+            return;
+
+        memory_ += tree->memory();
+        lru_.push_front(key);
+        trees_.emplace(key, Entry{std::move(tree), lru_.begin()});
+        shrink();
+    }
+
+    void update(const TopologySnapshot& s, const std::vector<LinkChange>& changes) {
+        std::lock_guard<std::mutex> lk(mut_);
+        generation_ = s.generation;
+        for (auto& it : trees_) {
+            auto& entry = it.second;
+            bool repaired = false;
+            for (const auto& change : changes) {
+                if (change.metrics && entry.tree->metrics != *change.metrics)
+                    continue;
+
+                if (not repaired && entry.tree.use_count() > 1) { // copy on write
+                    entry.tree = std::make_shared<ShortestPathTree>(*entry.tree);
+                }
+                repaired = true;
+                memory_ -= entry.tree->memory();
+                repair(s, *entry.tree, change.a, change.b);
+                memory_ += entry.tree->memory();
+            }
+            if (repaired)
+                stats_.repairs++;
+        }
+        shrink();
+    }
+
+    SptCacheStats stats() const {
+        std::lock_guard<std::mutex> lk(mut_);
+        auto ret = stats_;
+        ret.trees = trees_.size();
+        ret.memory = memory_;
+        ret.memory_limit = limit_;
+        return ret;
+    }
+
+private:
+    struct Entry {
+        ShortestPathTreePtr tree;
+        std::list<Key>::iterator lru;
+    };
+
+    using Queue = std::priority_queue<
+        std::pair<uint64_t, vertex_descriptor>,
+        std::vector<std::pair<uint64_t, vertex_descriptor>>,
+        std::greater<std::pair<uint64_t, vertex_descriptor>> >;
+
+    mutable std::mutex mut_;
+    std::map<Key, Entry> trees_;
+    std::list<Key> lru_; // most recently used first
+    size_t memory_ {0};
+    size_t limit_ {0};
+    uint64_t generation_ {0};
+    SptCacheStats stats_ {};
+
+    void shrink() {
+        while (memory_ > limit_ && not lru_.empty()) {
+            auto it = trees_.find(lru_.back());
+            memory_ -= it->second.tree->memory();
+            trees_.erase(it);
+            lru_.pop_back();
+            stats_.evictions++;
+        }
+    }
+
+    static uint64_t linkWeight(const TopologySnapshot& s, vertex_descriptor a,
+                               vertex_descriptor b, MetricsFlag mf) {
+        uint64_t ret = ShortestPathTree::infinity;
+        auto edges = out_edges(a, s.graph);
+        for (auto it = edges.first; it != edges.second; ++it) {
+            if (target(*it, s.graph) == b)
+                ret = std::min(ret, linkMetrics(s.link(*it), mf));
+        }
+        return ret;
+    }
+
+    static void repair(const TopologySnapshot& s, ShortestPathTree& t,
+                       vertex_descriptor a, vertex_descriptor b) {
+        auto n = num_vertices(s.graph);
+        for (auto v = t.pred.size(); v < n; v++) { // new isolated switches
+            t.pred.push_back(v);
+            t.dist.push_back(ShortestPathTree::infinity);
+        }
+
+        auto w = linkWeight(s, a, b, t.metrics);
+        for (auto x : {a, b}) {
+            auto y = (x == a ? b : a);
+            if (t.dist[y] != ShortestPathTree::infinity &&
+                    w != ShortestPathTree::infinity && t.dist[y] + w < t.dist[x]) {
+                // shorter path through the link
+                t.dist[x] = t.dist[y] + w;
+                t.pred[x] = y;
+                Queue queue;
+                queue.emplace(t.dist[x], x);
+                relax(s, t, queue);
+            } else if (x != t.root && t.pred[x] == y &&
+                    (w == ShortestPathTree::infinity || t.dist[y] + w > t.dist[x])) {
+                // tree link became longer or disappeared
+                detach(s, t, x);
+            }
+        }
+    }
+
+    static void relax(const TopologySnapshot& s, ShortestPathTree& t, Queue& queue) {
+        const auto& g = s.graph;
+        while (not queue.empty()) {
+            auto top = queue.top();
+            queue.pop();
+            auto u = top.second;
+            if (top.first != t.dist[u])
+                continue;
+
+            auto edges = out_edges(u, g);
+            for (auto it = edges.first; it != edges.second; ++it) {
+                auto v = target(*it, g);
+                auto d = t.dist[u] + linkMetrics(s.link(*it), t.metrics);
+                if (d < t.dist[v]) {
+                    t.dist[v] = d;
+                    t.pred[v] = u;
+                    queue.emplace(d, v);
+                }
+            }
+        }
+    }
+
+    // recompute distances of the subtree rooted at `x`
+    static void detach(const TopologySnapshot& s, ShortestPathTree& t,
+                       vertex_descriptor x) {
+        const auto& g = s.graph;
+        enum : uint8_t { unknown, affected, kept };
+        std::vector<uint8_t> state(t.pred.size(), unknown);
+        std::vector<vertex_descriptor> chain;
+        state[x] = affected;
+        state[t.root] = kept;
+
+        for (vertex_descriptor v = 0; v < t.pred.size(); v++) {
+            auto u = v;
+            while (state[u] == unknown && t.pred[u] != u) {
+                chain.push_back(u);
+                u = t.pred[u];
+            }
+            auto result = (state[u] == affected ? affected : kept);
+            for (auto c : chain)
+                state[c] = result;
+            chain.clear();
+        }
+
+        for (vertex_descriptor v = 0; v < t.pred.size(); v++) {
+            if (state[v] == affected) {
+                t.pred[v] = v;
+                t.dist[v] = ShortestPathTree::infinity;
+            }
+        }
+
+        Queue queue;
+        for (vertex_descriptor v = 0; v < t.pred.size(); v++) {
+            if (state[v] != affected)
+                continue;
+
+            auto edges = out_edges(v, g);
+            for (auto it = edges.first; it != edges.second; ++it) {
+                auto u = target(*it, g);
+                if (state[u] == affected || t.dist[u] == ShortestPathTree::infinity)
+                    continue;
+                auto d = t.dist[u] + linkMetrics(s.link(*it), t.metrics);
+                if (d < t.dist[v]) {
+                    t.dist[v] = d;
+                    t.pred[v] = u;
+                }
+            }
+            if (t.dist[v] != ShortestPathTree::infinity)
+                queue.emplace(t.dist[v], v);
+        }
+        relax(s, t, queue);
+    }
+};
+
+// Residual network for disjoint paths between two switches, solved by
+// successive shortest paths (Suurballe, Bhandari). Vertex potentials keep
+// reduced costs non-negative, so every augmentation is one dijkstra and
+// the found paths have minimal total weight. Every link gives an arc
+// in both directions, each paired with its residual arc; for node
+// disjointness every switch is split into entry and exit vertices
+// joined by an arc of unit capacity.
+class DisjointNetwork {
+public:
+    static constexpr int64_t infinity = std::numeric_limits<int64_t>::max();
+    static constexpr uint32_t none = std::numeric_limits<uint32_t>::max();
+
+    DisjointNetwork(const PathView& view, MetricsFlag mf, bool split,
+                    vertex_descriptor source, vertex_descriptor sink)
+        : split_(split)
+    {
+        auto n = num_vertices(view.graph);
+        out_.resize(split_ ? 2 * n : n);
+        if (split_) {
+            for (vertex_descriptor v = 0; v < n; v++)
+                addArc(entry(v), exit(v), 0, none);
+        }
+
+        auto fg = view.filtered();
+        for (vertex_descriptor v = 0; v < n; v++) {
+            auto edges = out_edges(v, fg);
+            for (auto it = edges.first; it != edges.second; ++it) {
+                auto u = target(*it, fg);
+                auto weight = view.weight(*it, mf);
+                if (u == v || weight == 0) // loopback or incorrect metrics
+                    continue;
+                addArc(exit(v), entry(u), weight, view.graph[*it].link);
+            }
+        }
+
+        source_ = exit(source);
+        sink_ = entry(sink);
+        potential_.assign(out_.size(), 0);
+    }
+
+    // Takes the path from `tree` as the first one and its distances
+    // as potentials, which saves the first dijkstra.
+    bool warmStart(const ShortestPathTree& tree) {
+        auto v = sink_ / (split_ ? 2 : 1);
+        auto root = source_ / (split_ ? 2 : 1);
+        if (tree.root != root || tree.pred.size() * (split_ ? 2 : 1) != out_.size())
+            return false;
+
+        std::vector<uint32_t> path;
+        while (v != root) {
+            auto u = tree.pred[v];
+            if (u == v) // unreachable
+                return false;
+
+            uint32_t arc = none;
+            for (auto i : out_[exit(u)]) {
+                const auto& a = arcs_[i];
+                if (a.to == entry(v) && a.cap > 0 && a.link != none &&
+                        (arc == none || a.cost < arcs_[arc].cost))
+                    arc = i;
+            }
+            if (arc == none)
+                return false;
+
+            path.push_back(arc);
+            if (split_ && u != root)
+                path.push_back(splitArc(u));
+            v = u;
+        }
+
+        for (vertex_descriptor x = 0; x < tree.dist.size(); x++) {
+            auto d = tree.dist[x] == ShortestPathTree::infinity
+                         ? infinity : int64_t(tree.dist[x]);
+            potential_[entry(x)] = potential_[exit(x)] = d;
+        }
+        push(path);
+        return true;
+    }
+
+    // Sends the next path through the residual network,
+    // returns false if there are no more disjoint paths
+    bool augment() {
+        dist_.assign(out_.size(), infinity);
+        parent_.assign(out_.size(), none);
+
+        Queue queue;
+        dist_[source_] = 0;
+        queue.emplace(0, source_);
+        while (not queue.empty()) {
+            auto top = queue.top();
+            queue.pop();
+            auto u = top.second;
+            if (top.first != dist_[u])
+                continue;
+            if (u == sink_)
+                break;
+
+            for (auto i : out_[u]) {
+                const auto& a = arcs_[i];
+                if (a.cap <= 0 || a.blocked)
+                    continue;
+                auto d = dist_[u] + a.cost + potential_[u] - potential_[a.to];
+                if (d < dist_[a.to]) {
+                    dist_[a.to] = d;
+                    parent_[a.to] = i;
+                    queue.emplace(d, a.to);
+                }
+            }
+        }
+
+        auto limit = dist_[sink_];
+        if (limit == infinity)
+            return false;
+
+        for (size_t x = 0; x < out_.size(); x++) {
+            if (potential_[x] != infinity)
+                potential_[x] += std::min(dist_[x], limit);
+        }
+
+        std::vector<uint32_t> path;
+        for (auto x = sink_; x != source_; x = arcs_[parent_[x] ^ 1].to) {
+            path.push_back(parent_[x]);
+        }
+        push(path);
+        return true;
+    }
+
+    // Forbids rerouting of the last path, so it stays the shortest one
+    // and following paths are only disjoint with it.
+    void fixLast() {
+        std::unordered_set<uint32_t> links;
+        for (auto it = last_.rbegin(); it != last_.rend(); ++it) {
+            auto i = *it;
+            if (arcs_[i].link == none) {
+                arcs_[i].blocked = arcs_[i ^ 1].blocked = true;
+            } else {
+                links.insert(arcs_[i].link);
+                fixed_.push_back(i);
+            }
+        }
+        for (auto& a : arcs_) {
+            if (links.count(a.link))
+                a.blocked = true;
+        }
+    }
+
+    // Found paths as sequences of links from the source switch
+    // with their total weights
+    std::vector<std::pair<int64_t, std::vector<uint32_t>>> paths() const {
+        std::vector<std::pair<int64_t, std::vector<uint32_t>>> ret;
+        std::vector<bool> used(arcs_.size(), false);
+
+        // paths may cross at switches, so the fixed one
+        // is taken as is rather than decomposed from the flow
+        if (not fixed_.empty()) {
+            int64_t cost = 0;
+            std::vector<uint32_t> links;
+            for (auto i : fixed_) {
+                used[i] = true;
+                cost += arcs_[i].cost;
+                links.push_back(arcs_[i].link);
+            }
+            ret.emplace_back(cost, std::move(links));
+        }
+
+        for (auto i : out_[source_]) {
+            if (used[i] || not used_by_flow(i))
+                continue;
+
+            int64_t cost = 0;
+            std::vector<uint32_t> links;
+            while (i != none) {
+                used[i] = true;
+                cost += arcs_[i].cost;
+                links.push_back(arcs_[i].link);
+                auto x = arcs_[i].to;
+                if (x == sink_) {
+                    ret.emplace_back(cost, std::move(links));
+                    break;
+                }
+
+                i = none; // flow is conserved, so never left
+                for (auto next : out_[split_ ? x + 1 : x]) {
+                    if (not used[next] && used_by_flow(next)) {
+                        i = next;
+                        break;
+                    }
+                }
+            }
+        }
+        return ret;
+    }
+
+private:
+    struct Arc {
+        uint32_t to;
+        int32_t cap;
+        int64_t cost;
+        uint32_t link;
+        bool blocked;
+    };
+
+    using Queue = std::priority_queue<
+        std::pair<int64_t, uint32_t>,
+        std::vector<std::pair<int64_t, uint32_t>>,
+        std::greater<std::pair<int64_t, uint32_t>> >;
+
+    bool split_;
+    uint32_t source_;
+    uint32_t sink_;
+    std::vector<Arc> arcs_; // residual arc of arc `i` is `i ^ 1`
+    std::vector<std::vector<uint32_t>> out_;
+    std::vector<int64_t> potential_;
+    std::vector<int64_t> dist_;
+    std::vector<uint32_t> parent_;
+    std::vector<uint32_t> last_;
+    std::vector<uint32_t> fixed_; // link arcs of the fixed path
+
+    uint32_t entry(vertex_descriptor v) const { return split_ ? 2 * v : v; }
+    uint32_t exit(vertex_descriptor v) const { return split_ ? 2 * v + 1 : v; }
+    uint32_t splitArc(vertex_descriptor v) const { return 2 * v; }
+
+    void addArc(uint32_t from, uint32_t to, int64_t cost, uint32_t link) {
+        out_[from].push_back(arcs_.size());
+        arcs_.push_back(Arc{to, 1, cost, link, false});
+        out_[to].push_back(arcs_.size());
+        arcs_.push_back(Arc{from, 0, -cost, link, false});
+    }
+
+    bool used_by_flow(uint32_t i) const {
+        return i % 2 == 0 && arcs_[i].link != none && arcs_[i].cap == 0;
+    }
+
+    void push(const std::vector<uint32_t>& path) {
+        for (auto i : path) {
+            arcs_[i].cap--;
+            arcs_[i ^ 1].cap++;
+        }
+        last_ = path;
+    }
+};
+
+// Maintenance and load of core ports, read from SwitchManager on the Qt
+// thread, so repair workers exclude unavailable links without touching it
+struct Availability {
+    struct Port {
+        switch_and_port sp;
+        bool maintenance;
+        uint64_t max, tx, rx; // Kbps
+    };
+    std::vector<uint64_t> maintenance_switches;
+    std::vector<Port> ports;
+};
+
+// Utilization of core ports, published by reloadStats for multipath routes
+struct LinkLoad {
+    std::map<switch_and_port, uint8_t> util; // percents
+    // above the rebalance threshold and not yet below it by the hysteresis
+    std::set<switch_and_port> hot;
+
+    uint8_t of(switch_and_port sp) const {
+        auto it = util.find(sp);
+        return it != util.end() ? it->second : 0;
+    }
+};
+
+using LinkLoadPtr = std::shared_ptr<const LinkLoad>;
+
+// Links of the paths between route ends not longer than `bound`.
+// The distance to `to` strictly decreases along every link,
+// so following them never loops.
+struct MultipathDag {
+    struct Hop {
+        vertex_descriptor to;
+        uint64_t weight;
+        switch_and_port out;
+        switch_and_port in;
+    };
+
+    vertex_descriptor from;
+    vertex_descriptor to;
+    uint64_t bound {0};
+    std::vector<uint64_t> dist; // towards `to`
+    std::unordered_map<vertex_descriptor, std::vector<Hop>> hops;
+};
+
+static uint64_t mixHash(uint64_t flow_hash, uint64_t dpid)
+{
+    // splitmix64 finalizer, so switches choose independently
+    uint64_t x = flow_hash ^ (dpid * 0x9e3779b97f4a7c15ULL);
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
 
 struct TopologyImpl {
-    TopologyImpl(Topology* app): app(app) {};
+    TopologyImpl(Topology* app)
+        : app(app)
+        , snapshot_(std::make_shared<TopologySnapshot>(0, 0, graph, vertex_map))
+    {};
 
     std::mutex graph_mutex;
     Topology* app;
@@ -328,12 +1105,100 @@ struct TopologyImpl {
     uint32_t pending_id {1};
 
     TopologyGraph graph;
-    std::unordered_map<uint64_t, vertex_descriptor>
-        vertex_map;
+    VertexMap vertex_map;
     std::unordered_map<uint32_t, RoutePtr> route_map;
 
     std::map<switch_and_port, std::pair<uint8_t, uint8_t> > triggers;
     std::map<switch_and_port, uint64_t> speed_rate; // bytes/s
+    mutable SptCache spt_cache;
+    LinkLoadPtr load_ {std::make_shared<LinkLoad>()};
+    std::unique_ptr<IdGen> group_ids;
+    std::mutex failover_mutex;
+    uint8_t rebalance_threshold {80}; // percents
+    uint8_t rebalance_hysteresis {10};
+    std::atomic<uint64_t> generation {0}; // of links and maintenance state
+
+    // changes of the graph since the published snapshot,
+    // guarded by graph_mutex
+    TopologySnapshotPtr snapshot_;
+    std::vector<LinkChange> changes;
+    std::vector<PathPtr> broken_paths; // triggers to emit
+    std::vector<RoutePtr> broken_routes;
+    std::chrono::steady_clock::time_point broken_since;
+    // links already removed on linkFailed, before their linkBroken
+    std::set<std::pair<switch_and_port, switch_and_port>> failed_links;
+
+    // paths traversing every port of core links
+    std::map<switch_and_port, std::set<PathPtr>> link_index;
+    std::mutex index_mutex;
+
+    // dynamic paths of the routes affected by link failures,
+    // computed by repair workers against graph snapshots
+    struct Repair {
+        uint64_t generation;
+        boost::shared_future<data_link_route> path;
+    };
+    struct RepairBatch {
+        std::chrono::steady_clock::time_point started;
+        size_t pending;
+    };
+    std::unordered_map<uint32_t, Repair> repairs;
+    RouteRepairStats repair_stats {};
+    std::mutex repair_mutex;
+
+    // routes changed since the last flush to database,
+    // each is written once however often it changed
+    struct PendingWrite {
+        bool erase;
+        std::chrono::steady_clock::time_point since; // first change
+    };
+    std::unordered_map<uint32_t, PendingWrite> pending_writes;
+    RoutePersistStats persist_stats {};
+    std::chrono::steady_clock::time_point rate_since;
+    uint64_t rate_written {0};
+    size_t flush_batch_bytes {1 << 20}; // encoded routes per request
+    std::mutex persist_mutex;
+
+    void scheduleWrite(uint32_t route_id, bool erase) {
+        std::lock_guard<std::mutex> lk(persist_mutex);
+        persist_stats.updates++;
+        auto it = pending_writes.find(route_id);
+        if (it != pending_writes.end()) {
+            it->second.erase = erase;
+            persist_stats.coalesced++;
+        } else {
+            pending_writes.emplace(route_id, PendingWrite{
+                erase, std::chrono::steady_clock::now()
+            });
+        }
+    }
+
+    LinkLoadPtr load() const {
+        return std::atomic_load(&load_);
+    }
+
+    TopologySnapshotPtr snapshot() const {
+        return std::atomic_load(&snapshot_);
+    }
+
+    void linkChanged(vertex_descriptor a, vertex_descriptor b,
+                     std::optional<MetricsFlag> metrics = {}) {
+        changes.push_back(LinkChange{a, b, metrics});
+        if (not metrics)
+            generation++;
+        schedulePublish();
+    }
+
+    // returns whether paths are affected and should be published
+    bool breakLink(switch_and_port from, switch_and_port to);
+
+    // changes arriving within the interval are published together
+    void schedulePublish() {
+        if (not app->publish_timer->isActive())
+            app->publish_timer->start();
+    }
+
+    std::vector<PathPtr> publish();
 
     vertex_descriptor vertex(uint64_t dpid) const {
         auto it = vertex_map.find(dpid);
@@ -382,70 +1247,289 @@ struct TopologyImpl {
     }
 
     void eraseRoute(uint32_t route_id) { // TODO mutex
-        if (route_map.find(route_id) == route_map.end())
+        auto it = route_map.find(route_id);
+        if (it == route_map.end())
             return;
 
-        route_map.erase(route_id);
+        for (const auto& path : it->second->paths) {
+            unindexPath(path);
+        }
+        route_map.erase(it);
+
+        std::lock_guard<std::mutex> lk(repair_mutex);
+        repairs.erase(route_id);
+    }
+
+    PathPtr attachPath(const RoutePtr& route, data_link_route path) {
+        auto ret = route->attachPath(std::move(path));
+        indexPath(ret);
+        return ret;
     }
 
+    void detachPath(const RoutePtr& route, uint8_t path_id) {
+        auto path = route->getPath(path_id);
+        route->detachPath(path_id);
+        if (path) unindexPath(path);
+    }
+
+    void indexPath(const PathPtr& path) {
+        std::lock_guard<std::mutex> lk(index_mutex);
+        for (const auto& sp : path->m_path) {
+            link_index[sp].insert(path);
+        }
+    }
+
+    void unindexPath(const PathPtr& path) {
+        std::lock_guard<std::mutex> lk(index_mutex);
+        for (const auto& sp : path->m_path) {
+            auto it = link_index.find(sp);
+            if (it == link_index.end())
+                continue;
+            it->second.erase(path);
+            if (it->second.empty())
+                link_index.erase(it);
+        }
+    }
+
+    std::vector<PathPtr> pathsVia(switch_and_port sp) {
+        std::lock_guard<std::mutex> lk(index_mutex);
+        auto it = link_index.find(sp);
+        return it != link_index.end()
+                   ? std::vector<PathPtr>(it->second.begin(), it->second.end())
+                   : std::vector<PathPtr>{};
+    }
+
+    void repairRoutes(const std::vector<RoutePtr>& affected,
+                      std::chrono::steady_clock::time_point started,
+                      TopologySnapshotPtr snapshot);
+    void finishRepair(std::chrono::steady_clock::time_point started);
+    data_link_route dynamicPath(const RoutePtr& route, bool consume);
+
     data_link_route findPath(RoutePtr route, RouteSelector selector) const;
-    data_link_route exactPath(switch_list exact) const;
+    std::vector<data_link_route> disjointPaths(RoutePtr route, RouteSelector selector,
+                                               uint8_t count) const;
+    Availability availability() const;
+    void excludeUnavailable(uint8_t util, const Availability& av,
+                            PathView& view) const;
+    MultipathDag multipathDag(const RoutePtr& route) const;
+    std::map<uint64_t, std::vector<uint32_t>> failoverPorts(const RoutePtr& route) const;
+    data_link_route flowPath(const RoutePtr& route, const MultipathDag& dag,
+                             uint64_t flow_hash) const;
+    data_link_route findPath(uint64_t from, uint64_t to,
+                             const std::vector<data_link_route>& paths,
+                             RouteSelector selector, const Availability& av,
+                             PathView& view) const;
+    data_link_route exactPath(switch_list exact, const PathView& view) const;
     data_link_route inExPath(switch_list include, switch_list exclude,
-                                 MetricsFlag m, RoutePtr route, TopologyGraph& g) const;
+                             MetricsFlag m, uint64_t from, uint64_t to,
+                             PathView& view) const;
     data_link_route computePath(uint64_t from_dpid, uint64_t to_dpid, 
-                                 MetricsFlag mf, const TopologyGraph& g) const;
+                                 MetricsFlag mf, const PathView& view) const;
+    void shortestPaths(vertex_descriptor root, MetricsFlag mf, const PathView& view,
+                       std::vector<vertex_descriptor>& p,
+                       std::vector<uint64_t>& d) const;
+    ShortestPathTreeConstPtr cachedTree(vertex_descriptor root, MetricsFlag mf,
+                                        const PathView& view) const;
+    data_link_route walkPath(uint64_t from_dpid, vertex_descriptor v,
+                             vertex_descriptor e, MetricsFlag mf,
+                             const PathView& view,
+                             const std::vector<vertex_descriptor>& p) const;
+
+    void maxWeight(const data_link_route& route, PathView& view) const;
+    std::vector<link_property> get_dump() {
+        return snapshot()->links;
+    }
+
+    // destroyed first, so pending repairs finish while members are alive
+    std::unique_ptr<boost::basic_thread_pool> repair_pool;
+};
+
+// called with graph_mutex held, returns broken paths to emit triggers
+std::vector<PathPtr> TopologyImpl::publish()
+{
+    auto next = snapshot();
+    if (not changes.empty()) {
+        next = std::make_shared<const TopologySnapshot>(
+                   next->generation + 1, generation, graph, vertex_map);
+        spt_cache.update(*next, changes);
+        changes.clear();
+        std::atomic_store(&snapshot_, next);
+    }
+
+    // all affected routes are recomputed against the same snapshot
+    std::vector<RoutePtr> affected;
+    for (auto& route : broken_routes) {
+        if (route_map.count(route->id) &&
+                std::find(affected.begin(), affected.end(), route) == affected.end())
+            affected.push_back(route);
+    }
+    repairRoutes(affected, broken_since, next);
+    broken_routes.clear();
+
+    return std::move(broken_paths);
+}
+
+void TopologyImpl::repairRoutes(const std::vector<RoutePtr>& affected,
+                                std::chrono::steady_clock::time_point started,
+                                TopologySnapshotPtr snapshot)
+{
+    if (affected.empty())
+        return;
 
-    void maxWeight(const data_link_route& route, TopologyGraph& g) const;
-    std::vector<link_property> get_dump() { // TODO: check
-        std::vector<link_property> ret;
-        auto e = edges(graph);
-        auto e_iter = e.first;
-        while (e_iter != e.second) {
-            ret.push_back(graph[*e_iter]);
-            e_iter++;
+    std::vector<RoutePtr> dynamic;
+    std::lock_guard<std::mutex> lk(repair_mutex);
+    repair_stats.link_failures++;
+    repair_stats.affected_routes += affected.size();
+
+    for (const auto& route : affected) {
+        if (route->allowed_dynamic && repair_pool) {
+            dynamic.push_back(route);
+        } else if (route->getFirstWorkPath()) {
+            repair_stats.repaired_routes++;
+        } else {
+            repair_stats.failed_routes++;
         }
+    }
 
-        return ret;
+    if (dynamic.empty()) {
+        finishRepair(started);
+        return;
     }
-};
+
+    auto batch = std::make_shared<RepairBatch>(RepairBatch{started, dynamic.size()});
+    repair_stats.pending_routes += dynamic.size();
+    auto av = std::make_shared<const Availability>(availability());
+
+    for (const auto& route : dynamic) {
+        // workers get copies, the route itself is changed by the Qt thread
+        auto path = boost::async(*repair_pool,
+                                 [this, from = route->from, to = route->to,
+                                  paths = route->pathList(),
+                                  selector = route->dynamicSelector(),
+                                  snapshot, av, batch]() {
+            PathView view(*snapshot);
+            auto ret = findPath(from, to, paths, selector, *av, view);
+
+            std::lock_guard<std::mutex> lk(repair_mutex);
+            repair_stats.pending_routes--;
+            if (ret.empty()) {
+                repair_stats.failed_routes++;
+            } else {
+                repair_stats.repaired_routes++;
+            }
+            if (--batch->pending == 0) {
+                finishRepair(batch->started);
+            }
+            return ret;
+        });
+        repairs[route->id] = Repair{snapshot->links_generation, path.share()};
+    }
+}
+
+// called with repair_mutex held
+void TopologyImpl::finishRepair(std::chrono::steady_clock::time_point started)
+{
+    using namespace std::chrono;
+    auto elapsed = duration_cast<microseconds>(steady_clock::now() - started);
+    repair_stats.last_repair_time = elapsed;
+    repair_stats.max_repair_time = std::max(repair_stats.max_repair_time, elapsed);
+}
+
+data_link_route TopologyImpl::dynamicPath(const RoutePtr& route, bool consume)
+{
+    boost::shared_future<data_link_route> repaired;
+    {
+        std::lock_guard<std::mutex> lk(repair_mutex);
+        auto it = repairs.find(route->id);
+        if (it != repairs.end()) {
+            if (it->second.generation == generation)
+                repaired = it->second.path;
+            if (consume || it->second.generation != generation)
+                repairs.erase(it);
+        }
+    }
+
+    if (repaired.valid()) {
+        auto ret = repaired.get(); // waits if still computing
+        if (not ret.empty() && not route->hasPath(ret))
+            return ret;
+    }
+
+    return findPath(route, route->dynamicSelector());
+}
 
 data_link_route TopologyImpl::computePath(uint64_t from_dpid, uint64_t to_dpid, 
-                                 MetricsFlag mf, const TopologyGraph& g) const
+                                 MetricsFlag mf, const PathView& view) const
 {
     data_link_route ret;
+    const auto& g = view.graph;
     if (num_vertices(g) == 0)
         return ret;
 
-    auto v = vertex(from_dpid);
-    auto e = vertex(to_dpid);
-    if (v == TopologyGraph::null_vertex() || e == TopologyGraph::null_vertex())
+    auto v = view.vertex(from_dpid);
+    auto e = view.vertex(to_dpid);
+    if (v == SnapshotGraph::null_vertex() || e == SnapshotGraph::null_vertex())
         return ret;
 
-    std::vector<vertex_descriptor> p(num_vertices(g), TopologyGraph::null_vertex());
-
-    // _constructor_ for weight_map
-    auto select_metrics = [&g, &mf](TopologyGraph::edge_descriptor ed) {
-        switch (mf) {
-        case MetricsFlag::Hop:
-            return g[ed].hop_metrics;
-        case MetricsFlag::PortSpeed:
-            return g[ed].ps_metrics;
-        case MetricsFlag::PortLoading:
-            return g[ed].pl_metrics;
-        default:
-            // FIXME: should throw exception?
-            LOG(ERROR) << "[Topology] Incorrect metrics!";
-            return (uint64_t)0;
-        }
-    };
+    auto tree = cachedTree(e, mf, view);
+    if (not tree) {
+        // working buffers of dijkstra are reused by requests of the same thread
+        static thread_local std::vector<vertex_descriptor> p;
+        static thread_local std::vector<uint64_t> d;
+        shortestPaths(e, mf, view, p, d);
+        return walkPath(from_dpid, v, e, mf, view, p);
+    }
+
+    return walkPath(from_dpid, v, e, mf, view, tree->pred);
+}
+
+void TopologyImpl::shortestPaths(vertex_descriptor root, MetricsFlag mf,
+                                 const PathView& view,
+                                 std::vector<vertex_descriptor>& p,
+                                 std::vector<uint64_t>& d) const
+{
+    const auto& g = view.graph;
+    auto fg = view.filtered();
+    auto index = boost::get(vertex_index, g);
     auto metrics_weight_map = 
-         boost::make_function_property_map<TopologyGraph::edge_descriptor, uint64_t>
-         (select_metrics);
+         boost::make_function_property_map<snapshot_edge_descriptor, uint64_t>
+         ([&view, mf](snapshot_edge_descriptor ed) { return view.weight(ed, mf); });
 
     // computing predecessor_map with dijkstra algorithm
-    dijkstra_shortest_paths_no_color_map(g, e, weight_map( metrics_weight_map )
-        .predecessor_map( make_iterator_property_map(p.begin(), boost::get(vertex_index, g)) )
+    p.assign(num_vertices(g), SnapshotGraph::null_vertex());
+    d.resize(num_vertices(g));
+    dijkstra_shortest_paths_no_color_map(fg, root, weight_map( metrics_weight_map )
+        .predecessor_map( make_iterator_property_map(p.begin(), index) )
+        .distance_map( make_iterator_property_map(d.begin(), index) )
     );
+}
+
+ShortestPathTreeConstPtr TopologyImpl::cachedTree(vertex_descriptor root,
+                                                  MetricsFlag mf,
+                                                  const PathView& view) const
+{
+    if (not view.plain() || not spt_cache.enabled())
+        return nullptr;
+
+    auto tree = spt_cache.find(root, mf, view.snapshot.generation);
+    if (not tree) {
+        auto computed = std::make_shared<ShortestPathTree>(root, mf);
+        shortestPaths(root, mf, view, computed->pred, computed->dist);
+        spt_cache.insert(computed, view.snapshot.generation);
+        tree = std::move(computed);
+    }
+    return tree;
+}
+
+data_link_route TopologyImpl::walkPath(uint64_t from_dpid, vertex_descriptor v,
+                                       vertex_descriptor e, MetricsFlag mf,
+                                       const PathView& view,
+                                       const std::vector<vertex_descriptor>& p) const
+{
+    data_link_route ret;
+    auto fg = view.filtered();
+    if (v >= p.size()) // switch was added after the tree was computed
+        return ret;
 
     // computing result path from v to e
     // using predecessor_map
@@ -454,34 +1538,16 @@ data_link_route TopologyImpl::computePath(uint64_t from_dpid, uint64_t to_dpid,
     while (v != e) {
         uint64_t min_metrics = 0;
         switch_and_port res1, res2;
-        auto edges = edge_range(v, u, g);
+        auto edges = out_edges(v, fg);
         for (auto it = edges.first; it != edges.second; it++) {
-            // comparing parallel links using selected metrics
-            auto check_metrics = [&min_metrics](const auto& link, auto mf){
-                uint64_t curr {0};
-                switch (mf) {
-                case MetricsFlag::Hop:
-                    curr = link.hop_metrics;
-                    break;
-                case MetricsFlag::PortSpeed:
-                    curr = link.ps_metrics;
-                    break;
-                case MetricsFlag::PortLoading:
-                    curr = link.pl_metrics;
-                    break;
-                default:
-                    LOG(ERROR) << "[Topology] Incorrect metrics";
-                }
-
-                if (!min_metrics || min_metrics > curr) {
-                    min_metrics = curr;
-                    return true;
-                }
-                return false;
-            };
+            if (target(*it, fg) != u)
+                continue;
 
-            const auto& link = g[*it];
-            if (check_metrics(link, mf)) {
+            // comparing parallel links using selected metrics
+            uint64_t curr = view.weight(*it, mf);
+            if (!min_metrics || min_metrics > curr) {
+                min_metrics = curr;
+                const auto& link = view.snapshot.link(*it);
                 res1 = link.source;
                 res2 = link.target;
             }
@@ -510,72 +1576,75 @@ data_link_route TopologyImpl::computePath(uint64_t from_dpid, uint64_t to_dpid,
     return ret;
 }
 
-void TopologyImpl::maxWeight(const data_link_route& path, TopologyGraph& g) const
+void TopologyImpl::maxWeight(const data_link_route& path, PathView& view) const
 {
     if (path.size() == 0) return;
 
+    const auto& g = view.graph;
     for (auto it = path.begin(), next = it++; it != path.end(); it++, next++) {
         if (it->dpid == next->dpid)
             continue;
 
-        CHECK(vertex(it->dpid) != TopologyGraph::null_vertex(), "Inconsistent topology graph");
+        auto u = view.vertex(it->dpid);
+        auto v = view.vertex(next->dpid);
+        if (u == SnapshotGraph::null_vertex() || v == SnapshotGraph::null_vertex())
+            continue; // switch is gone since the path was computed
 
-        auto edges = edge_range(vertex(it->dpid), vertex(next->dpid), g);
+        auto edges = out_edges(u, g);
         for (auto par = edges.first; par != edges.second; ++par) {
-            link_property& prop = g[*par];
+            if (target(*par, g) != v)
+                continue;
+
+            const link_property& prop = view.snapshot.link(*par);
             if (prop.source != *it && prop.target != *it) { // if parallel links
                 continue;
             }
 
-            prop.hop_metrics += max_weight;
-            prop.ps_metrics += max_weight;
-            prop.pl_metrics += max_weight;
+            view.penalties[g[*par].link] += max_weight;
         }
     }
 }
 
-data_link_route TopologyImpl::exactPath(switch_list exact) const
+data_link_route TopologyImpl::exactPath(switch_list exact,
+                                        const PathView& view) const
 {
     data_link_route ret;
-    for (size_t i = 0; i < exact.size() - 1; i++) {
+    for (size_t i = 0; i + 1 < exact.size(); i++) {
         auto curr = exact.at(i);
-        auto sw = app->m_switch_manager->switch_(curr);
         auto next = exact.at(i+1);
-        auto ports = sw->ports();
 
-        auto found = std::find_if(ports.begin(), ports.end(), 
-            [this, curr, next](auto port) {
-                switch_and_port sp { curr, port->number() };
-                return app->other(sp).dpid == next;
+        const auto& links = view.snapshot.links;
+        auto found = std::find_if(links.begin(), links.end(),
+            [curr, next](const link_property& link) {
+                return (link.source.dpid == curr && link.target.dpid == next) ||
+                       (link.source.dpid == next && link.target.dpid == curr);
         });
 
-        if (found == ports.end()) {
+        if (found == links.end()) {
             LOG(WARNING) << "[Topology] Creating path - Can't create exact path"
                             "between <" << exact.front() <<
                             "> and <" << exact.back() << ">";
             return data_link_route{};
         }
 
-        switch_and_port sp {curr, (*found)->number()};
-        switch_and_port other = app->other(sp);
-        ret.push_back(sp);
-        ret.push_back(other);
+        bool forward = found->source.dpid == curr;
+        ret.push_back(forward ? found->source : found->target);
+        ret.push_back(forward ? found->target : found->source);
     }
 
     return ret;
 }
 
 data_link_route TopologyImpl::inExPath(switch_list include, switch_list exclude,
-                                       MetricsFlag m, RoutePtr route,  TopologyGraph& g) const
+                                       MetricsFlag m, uint64_t from, uint64_t to,
+                                       PathView& view) const
 {
     data_link_route ret;
-    auto from = route->from;
-    auto to = route->to;
 
     for (auto dpid : exclude) {
         if (dpid != from && dpid != to && 
-                vertex(dpid) != TopologyGraph::null_vertex())
-            clear_vertex(vertex(dpid), g);
+                view.vertex(dpid) != SnapshotGraph::null_vertex())
+            view.removed_switches.insert(view.vertex(dpid));
     }
 
     switch_list ends {from, to};
@@ -590,7 +1659,7 @@ data_link_route TopologyImpl::inExPath(switch_list include, switch_list exclude,
 
     auto tfrom = from;
     for (auto dpid : include) {
-        auto part = computePath(tfrom, dpid, m, g);
+        auto part = computePath(tfrom, dpid, m, view);
         if (part.size() == 0) {
             VLOG(2) << "[Topology] Creating path - No path between <" 
                     << from << "> and <" << to
@@ -606,75 +1675,338 @@ data_link_route TopologyImpl::inExPath(switch_list include, switch_list exclude,
     return ret;
 }
 
-data_link_route TopologyImpl::findPath(RoutePtr route, RouteSelector selector) const
+// repair workers get a copy taken when they are dispatched
+Availability TopologyImpl::availability() const
 {
-    using namespace route_selector;
-
-    app->updateMetrics();
+    Availability ret;
+    for (auto sw : app->m_switch_manager->switches()) {
+        if (sw->maintenance()) {
+            ret.maintenance_switches.push_back(sw->dpid());
+            continue;
+        }
 
-    data_link_route ret;
-    TopologyGraph tmp_graph(graph);
+        for (auto port : sw->ports()) {
+            auto sp = switch_and_port {sw->dpid(), port->number()};
+            auto other = app->other(sp);
+            if (other.dpid == 0 || sp.dpid == other.dpid) // not core port or loopback
+                continue;
 
-    std::for_each(route->paths.begin(), route->paths.end(), [&tmp_graph, this](auto path) {
-        this->maxWeight(path->m_path, tmp_graph);
-    });
+            auto eth = std::dynamic_pointer_cast<EthernetPort>(port);
+            auto stats = port->stats();
+            auto& speed = stats.current_speed;
+            ret.ports.push_back(Availability::Port{
+                sp, port->maintenance(),
+                eth->current_speed(),
+                (uint64_t)speed.tx_bytes() * 8 / 1000,
+                (uint64_t)speed.rx_bytes() * 8 / 1000
+            });
+        }
+    }
+    return ret;
+}
 
+void TopologyImpl::excludeUnavailable(uint8_t util, const Availability& av,
+                                      PathView& view) const
+{
     // erase maintenance switches
-    for (auto sw : app->m_switch_manager->switches()) {
-        if (sw->maintenance()) {
-            clear_vertex(vertex(sw->dpid()), tmp_graph);
+    for (auto dpid : av.maintenance_switches) {
+        if (view.vertex(dpid) != SnapshotGraph::null_vertex()) {
+            view.removed_switches.insert(view.vertex(dpid));
         }
     }
 
     // erase maintenance and overloaded links
+    for (const auto& port : av.ports) {
+        if (port.maintenance) { // erase maintenance port
+            if (auto link = view.link(port.sp)) {
+                view.removed_links.insert(*link);
+            }
+        }
+        else if (util > 0) { // else check overload
+            uint64_t allowed = port.max * util / 100;
+
+            if (port.tx > allowed || port.rx > allowed) {
+                VLOG(7) << "[Topology] Overloaded link - " << port.sp;
+                if (auto link = view.link(port.sp)) {
+                    view.removed_links.insert(*link);
+                }
+            }
+        }
+    }
+}
+
+std::vector<data_link_route> TopologyImpl::disjointPaths(RoutePtr route,
+                                                         RouteSelector selector,
+                                                         uint8_t count) const
+{
+    using namespace route_selector;
+
+    auto snapshot = this->snapshot();
+    PathView view(*snapshot);
+    MetricsFlag metr = selector.get(metrics) ? *selector.get(metrics) : +MetricsFlag::Hop;
     uint8_t util = selector.get(util_trigger) ? *selector.get(util_trigger) : 0;
-    for (auto sw : app->m_switch_manager->switches()) {
-        if (sw->maintenance()) continue; // already removed
+    bool node = selector.get(disjoint_paths) &&
+                *selector.get(disjoint_paths) == +DisjointFlag::Node;
+    bool min_total = selector.get(min_total_cost) && *selector.get(min_total_cost);
+
+    excludeUnavailable(util, availability(), view);
+    if (selector.get(exclude_dpid)) {
+        for (auto dpid : *selector.get(exclude_dpid)) {
+            if (dpid != route->from && dpid != route->to &&
+                    view.vertex(dpid) != SnapshotGraph::null_vertex())
+                view.removed_switches.insert(view.vertex(dpid));
+        }
+    }
 
-        for (auto port : sw->ports()) {
-            auto sp = switch_and_port {sw->dpid(), port->number()};
-            auto other = app->other(sp);
-            if (other.dpid == 0 || sp.dpid == other.dpid) // not core port or loopback
+    // flow goes from `to`, so the cached tree gives the first path
+    auto s = view.vertex(route->to);
+    auto t = view.vertex(route->from);
+    if (s == SnapshotGraph::null_vertex() || t == SnapshotGraph::null_vertex() || s == t)
+        return {};
+
+    DisjointNetwork network(view, metr, node, s, t);
+    auto tree = cachedTree(s, metr, view);
+    if (not (tree && network.warmStart(*tree)) && not network.augment())
+        return {};
+    if (not min_total)
+        network.fixLast();
+    for (uint8_t found = 1; found < count; found++) {
+        if (not network.augment())
+            break;
+    }
+
+    // the cheapest path goes first
+    auto paths = network.paths();
+    std::stable_sort(paths.begin(), paths.end(), [](const auto& a, const auto& b) {
+        return a.first < b.first;
+    });
+
+    std::vector<data_link_route> ret;
+    for (const auto& path : paths) {
+        // links from `to`, reversed to the route direction
+        std::vector<std::pair<switch_and_port, switch_and_port>> hops;
+        auto curr = route->to;
+        for (auto link : path.second) {
+            const auto& prop = snapshot->links[link];
+            if (prop.source.dpid == curr) {
+                hops.emplace_back(prop.source, prop.target);
+            } else {
+                hops.emplace_back(prop.target, prop.source);
+            }
+            curr = hops.back().second.dpid;
+        }
+
+        data_link_route p;
+        for (auto it = hops.rbegin(); it != hops.rend(); ++it) {
+            p.push_back(it->second);
+            p.push_back(it->first);
+        }
+        ret.push_back(std::move(p));
+    }
+    return ret;
+}
+
+MultipathDag TopologyImpl::multipathDag(const RoutePtr& route) const
+{
+    MultipathDag dag;
+    auto snapshot = this->snapshot();
+    PathView view(*snapshot);
+    excludeUnavailable(0, availability(), view);
+
+    auto mf = route->balancing.metrics;
+    dag.from = view.vertex(route->from);
+    dag.to = view.vertex(route->to);
+    if (dag.from == SnapshotGraph::null_vertex() ||
+            dag.to == SnapshotGraph::null_vertex() || dag.from == dag.to)
+        return dag;
+
+    // distances to both ends, from the cache if possible
+    std::vector<vertex_descriptor> p;
+    std::vector<uint64_t> from_dist;
+    auto distances = [&](vertex_descriptor root, std::vector<uint64_t>& d) {
+        if (auto tree = cachedTree(root, mf, view)) {
+            d = tree->dist;
+        } else {
+            shortestPaths(root, mf, view, p, d);
+        }
+    };
+    distances(dag.to, dag.dist);
+    distances(dag.from, from_dist);
+
+    auto shortest = dag.dist[dag.from];
+    if (shortest == ShortestPathTree::infinity)
+        return dag;
+    dag.bound = shortest + shortest * route->balancing.stretch / 100;
+
+    // links reachable from `from`
+    auto fg = view.filtered();
+    std::vector<bool> seen(num_vertices(view.graph), false);
+    std::queue<vertex_descriptor> queue;
+    queue.push(dag.from);
+    seen[dag.from] = true;
+    while (not queue.empty()) {
+        auto u = queue.front();
+        queue.pop();
+
+        auto edges = out_edges(u, fg);
+        for (auto it = edges.first; it != edges.second; ++it) {
+            auto v = target(*it, fg);
+            auto weight = view.weight(*it, mf);
+            if (weight == 0 || dag.dist[v] >= dag.dist[u] ||
+                    from_dist[u] + weight + dag.dist[v] > dag.bound)
                 continue;
 
-            if (port->maintenance()) { // erase maintenance port
-                auto e = edge(sp, tmp_graph);
-                if (e.second) {
-                    remove_edge(e.first, tmp_graph);
-                }
+            const auto& link = snapshot->link(*it);
+            bool forward = snapshot->vertex(link.source.dpid) == u;
+            dag.hops[u].push_back(MultipathDag::Hop{
+                v, weight,
+                forward ? link.source : link.target,
+                forward ? link.target : link.source
+            });
+            if (not seen[v]) {
+                seen[v] = true;
+                queue.push(v);
             }
-            else if (util > 0) { // else check overload
-                auto eth = std::dynamic_pointer_cast<EthernetPort>(port);
-                auto stats = port->stats();
-                auto& speed = stats.current_speed;
-                uint64_t max = eth->current_speed(); // Kbps
-                uint64_t tx = (uint64_t)speed.tx_bytes() * 8 / 1000;
-                uint64_t rx = (uint64_t)speed.rx_bytes() * 8 / 1000;
-                uint64_t allowed = max * util / 100;
-
-                if (tx > allowed || rx > allowed) {
-                    VLOG(7) << "[Topology] Overloaded link - " << sp;
-                    auto e = edge(sp, tmp_graph);
-                    if (e.second) {
-                        remove_edge(e.first, tmp_graph);
-                    }
+        }
+    }
+    return dag;
+}
+
+data_link_route TopologyImpl::flowPath(const RoutePtr& route, const MultipathDag& dag,
+                                       uint64_t flow_hash) const
+{
+    data_link_route ret;
+    auto load = this->load();
+    const auto& balancing = route->balancing;
+
+    uint64_t cost = 0;
+    for (auto u = dag.from; u != dag.to;) {
+        auto hops = dag.hops.find(u);
+        if (hops == dag.hops.end())
+            return data_link_route{};
+
+        // the whole path must stay within the bound
+        std::vector<const MultipathDag::Hop*> candidates;
+        for (const auto& hop : hops->second) {
+            if (cost + hop.weight + dag.dist[hop.to] <= dag.bound)
+                candidates.push_back(&hop);
+        }
+
+        if (balancing.rebalance) {
+            auto hot = [&load](const MultipathDag::Hop* hop) {
+                return load->hot.count(hop->out) || load->hot.count(hop->in);
+            };
+            if (not std::all_of(candidates.begin(), candidates.end(), hot)) {
+                candidates.erase(std::remove_if(candidates.begin(), candidates.end(), hot),
+                                 candidates.end());
+            }
+        }
+
+        if (candidates.empty())
+            return data_link_route{};
+
+        auto key = mixHash(flow_hash, hops->second.front().out.dpid);
+        auto next = candidates[key % candidates.size()];
+        if (balancing.balance == +BalanceFlag::Load) {
+            // weighted by free capacity of links
+            std::vector<uint64_t> free;
+            uint64_t total = 0;
+            for (auto hop : candidates) {
+                uint8_t util = std::max(load->of(hop->out), load->of(hop->in));
+                free.push_back(101 - std::min<uint8_t>(util, 100));
+                total += free.back();
+            }
+
+            auto point = key % total;
+            for (size_t i = 0; i < candidates.size(); i++) {
+                if (point < free[i]) {
+                    next = candidates[i];
+                    break;
                 }
+                point -= free[i];
             }
         }
+
+        ret.push_back(next->out);
+        ret.push_back(next->in);
+        cost += next->weight;
+        u = next->to;
+    }
+    return ret;
+}
+
+// Output ports of the route paths on every switch, ports of the used path
+// first. Switches with more than one port are divergence points.
+std::map<uint64_t, std::vector<uint32_t>>
+TopologyImpl::failoverPorts(const RoutePtr& route) const
+{
+    std::vector<PathPtr> paths;
+    uint8_t used;
+    {
+        std::lock_guard<std::mutex> lock(route->mut);
+        paths = route->paths;
+        used = route->used_path;
+    }
+    if (used < paths.size()) {
+        std::rotate(paths.begin(), paths.begin() + used, paths.begin() + used + 1);
+    }
+
+    std::map<uint64_t, std::vector<uint32_t>> ret;
+    for (const auto& path : paths) {
+        const auto& m_path = path->m_path;
+        for (size_t i = 0; i + 1 < m_path.size(); i += 2) { // output ports only
+            auto& ports = ret[m_path[i].dpid];
+            if (std::find(ports.begin(), ports.end(), m_path[i].port) == ports.end())
+                ports.push_back(m_path[i].port);
+        }
+    }
+
+    for (auto it = ret.begin(); it != ret.end();) {
+        if (it->second.size() < 2) {
+            it = ret.erase(it);
+        } else {
+            ++it;
+        }
     }
+    return ret;
+}
+
+data_link_route TopologyImpl::findPath(RoutePtr route, RouteSelector selector) const
+{
+    using namespace route_selector;
+
+    auto snapshot = this->snapshot();
+    PathView view(*snapshot);
+    return findPath(route->from, route->to, route->pathList(),
+                    std::move(selector), availability(), view);
+}
+
+data_link_route TopologyImpl::findPath(uint64_t from, uint64_t to,
+                                       const std::vector<data_link_route>& paths,
+                                       RouteSelector selector, const Availability& av,
+                                       PathView& view) const
+{
+    using namespace route_selector;
 
-    auto from = route->from;
-    auto to = route->to;
     MetricsFlag metr = selector.get(metrics) ? *selector.get(metrics) : +MetricsFlag::Hop;
 
+    data_link_route ret;
+
+    std::for_each(paths.begin(), paths.end(), [&view, this](const auto& path) {
+        this->maxWeight(path, view);
+    });
+
+    uint8_t util = selector.get(util_trigger) ? *selector.get(util_trigger) : 0;
+    excludeUnavailable(util, av, view);
+
     if (selector.get(exact_dpid)) {
-        ret = std::move(exactPath(std::move(*selector.get(exact_dpid))));
+        ret = std::move(exactPath(std::move(*selector.get(exact_dpid)), view));
         // reverse if path description came with reverse order
         if (ret.size() > 1 && ret[0].dpid == to && ret[ret.size()-1].dpid == from) {
             std::reverse(std::begin(ret), std::end(ret));
         }
         // return empty result if path is incorrect
-        if (ret.front().dpid != from || ret.back().dpid != to) {
+        if (ret.empty() || ret.front().dpid != from || ret.back().dpid != to) {
             return data_link_route{};
         }
 
@@ -685,12 +2017,12 @@ data_link_route TopologyImpl::findPath(RoutePtr route, RouteSelector selector) c
         if (selector.get(exclude_dpid))
             exclude = std::move(*selector.get(exclude_dpid));
         ret = std::move(inExPath(std::move(include), std::move(exclude),
-                                 metr, route, tmp_graph));
+                                 metr, from, to, view));
     } else {
-        ret = std::move(computePath(from, to, metr, tmp_graph));
+        ret = std::move(computePath(from, to, metr, view));
     }
 
-    if (ret.empty() || route->hasPath(ret))
+    if (ret.empty() || std::find(paths.begin(), paths.end(), ret) != paths.end())
         return data_link_route{};
 
     return ret;
@@ -713,6 +2045,34 @@ void Topology::init(Loader *loader, const Config &rootConfig)
     m_switch_manager = SwitchManager::get(loader);
     recovery = RecoveryManager::get(loader);
     db_connector_ = DatabaseConnector::get(loader);
+    sender_ = OFMsgSender::get(loader);
+
+    auto config = config_cd(rootConfig, "topology");
+    // memory limit of shortest-path trees cache, megabytes
+    auto spt_cache_size = config_get(config, "spt-cache-size", 16);
+    m->spt_cache.setLimit(spt_cache_size > 0 ? size_t(spt_cache_size) << 20 : 0);
+    // threads recomputing dynamic routes broken by link failures
+    auto repair_workers = config_get(config, "repair-workers", 2);
+    if (repair_workers > 0)
+        m->repair_pool.reset(new boost::basic_thread_pool(repair_workers));
+    // utilization of links to move multipath flows off them, percents
+    m->rebalance_threshold = config_get(config, "rebalance-threshold", 80);
+    m->rebalance_hysteresis = config_get(config, "rebalance-hysteresis", 10);
+    // ids of fast-failover groups, shared by all switches
+    m->group_ids.reset(new IdGen(config_get(config, "failover-group-first", 0x70000000),
+                                 config_get(config, "failover-group-count", 0x10000)));
+
+    // changed routes are written to database in batches
+    m->flush_batch_bytes = std::max(config_get(config, "db-batch-bytes", 1 << 20), 1);
+    m->rate_since = std::chrono::steady_clock::now();
+    flush_timer = new QTimer(this);
+    connect(flush_timer, &QTimer::timeout, this, &Topology::flush_database);
+    flush_timer->start(config_get(config, "db-flush-interval", 200));
+
+    publish_timer = new QTimer(this);
+    publish_timer->setSingleShot(true);
+    publish_timer->setInterval(config_get(config, "snapshot-batch-interval", 50));
+    connect(publish_timer, &QTimer::timeout, this, &Topology::publish);
 
     stats_timer = new QTimer(this);
     connect(stats_timer, &QTimer::timeout, this, &Topology::reloadStats);
@@ -726,6 +2086,11 @@ void Topology::init(Loader *loader, const Config &rootConfig)
             this, SLOT(linkDiscovered(switch_and_port, switch_and_port)));
     connect(ld, SIGNAL(linkBroken(switch_and_port, switch_and_port)),
             this, SLOT(linkBroken(switch_and_port, switch_and_port)));
+    // fast detection reports failures from its own thread, they are
+    // handled in this one, the owner of routes, paths and timers
+    connect(ld, SIGNAL(linkFailed(switch_and_port, switch_and_port)),
+            this, SLOT(linkFailed(switch_and_port, switch_and_port)),
+            Qt::QueuedConnection);
 
     connect(m_switch_manager, &SwitchManager::portMaintenanceStart,
             this, &Topology::onPMaintenance);
@@ -773,15 +2138,11 @@ void Topology::onPMaintenance(PortPtr port)
 {
     std::vector<PathPtr> need_emit;
     switch_and_port mnt { port->switch_()->dpid(), port->number() };
-    for (auto it : m->route_map) {
-        auto& paths = it.second->paths;
-        std::for_each(paths.begin(), paths.end(), [mnt, &need_emit](auto path) {
-            if (path->contains(mnt)) {
-                if (path->activateTrigger(TriggerFlag::Maintenance)) {
-                    need_emit.push_back(path);
-                }
-            }
-        });
+    m->generation++;
+    for (auto path : m->pathsVia(mnt)) {
+        if (path->activateTrigger(TriggerFlag::Maintenance)) {
+            need_emit.push_back(path);
+        }
     }
 
     std::for_each(need_emit.begin(), need_emit.end(), [this](auto path) {
@@ -793,15 +2154,11 @@ void Topology::onPMaintenanceOff(PortPtr port)
 {
     std::vector<PathPtr> need_emit;
     switch_and_port mnt { port->switch_()->dpid(), port->number() };
-    for (auto it : m->route_map) {
-        auto& paths = it.second->paths;
-        std::for_each(paths.begin(), paths.end(), [mnt, &need_emit, this](auto path) {
-            if (path->contains(mnt)) {
-                if (path->inactivateTrigger(TriggerFlag::Maintenance, this)) {
-                    need_emit.push_back(path);
-                }
-            }
-        });
+    m->generation++;
+    for (auto path : m->pathsVia(mnt)) {
+        if (path->inactivateTrigger(TriggerFlag::Maintenance, this)) {
+            need_emit.push_back(path);
+        }
     }
 
     std::for_each(need_emit.begin(), need_emit.end(), [this](auto path) {
@@ -815,6 +2172,7 @@ void Topology::onPMaintenanceOff(PortPtr port)
 void Topology::onSMaintenance(SwitchPtr sw)
 {
     auto dpid = sw->dpid();
+    m->generation++;
     std::vector<PathPtr> need_emit;
     for (auto it : m->route_map) {
         auto& paths = it.second->paths;
@@ -835,6 +2193,7 @@ void Topology::onSMaintenance(SwitchPtr sw)
 void Topology::onSMaintenanceOff(SwitchPtr sw)
 {
     auto dpid = sw->dpid();
+    m->generation++;
     std::vector<PathPtr> need_emit;
     for (auto it : m->route_map) {
         auto& paths = it.second->paths;
@@ -860,6 +2219,25 @@ std::vector<link_property> Topology::dumpWeights()
     return m->get_dump();
 }
 
+SptCacheStats Topology::sptCacheStats() const
+{
+    return m->spt_cache.stats();
+}
+
+RouteRepairStats Topology::routeRepairStats() const
+{
+    std::lock_guard<std::mutex> lk(m->repair_mutex);
+    return m->repair_stats;
+}
+
+RoutePersistStats Topology::routePersistStats() const
+{
+    std::lock_guard<std::mutex> lk(m->persist_mutex);
+    auto ret = m->persist_stats;
+    ret.pending = m->pending_writes.size();
+    return ret;
+}
+
 std::vector<uint32_t> Topology::getRoutes() const
 {
     std::vector<uint32_t> ret;
@@ -897,15 +2275,12 @@ void Topology::linkDiscovered(switch_and_port from, switch_and_port to)
         m->timer_id = startTimer(ready_timeout * 1000);
     }
 
-    for (auto it : m->route_map) {
-        auto& paths = it.second->paths;
-        std::for_each(paths.begin(), paths.end(), [from, &need_emit, this](auto path) {
-            if (path->broken_flag && path->contains(from)) {
-                if (path->inactivateTrigger(TriggerFlag::Broken, this)) { // if true, need emit
-                    need_emit.push_back(path);
-                }
+    for (auto path : m->pathsVia(from)) {
+        if (path->broken_flag) {
+            if (path->inactivateTrigger(TriggerFlag::Broken, this)) { // if true, need emit
+                need_emit.push_back(path);
             }
-        });
+        }
     }
 
     } // mutex
@@ -920,27 +2295,71 @@ void Topology::linkDiscovered(switch_and_port from, switch_and_port to)
 
 void Topology::linkBroken(switch_and_port from, switch_and_port to)
 {
-    std::vector<PathPtr> need_emit;
+    std::lock_guard<std::mutex> lk(m->graph_mutex);
+
+    if (m->failed_links.erase({from, to}))
+        return; // handled by linkFailed
+
+    if (m->breakLink(from, to))
+        m->schedulePublish();
+}
 
+void Topology::linkFailed(switch_and_port from, switch_and_port to)
+{
+    // the snapshot without the link is published at once
+    // instead of waiting for the batch
     { // mutex
     std::lock_guard<std::mutex> lk(m->graph_mutex);
+    m->failed_links.emplace(from, to);
+    if (not m->breakLink(from, to))
+        return;
+    } // mutex
 
-    auto e = m->edge(from, m->graph);
+    publish_timer->stop();
+    publish();
+}
+
+// called with graph_mutex held
+bool TopologyImpl::breakLink(switch_and_port from, switch_and_port to)
+{
+    auto e = edge(from, graph);
     if (e.second) {
-        remove_edge(e.first, m->graph);
+        auto u = source(e.first, graph);
+        auto v = target(e.first, graph);
+        remove_edge(e.first, graph);
+        linkChanged(u, v);
     }
 
-    for (auto it : m->route_map) {
-        auto& paths = it.second->paths;
-        std::for_each(paths.begin(), paths.end(), [from, &need_emit](auto path) {
-            if (path->broken_flag && path->contains(from)) {
-                if (path->activateTrigger(TriggerFlag::Broken)) { // if true, need emit signal
-                    need_emit.push_back(path);
-                }
+    // triggers are emitted and affected routes are repaired
+    // when the snapshot without this link is published
+    auto paths = pathsVia(from);
+    if (paths.empty())
+        return false;
+
+    if (broken_paths.empty() && broken_routes.empty())
+        broken_since = std::chrono::steady_clock::now();
+
+    for (auto path : paths) {
+        if (path->broken_flag) {
+            if (path->activateTrigger(TriggerFlag::Broken)) { // if true, need emit signal
+                broken_paths.push_back(path);
             }
-        });
+        }
+
+        auto route = route_map.find(path->route_id);
+        if (route != route_map.end())
+            broken_routes.push_back(route->second);
     }
+    return true;
+}
+
+void Topology::publish()
+{
+    std::vector<PathPtr> need_emit;
 
+    { // mutex
+    std::lock_guard<std::mutex> lk(m->graph_mutex);
+    need_emit = m->publish();
     } // mutex
 
     std::for_each(need_emit.begin(), need_emit.end(), [this](auto path) {
@@ -950,6 +2369,11 @@ void Topology::linkBroken(switch_and_port from, switch_and_port to)
 
 void Topology::reloadStats()
 {
+    { // mutex
+    std::lock_guard<std::mutex> lk(m->graph_mutex);
+    updateMetrics();
+    } // mutex
+
     for (auto sw : m_switch_manager->switches()) {
         for (auto port : sw->ports()) {
             switch_and_port sp {sw->dpid(), port->number()};
@@ -992,6 +2416,48 @@ void Topology::reloadStats()
         }
     }
 
+    // ports stay hot until they cool below the threshold by the hysteresis
+    auto prev = m->load();
+    auto load = std::make_shared<LinkLoad>();
+    for (const auto& it : m->triggers) {
+        int util = it.second.second;
+        int threshold = m->rebalance_threshold;
+        if (prev->hot.count(it.first))
+            threshold -= m->rebalance_hysteresis;
+
+        load->util[it.first] = it.second.second;
+        if (util > threshold)
+            load->hot.insert(it.first);
+    }
+
+    std::vector<switch_and_port> changed;
+    std::set_symmetric_difference(prev->hot.begin(), prev->hot.end(),
+                                  load->hot.begin(), load->hot.end(),
+                                  std::back_inserter(changed));
+    std::atomic_store(&m->load_, LinkLoadPtr(std::move(load)));
+
+    std::vector<uint32_t> rebalanced;
+    if (not changed.empty()) {
+        for (const auto& it : m->route_map) {
+            auto route = it.second;
+            if (route->balancing.balance == +BalanceFlag::None ||
+                    not route->balancing.rebalance)
+                continue;
+
+            auto dag = m->multipathDag(route);
+            auto affected = std::any_of(dag.hops.begin(), dag.hops.end(),
+                [&changed](const auto& hops) {
+                    return std::any_of(hops.second.begin(), hops.second.end(),
+                        [&changed](const auto& hop) {
+                            return std::binary_search(changed.begin(), changed.end(), hop.out) ||
+                                   std::binary_search(changed.begin(), changed.end(), hop.in);
+                        });
+                });
+            if (affected)
+                rebalanced.push_back(route->id);
+        }
+    }
+
     std::vector<PathPtr> act_need_emit_drop, inact_need_emit_drop;
     std::vector<PathPtr> act_need_emit_util, inact_need_emit_util;
 
@@ -1059,6 +2525,11 @@ void Topology::reloadStats()
     emitting(act_need_emit_util, TriggerFlag::Util, true);
     emitting(inact_need_emit_drop, TriggerFlag::Drop, false);
     emitting(inact_need_emit_util, TriggerFlag::Util, false);
+
+    for (auto id : rebalanced) {
+        VLOG(2) << "[Topology] Rebalanced multipath route - " << id;
+        emit routeRebalanced(id);
+    }
 }
 
 void Topology::updateMetrics()
@@ -1092,7 +2563,12 @@ void Topology::updateMetrics()
                 uint64_t max = getSpeedRate(neighbor); // Bps
                 uint64_t cur = std::max(tx, rx);
                 uint64_t weight = max_weight - 8 * (max - cur) / 1000000; // Mbit
-                prop.pl_metrics = (weight > 0 ? weight : 1);
+                uint64_t pl_metrics = (weight > 0 ? weight : 1);
+                if (prop.pl_metrics != pl_metrics) {
+                    prop.pl_metrics = pl_metrics;
+                    m->linkChanged(vert, target(*it, m->graph),
+                                   +MetricsFlag::PortLoading);
+                }
             }
         }
     }
@@ -1124,11 +2600,54 @@ void Topology::addLink(switch_and_port from, switch_and_port to)
 
     uint64_t ps_metrics = (speed >= max_weight ? 1 : max_weight - speed + 1);
     add_edge(u, v, link_property{from, to, 1, ps_metrics, 1}, m->graph);
+    m->linkChanged(u, v);
 }
 
 void Topology::switchUp(SwitchPtr sw)
 {
     m->new_vertex(sw->dpid());
+
+    // the switch may have lost its groups, kept them with buckets changed
+    // while it was away or kept groups deleted meanwhile. Its group table
+    // tells which of ADD and MODIFY applies, so neither is rejected.
+    // Groups in use aren't deleted, it would remove flows pointing to them.
+    uint64_t dpid = sw->dpid();
+    try {
+        sw->connection()->agent()->request_group_desc().then(executor,
+            [this, dpid](future<OFAgent::sequence<of13::GroupDesc>> f) {
+                std::unordered_set<uint32_t> present;
+                try {
+                    for (auto& desc : f.get()) {
+                        present.insert(desc.group_id());
+                    }
+                } catch (const std::exception& e) {
+                    LOG(WARNING) << "[Topology] Can't restore fast-failover groups on "
+                                 << dpid << ": " << e.what();
+                    return;
+                }
+
+                std::lock_guard<std::mutex> graph_lk(m->graph_mutex);
+                std::lock_guard<std::mutex> lk(m->failover_mutex);
+                for (const auto& it : m->route_map) {
+                    auto group = it.second->failover.find(dpid);
+                    if (group == it.second->failover.end())
+                        continue;
+                    auto command = present.erase(group->second.group_id)
+                                 ? of13::OFPGC_MODIFY : of13::OFPGC_ADD;
+                    sendGroup(group->second, command);
+                }
+                // left from routes deleted while the switch was away
+                for (auto group_id : present) {
+                    if (m->group_ids->inside(group_id)) {
+                        sendGroup(FailoverGroup{dpid, group_id, {}},
+                                  of13::OFPGC_DELETE);
+                    }
+                }
+            });
+    } catch (const std::exception& e) {
+        LOG(WARNING) << "[Topology] Can't request groups of " << dpid
+                     << ": " << e.what();
+    }
 }
 
 void Topology::switchDown(SwitchPtr sw)
@@ -1136,49 +2655,213 @@ void Topology::switchDown(SwitchPtr sw)
     m->delete_vertex(sw->dpid());
 }
 
+// Route is stored as "<crc32 of cbor>:<base64 of cbor>" of its json
+static std::string encode_route(const json& jr)
+{
+    auto cbor = json::to_cbor(jr);
+    boost::crc_32_type crc;
+    crc.process_bytes(cbor.data(), cbor.size());
+
+    char sum[9];
+    std::snprintf(sum, sizeof(sum), "%08x", crc.checksum());
+    return std::string(sum) + ":" + base64::encode(cbor.data(), cbor.size());
+}
+
+static std::optional<json> decode_route(const std::string& value)
+{
+    auto delim = value.find(':');
+    if (delim == std::string::npos)
+        return std::nullopt;
+
+    auto raw = base64::decode(value.substr(delim + 1));
+    if (not raw)
+        return std::nullopt;
+
+    boost::crc_32_type crc;
+    crc.process_bytes(raw->data(), raw->size());
+    if (std::strtoul(value.substr(0, delim).c_str(), nullptr, 16) != crc.checksum())
+        return std::nullopt;
+
+    try {
+        return json::from_cbor(*raw);
+    } catch (const std::exception&) {
+        return std::nullopt;
+    }
+}
+
 void Topology::update_database(uint32_t route_id)
 {
     if (!db_connector_) return;
 
-    if (m->route_map.count(route_id)) {
-        std::string route_dump = m->route_map.at(route_id)->to_json().dump();
-        db_connector_->putSValue("topology:route", std::to_string(route_id), route_dump);
-    }
+    m->scheduleWrite(route_id, false);
 }
 
 void Topology::erase_from_database(uint32_t route_id)
 {
     if (!db_connector_) return;
 
-    db_connector_->delJson("topology:route", std::to_string(route_id));
+    m->scheduleWrite(route_id, true);
+}
+
+void Topology::flush_database()
+{
+    using namespace std::chrono;
+    if (!db_connector_) return;
+
+    decltype(m->pending_writes) pending;
+    {
+        std::lock_guard<std::mutex> lk(m->persist_mutex);
+        pending.swap(m->pending_writes);
+
+        auto now = steady_clock::now();
+        auto elapsed = duration<double>(now - m->rate_since).count();
+        if (elapsed >= 1.0) {
+            m->persist_stats.write_rate = m->rate_written / elapsed;
+            m->rate_written = 0;
+            m->rate_since = now;
+        }
+    }
+    if (pending.empty()) return;
+
+    // routes are encoded once per flush however often they changed
+    DatabaseConnector::Fields written;
+    std::vector<std::string> erased;
+    auto oldest = steady_clock::time_point::max();
+    {
+        std::lock_guard<std::mutex> lk(m->graph_mutex);
+        for (const auto& it : pending) {
+            oldest = std::min(oldest, it.second.since);
+            auto route = m->route_map.find(it.first);
+            if (it.second.erase || route == m->route_map.end()) {
+                erased.push_back(std::to_string(it.first));
+            } else {
+                written.emplace_back(std::to_string(it.first),
+                                     encode_route(route->second->to_json()));
+            }
+        }
+    }
+
+    // requests are limited by size, each has one route at least
+    auto batch_end = [limit = m->flush_batch_bytes](const auto& items, size_t first,
+                                                     auto&& size) {
+        size_t bytes = size(items[first]);
+        auto last = first + 1;
+        while (last < items.size() && bytes + size(items[last]) <= limit) {
+            bytes += size(items[last++]);
+        }
+        return last;
+    };
+
+    uint64_t batches = 0;
+    uint64_t bytes = 0;
+    size_t stored = 0;
+    size_t removed = 0;
+    std::vector<uint32_t> failed;
+    auto field_size = [](const auto& field) {
+        return field.first.size() + field.second.size();
+    };
+    for (size_t i = 0; i < written.size();) {
+        auto last = batch_end(written, i, field_size);
+        DatabaseConnector::Fields batch(written.begin() + i, written.begin() + last);
+        batches++;
+        if (db_connector_->putFields("topology", "routes", batch)) {
+            stored += batch.size();
+            for (const auto& field : batch) {
+                bytes += field.second.size();
+            }
+        } else {
+            for (const auto& field : batch) {
+                failed.push_back(std::stoul(field.first));
+            }
+        }
+        i = last;
+    }
+    auto id_size = [](const std::string& id) { return id.size(); };
+    for (size_t i = 0; i < erased.size();) {
+        auto last = batch_end(erased, i, id_size);
+        std::vector<std::string> batch(erased.begin() + i, erased.begin() + last);
+        batches++;
+        if (db_connector_->delFields("topology", "routes", batch)) {
+            removed += batch.size();
+        } else {
+            for (const auto& id : batch) {
+                failed.push_back(std::stoul(id));
+            }
+        }
+        i = last;
+    }
+
+    auto lag = duration_cast<microseconds>(steady_clock::now() - oldest);
+    std::lock_guard<std::mutex> lk(m->persist_mutex);
+    // failed routes are written again on the next flush,
+    // unless changed since then
+    for (auto id : failed) {
+        m->pending_writes.emplace(id, pending.at(id));
+    }
+
+    auto& stats = m->persist_stats;
+    stats.written += stored;
+    stats.erased += removed;
+    stats.failed += failed.size();
+    stats.batches += batches;
+    stats.bytes += bytes;
+    stats.last_lag = lag;
+    stats.max_lag = std::max(stats.max_lag, lag);
+    m->rate_written += stored;
+
+    if (not failed.empty()) {
+        LOG(ERROR) << "[Topology] Can't write " << failed.size()
+                   << " routes to database, they will be retried";
+    }
+    VLOG(20) << "[Topology] Flushed " << stored << " routes and "
+             << removed << " removals to database in "
+             << batches << " requests";
 }
 
 void Topology::load_from_database()
 {
     if (!db_connector_) return;
 
-    auto keys = db_connector_->getKeys("topology:route");
-    for (const auto& i : keys) {
-        auto tmp = db_connector_->getSValue("topology:route", i);
-        json jr = json::parse(tmp);
+    auto restore = [this](json& jr) {
         uint32_t id = jr["id"];
         uint64_t from = jr["from"];
         uint64_t to = jr["to"];
         bool dynamic = jr["dynamic"];
-        if (m->route_map.count(id)) continue;
+        if (m->route_map.count(id)) return;
 
         auto route = m->addRoute(from, to, id);
         std::string owner = jr["owner"];
         route->allowed_dynamic = dynamic;
         route->owner = ServiceFlag::_from_string(owner.c_str());
         route->used_path =jr["used_path"]; 
+        if (jr.count("disjoint")) {
+            std::string mode = jr["disjoint"]["mode"];
+            route->disjoint_mode = DisjointFlag::_from_string(mode.c_str());
+            route->disjoint_count = jr["disjoint"]["requested"];
+        }
+        if (jr.count("multipath")) {
+            std::string balance = jr["multipath"]["balance"];
+            std::string metrics = jr["multipath"]["metrics"];
+            route->balancing.balance = BalanceFlag::_from_string(balance.c_str());
+            route->balancing.metrics = MetricsFlag::_from_string(metrics.c_str());
+            route->balancing.stretch = jr["multipath"]["stretch"];
+            route->balancing.rebalance = jr["multipath"]["rebalance"];
+        }
+        if (jr.count("fast_failover")) {
+            route->fast_failover = true;
+            for (auto& jg : jr["fast_failover"]) {
+                FailoverGroup group {jg["dpid"], jg["group_id"],
+                                     jg["ports"].get<std::vector<uint32_t>>()};
+                route->failover.emplace(group.dpid, std::move(group));
+            }
+        }
 
         for (auto& jp : jr["paths"]) {
             data_link_route p;
             for (auto& sp : jp["m_path"]) {
                 p.push_back({sp.at(0), sp.at(1)});
             }
-            auto path = route->attachPath(p);
+            auto path = m->attachPath(route, p);
 
             path->flap = jp["flapping"];
             path->broken_flag = jp["broken_flag"];
@@ -1186,6 +2869,7 @@ void Topology::load_from_database()
             path->util_threshold = jp["util_threshold"];
             std::string metrics = jp["metrics"];
             path->metrics = MetricsFlag::_from_string(metrics.c_str());
+            path->disjoint = jp.value("disjoint", false);
         }
 
         if (dynamic) {
@@ -1205,7 +2889,41 @@ void Topology::load_from_database()
 
             route->dynamic = std::move(dyn_sel);
         }
+    };
+
+    // all routes are read by one request
+    DatabaseConnector::Fields fields;
+    if (not db_connector_->getFields("topology", "routes", fields)) {
+        LOG(ERROR) << "[Topology] Can't load routes from database";
+        return;
+    }
+    for (const auto& field : fields) {
+        auto jr = decode_route(field.second);
+        if (not jr) {
+            LOG(ERROR) << "[Topology] Corrupted route " << field.first
+                       << " in database was skipped";
+            continue;
+        }
+        restore(*jr);
     }
+
+    // routes stored one per key by previous versions are moved to the hash
+    for (const auto& key : db_connector_->getKeys("topology:route")) {
+        auto tmp = db_connector_->getSValue("topology:route", key);
+        json jr = json::parse(tmp);
+        restore(jr);
+        db_connector_->delJson("topology:route", key);
+        update_database(jr["id"]);
+    }
+
+    // groups stay on switches, their ids are still in use
+    std::vector<uint64_t> booked;
+    for (const auto& it : m->route_map) {
+        for (const auto& group : it.second->failover) {
+            booked.push_back(group.second.group_id);
+        }
+    }
+    m->group_ids->recovery(booked);
 }
 
 void Topology::clear_database()
@@ -1238,7 +2956,20 @@ uint32_t Topology::newRoute(uint64_t from, uint64_t to, RouteSelector selector)
     auto route = m->addRoute(from, to);
     route->owner = owner;
 
-    auto path_id = newPath(route->id, selector);
+    uint8_t count = selector.get(configured_count) ? *selector.get(configured_count) : 1;
+    auto disjoint = selector.get(disjoint_paths) ? *selector.get(disjoint_paths)
+                                                 : +DisjointFlag::None;
+    if (disjoint != +DisjointFlag::None && count > 1 && count < 10 &&
+            not selector.get(exact_dpid) && not selector.get(include_dpid)) {
+        route->disjoint_mode = disjoint;
+        route->disjoint_count = count;
+        for (auto& computed : m->disjointPaths(route, selector, count)) {
+            auto id = attachPath(route->id, std::move(computed), selector);
+            route->paths.at(id)->disjoint = true;
+        }
+    }
+
+    auto path_id = route->paths.empty() ? newPath(route->id, selector) : 0;
     if (path_id == max_path_id) {
         VLOG(1) << "[Topology] Creating route - Can't create route: "
                 << from << " -> " << to;
@@ -1248,8 +2979,11 @@ uint32_t Topology::newRoute(uint64_t from, uint64_t to, RouteSelector selector)
 
     auto path = route->paths.at(path_id);
 
+    if (selector.get(multipath) && *selector.get(multipath) != +BalanceFlag::None) {
+        addMultipath(route->id, selector);
+    }
+
     if (selector.get(configured_count)) {
-        uint8_t count = *selector.get(configured_count);
         if (count > 0 && count < 10) { // allowed values
             RouteSelector aux_selector { metrics = path->metrics,
                                          flapping = path->flap,
@@ -1259,7 +2993,8 @@ uint32_t Topology::newRoute(uint64_t from, uint64_t to, RouteSelector selector)
                                          exclude_dpid =
                                              *selector.get(exclude_dpid)
                                        };
-            for (auto i = 1; i < count; i++) { // aux paths
+            // aux paths, penalized by already created ones
+            for (auto i = route->paths.size(); i < count; i++) {
                 newPath(route->id, aux_selector);
             }
         }
@@ -1272,17 +3007,22 @@ uint32_t Topology::newRoute(uint64_t from, uint64_t to, RouteSelector selector)
 uint8_t Topology::newPath(uint32_t route_id, RouteSelector selector)
 {
     //TODO: mutex
-    using namespace route_selector;
     if (m->route_map.count(route_id) == 0)
         return max_path_id;
 
     auto route = m->route_map.at(route_id);
-    auto computed = std::move(m->findPath(route, selector));
+    return attachPath(route_id, m->findPath(route, selector), selector);
+}
 
+uint8_t Topology::attachPath(uint32_t route_id, data_link_route computed,
+                             RouteSelector selector)
+{
+    using namespace route_selector;
     if (computed.size() == 0)
         return max_path_id;
 
-    auto path = route->attachPath(computed);
+    auto route = m->route_map.at(route_id);
+    auto path = m->attachPath(route, computed);
 
     // get parameters of triggers
     if (selector.get(flapping))
@@ -1299,6 +3039,7 @@ uint8_t Topology::newPath(uint32_t route_id, RouteSelector selector)
 
     VLOG(2) << "[Topology] Created path - "
             << route_id << ":" << (int)path->id;
+    syncFailover(route_id);
     update_database(route_id);
     return path->id;
 }
@@ -1315,13 +3056,14 @@ bool Topology::deletePath(uint32_t route_id, uint8_t path_id)
         if (route->paths.size() > 1 &&           // erase if only more than one path
                 route->used_path != path_id &&   // and this path isn't using now
                 route->paths.size() > path_id) { // path_id exists
-            route->detachPath(path_id);
+            m->detachPath(route, path_id);
         } else {
             return false;
         }
 
         VLOG(2) << "[Topology] Removed path - "
                 << route_id << ":" << (int)path_id;
+        syncFailover(route_id);
         update_database(route_id);
         return true;
     }).get();
@@ -1335,7 +3077,7 @@ data_link_route Topology::predictPath(uint32_t route_id) const
     auto route = m->route_map.at(route_id);
     if (not route->allowed_dynamic) return data_link_route{};
 
-    auto computed = std::move(m->findPath(route, route->dynamic));
+    auto computed = m->dynamicPath(route, false);
     return computed.size() > 0 ? computed : data_link_route{};
 }
 
@@ -1526,6 +3268,7 @@ void Topology::setUsedPath(uint32_t id, uint8_t path_id)
         path->resetTriggers();
     }
 
+    syncFailover(id);
     update_database(id);
 }
 
@@ -1551,6 +3294,7 @@ bool Topology::movePath(uint32_t id, uint8_t path_id, uint8_t new_id)
     for (size_t i = 0; i < route->paths.size(); i++)
         route->paths.at(i)->id = i;
 
+    syncFailover(id);
     update_database(id);
     return true;
 }
@@ -1585,7 +3329,10 @@ bool Topology::addDynamic(uint64_t route_id, RouteSelector selector)
     if (m->route_map.count(route_id) == 0) return false;
 
     auto route = m->route_map.at(route_id);
-    route->dynamic = std::move(selector);
+    {
+        std::lock_guard<std::mutex> lock(route->mut);
+        route->dynamic = std::move(selector);
+    }
     route->allowed_dynamic = true;
     update_database(route_id);
     return true;
@@ -1596,7 +3343,10 @@ bool Topology::delDynamic(uint64_t route_id)
     if (m->route_map.count(route_id) == 0) return false;
 
     auto route = m->route_map.at(route_id);
-    route->dynamic = RouteSelector{};
+    {
+        std::lock_guard<std::mutex> lock(route->mut);
+        route->dynamic = RouteSelector{};
+    }
     route->allowed_dynamic = false;
     update_database(route_id);
     return true;
@@ -1609,23 +3359,195 @@ uint8_t Topology::getDynamic(uint64_t route_id)
     auto ret {max_path_id};
     auto route = m->route_map.at(route_id);
     if (route->allowed_dynamic)
-        ret = newPath(route_id, route->dynamic);
+        ret = attachPath(route_id, m->dynamicPath(route, true), route->dynamic);
+
+    return ret;
+}
+
+bool Topology::addMultipath(uint32_t route_id, RouteSelector selector)
+{
+    using namespace route_selector;
+    if (m->route_map.count(route_id) == 0) return false;
+
+    auto route = m->route_map.at(route_id);
+    auto& balancing = route->balancing;
+    balancing.balance = selector.get(multipath) ? *selector.get(multipath)
+                                                : +BalanceFlag::Hash;
+    balancing.metrics = selector.get(metrics) ? *selector.get(metrics)
+                                              : +MetricsFlag::Hop;
+    if (balancing.metrics == +MetricsFlag::Manual ||
+            balancing.metrics == +MetricsFlag::None)
+        balancing.metrics = MetricsFlag::Hop;
+    balancing.stretch = selector.get(max_stretch) ? *selector.get(max_stretch) : 0;
+    balancing.rebalance = selector.get(rebalance) && *selector.get(rebalance);
+    update_database(route_id);
+    return true;
+}
+
+bool Topology::delMultipath(uint32_t route_id)
+{
+    if (m->route_map.count(route_id) == 0) return false;
+
+    auto route = m->route_map.at(route_id);
+    route->balancing = Route::Balancing{};
+    update_database(route_id);
+    return true;
+}
+
+data_link_route Topology::getMultipath(uint32_t route_id) const
+{
+    auto it = m->route_map.find(route_id);
+    if (it == m->route_map.end() ||
+            it->second->balancing.balance == +BalanceFlag::None)
+        return data_link_route{};
 
+    data_link_route ret;
+    auto dag = m->multipathDag(it->second);
+    for (const auto& hops : dag.hops) {
+        for (const auto& hop : hops.second) {
+            ret.push_back(hop.out);
+            ret.push_back(hop.in);
+        }
+    }
     return ret;
 }
 
+data_link_route Topology::getFlowPath(uint32_t route_id, uint64_t flow_hash) const
+{
+    auto it = m->route_map.find(route_id);
+    if (it == m->route_map.end() ||
+            it->second->balancing.balance == +BalanceFlag::None)
+        return data_link_route{};
+
+    return m->flowPath(it->second, m->multipathDag(it->second), flow_hash);
+}
+
 void Topology::deleteRoute(uint32_t id)
 {
     //std::lock_guard<std::mutex> lk(m->graph_mutex);
+    auto it = m->route_map.find(id);
+    if (it != m->route_map.end() && it->second->fast_failover) {
+        it->second->fast_failover = false;
+        syncFailover(id); // remove groups and release their ids
+    }
     m->eraseRoute(id);
     erase_from_database(id);
 }
 
+bool Topology::addFastFailover(uint32_t route_id)
+{
+    if (m->route_map.count(route_id) == 0) return false;
+
+    auto route = m->route_map.at(route_id);
+    route->fast_failover = true;
+    syncFailover(route_id);
+    update_database(route_id);
+    return true;
+}
+
+bool Topology::delFastFailover(uint32_t route_id)
+{
+    if (m->route_map.count(route_id) == 0) return false;
+
+    auto route = m->route_map.at(route_id);
+    route->fast_failover = false;
+    syncFailover(route_id);
+    update_database(route_id);
+    return true;
+}
+
+std::vector<FailoverGroup> Topology::getFastFailover(uint32_t route_id) const
+{
+    std::vector<FailoverGroup> ret;
+    auto it = m->route_map.find(route_id);
+    if (it == m->route_map.end())
+        return ret;
+
+    std::lock_guard<std::mutex> lk(m->failover_mutex);
+    for (const auto& group : it->second->failover) {
+        ret.push_back(group.second);
+    }
+    return ret;
+}
+
+// Brings groups of the route in line with its paths: groups are
+// modified in place, so flows forwarding to them stay installed
+void Topology::syncFailover(uint32_t route_id)
+{
+    auto it = m->route_map.find(route_id);
+    if (it == m->route_map.end())
+        return;
+
+    auto route = it->second;
+    auto wanted = route->fast_failover ? m->failoverPorts(route)
+                                       : std::map<uint64_t, std::vector<uint32_t>>{};
+
+    std::lock_guard<std::mutex> lk(m->failover_mutex);
+    auto& groups = route->failover;
+    for (auto group = groups.begin(); group != groups.end();) {
+        if (wanted.count(group->first)) {
+            ++group;
+            continue;
+        }
+        // an absent switch still holding the group drops it on switchUp
+        sendGroup(group->second, of13::OFPGC_DELETE);
+        m->group_ids->release(group->second.group_id);
+        group = groups.erase(group);
+    }
+
+    for (auto& ports : wanted) {
+        auto group = groups.find(ports.first);
+        if (group == groups.end()) {
+            FailoverGroup added {ports.first, 0, std::move(ports.second)};
+            try {
+                added.group_id = m->group_ids->acquire();
+            } catch (const IdGen::PoolIsEmpty& e) {
+                LOG(ERROR) << "[Topology] No fast-failover group ids left for route "
+                           << route_id;
+                return;
+            }
+            sendGroup(added, of13::OFPGC_ADD);
+            groups.emplace(added.dpid, std::move(added));
+        } else if (group->second.ports != ports.second) {
+            group->second.ports = std::move(ports.second);
+            sendGroup(group->second, of13::OFPGC_MODIFY);
+        }
+    }
+}
+
+bool Topology::sendGroup(const FailoverGroup& group, uint16_t command)
+{
+    // groups of absent switches are brought in line on switchUp
+    auto sw = m_switch_manager->switch_(group.dpid);
+    if (not sw || not sw->connection()->alive()) {
+        VLOG(3) << "[Topology] Fast-failover group " << group.group_id
+                << " on absent switch " << group.dpid << " is left for its return";
+        return false;
+    }
+
+    of13::GroupMod gm(0, command, of13::OFPGT_FF, group.group_id);
+    if (command != of13::OFPGC_DELETE) {
+        for (auto port : group.ports) {
+            of13::Bucket bucket(0, port, of13::OFPG_ANY);
+            of13::OutputAction output(port, of13::OFPCML_NO_BUFFER);
+            bucket.add_action(output);
+            gm.add_bucket(bucket);
+        }
+    }
+
+    VLOG(3) << "[Topology] Fast-failover group " << group.group_id
+            << " command " << command << " on " << group.dpid;
+    sender_->send(group.dpid, gm, SendLane::Critical);
+    return true;
+}
+
 uint8_t Topology::minHops(uint64_t from, uint64_t to)
 {
     if (from == to) return 0;
 
-    auto path = std::move(m->computePath(from, to, MetricsFlag::Hop, m->graph));
+    auto snapshot = m->snapshot();
+    PathView view(*snapshot);
+    auto path = std::move(m->computePath(from, to, MetricsFlag::Hop, view));
     return path.size()/2;
 }
 
@@ -23,6 +23,7 @@
 #include "lib/better_enum.hpp"
 #include "lib/qt_executor.hpp"
 
+#include <chrono>
 #include <vector>
 
 #include <QTimer>
@@ -45,6 +46,49 @@ struct link_property {
 inline bool operator<(link_property a, link_property b)
 { return std::tie(a.source, a.target) < std::tie(b.source, b.target); }
 
+struct SptCacheStats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t repairs;       // trees repaired after topology changes
+    uint64_t evictions;     // trees evicted by memory limit
+    size_t trees;
+    size_t memory;          // bytes
+    size_t memory_limit;
+};
+
+// OFPGT_FF group on a switch where paths of a route diverge
+struct FailoverGroup {
+    uint64_t dpid;
+    uint32_t group_id;
+    std::vector<uint32_t> ports; // watched output ports, preferred first
+};
+
+struct RouteRepairStats {
+    uint64_t link_failures;     // failures of links used by routes
+    uint64_t affected_routes;
+    uint64_t repaired_routes;   // with working or recomputed path
+    uint64_t failed_routes;     // without path
+    size_t pending_routes;      // being recomputed
+    // from link failure to the last affected route repaired
+    std::chrono::microseconds last_repair_time;
+    std::chrono::microseconds max_repair_time;
+};
+
+struct RoutePersistStats {
+    uint64_t updates;           // route changes to be saved
+    uint64_t coalesced;         // of them merged into pending writes
+    uint64_t written;           // routes written to database
+    uint64_t erased;            // routes removed from database
+    uint64_t failed;            // writes failed, to be retried
+    uint64_t batches;           // requests to database
+    uint64_t bytes;             // of encoded routes written
+    size_t pending;             // routes waiting for flush
+    double write_rate;          // routes written per second
+    // from the first pending change of a route to its write
+    std::chrono::microseconds last_lag;
+    std::chrono::microseconds max_lag;
+};
+
 BETTER_ENUM(ServiceFlag, uint16_t, InBand,
                                    MCast,
                                    BBD,
@@ -62,6 +106,16 @@ BETTER_ENUM(TriggerFlag, uint16_t, Broken      = 1 << 0,
                                    Util        = 1 << 3,
                                    None        = 1 << 4);
 
+// Paths of a route without common links or transit switches
+BETTER_ENUM(DisjointFlag, uint16_t, Link,
+                                    Node,
+                                    None);
+
+// Assignment of flows to the equal-cost paths of a route
+BETTER_ENUM(BalanceFlag, uint16_t, Hash,
+                                   Load,
+                                   None);
+
 namespace route_selector {
     constexpr kwarg<struct app_tag, ServiceFlag> app;
     constexpr kwarg<struct metrics_tag, MetricsFlag> metrics;
@@ -70,6 +124,16 @@ namespace route_selector {
     constexpr kwarg<struct drops_tag, uint8_t> drop_trigger;
     constexpr kwarg<struct util_tag, uint8_t> util_trigger;
     constexpr kwarg<struct conf_tag, uint8_t> configured_count;
+    // configured paths are computed together and are disjoint
+    constexpr kwarg<struct disjoint_tag, DisjointFlag> disjoint_paths;
+    // otherwise the first path is the shortest one
+    constexpr kwarg<struct min_total_tag, bool> min_total_cost;
+
+    constexpr kwarg<struct multipath_tag, BalanceFlag> multipath;
+    // percents over the shortest path, 0 for equal-cost paths only
+    constexpr kwarg<struct stretch_tag, uint8_t> max_stretch;
+    // move flows off links above topology.rebalance-threshold
+    constexpr kwarg<struct rebalance_tag, bool> rebalance;
 
     constexpr kwarg<struct include_tag, switch_list> include_dpid;
     constexpr kwarg<struct exclude_tag, switch_list> exclude_dpid;
@@ -84,6 +148,11 @@ using RouteSelector = decltype(kwargs(
     route_selector::drop_trigger,
     route_selector::util_trigger,
     route_selector::configured_count,
+    route_selector::disjoint_paths,
+    route_selector::min_total_cost,
+    route_selector::multipath,
+    route_selector::max_stretch,
+    route_selector::rebalance,
 
     route_selector::include_dpid,
     route_selector::exclude_dpid,
@@ -102,6 +171,9 @@ public:
     ~Topology();
     void init(Loader* provider, const Config& config) override;
     std::vector<link_property> dumpWeights();
+    SptCacheStats sptCacheStats() const;
+    RouteRepairStats routeRepairStats() const;
+    RoutePersistStats routePersistStats() const;
     std::vector<uint32_t> getRoutes() const;
     std::vector<uint32_t> getRoutes(ServiceFlag sf) const;
 
@@ -132,12 +204,26 @@ public:
     bool delDynamic(uint64_t route_id);
     uint8_t getDynamic(uint64_t route_id);
 
+    bool addMultipath(uint32_t route_id, RouteSelector selector);
+    bool delMultipath(uint32_t route_id);
+
+    // Programs fast-failover groups at divergence points of the route
+    // paths, so switches move to backup paths locally. Applications
+    // forward the route traffic to these groups on listed switches.
+    bool addFastFailover(uint32_t route_id);
+    bool delFastFailover(uint32_t route_id);
+
     // Observers
     data_link_route predictPath(uint32_t route_id) const;
     data_link_route getPath(uint32_t route_id, uint8_t path_id) const;
     data_link_route getFirstWorkPath(uint32_t route_id) const;
     uint8_t getFirstWorkPathId(uint32_t route_id) const;
     uint8_t getUsedPath(uint32_t id) const;
+    // links of the multipath route as pairs of ports, towards `to`
+    data_link_route getMultipath(uint32_t route_id) const;
+    // path of the multipath route for the flow with this hash
+    data_link_route getFlowPath(uint32_t route_id, uint64_t flow_hash) const;
+    std::vector<FailoverGroup> getFastFailover(uint32_t route_id) const;
 
     // Aux observers
     ServiceFlag getOwner(uint32_t id) const;
@@ -154,6 +240,7 @@ public:
 protected slots:
     void linkDiscovered(switch_and_port from, switch_and_port to);
     void linkBroken(switch_and_port from, switch_and_port to);
+    void linkFailed(switch_and_port from, switch_and_port to);
     void reloadStats();
     void onRecovery();
     void onPrimary();
@@ -165,15 +252,23 @@ protected slots:
 private:
     struct TopologyImpl* m;
     QTimer* stats_timer;
+    QTimer* publish_timer;
+    QTimer* flush_timer;
     ILinkDiscovery* ld_app;
     class SwitchManager* m_switch_manager;
     class RecoveryManager* recovery;
     class DatabaseConnector* db_connector_ = nullptr;
+    class OFMsgSender* sender_ = nullptr;
     qt_executor executor {this};
 
     void updateMetrics();
+    void publish();
     void timerEvent(QTimerEvent *event) override;
     void addLink(switch_and_port from, switch_and_port to);
+    uint8_t attachPath(uint32_t route_id, data_link_route computed,
+                       RouteSelector selector);
+    void syncFailover(uint32_t route_id);
+    bool sendGroup(const FailoverGroup& group, uint16_t command);
 
     void switchUp(SwitchPtr sw) override;
     void switchDown(SwitchPtr sw) override;
@@ -182,11 +277,14 @@ private:
     void erase_from_database(uint32_t route_id);
     void load_from_database();
     void clear_database();
+    void flush_database();
 signals:
     void ready();
 
     void routeTriggerActive(uint32_t id, uint8_t path_id, TriggerFlag tf);
     void routeTriggerInactive(uint32_t id, uint8_t path_id, TriggerFlag tf);
+    // hot links of the multipath route changed, flows should be reassigned
+    void routeRebalanced(uint32_t id);
 };
 
 } // namespace runos
@@ -23,6 +23,7 @@
 #include <boost/lexical_cast.hpp>
 #include <boost/property_tree/json_parser.hpp>
 
+#include <optional>
 #include <sstream>
 
 namespace runos {
@@ -67,6 +68,78 @@ struct TopologyDump : rest::resource {
     }
 };
 
+struct SptCacheDump : rest::resource {
+    Topology* app;
+
+    explicit SptCacheDump(Topology* app)
+        : app(app) {}
+
+    rest::ptree Get() const override {
+        rest::ptree ret;
+
+        auto stats = app->sptCacheStats();
+        auto requests = stats.hits + stats.misses;
+        ret.put("hits", stats.hits);
+        ret.put("misses", stats.misses);
+        ret.put("hit-rate", requests ? double(stats.hits) / requests : 0.0);
+        ret.put("repairs", stats.repairs);
+        ret.put("evictions", stats.evictions);
+        ret.put("trees", stats.trees);
+        ret.put("memory", stats.memory);
+        ret.put("memory-limit", stats.memory_limit);
+
+        return ret;
+    }
+};
+
+struct RouteRepairDump : rest::resource {
+    Topology* app;
+
+    explicit RouteRepairDump(Topology* app)
+        : app(app) {}
+
+    rest::ptree Get() const override {
+        rest::ptree ret;
+
+        auto stats = app->routeRepairStats();
+        ret.put("link-failures", stats.link_failures);
+        ret.put("affected-routes", stats.affected_routes);
+        ret.put("repaired-routes", stats.repaired_routes);
+        ret.put("failed-routes", stats.failed_routes);
+        ret.put("pending-routes", stats.pending_routes);
+        ret.put("last-repair-time-us", stats.last_repair_time.count());
+        ret.put("max-repair-time-us", stats.max_repair_time.count());
+
+        return ret;
+    }
+};
+
+struct RoutePersistDump : rest::resource {
+    Topology* app;
+
+    explicit RoutePersistDump(Topology* app)
+        : app(app) {}
+
+    rest::ptree Get() const override {
+        rest::ptree ret;
+
+        auto stats = app->routePersistStats();
+        ret.put("updates", stats.updates);
+        ret.put("coalesced", stats.coalesced);
+        ret.put("written", stats.written);
+        ret.put("erased", stats.erased);
+        ret.put("failed", stats.failed);
+        ret.put("batches", stats.batches);
+        ret.put("bytes", stats.bytes);
+        ret.put("pending", stats.pending);
+        ret.put("write-rate", stats.write_rate);
+        ret.put("last-lag-us", stats.last_lag.count());
+        ret.put("max-lag-us", stats.max_lag.count());
+
+        return ret;
+    }
+};
+
 struct RouteCollection : rest::resource {
     Topology* app;
     uint32_t id;
@@ -269,6 +342,124 @@ struct RouteResourceMods : rest::resource {
     }
 };
 
+struct MultipathResource : rest::resource {
+    Topology* app;
+    uint32_t id;
+    std::optional<uint64_t> flow_hash;
+
+    explicit MultipathResource(Topology* app, uint32_t id)
+        : app(app), id(id)
+    { }
+
+    explicit MultipathResource(Topology* app, uint32_t id, uint64_t flow_hash)
+        : app(app), id(id), flow_hash(flow_hash)
+    { }
+
+    rest::ptree Get() const override {
+        rest::ptree ret;
+        json jret;
+
+        if (flow_hash) {
+            auto path = app->getFlowPath(id, *flow_hash);
+            THROW_IF(path.empty(), rest::http_error(404),
+                     "Route not found or multipath is disabled");
+            std::for_each(path.begin(), path.end(), [&jret](const auto& sp) {
+                jret["m_path"].push_back({sp.dpid, sp.port});
+            });
+        } else {
+            auto links = app->getMultipath(id);
+            THROW_IF(links.empty(), rest::http_error(404),
+                     "Route not found or multipath is disabled");
+            for (size_t i = 0; i + 1 < links.size(); i += 2) {
+                jret["links"].push_back({{links[i].dpid, links[i].port},
+                                         {links[i+1].dpid, links[i+1].port}});
+            }
+        }
+
+        std::istringstream is(jret.dump());
+        read_json(is, ret);
+        return ret;
+    }
+
+    rest::ptree Post(rest::ptree const& pt) override {
+        using namespace route_selector;
+        RouteSelector sel;
+
+        try {
+            sel.set(multipath, BalanceFlag::_from_string(
+                                   pt.get<std::string>("balance", "Hash").c_str()));
+            sel.set(metrics, MetricsFlag::_from_string(
+                                 pt.get<std::string>("metrics", "Hop").c_str()));
+        } catch (const std::runtime_error& ex) {
+            THROW(rest::http_error(400), "Incorrect balance or metrics");
+        }
+        if (auto stretch = pt.get_optional<int>("stretch")) {
+            THROW_IF(*stretch < 0 or *stretch > 255, rest::http_error(400),
+                    "Incorrect stretch: {}", *stretch);
+            sel.set(max_stretch, static_cast<uint8_t>(*stretch));
+        }
+        if (auto rebal = pt.get_optional<bool>("rebalance")) {
+            sel.set(rebalance, *rebal);
+        }
+
+        THROW_IF(!app->addMultipath(id, sel), rest::http_error(404), "Route not found");
+        rest::ptree ret;
+        ret.put("act", "Multipath was added");
+        return ret;
+    }
+
+    rest::ptree Delete() override {
+        THROW_IF(!app->delMultipath(id), rest::http_error(404), "Route not found");
+        rest::ptree ret;
+        ret.put("act", "Multipath was removed");
+        return ret;
+    }
+};
+
+struct FastFailoverResource : rest::resource {
+    Topology* app;
+    uint32_t id;
+
+    explicit FastFailoverResource(Topology* app, uint32_t id)
+        : app(app), id(id)
+    { }
+
+    rest::ptree Get() const override {
+        rest::ptree ret;
+        rest::ptree groups;
+        for (const auto& group : app->getFastFailover(id)) {
+            rest::ptree gpt;
+            gpt.put("dpid", group.dpid);
+            gpt.put("group_id", group.group_id);
+            rest::ptree ports;
+            for (auto port : group.ports) {
+                rest::ptree ppt;
+                ppt.put("", port);
+                ports.push_back(std::make_pair("", ppt));
+            }
+            gpt.add_child("ports", ports);
+            groups.push_back(std::make_pair("", gpt));
+        }
+        ret.add_child("array", groups);
+        ret.put("_size", groups.size());
+        return ret;
+    }
+
+    rest::ptree Post(rest::ptree const&) override {
+        THROW_IF(!app->addFastFailover(id), rest::http_error(404), "Route not found");
+        rest::ptree ret;
+        ret.put("act", "Fast failover was added");
+        return ret;
+    }
+
+    rest::ptree Delete() override {
+        THROW_IF(!app->delFastFailover(id), rest::http_error(404), "Route not found");
+        rest::ptree ret;
+        ret.put("act", "Fast failover was removed");
+        return ret;
+    }
+};
+
 struct RouteResource : rest::resource {
     Topology* app;
 
@@ -318,9 +509,34 @@ struct RouteResource : rest::resource {
             return ret;
         }
 
-        uint32_t route_id = app->newRoute(from, to, 
-                                          route_selector::app=owner,
-                                          route_selector::metrics=metrics);
+        RouteSelector sel { route_selector::app=owner,
+                            route_selector::metrics=metrics };
+        if (auto count = pt.get_optional<int>("count")) {
+            THROW_IF(*count < 1 or *count > 9, rest::http_error(400),
+                    "Incorrect count: {}", *count);
+            sel.set(route_selector::configured_count, static_cast<uint8_t>(*count));
+        }
+        if (auto disjoint = pt.get_optional<std::string>("disjoint")) {
+            try {
+                sel.set(route_selector::disjoint_paths,
+                        DisjointFlag::_from_string(disjoint->c_str()));
+            } catch (const std::runtime_error& ex) {
+                THROW(rest::http_error(400), "Incorrect disjoint: {}", *disjoint);
+            }
+        }
+        if (auto min_total = pt.get_optional<bool>("min_total_cost")) {
+            sel.set(route_selector::min_total_cost, *min_total);
+        }
+        if (auto balance = pt.get_optional<std::string>("multipath")) {
+            try {
+                sel.set(route_selector::multipath,
+                        BalanceFlag::_from_string(balance->c_str()));
+            } catch (const std::runtime_error& ex) {
+                THROW(rest::http_error(400), "Incorrect multipath: {}", *balance);
+            }
+        }
+
+        uint32_t route_id = app->newRoute(from, to, std::move(sel));
         RouteCollection col{app, route_id};
         return col.Get();
     }
@@ -409,6 +625,33 @@ public:
         });
 
 
+        rest_->mount(path_spec("/routes/id/(\\d+)/multipath/"), [=](const path_match& m) {
+            try {
+                auto route_id = boost::lexical_cast<uint32_t>(m[1].str());
+                return MultipathResource { app, route_id };
+            } catch (const boost::bad_lexical_cast& e) {
+                THROW( rest::http_error(400), "Bad request: {}", e.what() ); // bad request
+            }
+        });
+        rest_->mount(path_spec("/routes/id/(\\d+)/multipath/flow/(\\d+)/"), [=](const path_match& m) {
+            try {
+                auto route_id = boost::lexical_cast<uint32_t>(m[1].str());
+                auto flow_hash = boost::lexical_cast<uint64_t>(m[2].str());
+                return MultipathResource { app, route_id, flow_hash };
+            } catch (const boost::bad_lexical_cast& e) {
+                THROW( rest::http_error(400), "Bad request: {}", e.what() ); // bad request
+            }
+        });
+
+        rest_->mount(path_spec("/routes/id/(\\d+)/fast-failover/"), [=](const path_match& m) {
+            try {
+                auto route_id = boost::lexical_cast<uint32_t>(m[1].str());
+                return FastFailoverResource { app, route_id };
+            } catch (const boost::bad_lexical_cast& e) {
+                THROW( rest::http_error(400), "Bad request: {}", e.what() ); // bad request
+            }
+        });
+
         rest_->mount(path_spec("/routes/service/(\\S+)/"), [=](const path_match& m) {
             std::string service = m[1].str();
             return RouteCollection { app, service };
@@ -419,6 +662,15 @@ public:
         rest_->mount(path_spec("/dump/topology/"), [=](const path_match& m) {
             return TopologyDump { app };
         });
+        rest_->mount(path_spec("/dump/spt-cache/"), [=](const path_match& m) {
+            return SptCacheDump { app };
+        });
+        rest_->mount(path_spec("/dump/route-repair/"), [=](const path_match& m) {
+            return RouteRepairDump { app };
+        });
+        rest_->mount(path_spec("/dump/route-persistence/"), [=](const path_match& m) {
+            return RoutePersistDump { app };
+        });
     }
 };
 
@@ -28,6 +28,8 @@
 #include <string>
 #include <memory>
 #include <cstdint>
+#include <chrono>
+#include <utility>
 
 namespace runos {
 
@@ -77,6 +79,17 @@ public:
     // Traffic stats
     virtual Statistics<TrafficMeasurement> traffic_stats(ForwardingType type) const = 0;
 
+    // History of speeds, counter is the index in the measurement
+    using history_time = std::chrono::system_clock::time_point;
+    virtual HistoryRange stats_history(size_t counter, history_time from,
+                                       history_time to) const = 0;
+    virtual HistoryRange queue_stats_history(uint32_t qid, size_t counter,
+                                             history_time from,
+                                             history_time to) const = 0;
+    // Bytes allocated for the history of the port and its queues,
+    // and the bound of it
+    virtual std::pair<size_t, size_t> history_memory() const = 0;
+
     // Description
     virtual unsigned number() const = 0;
     virtual const ethaddr& hw_addr() const = 0;
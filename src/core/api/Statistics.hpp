@@ -18,6 +18,8 @@
 
 #include <cstdint>
 #include <array>
+#include <chrono>
+#include <vector>
 
 namespace runos {
 
@@ -31,6 +33,22 @@ struct Statistics {
     Measurement<double> max_speed;
 };
 
+// Speed of a counter within the bucket starting at time
+struct HistoryPoint {
+    int64_t time; // seconds since epoch
+    double avg;
+    double min;
+    double max;
+};
+
+struct HistoryRange {
+    std::chrono::seconds step; // resolution chosen for the range
+    std::vector<HistoryPoint> points;
+    double min;
+    double max;
+    double avg;
+};
+
 template<class T>
 struct TrafficMeasurement : std::array<T, 2> {
     using std::array<T, 2>::array;
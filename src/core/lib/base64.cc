@@ -0,0 +1,114 @@
+/*
+ * Copyright 2019 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "base64.hpp"
+
+#include <array>
+
+namespace runos {
+namespace base64 {
+
+static constexpr char alphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+static constexpr char pad = '=';
+static constexpr int8_t invalid = -1;
+
+static std::array<int8_t, 256> make_reverse_table()
+{
+    std::array<int8_t, 256> table;
+    table.fill(invalid);
+    for (int8_t i = 0; i < 64; ++i) {
+        table[static_cast<uint8_t>(alphabet[i])] = i;
+    }
+    return table;
+}
+
+std::string encode(const uint8_t* data, size_t len)
+{
+    std::string ret;
+    ret.reserve((len + 2) / 3 * 4);
+
+    size_t i = 0;
+    for (; i + 2 < len; i += 3) {
+        uint32_t triple = (data[i] << 16) | (data[i + 1] << 8) | data[i + 2];
+        ret.push_back(alphabet[(triple >> 18) & 0x3f]);
+        ret.push_back(alphabet[(triple >> 12) & 0x3f]);
+        ret.push_back(alphabet[(triple >> 6) & 0x3f]);
+        ret.push_back(alphabet[triple & 0x3f]);
+    }
+
+    if (i < len) {
+        uint32_t triple = data[i] << 16;
+        if (i + 1 < len) {
+            triple |= data[i + 1] << 8;
+        }
+        ret.push_back(alphabet[(triple >> 18) & 0x3f]);
+        ret.push_back(alphabet[(triple >> 12) & 0x3f]);
+        ret.push_back(i + 1 < len ? alphabet[(triple >> 6) & 0x3f] : pad);
+        ret.push_back(pad);
+    }
+
+    return ret;
+}
+
+std::string encode(const std::string& data)
+{
+    return encode(reinterpret_cast<const uint8_t*>(data.data()), data.size());
+}
+
+std::optional<std::string> decode(const std::string& text)
+{
+    static const auto reverse = make_reverse_table();
+
+    if (text.size() % 4 != 0) {
+        return std::nullopt;
+    }
+
+    std::string ret;
+    ret.reserve(text.size() / 4 * 3);
+
+    for (size_t i = 0; i < text.size(); i += 4) {
+        uint32_t quad = 0;
+        size_t padding = 0;
+
+        for (size_t j = 0; j < 4; ++j) {
+            auto c = static_cast<uint8_t>(text[i + j]);
+            // padding is allowed only at the two last positions of the text
+            if (c == pad && j >= 2 && i + 4 == text.size()) {
+                ++padding;
+                quad <<= 6;
+                continue;
+            }
+            if (padding || reverse[c] == invalid) {
+                return std::nullopt;
+            }
+            quad = (quad << 6) | reverse[c];
+        }
+
+        ret.push_back(static_cast<char>((quad >> 16) & 0xff));
+        if (padding < 2) {
+            ret.push_back(static_cast<char>((quad >> 8) & 0xff));
+        }
+        if (padding < 1) {
+            ret.push_back(static_cast<char>(quad & 0xff));
+        }
+    }
+
+    return ret;
+}
+
+} // namespace base64
+} // namespace runos
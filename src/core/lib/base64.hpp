@@ -0,0 +1,36 @@
+/*
+ * Copyright 2019 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+
+namespace runos {
+namespace base64 {
+
+// Binary blobs are stored as base64 text,
+// since database values should be printable and quote-free.
+std::string encode(const uint8_t* data, size_t len);
+std::string encode(const std::string& data);
+
+// Returns decoded data or nothing on malformed input
+std::optional<std::string> decode(const std::string& text);
+
+} // namespace base64
+} // namespace runos
@@ -0,0 +1,355 @@
+/*
+ * Copyright 2019 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+namespace runos {
+
+namespace counter_series_detail {
+
+inline int leading_zeros(uint64_t x) { return x ? __builtin_clzll(x) : 64; }
+inline int trailing_zeros(uint64_t x) { return x ? __builtin_ctzll(x) : 64; }
+
+class BitWriter {
+public:
+    BitWriter(std::vector<uint64_t>& words, size_t bits)
+        : words_(words)
+        , bits_(bits)
+    { }
+
+    size_t size() const { return bits_; }
+
+    // Low `count` bits of value, count <= 64
+    void write(uint64_t value, int count)
+    {
+        if (count == 0)
+            return;
+        if (count < 64)
+            value &= (uint64_t(1) << count) - 1;
+
+        auto used = int(bits_ % 64);
+        if (used == 0)
+            words_.push_back(0);
+        auto free = 64 - used;
+        if (count <= free) {
+            words_.back() |= value << (free - count);
+        } else {
+            words_.back() |= value >> (count - free);
+            words_.push_back(value << (64 - (count - free)));
+        }
+        bits_ += count;
+    }
+
+    void bit(bool value) { write(value, 1); }
+
+private:
+    std::vector<uint64_t>& words_;
+    size_t bits_;
+};
+
+class BitReader {
+public:
+    explicit BitReader(const uint64_t* words)
+        : words_(words)
+    { }
+
+    uint64_t read(int count)
+    {
+        if (count == 0)
+            return 0;
+        auto word = pos_ / 64;
+        auto used = int(pos_ % 64);
+        auto free = 64 - used;
+        uint64_t ret;
+        if (count <= free) {
+            ret = words_[word] << used >> (64 - count);
+        } else {
+            auto rest = count - free;
+            ret = (words_[word] << used >> used << rest)
+                | (words_[word + 1] >> (64 - rest));
+        }
+        pos_ += count;
+        return ret;
+    }
+
+    bool bit() { return read(1); }
+
+private:
+    const uint64_t* words_;
+    size_t pos_ {0};
+};
+
+// Sign-extends low `count` bits
+inline int64_t sign_extend(uint64_t value, int count)
+{
+    auto shift = 64 - count;
+    return int64_t(value << shift) >> shift;
+}
+
+} // namespace counter_series_detail
+
+// Compressed time series of N monotonic counters sampled together,
+// Gorilla style. Timestamps (ms) are stored as delta-of-delta with
+// variable-length prefixes. Counters are stored as XOR of consecutive
+// increments: steady traffic costs one bit per counter, varying one
+// the meaningful bits of the change only.
+//
+// Samples go to the open chunk, which is sealed and shrunk when full
+// or when time goes back. Sealed chunks are immutable and are dropped
+// whole by trim().
+template<size_t N>
+class CounterSeries {
+public:
+    using Values = std::array<uint64_t, N>;
+
+    explicit CounterSeries(uint32_t chunk_samples = 120)
+        : chunk_samples_(std::max<uint32_t>(chunk_samples, 2))
+    { }
+
+    void append(int64_t time, const Values& values)
+    {
+        if (chunks_.empty() || chunks_.back().sealed ||
+            time < chunks_.back().last)
+        {
+            if (not chunks_.empty())
+                seal(chunks_.back());
+            chunks_.emplace_back();
+            start(chunks_.back(), time, values);
+        } else {
+            encode(chunks_.back(), time, values);
+        }
+
+        if (chunks_.back().count >= chunk_samples_)
+            seal(chunks_.back());
+    }
+
+    // Drops chunks with all samples before oldest
+    void trim(int64_t oldest)
+    {
+        while (not chunks_.empty() && chunks_.front().last < oldest)
+            chunks_.pop_front();
+    }
+
+    // Calls f(time, values) for samples in [from, to] in order,
+    // preceded by the sample before `from` if it is in the same chunk
+    template<class F>
+    void scan(int64_t from, int64_t to, F&& f) const
+    {
+        for (const auto& chunk : chunks_) {
+            if (chunk.last < from || chunk.first > to)
+                continue;
+            decode(chunk, from, to, f);
+        }
+    }
+
+    int64_t first_time() const
+    { return chunks_.empty() ? 0 : chunks_.front().first; }
+
+    bool empty() const { return chunks_.empty(); }
+
+    size_t samples() const
+    {
+        size_t ret = 0;
+        for (const auto& chunk : chunks_)
+            ret += chunk.count;
+        return ret;
+    }
+
+    // Allocated bytes
+    size_t memory() const
+    {
+        size_t ret = sizeof(*this);
+        for (const auto& chunk : chunks_)
+            ret += sizeof(Chunk) + chunk.words.capacity() * sizeof(uint64_t);
+        return ret;
+    }
+
+    void clear() { chunks_.clear(); }
+
+private:
+    using BitWriter = counter_series_detail::BitWriter;
+    using BitReader = counter_series_detail::BitReader;
+
+    struct Window {
+        uint64_t increment {0};
+        uint8_t leading {64};   // 64: no window yet
+        uint8_t meaningful {0};
+    };
+
+    struct Chunk {
+        int64_t first {0};
+        int64_t last {0};
+        uint32_t count {0};
+        bool sealed {false};
+        Values first_values {};
+        std::vector<uint64_t> words;
+    };
+
+    // State of encoding the open chunk
+    struct Encoder {
+        size_t bits {0};
+        int64_t delta {0};
+        Values values {};
+        std::array<Window, N> windows {};
+    };
+
+    uint32_t chunk_samples_;
+    std::deque<Chunk> chunks_;
+    Encoder open_;
+
+    void start(Chunk& chunk, int64_t time, const Values& values)
+    {
+        chunk.first = chunk.last = time;
+        chunk.count = 1;
+        chunk.first_values = values;
+        open_ = Encoder();
+        open_.values = values;
+    }
+
+    static void seal(Chunk& chunk)
+    {
+        chunk.sealed = true;
+        chunk.words.shrink_to_fit();
+    }
+
+    void encode(Chunk& chunk, int64_t time, const Values& values)
+    {
+        BitWriter w(chunk.words, open_.bits);
+
+        int64_t delta = time - chunk.last;
+        int64_t dod = delta - open_.delta;
+        if (dod == 0) {
+            w.write(0b0, 1);
+        } else if (dod >= -64 && dod <= 63) {
+            w.write(0b10, 2); w.write(uint64_t(dod), 7);
+        } else if (dod >= -256 && dod <= 255) {
+            w.write(0b110, 3); w.write(uint64_t(dod), 9);
+        } else if (dod >= -2048 && dod <= 2047) {
+            w.write(0b1110, 4); w.write(uint64_t(dod), 12);
+        } else {
+            w.write(0b1111, 4); w.write(uint64_t(dod), 64);
+        }
+        open_.delta = delta;
+        chunk.last = time;
+
+        for (size_t i = 0; i < N; ++i) {
+            auto& window = open_.windows[i];
+            uint64_t increment = values[i] - open_.values[i];
+            uint64_t x = increment ^ window.increment;
+            window.increment = increment;
+
+            if (x == 0) {
+                w.bit(false);
+                continue;
+            }
+            w.bit(true);
+
+            int leading = std::min(counter_series_detail::leading_zeros(x), 31);
+            int trailing = counter_series_detail::trailing_zeros(x);
+            if (window.leading != 64 && leading >= window.leading &&
+                trailing >= 64 - window.leading - window.meaningful)
+            {
+                // fits into the previous window
+                w.bit(false);
+                w.write(x >> (64 - window.leading - window.meaningful),
+                        window.meaningful);
+            } else {
+                int meaningful = 64 - leading - trailing;
+                w.bit(true);
+                w.write(uint64_t(leading), 5);
+                w.write(uint64_t(meaningful - 1), 6);
+                w.write(x >> trailing, meaningful);
+                window.leading = uint8_t(leading);
+                window.meaningful = uint8_t(meaningful);
+            }
+        }
+        open_.values = values;
+        open_.bits = w.size();
+        ++chunk.count;
+    }
+
+    template<class F>
+    static void decode(const Chunk& chunk, int64_t from, int64_t to, F& f)
+    {
+        int64_t time = chunk.first;
+        int64_t delta = 0;
+        Values values = chunk.first_values;
+        std::array<Window, N> windows {};
+
+        // the sample before `from` gives the increment of the first one
+        bool previous = false;
+        Values prev_values {};
+        int64_t prev_time = 0;
+
+        auto emit = [&]() {
+            if (time < from) {
+                previous = true;
+                prev_time = time;
+                prev_values = values;
+                return;
+            }
+            if (previous) {
+                f(prev_time, prev_values);
+                previous = false;
+            }
+            f(time, values);
+        };
+
+        emit();
+        BitReader r(chunk.words.data());
+        for (uint32_t n = 1; n < chunk.count; ++n) {
+            int64_t dod;
+            if (not r.bit()) {
+                dod = 0;
+            } else if (not r.bit()) {
+                dod = counter_series_detail::sign_extend(r.read(7), 7);
+            } else if (not r.bit()) {
+                dod = counter_series_detail::sign_extend(r.read(9), 9);
+            } else if (not r.bit()) {
+                dod = counter_series_detail::sign_extend(r.read(12), 12);
+            } else {
+                dod = int64_t(r.read(64));
+            }
+            delta += dod;
+            time += delta;
+
+            for (size_t i = 0; i < N; ++i) {
+                auto& window = windows[i];
+                if (r.bit()) {
+                    if (r.bit()) {
+                        window.leading = uint8_t(r.read(5));
+                        window.meaningful = uint8_t(r.read(6) + 1);
+                    }
+                    auto shift = 64 - window.leading - window.meaningful;
+                    window.increment ^= r.read(window.meaningful) << shift;
+                }
+                values[i] += window.increment;
+            }
+
+            if (time > to)
+                return;
+            emit();
+        }
+    }
+};
+
+} // namespace runos
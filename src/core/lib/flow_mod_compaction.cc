@@ -0,0 +1,167 @@
+/*
+ * Copyright 2019 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "flow_mod_compaction.hpp"
+#include "../openflow/common.hh"
+
+#include <cstring>
+
+namespace runos {
+namespace flow_mod_compaction {
+
+namespace {
+
+using namespace boost::endian;
+
+constexpr uint8_t OFP_VERSION = 0x04;
+constexpr uint8_t OFPT_FLOW_MOD = 14;
+
+enum command : uint8_t {
+    OFPFC_ADD = 0,
+    OFPFC_MODIFY = 1,
+    OFPFC_MODIFY_STRICT = 2,
+    OFPFC_DELETE = 3,
+    OFPFC_DELETE_STRICT = 4
+};
+
+enum flags : uint16_t {
+    OFPFF_SEND_FLOW_REM = 1 << 0,
+    OFPFF_CHECK_OVERLAP = 1 << 1,
+    OFPFF_RESET_COUNTS = 1 << 2
+};
+
+constexpr uint8_t OFPTT_ALL = 0xff;
+constexpr uint32_t OFPP_ANY = 0xffffffff;
+constexpr uint32_t OFPG_ANY = 0xffffffff;
+constexpr uint32_t OFP_NO_BUFFER = 0xffffffff;
+
+struct flow_mod {
+    of::header header;
+    big_uint64_t cookie;
+    big_uint64_t cookie_mask;
+    big_uint8_t table_id;
+    big_uint8_t command;
+    big_uint16_t idle_timeout;
+    big_uint16_t hard_timeout;
+    big_uint16_t priority;
+    big_uint32_t buffer_id;
+    big_uint32_t out_port;
+    big_uint32_t out_group;
+    big_uint16_t flags;
+    uint8_t pad[2];
+    big_uint16_t match_type;
+    big_uint16_t match_length; // excluding padding
+};
+static_assert(sizeof(flow_mod) == 52, "");
+
+bool compactable(const flow_mod& fm)
+{
+    if (fm.table_id == OFPTT_ALL ||
+        fm.buffer_id != OFP_NO_BUFFER ||
+        (fm.flags & OFPFF_CHECK_OVERLAP)) {
+        return false;
+    }
+
+    switch (fm.command) {
+    case OFPFC_ADD:
+        return true;
+    case OFPFC_MODIFY_STRICT:
+        return fm.cookie_mask == 0;
+    case OFPFC_DELETE_STRICT:
+        return fm.cookie_mask == 0 &&
+               fm.out_port == OFPP_ANY &&
+               fm.out_group == OFPG_ANY;
+    default:
+        return false;
+    }
+}
+
+} // namespace
+
+std::string key(const uint8_t* data, size_t len)
+{
+    if (len < sizeof(flow_mod)) {
+        return {};
+    }
+
+    auto fm = reinterpret_cast<const flow_mod*>(data);
+    if (fm->header.version != OFP_VERSION ||
+        fm->header.type != OFPT_FLOW_MOD ||
+        fm->header.length != len) {
+        return {};
+    }
+
+    size_t match_offset = offsetof(flow_mod, match_type);
+    size_t match_length = fm->match_length;
+    if (match_offset + match_length > len || not compactable(*fm)) {
+        return {};
+    }
+
+    std::string ret;
+    ret.reserve(sizeof(uint8_t) + sizeof(uint16_t) + match_length);
+    ret.push_back(static_cast<char>(fm->table_id));
+    ret.append(reinterpret_cast<const char*>(&fm->priority), sizeof(uint16_t));
+    ret.append(reinterpret_cast<const char*>(data + match_offset), match_length);
+    return ret;
+}
+
+Resolution resolve(const uint8_t* earlier, uint8_t* later)
+{
+    auto e = reinterpret_cast<const flow_mod*>(earlier);
+    auto l = reinterpret_cast<flow_mod*>(later);
+
+    // Switch sends flow-removed for deleted flow, keep it
+    bool removal_expected = (e->flags & OFPFF_SEND_FLOW_REM) &&
+                            e->command != OFPFC_DELETE_STRICT;
+
+    switch (l->command) {
+    case OFPFC_ADD:
+        // Added flow replaces the existing one
+        if (e->command == OFPFC_DELETE_STRICT) {
+            return Resolution::KeepBoth;
+        }
+        return Resolution::DropEarlier;
+
+    case OFPFC_DELETE_STRICT:
+        if (removal_expected) {
+            return Resolution::KeepBoth;
+        }
+        return Resolution::DropEarlier;
+
+    case OFPFC_MODIFY_STRICT:
+        if (e->command == OFPFC_MODIFY_STRICT) {
+            l->flags = l->flags | (e->flags & OFPFF_RESET_COUNTS);
+            return Resolution::DropEarlier;
+        }
+        if (e->command == OFPFC_ADD) {
+            // Add flow with the modified instructions at once
+            l->command = OFPFC_ADD;
+            l->cookie = e->cookie;
+            l->cookie_mask = 0;
+            l->idle_timeout = e->idle_timeout;
+            l->hard_timeout = e->hard_timeout;
+            l->flags = e->flags;
+            return Resolution::MergeIntoLater;
+        }
+        return Resolution::KeepBoth;
+
+    default:
+        return Resolution::KeepBoth;
+    }
+}
+
+} // namespace flow_mod_compaction
+} // namespace runos
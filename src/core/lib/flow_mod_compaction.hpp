@@ -0,0 +1,43 @@
+/*
+ * Copyright 2019 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace runos {
+namespace flow_mod_compaction {
+
+enum class Resolution {
+    KeepBoth,       // earlier message is still needed
+    DropEarlier,    // later message fully supersedes earlier one
+    MergeIntoLater  // later message was rewritten to include earlier one
+};
+
+// Returns (table, priority, match) key of packed OpenFlow 1.3 flow-mod
+// which may be compacted, or empty string otherwise.
+// Only strict commands without cookie, out_port and out_group filters,
+// overlap checks and buffered packets are compactable.
+std::string key(const uint8_t* data, size_t len);
+
+// Resolves two compactable flow-mods with equal keys,
+// `later` is sent after `earlier` in the same lane and may be rewritten.
+Resolution resolve(const uint8_t* earlier, uint8_t* later);
+
+} // namespace flow_mod_compaction
+} // namespace runos
@@ -0,0 +1,81 @@
+/*
+ * Copyright 2019 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "metrics.hpp"
+
+#include <deque>
+#include <map>
+#include <mutex>
+#include <utility>
+
+namespace runos {
+namespace metrics {
+
+namespace {
+
+struct Registry {
+    struct Entry {
+        std::string group;
+        std::string name;
+        Timing timing;
+    };
+
+    std::mutex mutex;
+    std::deque<Entry> entries; // stable addresses
+    std::map<std::pair<std::string, std::string>, Timing*> index;
+};
+
+Registry& registry()
+{
+    static Registry ret;
+    return ret;
+}
+
+} // namespace
+
+Timing& timing(const std::string& group, const std::string& name)
+{
+    auto& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    auto key = std::make_pair(group, name);
+    auto it = r.index.find(key);
+    if (it != r.index.end()) {
+        return *it->second;
+    }
+
+    r.entries.emplace_back();
+    auto& entry = r.entries.back();
+    entry.group = group;
+    entry.name = name;
+    r.index.emplace(std::move(key), &entry.timing);
+    return entry.timing;
+}
+
+void for_each_timing(const std::string& group,
+                     const std::function<void(const std::string& name,
+                                              const Timing&)>& f)
+{
+    auto& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    for (const auto& entry : r.entries) {
+        if (entry.group == group) {
+            f(entry.name, entry.timing);
+        }
+    }
+}
+
+} // namespace metrics
+} // namespace runos
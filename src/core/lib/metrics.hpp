@@ -0,0 +1,82 @@
+/*
+ * Copyright 2019 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+namespace runos {
+namespace metrics {
+
+// Durations of a repeated operation, aggregated when recorded,
+// so reading them costs a few atomic loads
+class Timing {
+public:
+    using clock = std::chrono::steady_clock;
+
+    void record(clock::duration duration)
+    {
+        auto ns = uint64_t(std::chrono::duration_cast<
+                               std::chrono::nanoseconds>(duration).count());
+        count_.fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(ns, std::memory_order_relaxed);
+        auto max = max_.load(std::memory_order_relaxed);
+        while (ns > max &&
+               not max_.compare_exchange_weak(max, ns, std::memory_order_relaxed))
+        { }
+    }
+
+    uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+    double sum_seconds() const { return double(sum_.load(std::memory_order_relaxed)) * 1e-9; }
+    double max_seconds() const { return double(max_.load(std::memory_order_relaxed)) * 1e-9; }
+
+private:
+    std::atomic<uint64_t> count_ {0};
+    std::atomic<uint64_t> sum_ {0};  // ns
+    std::atomic<uint64_t> max_ {0};  // ns
+};
+
+// Records the lifetime of the scope
+class ScopedTiming {
+public:
+    explicit ScopedTiming(Timing& timing)
+        : timing_(timing)
+        , start_(Timing::clock::now())
+    { }
+
+    ~ScopedTiming() { timing_.record(Timing::clock::now() - start_); }
+
+private:
+    Timing& timing_;
+    Timing::clock::time_point start_;
+};
+
+// Process-wide timing of the operation `name` of `group`, e.g. a
+// database request or polling of an application. Timings are never
+// removed, so references may be kept by the callers.
+Timing& timing(const std::string& group, const std::string& name);
+
+// Visits timings of the group in registration order
+void for_each_timing(const std::string& group,
+                     const std::function<void(const std::string& name,
+                                              const Timing&)>& f);
+
+} // namespace metrics
+} // namespace runos
@@ -0,0 +1,169 @@
+/*
+ * Copyright 2019 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#include <fmt/format.h>
+
+namespace runos {
+
+constexpr auto openmetrics_content_type =
+    "application/openmetrics-text; version=1.0.0; charset=utf-8";
+
+// Writes OpenMetrics text exposition straight into the buffer.
+// The buffer is cleared but keeps its capacity, so rendering into
+// the same buffer again does not allocate.
+//
+//   w.family("runos_port_packets", "counter", "Packets of the port");
+//   w.sample("runos_port_packets_total")
+//    .label("dpid", dpid).label("port", port).value(packets);
+class OpenMetricsWriter {
+public:
+    explicit OpenMetricsWriter(std::string& out)
+        : out_(out)
+    {
+        out_.clear();
+    }
+
+    OpenMetricsWriter& family(std::string_view name, std::string_view type,
+                              std::string_view help,
+                              std::string_view unit = {})
+    {
+        out_.append("# TYPE ").append(name).append(" ")
+            .append(type).append("\n");
+        if (not unit.empty()) {
+            out_.append("# UNIT ").append(name).append(" ")
+                .append(unit).append("\n");
+        }
+        out_.append("# HELP ").append(name).append(" ");
+        escape(help);
+        out_.append("\n");
+        return *this;
+    }
+
+    OpenMetricsWriter& sample(std::string_view name)
+    {
+        out_.append(name);
+        labels_ = 0;
+        return *this;
+    }
+
+    OpenMetricsWriter& label(std::string_view key, std::string_view value)
+    {
+        begin_label(key);
+        escape(value);
+        out_.push_back('"');
+        return *this;
+    }
+
+    OpenMetricsWriter& label(std::string_view key, const char* value)
+    {
+        return label(key, std::string_view(value));
+    }
+
+    OpenMetricsWriter& label(std::string_view key, uint64_t value)
+    {
+        begin_label(key);
+        number(value);
+        out_.push_back('"');
+        return *this;
+    }
+
+    template<class T>
+    std::enable_if_t<std::is_integral<T>::value, OpenMetricsWriter&>
+    label(std::string_view key, T value)
+    {
+        return label(key, uint64_t(value));
+    }
+
+    template<class T>
+    std::enable_if_t<std::is_integral<T>::value>
+    value(T value)
+    {
+        this->value(uint64_t(value));
+    }
+
+    void value(uint64_t value)
+    {
+        end_labels();
+        number(value);
+        out_.push_back('\n');
+    }
+
+    void value(double value)
+    {
+        end_labels();
+        if (std::isnan(value)) {
+            out_.append("NaN");
+        } else if (std::isinf(value)) {
+            out_.append(value > 0 ? "+Inf" : "-Inf");
+        } else {
+            // shortest round-trip form, to_chars of double needs GCC 11
+            fmt::format_to(std::back_inserter(out_), "{}", value);
+        }
+        out_.push_back('\n');
+    }
+
+    // Required at the end of the exposition
+    void finish() { out_.append("# EOF\n"); }
+
+private:
+    std::string& out_;
+    size_t labels_ {0};
+
+    void begin_label(std::string_view key)
+    {
+        out_.push_back(labels_++ == 0 ? '{' : ',');
+        out_.append(key).append("=\"");
+    }
+
+    void end_labels()
+    {
+        if (labels_ > 0) {
+            out_.push_back('}');
+        }
+        out_.push_back(' ');
+    }
+
+    void number(uint64_t value)
+    {
+        char buf[24];
+        auto res = std::to_chars(buf, buf + sizeof(buf), value);
+        out_.append(buf, res.ptr);
+    }
+
+    void escape(std::string_view s)
+    {
+        for (char c : s) {
+            switch (c) {
+            case '\\': out_.append("\\\\"); break;
+            case '\n': out_.append("\\n"); break;
+            case '"': out_.append("\\\""); break;
+            default: out_.push_back(c);
+            }
+        }
+    }
+};
+
+} // namespace runos
@@ -15,8 +15,13 @@
  */
 
 #include "poller.hpp"
+#include "metrics.hpp"
 #include "runos/core/logging.hpp"
+
+#include <boost/core/demangle.hpp>
+
 #include <thread>
+#include <typeinfo>
 
 namespace runos {
 
@@ -54,16 +59,29 @@ void Poller::run()
     if (not wthread->isRunning()) {
         QObject::connect(wthread, &QThread::started, wtimer, qOverload<>(&QTimer::start));
         QObject::connect(wthread, &QThread::finished, wtimer, &QTimer::stop);
+        // time spent in polling is exported as metrics
         switch(type) {
-        case PollerType::Application:
-            QObject::connect(wtimer, SIGNAL(timeout()),
-                             parent, SLOT(polling()), Qt::DirectConnection);
+        case PollerType::Application: {
+            auto& timing = metrics::timing("polling", parent->provides());
+            QObject::connect(wtimer, &QTimer::timeout, parent,
+                [parent = parent, &timing]() {
+                    metrics::ScopedTiming scoped(timing);
+                    QMetaObject::invokeMethod(parent, "polling",
+                                              Qt::DirectConnection);
+                }, Qt::DirectConnection);
             break;
-        case PollerType::Polling:
-            QObject::connect(wtimer, &QTimer::timeout,
-                             polling_parent, &Polling::polling, Qt::DirectConnection);
+        }
+        case PollerType::Polling: {
+            auto& timing = metrics::timing("polling",
+                boost::core::demangle(typeid(*polling_parent).name()));
+            QObject::connect(wtimer, &QTimer::timeout, polling_parent,
+                [polling_parent = polling_parent, &timing]() {
+                    metrics::ScopedTiming scoped(timing);
+                    polling_parent->polling();
+                }, Qt::DirectConnection);
             break;
         }
+        }
         wthread->start();
     } else {
         if (not wtimer->isActive()) {
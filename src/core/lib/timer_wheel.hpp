@@ -0,0 +1,108 @@
+/*
+ * Copyright 2019 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace runos {
+
+// Hashed timer wheel: timers are kept in slots by their deadline tick,
+// so scheduling is constant time and expiring costs the ticks passed
+// plus the timers fired. Timers beyond one turn of the wheel stay
+// in their slot for the next turns.
+//
+// Timers are never cancelled. Owners keep the actual deadline
+// and skip or reschedule stale timers when they fire.
+template<class T>
+class TimerWheel {
+public:
+    using clock = std::chrono::steady_clock;
+
+    explicit TimerWheel(clock::duration tick = std::chrono::milliseconds(100),
+                        size_t slot_count = 256)
+        : tick_(std::max(tick, clock::duration(1)))
+        , slots_(std::max(slot_count, size_t(1)))
+        , current_(ticks(clock::now()))
+    { }
+
+    void schedule(T value, clock::time_point deadline)
+    {
+        // fires not earlier than the deadline
+        auto at = std::max(ticks(deadline) + 1, current_ + 1);
+        slots_[at % slots_.size()].push_back({at, std::move(value)});
+        size_++;
+    }
+
+    // Calls f(T&&) for every timer with deadline passed by `now`
+    template<class F>
+    void expire(clock::time_point now, F&& f)
+    {
+        auto until = ticks(now);
+        // each slot is visited once however long the wheel was idle
+        auto last = std::min(until, current_ + uint64_t(slots_.size()));
+
+        std::vector<T> fired;
+        for (; current_ < last; ++current_) {
+            auto& slot = slots_[(current_ + 1) % slots_.size()];
+            auto due = std::partition(slot.begin(), slot.end(),
+                [until](const Timer& timer) { return timer.at > until; });
+            for (auto it = due; it != slot.end(); ++it) {
+                fired.push_back(std::move(it->value));
+            }
+            slot.erase(due, slot.end());
+        }
+        current_ = std::max(current_, until);
+        size_ -= fired.size();
+
+        // callbacks may schedule timers again
+        for (auto& value : fired) {
+            f(std::move(value));
+        }
+    }
+
+    void clear()
+    {
+        for (auto& slot : slots_) {
+            slot.clear();
+        }
+        size_ = 0;
+    }
+
+    size_t size() const { return size_; }
+
+private:
+    struct Timer {
+        uint64_t at; // tick
+        T value;
+    };
+
+    clock::duration tick_;
+    std::vector<std::vector<Timer>> slots_;
+    uint64_t current_; // last expired tick
+    size_t size_ {0};
+
+    uint64_t ticks(clock::time_point time) const
+    {
+        return uint64_t(time.time_since_epoch() / tick_);
+    }
+};
+
+} // namespace runos
@@ -14,6 +14,8 @@
  * limitations under the License.
  */
  
+#include <algorithm>
+#include <climits>
 #include <cstdlib>
 #include <iostream>
 #include <memory>
@@ -51,15 +53,65 @@
 
 #define debugLine printf("\n%s:%d\n", __FILE__, __LINE__)
 
-enum class ReturnType {
-    UNDEFINED,
-    SIMPLE_STRING,
-    ERROR,
-    INTEGER,
-    BULK_STRING,
-    ARRAY
+namespace {
+
+// Reply of any size in RESP, parsed as it arrives. Elements of
+// arrays are flattened, nil values become empty strings.
+struct RespReply {
+    std::string in;
+    size_t pos = 0;
+    std::vector<long> open; // elements left in nested arrays
+    std::vector<std::string> elements;
+    bool error = false;
+    bool done = false;
+
+    // Parses complete elements, true when the whole reply has arrived
+    bool feed()
+    {
+        while (!done) {
+            auto eol = in.find("\r\n", pos);
+            if (eol == std::string::npos) {
+                return false;
+            }
+
+            char type = in[pos];
+            long n = strtol(in.c_str() + pos + 1, nullptr, 10);
+            size_t next = eol + 2;
+
+            if (type == RC_MULTIBULK && n > 0) {
+                open.push_back(n);
+                pos = next;
+                continue;
+            } else if (type == RC_BULK && n >= 0) {
+                if (in.size() < next + n + 2) {
+                    return false;
+                }
+                elements.emplace_back(in, next, n);
+                pos = next + n + 2;
+            } else if (type == RC_MULTIBULK || type == RC_BULK) {
+                if (type == RC_BULK) {
+                    elements.emplace_back(); // nil
+                }
+                pos = next;
+            } else {
+                // status, error and integer replies
+                error = error || type == RC_ERROR;
+                elements.emplace_back(in, pos + 1, eol - pos - 1);
+                pos = next;
+            }
+
+            // completed arrays are elements of enclosing ones
+            while (!open.empty() && --open.back() == 0) {
+                open.pop_back();
+            }
+            done = open.empty();
+        }
+        return true;
+    }
 };
 
+} // namespace
+
 static void full_write(int fd, const char *buf, size_t len)
 {
         while (len > 0) {
@@ -634,12 +686,98 @@ long read_long(const char* buffer, int* delta)
         return redis_raw_send(recvtype, buffer); 
     }
 
+    int SimpleRedisClient::redis_command(const std::vector<std::string>& args)
+    {
+        if(fd <= 0)
+        {
+            if(redis_connect() < 0)
+            {
+                return RC_ERR;
+            }
+        }
+
+        data = 0;
+        data_size = 0;
+        answer_multibulk_vec_.clear();
+
+        // multi-bulk request, inline ones are limited to 64KB by redis
+        std::string command = "*" + std::to_string(args.size()) + "\r\n";
+        for (const auto& arg : args) {
+            command += "$" + std::to_string(arg.size()) + "\r\n";
+            command += arg;
+            command += "\r\n";
+        }
+
+        int rc = send_data(command.data(), command.size());
+        if (rc < 0)
+        {
+            print_rcBacktrace("Данные не отправлены [RC_ERR_SEND]");
+            reconnect();
+            return RC_ERR_SEND;
+        }
+
+        if (rc != (int) command.size())
+        {
+            print_rcBacktrace("Ответ не получен [RC_ERR_TIMEOUT]");
+            reconnect();
+            return RC_ERR_TIMEOUT;
+        }
+
+        // the reply is read whole, a cut one would be taken
+        // by the next request, so the connection is reset
+        RespReply reply;
+        char chunk[65536];
+        while (!reply.feed())
+        {
+            rc = read_select(fd, timeout);
+            if (rc <= 0)
+            {
+                print_rcBacktrace("Ответ не получен [RC_ERR_TIMEOUT]");
+                reconnect();
+                return RC_ERR_TIMEOUT;
+            }
+
+            rc = recv(fd, chunk, sizeof(chunk), 0);
+            if (rc == 0)
+            {
+                print_rcBacktrace("Соединение закрыто [RC_ERR_CONECTION_CLOSE]");
+                reconnect();
+                return RC_ERR_CONECTION_CLOSE;
+            }
+            if (rc < 0)
+            {
+                if (errno == EAGAIN || errno == EINTR)
+                {
+                    continue;
+                }
+                reconnect();
+                return CR_ERR_RECV;
+            }
+            reply.in.append(chunk, rc);
+        }
+
+        if (reply.error)
+        {
+            printf("\x1b[31mREDIS[fd=%d] RC_ERROR:%s\x1b[0m\n", fd,
+                   reply.elements.empty() ? "" : reply.elements.front().c_str());
+            return RC_ERR_PROTOCOL;
+        }
+
+        answer_multibulk_vec_ = std::move(reply.elements);
+        return (int) std::min<size_t>(reply.in.size(), INT_MAX);
+    }
+
     /**
      * Отправляет данные
      * @param buf
      * @return
      */
     int SimpleRedisClient::send_data( const char *buf ) const
+    {
+        return send_data(buf, strlen(buf)); // При отправке бинарных данных возможны баги.
+    }
+
+    int SimpleRedisClient::send_data( const char *buf, size_t tosend ) const
     {
         fd_set fds;
         struct timeval tv;
@@ -650,9 +788,7 @@ long read_long(const char* buffer, int* delta)
         tv.tv_sec = timeout / 1000;
         tv.tv_usec = (timeout % 1000)*1000;
 
-        int tosend = strlen(buf); // При отправке бинарных данных возможны баги.
-
-        while (sent < tosend)
+        while (sent < (int) tosend)
         {
             FD_ZERO(&fds);
             FD_SET(fd, &fds);
@@ -684,48 +820,40 @@ long read_long(const char* buffer, int* delta)
 
     void SimpleRedisClient::parse_multibulk_data()
     {
-        ReturnType return_type = ReturnType::UNDEFINED;
         answer_multibulk_vec_.clear();
-        int token = 0;
-        auto buffer_length = strlen(buffer);
-        unsigned int i = 0;
-        while (i < buffer_length) {
-            char symbol = buffer[i];
-            if (symbol == RC_ERROR || symbol == RC_INLINE ||
-                symbol == RC_BULK || symbol == RC_MULTIBULK ||
-                symbol == RC_INT || symbol == RC_ANY) {
-                token = 0;
-                if (symbol == RC_MULTIBULK) {
-                    return_type = ReturnType::ARRAY;
-                }
-                if (symbol == RC_BULK) {
-                    return_type = ReturnType::BULK_STRING;
-                }
-                ++i;
-                continue;
-            }
-            if (isdigit(symbol)) {
-                auto integer = (symbol - '0');
-                token = 10 * token + integer;
-                ++i;
-                continue;
-            }
-            if (symbol == '\r') {
-                i += 2; // skip \r\n
-                continue;
+        const char* p = buffer;
+        const char* end = buffer + strlen(buffer);
+
+        while (p < end) {
+            const char* eol = strstr(p, "\r\n");
+            if (eol == nullptr) {
+                break;
             }
-            if (return_type == ReturnType::BULK_STRING) {
-                // copy to new_string
-                std::string new_string;
-                for (int jj = 0; jj < token; ++jj) {
-                    new_string.push_back(buffer[i + jj]);
+
+            char symbol = *p;
+            if (symbol == RC_MULTIBULK) {
+                // headers of arrays are skipped, nested elements are flattened
+                p = eol + 2;
+            } else if (symbol == RC_BULK) {
+                // value is taken by its length, so it may start with
+                // digits or type markers and contain them anywhere
+                long len = strtol(p + 1, nullptr, 10);
+                p = eol + 2;
+                if (len < 0) {
+                    answer_multibulk_vec_.emplace_back(); // nil
+                    continue;
+                }
+                len = std::min<long>(len, end - p);
+                answer_multibulk_vec_.emplace_back(p, len);
+                p += len;
+                if (p + 2 <= end && p[0] == '\r' && p[1] == '\n') {
+                    p += 2;
                 }
-                answer_multibulk_vec_.push_back(new_string);
-                i += token;
-                token = 0;
-                return_type = ReturnType::UNDEFINED;
+            } else {
+                // status and integer elements
+                answer_multibulk_vec_.emplace_back(p + 1, eol - p - 1);
+                p = eol + 2;
             }
-            ++i;
         }
     }
 
@@ -968,6 +1096,51 @@ long read_long(const char* buffer, int* delta)
         REDIS_PRINTF_MACRO_CODE(RC_INT, "SCARD")
     }
 
+    /**
+     * Sets several fields of the hash at once.
+     * @see http://redis.io/commands/hmset
+     * @return Если меньше нуля то код ошибки, а если больше нуля то количество принятых байт
+     */
+    int SimpleRedisClient::hmset(const char *key,
+                                 const std::vector<std::pair<std::string, std::string>>& fields)
+    {
+        std::vector<std::string> args;
+        args.reserve(2 + 2 * fields.size());
+        args.emplace_back("HMSET");
+        args.emplace_back(key);
+        for (const auto& field : fields) {
+            args.push_back(field.first);
+            args.push_back(field.second);
+        }
+        return redis_command(args);
+    }
+
+    /**
+     * Removes several fields of the hash at once.
+     * @see http://redis.io/commands/hdel
+     * @return Если меньше нуля то код ошибки, а если больше нуля то количество принятых байт
+     */
+    int SimpleRedisClient::hdel(const char *key, const std::vector<std::string>& fields)
+    {
+        std::vector<std::string> args;
+        args.reserve(2 + fields.size());
+        args.emplace_back("HDEL");
+        args.emplace_back(key);
+        args.insert(args.end(), fields.begin(), fields.end());
+        return redis_command(args);
+    }
+
+    /**
+     * Returns all fields and values of the hash in one reply,
+     * read whole whatever its size.
+     * @see http://redis.io/commands/hgetall
+     * @return Если меньше нуля то код ошибки, а если больше нуля то количество принятых байт
+     */
+    int SimpleRedisClient::hgetall(const char *key)
+    {
+        return redis_command({"HGETALL", key});
+    }
+
     /**
      * Ни ключ ни значение не должны содержать "\r\n"
      * @param key
@@ -18,6 +18,7 @@
 #define	 __REDISCLIENT__H_
 
 #include <string>
+#include <utility>
 #include <vector>
 
 #define RC_NULL 0
@@ -378,6 +379,25 @@ public:
     int smembers_printf(const char *format, ...);
     
     int scard(const char *key);
+
+    /**
+     * Sets several fields of the hash at once.
+     * Fields and values may contain any bytes
+     * @see http://redis.io/commands/hmset
+     */
+    int hmset(const char *key,
+              const std::vector<std::pair<std::string, std::string>>& fields);
+
+    /**
+     * @see http://redis.io/commands/hdel
+     */
+    int hdel(const char *key, const std::vector<std::string>& fields);
+
+    /**
+     * Fields and values are returned by getVectorData() one after another
+     * @see http://redis.io/commands/hgetall
+     */
+    int hgetall(const char *key);
     int scard_printf(const char *format, ...);
     
     int lpush(const char *key, const char *member);
@@ -480,6 +500,13 @@ protected:
      * @return Если меньше нуля то код ошибки, а если больше нуля то количество принятых байт
      */
     int redis_send(char recvtype, const char *format, ...);
+
+    /**
+     * Отправляет запрос в формате multi-bulk, аргументы любой длины.
+     * Ответ читается целиком, элементы доступны через getVectorData()
+     * @return Если меньше нуля то код ошибки, а если больше нуля то количество принятых байт
+     */
+    int redis_command(const std::vector<std::string>& args);
     
     /**
      * Отправляет данные
@@ -487,6 +514,7 @@ protected:
      * @return 
      */
     int send_data( const char *buf ) const;
+    int send_data( const char *buf, size_t len ) const;
 
     void parse_multibulk_data();
  
@@ -36,7 +36,7 @@ int RedisDatabase::connectToStore(const char* address, int port)
     lock_t lock(client_mutex_);
     rclient->setHost(address);
     rclient->setPort(port);
-    rclient->setBufferSize(2048*4);
+    rclient->setBufferSize(BUFFER_SIZE);
 
     connection_state_ = rclient->redis_connect();
     if (connection_state_ < 0) {
@@ -111,6 +111,13 @@ std::string RedisDatabase::getValue(const std::string& key) const
     return str;
 }
 
+size_t RedisDatabase::maxValueSize(const std::string& key) const
+{
+    // SET is an inline command formatted in the client buffer
+    size_t overhead = key.size() + sizeof("SET '' ''\r\n");
+    return BUFFER_SIZE > overhead ? BUFFER_SIZE - overhead : 0;
+}
+
 int RedisDatabase::delValue(const std::string& key)
 {
     lock_t lock(client_mutex_);
@@ -137,6 +144,55 @@ RedisDatabase::getKeys(const std::string& key_pattern) const
     return keys;
 }
 
+int RedisDatabase::putFields(const std::string& key, const Fields& fields)
+{
+    if (fields.empty())
+        return 0;
+
+    lock_t lock(client_mutex_);
+    int ret = rclient->hmset(key.c_str(), fields);
+    if (ret < 0) {
+        LOG(ERROR) << "[RedisDatabase] REDIS HMSET(" << key << ", "
+                   << fields.size() << " fields) fail: ERROR(" << ret << ").";
+        return -1;
+    }
+    return ret;
+}
+
+int RedisDatabase::delFields(const std::string& key,
+                             const std::vector<std::string>& fields)
+{
+    if (fields.empty())
+        return 0;
+
+    lock_t lock(client_mutex_);
+    int ret = rclient->hdel(key.c_str(), fields);
+    if (ret < 0) {
+        LOG(ERROR) << "[RedisDatabase] REDIS HDEL(" << key << ", "
+                   << fields.size() << " fields) fail: ERROR(" << ret << ").";
+    }
+    return ret;
+}
+
+int RedisDatabase::getFields(const std::string& key, Fields& fields) const
+{
+    lock_t lock(client_mutex_);
+    fields.clear();
+    int ret = rclient->hgetall(key.c_str());
+
+    if (ret < 0) {
+        LOG(ERROR) << "[RedisDatabase] REDIS HGETALL(" << key
+                   << ") fail: ERROR(" << ret << ").";
+        return ret;
+    }
+
+    auto&& data = rclient->getVectorData();
+    for (size_t i = 0; i + 1 < data.size(); i += 2) {
+        fields.emplace_back(std::move(data[i]), std::move(data[i + 1]));
+    }
+    return ret;
+}
+
 Json RedisDatabase::getDoc(const char* key) const
 {
     Json doc = nullptr;
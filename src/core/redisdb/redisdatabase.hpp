@@ -28,6 +28,8 @@ namespace runos {
 class RedisDatabase
 {
 public:
+    using Fields = std::vector<std::pair<std::string, std::string>>;
+
     RedisDatabase();
     ~RedisDatabase() = default;
 
@@ -52,6 +54,13 @@ public:
      */
     std::string getValue(const std::string& key) const;
 
+    /*!
+     * \brief maxValueSize
+     * \param key
+     * \return the longest value which putValue can send on the key
+     */
+    size_t maxValueSize(const std::string& key) const;
+
     /*!
      * \brief delValue
      * \param key
@@ -66,6 +75,31 @@ public:
      */
     std::vector<std::string> getKeys(const std::string& key_pattern) const;
 
+    // Methods for hashes, each is a single request to Redis Database
+    /*!
+     * \brief putFields method to set several fields of the hash
+     * \param key
+     * \param fields pairs of field and value
+     * \return if (ret < 0) then ERROR else the number of receiving bytes
+     */
+    int putFields(const std::string& key, const Fields& fields);
+
+    /*!
+     * \brief delFields method to delete several fields of the hash
+     * \param key
+     * \param fields
+     * \return if (ret < 0) then ERROR else the number of receiving bytes
+     */
+    int delFields(const std::string& key, const std::vector<std::string>& fields);
+
+    /*!
+     * \brief getFields method to get all fields of the hash
+     * \param key
+     * \param fields pairs of field and value, empty on error
+     * \return if (ret < 0) then ERROR else the number of receiving bytes
+     */
+    int getFields(const std::string& key, Fields& fields) const;
+
     /*!
      * \brief get_doc
      * \param key
@@ -94,6 +128,9 @@ public:
     int setupSlaveOf(const char* address, int port);
 
 private:
+    // requests and replies of single values go through it
+    static constexpr size_t BUFFER_SIZE = 2048*4;
+
     std::unique_ptr<SimpleRedisClient> rclient;
     int connection_state_;
     mutable std::mutex client_mutex_;
@@ -0,0 +1,160 @@
+/*
+ * Copyright 2019 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "lib/counter_series.hpp"
+
+#include <mettle.hpp>
+
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <utility>
+#include <vector>
+
+using namespace mettle;
+using namespace runos;
+
+namespace {
+
+using Series = CounterSeries<4>;
+using Sample = std::pair<int64_t, Series::Values>;
+
+constexpr auto min_time = std::numeric_limits<int64_t>::min();
+constexpr auto max_time = std::numeric_limits<int64_t>::max();
+
+std::vector<Sample> scan(const Series& series, int64_t from, int64_t to)
+{
+    std::vector<Sample> ret;
+    series.scan(from, to, [&](int64_t time, const Series::Values& values) {
+        ret.emplace_back(time, values);
+    });
+    return ret;
+}
+
+// Port-like counters polled every second with jitter
+std::vector<Sample> traffic(size_t count, uint64_t seed)
+{
+    std::mt19937_64 rng(seed);
+    std::vector<Sample> ret;
+    int64_t time = 1500000000000;
+    Series::Values values {};
+    for (size_t i = 0; i < count; ++i) {
+        time += 1000 + int64_t(rng() % 7) - 3;
+        auto load = 1.0 + double(rng() % 1000) / 20000;
+        values[0] += uint64_t(80000 * load);
+        values[1] += uint64_t(1e8 * load);
+        if (rng() % 1000 == 0)
+            values[2] += rng() % 10;
+        ret.emplace_back(time, values);
+    }
+    return ret;
+}
+
+} // namespace
+
+suite<> counter_series("CounterSeries", [](auto& _) {
+    _.test("empty series", []() {
+        Series series;
+        expect(series.empty(), equal_to(true));
+        expect(series.samples(), equal_to(0u));
+        expect(scan(series, min_time, max_time).empty(), equal_to(true));
+    });
+
+    _.test("samples round-trip", []() {
+        Series series {120};
+        auto samples = traffic(10000, 42);
+        for (const auto& sample : samples) {
+            series.append(sample.first, sample.second);
+        }
+        expect(series.samples(), equal_to(samples.size()));
+        expect(series.first_time(), equal_to(samples.front().first));
+        expect(scan(series, min_time, max_time) == samples, equal_to(true));
+    });
+
+    _.test("resets, clock jumps and arbitrary values round-trip", []() {
+        std::mt19937_64 rng(42);
+        Series series {64};
+        std::vector<Sample> samples;
+        int64_t time = 0;
+        Series::Values values {};
+        for (int i = 0; i < 20000; ++i) {
+            switch (rng() % 8) {
+            case 0: time += int64_t(rng() % 100000000); break;
+            case 1: time -= int64_t(rng() % 10000); break; // clock goes back
+            default: time += 1000;
+            }
+            for (auto& value : values) {
+                switch (rng() % 16) {
+                case 0: value = rng(); break;
+                case 1: value = 0; break; // counter reset
+                default: value += rng() % 1000;
+                }
+            }
+            series.append(time, values);
+            samples.emplace_back(time, values);
+        }
+        expect(scan(series, min_time, max_time) == samples, equal_to(true));
+    });
+
+    _.test("range scan starts with the previous sample", []() {
+        Series series {100};
+        auto samples = traffic(1000, 1);
+        for (const auto& sample : samples) {
+            series.append(sample.first, sample.second);
+        }
+
+        auto range = scan(series, samples[250].first, samples[420].first);
+        expect(range.size(), equal_to(172u));
+        expect(range.front() == samples[249], equal_to(true));
+        expect(range.back() == samples[420], equal_to(true));
+
+        // the first sample of a chunk has no previous one to emit
+        range = scan(series, samples[300].first, samples[300].first);
+        expect(range.size(), equal_to(1u));
+        expect(range.front() == samples[300], equal_to(true));
+    });
+
+    _.test("trim drops whole chunks before the time", []() {
+        Series series {100};
+        auto samples = traffic(1000, 2);
+        for (const auto& sample : samples) {
+            series.append(sample.first, sample.second);
+        }
+
+        series.trim(samples[550].first);
+        expect(series.samples(), equal_to(500u));
+        expect(series.first_time(), equal_to(samples[500].first));
+        expect(scan(series, samples[550].first, max_time).front()
+                    == samples[549], equal_to(true));
+
+        series.trim(max_time);
+        expect(series.empty(), equal_to(true));
+    });
+
+    _.test("steady counters are compressed", []() {
+        Series series;
+        Series::Values values {};
+        constexpr size_t count = 86400;
+        for (size_t i = 0; i < count; ++i) {
+            values[0] += 1000;
+            values[1] += 1500000;
+            series.append(int64_t(i) * 1000, values);
+        }
+        // a bit per counter and timestamp plus chunk headers,
+        // against 40 bytes of a raw sample
+        expect(series.memory(), less_equal(2 * count));
+    });
+});
@@ -0,0 +1,114 @@
+/*
+ * Copyright 2019 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "lib/openmetrics.hpp"
+
+#include <mettle.hpp>
+
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <random>
+#include <string>
+
+using namespace mettle;
+using namespace runos;
+
+namespace {
+
+template<class T>
+std::string render_value(T value)
+{
+    std::string out;
+    OpenMetricsWriter(out).sample("m").value(value);
+    return out;
+}
+
+} // namespace
+
+suite<> openmetrics("OpenMetricsWriter", [](auto& _) {
+    _.test("family metadata", []() {
+        std::string out;
+        OpenMetricsWriter w(out);
+        w.family("runos_port_bytes", "counter", "Bytes of the port", "bytes");
+        w.family("runos_up", "gauge", "Up");
+        expect(out, equal_to(
+            "# TYPE runos_port_bytes counter\n"
+            "# UNIT runos_port_bytes bytes\n"
+            "# HELP runos_port_bytes Bytes of the port\n"
+            "# TYPE runos_up gauge\n"
+            "# HELP runos_up Up\n"));
+    });
+
+    _.test("samples with labels", []() {
+        std::string out;
+        OpenMetricsWriter w(out);
+        w.sample("runos_port_packets_total")
+         .label("dpid", uint64_t(0xffffffffffffffff))
+         .label("port", 3)
+         .label("name", "eth0")
+         .value(42);
+        w.sample("runos_switches").value(uint64_t(2));
+        w.finish();
+        expect(out, equal_to(
+            "runos_port_packets_total{dpid=\"18446744073709551615\","
+            "port=\"3\",name=\"eth0\"} 42\n"
+            "runos_switches 2\n"
+            "# EOF\n"));
+    });
+
+    _.test("help and label values are escaped", []() {
+        std::string out;
+        OpenMetricsWriter w(out);
+        w.family("m", "gauge", "a \"b\"\\\nc");
+        w.sample("m").label("k", std::string_view("x\"y\\\nz")).value(1);
+        expect(out, equal_to(
+            "# TYPE m gauge\n"
+            "# HELP m a \\\"b\\\"\\\\\\nc\n"
+            "m{k=\"x\\\"y\\\\\\nz\"} 1\n"));
+    });
+
+    _.test("special double values", []() {
+        using limits = std::numeric_limits<double>;
+        expect(render_value(limits::quiet_NaN()), equal_to("m NaN\n"));
+        expect(render_value(limits::infinity()), equal_to("m +Inf\n"));
+        expect(render_value(-limits::infinity()), equal_to("m -Inf\n"));
+        expect(render_value(0.1), equal_to("m 0.1\n"));
+        expect(render_value(-2.5), equal_to("m -2.5\n"));
+    });
+
+    _.test("doubles round-trip", []() {
+        std::mt19937_64 rng(42);
+        std::uniform_real_distribution<double> mantissa(-1, 1);
+        std::uniform_int_distribution<int> exponent(-300, 300);
+        for (int i = 0; i < 10000; ++i) {
+            double value = std::ldexp(mantissa(rng), exponent(rng));
+            auto out = render_value(value);
+            expect(std::strtod(out.c_str() + 2, nullptr), equal_to(value));
+        }
+    });
+
+    _.test("buffer is cleared and keeps its capacity", []() {
+        std::string out;
+        OpenMetricsWriter(out).sample("m").value(1);
+        out.reserve(4096);
+        auto capacity = out.capacity();
+
+        OpenMetricsWriter(out).sample("n").value(2);
+        expect(out, equal_to("n 2\n"));
+        expect(out.capacity(), equal_to(capacity));
+    });
+});
@@ -0,0 +1,225 @@
+/*
+ * Copyright 2019 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "StatsColumns.hpp"
+
+#include <mettle.hpp>
+
+#include <algorithm>
+#include <array>
+#include <numeric>
+#include <random>
+#include <vector>
+
+using namespace mettle;
+using namespace runos;
+
+namespace {
+
+using QueueColumns = StatsColumns<QueueMeasurement>;
+using seconds = QueueColumns::fpseconds;
+
+// Speeds of one row computed as StatisticsStore does
+struct ReferenceRow {
+    double prev_time {0};
+    double curr_time {0};
+    std::array<uint64_t, 3> prev {};
+    std::array<uint64_t, 3> curr {};
+    std::array<double, 3> speed {};
+    std::array<double, 3> max {};
+
+    void append(double time, std::array<uint64_t, 3> values)
+    {
+        if (curr_time > time) {
+            prev_time = curr_time = 0;
+            prev.fill(0);
+            curr.fill(0);
+        }
+        prev = curr;
+        prev_time = curr_time;
+        curr_time = time;
+        curr = values;
+        if (curr < prev)
+            prev.fill(0);
+
+        double delta = curr_time - prev_time;
+        for (size_t c = 0; c < 3; ++c) {
+            speed[c] = delta > 0 ? (curr[c] - prev[c]) / delta : 0;
+            max[c] = std::max(max[c], speed[c]);
+        }
+    }
+};
+
+} // namespace
+
+suite<> stats_columns("StatsColumns", [](auto& _) {
+    _.test("speed is the increment over the interval", []() {
+        QueueColumns columns;
+        columns.begin();
+        columns.append(1, seconds(1), 100, 10, 0);
+        columns.commit();
+        columns.begin();
+        columns.append(1, seconds(3), 500, 30, 0);
+        columns.commit();
+
+        auto stats = columns.get(columns.find(1));
+        expect(stats.integral[0], equal_to(500u));
+        expect(stats.current_speed[0], equal_to(200.0));
+        expect(stats.current_speed[1], equal_to(10.0));
+        expect(stats.current_speed[2], equal_to(0.0));
+        expect(stats.max_speed[0], equal_to(200.0));
+    });
+
+    _.test("counters going back are counted from zero", []() {
+        QueueColumns columns;
+        for (auto sample : {std::make_pair(1.0, 1000u), {2.0, 1300u}, {3.0, 50u}}) {
+            columns.begin();
+            columns.append(1, seconds(sample.first), sample.second, 0, 0);
+            columns.commit();
+        }
+
+        auto stats = columns.get(0);
+        expect(stats.integral[0], equal_to(50u));
+        expect(stats.current_speed[0], equal_to(50.0));
+        expect(stats.max_speed[0], equal_to(1000.0));
+    });
+
+    _.test("measurements are compared as a whole", []() {
+        QueueColumns columns;
+        columns.begin();
+        columns.append(1, seconds(1), 1000, 5, 0);
+        columns.commit();
+        columns.begin();
+        columns.append(1, seconds(2), 1000, 3, 7);
+        columns.commit();
+
+        // the second counter went back, so the first is counted from zero
+        auto stats = columns.get(0);
+        expect(stats.current_speed[0], equal_to(1000.0));
+        expect(stats.current_speed[1], equal_to(3.0));
+        expect(stats.current_speed[2], equal_to(7.0));
+    });
+
+    _.test("time going back resets the row but keeps maxima", []() {
+        QueueColumns columns;
+        for (auto sample : {std::make_pair(5.0, 100u), {6.0, 300u}, {2.0, 50u}}) {
+            columns.begin();
+            columns.append(1, seconds(sample.first), sample.second, 0, 0);
+            columns.commit();
+        }
+
+        auto stats = columns.get(0);
+        expect(stats.integral[0], equal_to(50u));
+        expect(stats.current_speed[0], equal_to(25.0));
+        expect(stats.max_speed[0], equal_to(200.0));
+    });
+
+    _.test("rows missing from a reply keep their values", []() {
+        QueueColumns columns;
+        columns.begin();
+        columns.append(queue_stats_key(1, 0), seconds(1), 10, 0, 0);
+        columns.append(queue_stats_key(1, 1), seconds(1), 20, 0, 0);
+        columns.commit();
+        columns.begin();
+        columns.append(queue_stats_key(1, 1), seconds(2), 60, 0, 0);
+        columns.commit();
+
+        auto first = columns.get(columns.find(queue_stats_key(1, 0)));
+        auto second = columns.get(columns.find(queue_stats_key(1, 1)));
+        expect(first.integral[0], equal_to(10u));
+        expect(first.current_speed[0], equal_to(10.0));
+        expect(second.integral[0], equal_to(60u));
+        expect(second.current_speed[0], equal_to(40.0));
+    });
+
+    _.test("erased rows are dropped from the index", []() {
+        QueueColumns columns;
+        columns.begin();
+        for (uint64_t key = 1; key <= 3; ++key) {
+            columns.append(key, seconds(1), key, 0, 0);
+        }
+        columns.commit();
+        columns.begin();
+        columns.append(3, seconds(2), 13, 0, 0);
+        columns.commit();
+
+        columns.erase_if([](uint64_t, bool updated) { return not updated; });
+        expect(columns.size(), equal_to(1u));
+        expect(columns.find(1), equal_to(QueueColumns::npos));
+        expect(columns.find(3), equal_to(0u));
+        expect(columns.get(0).integral[0], equal_to(13u));
+        expect(columns.get(0).current_speed[0], equal_to(10.0));
+    });
+
+    _.test("history is kept only if enabled", []() {
+        QueueColumns with_history(true);
+        StatsColumns<TrafficMeasurement> without_history;
+        for (double time : {1.0, 2.0}) {
+            with_history.begin();
+            with_history.append(1, seconds(time), 1, 1, 1);
+            with_history.commit();
+            without_history.begin();
+            without_history.append(1, seconds(time), 1, 1);
+            without_history.commit();
+        }
+
+        expect(with_history.history(0) != nullptr, equal_to(true));
+        expect(without_history.history(0) == nullptr, equal_to(true));
+    });
+
+    _.test("commit of many rows matches per-row computation", []() {
+        constexpr size_t rows = 4096;
+        std::mt19937_64 rng(42);
+        QueueColumns columns;
+        std::vector<ReferenceRow> reference(rows);
+        std::vector<std::array<uint64_t, 3>> counters(rows);
+        std::vector<size_t> order(rows);
+        std::iota(order.begin(), order.end(), 0);
+
+        for (int round = 1; round <= 20; ++round) {
+            // replies list rows in varying order and skip some of them
+            if (round % 5 == 0)
+                std::shuffle(order.begin(), order.end(), rng);
+
+            columns.begin();
+            for (auto row : order) {
+                if (rng() % 10 == 0)
+                    continue;
+                auto& values = counters[row];
+                for (auto& value : values) {
+                    value = rng() % 50 == 0 ? rng() % 1000
+                                            : value + rng() % 100000;
+                }
+                double time = round + double(rng() % 100) / 1000;
+                columns.append(row, seconds(time), values[0], values[1], values[2]);
+                reference[row].append(time, values);
+            }
+            columns.commit();
+        }
+
+        for (size_t row = 0; row < rows; ++row) {
+            auto stats = columns.get(columns.find(row));
+            const auto& ref = reference[row];
+            for (size_t c = 0; c < 3; ++c) {
+                expect(stats.integral[c], equal_to(ref.curr[c]));
+                expect(stats.current_speed[c],
+                       near_to(ref.speed[c], 1e-9 * ref.speed[c] + 1e-9));
+                expect(stats.max_speed[c],
+                       near_to(ref.max[c], 1e-9 * ref.max[c] + 1e-9));
+            }
+        }
+    });
+});
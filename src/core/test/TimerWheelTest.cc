@@ -0,0 +1,144 @@
+/*
+ * Copyright 2019 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "lib/timer_wheel.hpp"
+
+#include <mettle.hpp>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+using namespace mettle;
+using namespace runos;
+
+using namespace std::chrono_literals;
+using Wheel = TimerWheel<int>;
+using clock_type = Wheel::clock;
+
+namespace {
+
+std::vector<int> expire(Wheel& wheel, clock_type::time_point now)
+{
+    std::vector<int> fired;
+    wheel.expire(now, [&](int value) { fired.push_back(value); });
+    return fired;
+}
+
+} // namespace
+
+suite<> timer_wheel("TimerWheel", [](auto& _) {
+    _.test("timers fire not earlier than the deadline", []() {
+        Wheel wheel {10ms, 16};
+        auto start = clock_type::now();
+        wheel.schedule(1, start + 25ms);
+
+        expect(expire(wheel, start + 24ms).empty(), equal_to(true));
+        expect(wheel.size(), equal_to(1u));
+        expect(expire(wheel, start + 35ms), equal_to(std::vector<int>{1}));
+        expect(wheel.size(), equal_to(0u));
+        expect(expire(wheel, start + 100ms).empty(), equal_to(true));
+    });
+
+    _.test("past deadlines fire on the next expire", []() {
+        Wheel wheel {10ms, 16};
+        auto start = clock_type::now();
+        wheel.schedule(1, start - 1s);
+        expect(expire(wheel, start + 10ms), equal_to(std::vector<int>{1}));
+    });
+
+    _.test("timers beyond one turn wait for their turn", []() {
+        Wheel wheel {10ms, 8};
+        auto start = clock_type::now();
+        wheel.schedule(1, start + 1s);
+        wheel.schedule(2, start + 35ms);
+
+        expect(expire(wheel, start + 500ms), equal_to(std::vector<int>{2}));
+        expect(expire(wheel, start + 990ms).empty(), equal_to(true));
+        expect(expire(wheel, start + 1010ms), equal_to(std::vector<int>{1}));
+    });
+
+    _.test("an idle wheel fires everything due at once", []() {
+        Wheel wheel {1ms, 4};
+        auto start = clock_type::now();
+        for (int i = 0; i < 100; ++i) {
+            wheel.schedule(i, start + i * 1ms);
+        }
+
+        auto fired = expire(wheel, start + 1s);
+        std::sort(fired.begin(), fired.end());
+        expect(fired.size(), equal_to(100u));
+        expect(fired.front(), equal_to(0));
+        expect(fired.back(), equal_to(99));
+        expect(wheel.size(), equal_to(0u));
+    });
+
+    _.test("callbacks may schedule timers again", []() {
+        Wheel wheel {10ms, 16};
+        auto start = clock_type::now();
+        wheel.schedule(1, start + 10ms);
+
+        int fired = 0;
+        wheel.expire(start + 30ms, [&](int value) {
+            fired++;
+            wheel.schedule(value, start + 50ms);
+        });
+        expect(fired, equal_to(1));
+        expect(wheel.size(), equal_to(1u));
+        expect(expire(wheel, start + 70ms), equal_to(std::vector<int>{1}));
+    });
+
+    _.test("clear drops all timers", []() {
+        Wheel wheel {10ms, 16};
+        auto start = clock_type::now();
+        wheel.schedule(1, start + 10ms);
+        wheel.schedule(2, start + 10s);
+        wheel.clear();
+        expect(wheel.size(), equal_to(0u));
+        expect(expire(wheel, start + 20s).empty(), equal_to(true));
+    });
+
+    _.test("random timers fire once within a tick of the deadline", []() {
+        constexpr auto tick = 1ms;
+        std::mt19937 rng(42);
+        Wheel wheel {tick, 64};
+        auto start = clock_type::now();
+
+        std::vector<clock_type::time_point> deadlines;
+        for (int i = 0; i < 10000; ++i) {
+            deadlines.push_back(start + std::chrono::microseconds(rng() % 500000));
+            wheel.schedule(i, deadlines.back());
+        }
+
+        std::vector<int> times_fired(deadlines.size());
+        auto now = start;
+        while (wheel.size() > 0 && now < start + 1s) {
+            now += std::chrono::microseconds(rng() % 20000);
+            for (int id : expire(wheel, now)) {
+                expect(deadlines[id] <= now, equal_to(true));
+                times_fired[id]++;
+            }
+            for (size_t id = 0; id < deadlines.size(); ++id) {
+                if (times_fired[id] == 0)
+                    expect(deadlines[id] + tick > now, equal_to(true));
+            }
+        }
+
+        expect(wheel.size(), equal_to(0u));
+        expect(*std::max_element(times_fired.begin(), times_fired.end()),
+               equal_to(1));
+    });
+});